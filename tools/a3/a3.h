@@ -34,8 +34,6 @@ inline unsigned long long print_count() {
 
 #define A3_LOG(fmt, args...) A3_FPRINTF(stdout, fmt, ##args)
 
-BOOST_STATIC_ASSERT(A3_MEMORY_CTL_NUM != 0);
-
 namespace interprocess = boost::interprocess;
 
 class command {
@@ -45,7 +43,8 @@ class command {
         TYPE_WRITE,
         TYPE_READ,
         TYPE_UTILITY,
-        TYPE_BAR3
+        TYPE_BAR3,
+        TYPE_CHECKPOINT
     };
 
     enum bar_t {
@@ -58,8 +57,23 @@ class command {
     enum utility_t {
         UTILITY_PGRAPH_STATUS = 0,
         UTILITY_REGISTER_READ,
-        UTILITY_CLEAR_SHADOWING_UTILIZATION
+        UTILITY_CLEAR_SHADOWING_UTILIZATION,
+        UTILITY_BAR3_ARENA_SIZE
+    };
+
+    // TYPE_CHECKPOINT over the socket, value is checkpoint_t. START begins
+    // dirty tracking of the guest VRAM. ROUND and FINISH reply with value
+    // bytes of the stream following the reply, and offset is the number of
+    // dirty chunks left. FINISH stops tracking and emits the device state
+    // after the last chunk. LOAD is followed by offset bytes of the stream.
+    // Failures reply with offset kCHECKPOINT_FAILED.
+    enum checkpoint_t {
+        CHECKPOINT_START = 0,
+        CHECKPOINT_ROUND,
+        CHECKPOINT_FINISH,
+        CHECKPOINT_LOAD
     };
+    static const uint32_t kCHECKPOINT_FAILED = 0xFFFFFFFFU;
 
     uint32_t type;
     uint32_t value;
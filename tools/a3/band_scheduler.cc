@@ -24,9 +24,6 @@
 #include <cstdint>
 #include "a3.h"
 #include "lock.h"
-#include "context.h"
-#include "device.h"
-#include "device_bar1.h"
 #include "band_scheduler.h"
 namespace a3 {
 
@@ -67,16 +64,16 @@ void band_scheduler_t::stop() {
     }
 }
 
-static void yield_chance(const duration_t& duration) {
-    auto now = boost::posix_time::microsec_clock::local_time();
+static void yield_chance(clock_source_t* clock, const duration_t& duration) {
+    auto now = clock->now();
     const auto wait = now + duration;
     while (now < wait) {
-        boost::this_thread::yield();
-        now = boost::posix_time::microsec_clock::local_time();
+        clock->yield();
+        now = clock->now();
     }
 }
 
-void band_scheduler_t::enqueue(context* ctx, const command& cmd) {
+void band_scheduler_t::enqueue(sched_entity_t* ctx, const command& cmd) {
     // on arrival
     ctx->enqueue(cmd);
     A3_SYNCHRONIZED(counter_mutex_) {
@@ -85,36 +82,48 @@ void band_scheduler_t::enqueue(context* ctx, const command& cmd) {
     }
 }
 
+void band_scheduler_t::on_unregister_context(sched_entity_t* ctx) {
+    if (current_ == ctx) {
+        current_ = nullptr;
+    }
+    const std::size_t discarded = ctx->discard();
+    A3_SYNCHRONIZED(counter_mutex_) {
+        counter_ -= discarded;
+    }
+}
+
 void band_scheduler_t::replenish() {
-    // uint64_t count = 0;
     while (true) {
-        // replenish
-        A3_SYNCHRONIZED(sched_mutex()) {
-            if (!contexts().empty()) {
-                A3_SYNCHRONIZED(fire_mutex()) {
-                    duration_t period = bandwidth_ + gpu_idle_;
-                    duration_t defaults = period_ / contexts().size();
-                    previous_bandwidth_ = period;
-                    // duration_t period = bandwidth_;
-                    if (period != boost::posix_time::microseconds(0)) {
-                        const auto budget = period / contexts().size();
-                        for (context& ctx : contexts()) {
-                            ctx.replenish(budget, period_, defaults, bandwidth_ == boost::posix_time::microseconds(0));
-                        }
-                        // ++count;
+        replenish_once();
+        clock()->sleep(period_);
+        clock()->yield();
+    }
+}
+
+void band_scheduler_t::replenish_once() {
+    A3_SYNCHRONIZED(sched_mutex()) {
+        if (!contexts().empty()) {
+            A3_SYNCHRONIZED(fire_mutex()) {
+                duration_t period = bandwidth_ + gpu_idle_;
+                duration_t defaults = period_ / contexts().size();
+                previous_bandwidth_ = period;
+                // duration_t period = bandwidth_;
+                if (period != microseconds(0)) {
+                    const auto budget = period / contexts().size();
+                    for (sched_entity_t& ctx : contexts()) {
+                        ctx.replenish(budget, period_, defaults, bandwidth_ == microseconds(0));
                     }
-                    bandwidth_ = boost::posix_time::microseconds(0);
-                    gpu_idle_ = boost::posix_time::microseconds(0);
+                    // ++count;
                 }
+                bandwidth_ = microseconds(0);
+                gpu_idle_ = microseconds(0);
             }
         }
-        boost::this_thread::sleep(period_);
-        boost::this_thread::yield();
     }
 }
 
-bool band_scheduler_t::utilization_over_bandwidth(context* ctx) const {
-    if (bandwidth_ == boost::posix_time::microseconds(0)) {
+bool band_scheduler_t::utilization_over_bandwidth(sched_entity_t* ctx) const {
+    if (bandwidth_ == microseconds(0)) {
         return true;
     }
     if (ctx->bandwidth_used() > (previous_bandwidth_ / contexts().size())) {
@@ -123,91 +132,80 @@ bool band_scheduler_t::utilization_over_bandwidth(context* ctx) const {
     return (ctx->bandwidth_used().total_microseconds() / static_cast<double>(bandwidth_.total_microseconds())) > (1.0 / contexts().size());
 }
 
-context* band_scheduler_t::select_next_context(bool idle) {
-    A3_SYNCHRONIZED(sched_mutex()) {
-        if (idle) {
-            gpu_idle_ += gpu_idle_timer_.elapsed();
-        }
+sched_entity_t* band_scheduler_t::select_next_context(bool idle) {
+    if (idle) {
+        gpu_idle_ += gpu_idle_timer_.elapsed();
+    }
 
-        if (current()) {
-            // lowering priority
-            context* ctx = current();
-            if (ctx->budget() < boost::posix_time::microseconds(0) && utilization_over_bandwidth(ctx)) {
-                contexts().erase(contexts_t::s_iterator_to(*ctx));
-                contexts().push_back(*ctx);
-            }
+    if (current()) {
+        // lowering priority
+        sched_entity_t* ctx = current();
+        if (ctx->budget() < microseconds(0) && utilization_over_bandwidth(ctx)) {
+            contexts().erase(contexts_t::s_iterator_to(*ctx));
+            contexts().push_back(*ctx);
         }
+    }
 
-        context* band = nullptr;
-        context* under = nullptr;
-        context* over = nullptr;
-        for (context& ctx : contexts()) {
-            if (ctx.is_suspended()) {
-                if (ctx.budget() < boost::posix_time::microseconds(0)) {
-                    if (!over) {
-                        over = &ctx;
-                    }
-                } else if (utilization_over_bandwidth(&ctx)) {
-                    if (!band) {
-                        band = &ctx;
-                    }
-                } else {
-                    if (!under) {
-                        under = &ctx;
-                    }
+    sched_entity_t* band = nullptr;
+    sched_entity_t* under = nullptr;
+    sched_entity_t* over = nullptr;
+    for (sched_entity_t& ctx : contexts()) {
+        if (ctx.is_suspended()) {
+            if (ctx.budget() < microseconds(0)) {
+                if (!over) {
+                    over = &ctx;
                 }
-                if (over && under && band) {
-                    break;
+            } else if (utilization_over_bandwidth(&ctx)) {
+                if (!band) {
+                    band = &ctx;
+                }
+            } else {
+                if (!under) {
+                    under = &ctx;
                 }
             }
-        }
-
-        context* next =
-            (under) ? under :
-            (band)  ? band  : over;
-
-        if (!current()) {
-            return next;
-        }
-
-        if (next && next != current() && utilization_over_bandwidth(next) && !utilization_over_bandwidth(current()) && next->bandwidth_used() > current()->bandwidth_used()) {
-            yield_chance(boost::posix_time::microseconds(500));
-            if (current()->is_suspended()) {
-                return current();
+            if (over && under && band) {
+                break;
             }
         }
-
-        return next;
     }
-    return nullptr;  // Makes compiler happy
-}
 
-void band_scheduler_t::submit(context* ctx) {
-    A3_SYNCHRONIZED(fire_mutex()) {
-        command cmd;
+    sched_entity_t* next =
+        (under) ? under :
+        (band)  ? band  : over;
 
-        ctx->dequeue(&cmd);
+    if (!current()) {
+        return next;
+    }
 
-        utilization_.start();
-        A3_SYNCHRONIZED(device()->mutex()) {
-            device()->bar1()->write(ctx, cmd);
+    if (next && next != current() && utilization_over_bandwidth(next) && !utilization_over_bandwidth(current()) && next->bandwidth_used() > current()->bandwidth_used()) {
+        yield_chance(clock(), microseconds(500));
+        if (current()->is_suspended()) {
+            return current();
         }
+    }
 
-        while (device()->is_active(ctx)) {
-            boost::this_thread::yield();
-        }
+    return next;
+}
 
-        const auto duration = utilization_.elapsed();
-        bandwidth_ += duration;
-        sampler_->add(duration);
-        ctx->update_budget(duration);
+void band_scheduler_t::submit(sched_entity_t* ctx, const command& cmd) {
+    utilization_.start(clock());
+    ctx->fire(cmd);
+
+    while (ctx->is_active()) {
+        clock()->yield();
     }
+
+    const auto duration = utilization_.elapsed();
+    bandwidth_ += duration;
+    sampler_->add(duration);
+    ctx->update_budget(duration);
 }
 
 void band_scheduler_t::run() {
+    gpu_idle_timer_.start(clock());
     while (true) {
         bool idle = false;
-        gpu_idle_timer_.start();
         {
             boost::unique_lock<boost::mutex> lock(counter_mutex_);
             while (!counter_) {
@@ -216,13 +214,37 @@ void band_scheduler_t::run() {
                 cond_.wait(lock);
             }
         }
-        if ((current_ = select_next_context(idle))) {
-            A3_SYNCHRONIZED(counter_mutex_) {
-                counter_ -= 1;
-            }
-            submit(current());
+        dispatch(idle);
+    }
+}
+
+bool band_scheduler_t::has_pending() {
+    A3_SYNCHRONIZED(counter_mutex_) {
+        return counter_ != 0;
+    }
+    return false;
+}
+
+void band_scheduler_t::dispatch(bool idle) {
+    // Both mutexes are taken in the order unregister_context takes them.
+    // The command is dequeued before sched_mutex is dropped, so discard()
+    // does not count it again, and fire_mutex is kept until it completes,
+    // so the context is not unregistered under submit().
+    boost::unique_lock<boost::mutex> sched(sched_mutex());
+    boost::unique_lock<boost::mutex> fire(fire_mutex());
+    command cmd;
+    if ((current_ = select_next_context(idle)) && current()->dequeue(&cmd)) {
+        A3_SYNCHRONIZED(counter_mutex_) {
+            counter_ -= 1;
         }
+        sched.unlock();
+        submit(current(), cmd);
     }
+    gpu_idle_timer_.start(clock());
+}
+
+void band_scheduler_t::sample_once() {
+    sampler_->sample();
 }
 
 }  // namespace a3
@@ -5,32 +5,41 @@
 #include <boost/thread.hpp>
 #include "a3.h"
 #include "lock.h"
-#include "context.h"
+#include "sched_entity.h"
 #include "sampler.h"
 #include "scheduler.h"
 #include "duration.h"
 #include "timer.h"
 namespace a3 {
 
-class context;
-
 class band_scheduler_t : public scheduler_t {
  public:
     band_scheduler_t(const duration_t& period, const duration_t& sample);
     virtual ~band_scheduler_t();
     virtual void start();
     virtual void stop();
-    virtual void enqueue(context* ctx, const command& cmd);
+    virtual void enqueue(sched_entity_t* ctx, const command& cmd);
+    virtual bool has_pending();
+    virtual void dispatch(bool idle);
+    virtual void replenish_once();
+    virtual void sample_once();
+    virtual duration_t replenish_period() const { return period_; }
+    virtual duration_t sample_period() const { return sampler_->period(); }
+
+ protected:
+    virtual void on_unregister_context(sched_entity_t* ctx);
 
  private:
-    typedef std::pair<context*, command> fire_t;
+    typedef std::pair<sched_entity_t*, command> fire_t;
     void run();
     void replenish();
     void sampling();
-    bool utilization_over_bandwidth(context* ctx) const;
-    context* current() const { return current_; }
-    context* select_next_context(bool idle);
-    void submit(context* ctx);
+    bool utilization_over_bandwidth(sched_entity_t* ctx) const;
+    sched_entity_t* current() const { return current_; }
+    // called with sched_mutex and fire_mutex held
+    sched_entity_t* select_next_context(bool idle);
+    // called with fire_mutex held
+    void submit(sched_entity_t* ctx, const command& cmd);
 
     duration_t period_;
     duration_t gpu_idle_;
@@ -39,7 +48,7 @@ class band_scheduler_t : public scheduler_t {
     std::unique_ptr<sampler_t> sampler_;
     boost::mutex counter_mutex_;
     boost::condition_variable cond_;
-    context* current_;
+    sched_entity_t* current_;
     timer_t utilization_;
     timer_t gpu_idle_timer_;
     duration_t bandwidth_;
@@ -58,6 +58,10 @@ void bar1_channel_t::shadow(context* ctx) {
     // page directory
     uint64_t page_directory_virt = mmio::read64(&pmem, ramin_address() + 0x0200);
     uint64_t page_directory_phys = ctx->get_phys_address(page_directory_virt);
+    if (page_directory_phys == UINT64_MAX) {
+        A3_LOG("page directory 0x%" PRIX64 " cannot be backed\n", page_directory_virt);
+        return;
+    }
     uint64_t page_directory_size = mmio::read64(&pmem, ramin_address() + 0x0208);
     table()->refresh(ctx, page_directory_phys, page_directory_size);
 }
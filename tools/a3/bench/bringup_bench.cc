@@ -0,0 +1,109 @@
+/*
+ * A3 Bring-up Bench
+ *
+ * Copyright (c) 2012-2013 Yusuke Suzuki
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+// A context allocates one RAMIN page and one shadow page directory per
+// channel, and both should be zero filled. This replays the allocation
+// pattern of a context bring-up,
+//
+//     word   allocate and clear through pmem accessor per word (before)
+//     bulk   allocate and page::clear (window switched per 1MB)
+//     pool   take blocks from the zeroed page pool
+//
+// Run with "a3 --bench-bringup=<contexts> <bdf>". The pool is refilled
+// before each context, as it is between VM starts.
+#include <cstdio>
+#include <cinttypes>
+#include <memory>
+#include <vector>
+#include "../a3.h"
+#include "../device.h"
+#include "../page.h"
+#include "../page_pool.h"
+#include "../pmem.h"
+#include "../timer.h"
+#include "bringup_bench.h"
+namespace a3 {
+
+enum bringup_mode_t {
+    BRINGUP_WORD,
+    BRINGUP_BULK,
+    BRINGUP_POOL
+};
+
+static const char* kBRINGUP_MODES[] = { "word", "bulk", "pool" };
+
+static page* allocate(bringup_mode_t mode, std::size_t n) {
+    switch (mode) {
+    case BRINGUP_WORD: {
+            page* result = new page(n);
+            pmem::accessor pmem;
+            for (uint64_t offset = 0; offset < result->size(); offset += sizeof(uint32_t)) {
+                pmem.write32(result->address() + offset, 0);
+            }
+            return result;
+        }
+    case BRINGUP_BULK: {
+            page* result = new page(n);
+            result->clear();
+            return result;
+        }
+    case BRINGUP_POOL:
+        return new page(n, true);
+    }
+    return nullptr;
+}
+
+void run_bringup_bench(uint32_t contexts, uint32_t channels) {
+    std::printf("%u contexts x %u channels\n", contexts, channels);
+    std::printf("%-6s %12s %12s %12s\n", "mode", "avg ms", "max ms", "pool hits");
+    for (int m = BRINGUP_WORD; m <= BRINGUP_POOL; ++m) {
+        const bringup_mode_t mode = static_cast<bringup_mode_t>(m);
+        const uint64_t hits = device()->page_pool()->hits();
+        double total = 0;
+        double max = 0;
+        for (uint32_t i = 0; i < contexts; ++i) {
+            if (mode == BRINGUP_POOL) {
+                device()->page_pool()->wait_filled();
+            }
+            std::vector<std::unique_ptr<page>> pages;
+            timer_t timer;
+            timer.start();
+            for (uint32_t c = 0; c < channels; ++c) {
+                pages.emplace_back(allocate(mode, 1));     // RAMIN
+                pages.emplace_back(allocate(mode, 0x10));  // page directory
+            }
+            const double ms = timer.elapsed().total_microseconds() / 1000.0;
+            total += ms;
+            max = (ms > max) ? ms : max;
+        }
+        std::printf("%-6s %12.3f %12.3f %12" PRIu64 "\n",
+                    kBRINGUP_MODES[mode],
+                    contexts ? total / contexts : 0.0,
+                    max,
+                    device()->page_pool()->hits() - hits);
+    }
+}
+
+}  // namespace a3
+/* vim: set sw=4 ts=4 et tw=80 : */
@@ -0,0 +1,12 @@
+#ifndef A3_BENCH_BRINGUP_BENCH_H_
+#define A3_BENCH_BRINGUP_BENCH_H_
+#include <cstdint>
+namespace a3 {
+
+// Measures VRAM page bring-up of contexts on the initialized device, with
+// per word clearing, bulk clearing and the zeroed page pool.
+void run_bringup_bench(uint32_t contexts, uint32_t channels);
+
+}  // namespace a3
+#endif  // A3_BENCH_BRINGUP_BENCH_H_
+/* vim: set sw=4 ts=4 et tw=80 : */
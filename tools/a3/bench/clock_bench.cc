@@ -0,0 +1,120 @@
+/*
+ * A3 clock benchmark
+ *
+ * Copyright (c) 2012-2013 Yusuke Suzuki
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+// Per read cost of the time sources the schedulers have used,
+//
+//     posix      boost::posix_time::microsec_clock::local_time (before)
+//     monotonic  clock_gettime(CLOCK_MONOTONIC)
+//     tsc        tsc_t::now, the calibrated invariant TSC
+//     system     clock_source_t::system()->now(), tsc behind the virtual call
+//
+// and the drift of tsc against CLOCK_MONOTONIC over the run.
+//
+//     a3-clock-bench --reads 10000000
+#include <cstdio>
+#include <cinttypes>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include "../a3.h"
+#include "../cmdline.h"
+#include "../clock.h"
+#include "../tsc.h"
+namespace a3 {
+
+// sink of the reads, so that they are not optimized out
+static volatile int64_t g_sink;
+
+template<typename Func>
+static void measure(const char* name, uint64_t reads, Func func) {
+    const int64_t start = tsc_t::monotonic();
+    int64_t sum = 0;
+    for (uint64_t i = 0; i < reads; ++i) {
+        sum += func();
+    }
+    const int64_t elapsed = tsc_t::monotonic() - start;
+    g_sink = sum;
+    std::printf("%-10s %8.2f ns/read\n", name, static_cast<double>(elapsed) / reads);
+}
+
+static void run_clock_bench(uint64_t reads) {
+    const tsc_t& tsc = tsc_t::instance();
+    if (tsc.invariant()) {
+        std::printf("invariant TSC %" PRIu64 " kHz\n", tsc.frequency() / 1000);
+    } else {
+        std::printf("no invariant TSC, tsc reads CLOCK_MONOTONIC\n");
+    }
+
+    const int64_t tsc_start = tsc.now();
+    const int64_t monotonic_start = tsc_t::monotonic();
+
+    measure("posix", reads, [] {
+        return (boost::posix_time::microsec_clock::local_time() - boost::posix_time::ptime(boost::posix_time::min_date_time)).ticks();
+    });
+    measure("monotonic", reads, [] {
+        return tsc_t::monotonic();
+    });
+    measure("tsc", reads, [&tsc] {
+        return tsc.now();
+    });
+    const clock_source_t* clock = clock_source_t::system();
+    measure("system", reads, [clock] {
+        return clock->now().total_nanoseconds();
+    });
+
+    // reads should never go backwards
+    uint64_t backwards = 0;
+    int64_t last = tsc.now();
+    for (uint64_t i = 0; i < reads; ++i) {
+        const int64_t now = tsc.now();
+        backwards += now < last;
+        last = now;
+    }
+
+    const int64_t drift = (tsc.now() - tsc_start) - (tsc_t::monotonic() - monotonic_start);
+    std::printf("backwards  %" PRIu64 " reads\n", backwards);
+    std::printf("drift      %" PRId64 " ns against CLOCK_MONOTONIC\n", drift);
+}
+
+}  // namespace a3
+
+int main(int argc, char** argv) {
+    namespace c = a3;
+    c::cmdline::Parser cmd("a3-clock-bench");
+
+    cmd.Add("help", "help", 'h', "print this message");
+    cmd.Add<uint64_t>("reads", "reads", 'n', "reads per time source", false, 10000000);
+
+    if (!cmd.Parse(argc, argv)) {
+        std::fprintf(stderr, "%s\n%s", cmd.error().c_str(), cmd.usage().c_str());
+        return 1;
+    }
+
+    if (cmd.Exist("help")) {
+        std::fputs(cmd.usage().c_str(), stdout);
+        return 1;
+    }
+
+    c::run_clock_bench(cmd.Get<uint64_t>("reads"));
+    return 0;
+}
+/* vim: set sw=4 ts=4 et tw=80 : */
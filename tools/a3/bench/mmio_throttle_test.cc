@@ -0,0 +1,116 @@
+/*
+ * A3 MMIO throttle test
+ *
+ * Copyright (c) 2012-2013 Yusuke Suzuki
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+// Two sessions handle MMIO commands on their own threads. The noisy one
+// spends 1ms of CPU per command with a 10% share, the quiet one 20us per
+// command without a share, so the quiet one has a command pending most of
+// the time. The noisy session should be throttled and wait for a good part
+// of the run, and the quiet one never.
+//
+//     a3-mmio-throttle-test --time 2000
+#include <cstdio>
+#include <cinttypes>
+#include <atomic>
+#include <boost/thread.hpp>
+#include "../a3.h"
+#include "../cmdline.h"
+#include "../clock.h"
+#include "../metrics.h"
+#include "../mmio_throttle.h"
+#include "../tsc.h"
+namespace a3 {
+
+static void spin(int64_t us) {
+    const int64_t end = tsc_t::monotonic() + us * 1000;
+    while (tsc_t::monotonic() < end) {
+    }
+}
+
+static void session(uint32_t share, int64_t cost, const std::atomic<bool>* stop, context_metrics_t* metrics, uint64_t* commands) {
+    mmio_throttle_t throttle(share, metrics);
+    while (!stop->load()) {
+        throttle.admit();
+        spin(cost);
+        throttle.charge();
+        ++*commands;
+    }
+}
+
+static int run_throttle_test(uint64_t ms) {
+    context_metrics_t noisy;
+    context_metrics_t quiet;
+    uint64_t noisy_commands = 0;
+    uint64_t quiet_commands = 0;
+    std::atomic<bool> stop(false);
+
+    boost::thread noisy_thread([&] { session(10, 1000, &stop, &noisy, &noisy_commands); });
+    boost::thread quiet_thread([&] { session(0, 20, &stop, &quiet, &quiet_commands); });
+    boost::this_thread::sleep(milliseconds(ms).to_posix());
+    stop = true;
+    noisy_thread.join();
+    quiet_thread.join();
+
+    const double waited = noisy.throttled_wait.value() / 1e3;
+    std::printf("noisy: %" PRIu64 " commands, %" PRIu64 " throttled, waited %.1fms of %" PRIu64 "ms\n",
+                noisy_commands, noisy.throttled.value(), waited, ms);
+    std::printf("quiet: %" PRIu64 " commands, %" PRIu64 " throttled\n",
+                quiet_commands, quiet.throttled.value());
+
+    bool ok = true;
+    if (!noisy.throttled.value() || waited < ms / 4.0) {
+        std::printf("FAIL: noisy session is not throttled\n");
+        ok = false;
+    }
+    if (quiet.throttled.value()) {
+        std::printf("FAIL: quiet session is throttled\n");
+        ok = false;
+    }
+    if (ok) {
+        std::printf("PASS\n");
+    }
+    return ok ? 0 : 1;
+}
+
+}  // namespace a3
+
+int main(int argc, char** argv) {
+    namespace c = a3;
+    c::cmdline::Parser cmd("a3-mmio-throttle-test");
+
+    cmd.Add("help", "help", 'h', "print this message");
+    cmd.Add<uint64_t>("time", "time", 0, "run time (ms)", false, 2000);
+
+    if (!cmd.Parse(argc, argv)) {
+        std::fprintf(stderr, "%s\n%s", cmd.error().c_str(), cmd.usage().c_str());
+        return 1;
+    }
+
+    if (cmd.Exist("help")) {
+        std::fputs(cmd.usage().c_str(), stdout);
+        return 1;
+    }
+
+    return c::run_throttle_test(cmd.Get<uint64_t>("time"));
+}
+/* vim: set sw=4 ts=4 et tw=80 : */
@@ -0,0 +1,531 @@
+/*
+ * A3 scheduler simulator
+ *
+ * Copyright (c) 2012-2013 Yusuke Suzuki
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+// Drives the schedulers with synthetic tenants on a virtual GPU and a virtual
+// clock, so that the scheduling policies and their constants can be compared
+// without a device.
+//
+// Each tenant is a closed loop: it submits one command, waits for its
+// completion and thinks for a while before the next one. Kernel durations
+// are drawn from the distribution of the tenant,
+//
+//     const:<us>                constant
+//     uniform:<min us>:<max us> uniform
+//     exp:<mean us>             exponential
+//     lognormal:<mean us>:<sigma>
+//
+// optionally followed by "/<think us>". For example,
+//
+//     a3-sched-bench --scheduler band --tenants "const:200 exp:2000/500"
+//
+// The scheduler threads are not started. The simulator calls their single
+// iterations (dispatch, replenish_once, sample_once) in virtual time, and
+// the busy waits inside them advance the virtual clock.
+#include <cstdio>
+#include <cstdlib>
+#include <cinttypes>
+#include <cmath>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "../a3.h"
+#include "../cmdline.h"
+#include "../clock.h"
+#include "../sched_entity.h"
+#include "../scheduler.h"
+#include "../band_scheduler.h"
+#include "../credit_scheduler.h"
+#include "../direct_scheduler.h"
+#include "../fifo_scheduler.h"
+namespace a3 {
+
+class simulator_t;
+
+struct distribution_t {
+    enum kind_t {
+        CONSTANT,
+        UNIFORM,
+        EXPONENTIAL,
+        LOGNORMAL
+    };
+    kind_t kind;
+    double a;
+    double b;
+    double think;
+    std::string spec;
+};
+
+static bool parse_distribution(const std::string& spec, distribution_t* dist) {
+    std::string body = spec;
+    dist->think = 0;
+    dist->spec = spec;
+    const std::string::size_type slash = body.find('/');
+    if (slash != std::string::npos) {
+        dist->think = std::strtod(body.c_str() + slash + 1, nullptr);
+        body.resize(slash);
+    }
+    std::vector<std::string> fields;
+    std::istringstream ss(body);
+    for (std::string field; std::getline(ss, field, ':');) {
+        fields.push_back(field);
+    }
+    if (fields.size() < 2) {
+        return false;
+    }
+    dist->a = std::strtod(fields[1].c_str(), nullptr);
+    dist->b = fields.size() > 2 ? std::strtod(fields[2].c_str(), nullptr) : 0;
+    if (fields[0] == "const" && fields.size() == 2) {
+        dist->kind = distribution_t::CONSTANT;
+    } else if (fields[0] == "uniform" && fields.size() == 3 && dist->a <= dist->b) {
+        dist->kind = distribution_t::UNIFORM;
+    } else if (fields[0] == "exp" && fields.size() == 2) {
+        dist->kind = distribution_t::EXPONENTIAL;
+    } else if (fields[0] == "lognormal" && fields.size() == 3) {
+        dist->kind = distribution_t::LOGNORMAL;
+    } else {
+        return false;
+    }
+    return dist->a > 0 && dist->think >= 0;
+}
+
+class tenant_t : public sched_entity_t {
+ public:
+    tenant_t(simulator_t* sim, uint32_t id, const distribution_t& dist);
+
+    virtual void fire(const command& cmd);
+    virtual bool is_active();
+
+    void arrive();
+    bool waiting() const { return waiting_; }
+    const timestamp_t& next_arrival() const { return next_arrival_; }
+
+    uint32_t id() const { return id_; }
+    const distribution_t& distribution() const { return dist_; }
+    uint64_t submits() const { return submits_; }
+    double gpu_time() const { return gpu_time_; }
+    double demand() const { return demand_; }
+    std::vector<double>* latencies() { return &latencies_; }
+
+ private:
+    duration_t kernel();
+
+    simulator_t* sim_;
+    uint32_t id_;
+    distribution_t dist_;
+    bool waiting_;  // arrived, but not fired yet
+    timestamp_t arrived_;
+    timestamp_t next_arrival_;
+    uint64_t submits_;
+    double gpu_time_;  // us
+    double demand_;  // us, sum of the kernels that arrived
+    duration_t pending_kernel_;
+    std::vector<double> latencies_;  // us
+};
+
+class virtual_clock_t : public clock_source_t {
+ public:
+    explicit virtual_clock_t(simulator_t* sim) : sim_(sim) { }
+    virtual timestamp_t now() const;
+    virtual void sleep(const duration_t& duration);
+    virtual void yield();
+
+ private:
+    simulator_t* sim_;
+};
+
+class simulator_t : private boost::noncopyable {
+ public:
+    simulator_t(scheduler_t* scheduler, const duration_t& yield, uint64_t seed)
+        : scheduler_(scheduler)
+        , clock_(this)
+        , yield_(yield)
+        , random_(seed)
+        , now_()
+        , origin_(now_)
+        , busy_until_(now_)
+        , busy_()
+        , stalled_()
+        , dispatches_()
+        , replenishes_()
+        , polls_()
+        , callbacks_()
+        , depth_()
+        , dispatch_time_()
+        , replenish_time_()
+    {
+        scheduler_->set_clock(&clock_);
+    }
+
+    ~simulator_t() {
+        for (const auto& tenant : tenants_) {
+            scheduler_->unregister_context(tenant.get());
+        }
+    }
+
+    void add_tenant(const distribution_t& dist) {
+        tenants_.emplace_back(new tenant_t(this, tenants_.size(), dist));
+        scheduler_->register_context(tenants_.back().get());
+    }
+
+    void run(const duration_t& time);
+    void report(const char* name) const;
+
+    // callbacks from the virtual clock and tenants
+    const timestamp_t& now() const { return now_; }
+    void advance_to(const timestamp_t& time);
+    const duration_t& yield_time() const { return yield_; }
+    void poll() { ++polls_; }
+    timestamp_t execute(const duration_t& kernel);
+    bool gpu_active() const { return now_ < busy_until_; }
+    std::mt19937_64& random() { return random_; }
+    void arrive(tenant_t* tenant, const command& cmd) {
+        scheduler_->enqueue(tenant, cmd);
+    }
+
+    // excludes time spent in the simulator and arrivals from the scheduler
+    // overhead
+    class callback_t {
+     public:
+        explicit callback_t(simulator_t* sim) : sim_(sim) {
+            if (sim_->depth_++ == 0) {
+                start_ = std::chrono::steady_clock::now();
+            }
+        }
+        ~callback_t() {
+            if (--sim_->depth_ == 0) {
+                sim_->callbacks_ += std::chrono::steady_clock::now() - start_;
+            }
+        }
+     private:
+        simulator_t* sim_;
+        std::chrono::steady_clock::time_point start_;
+    };
+
+ private:
+    template<typename Func>
+    std::chrono::nanoseconds measure(Func func) {
+        const auto callbacks = callbacks_;
+        const auto start = std::chrono::steady_clock::now();
+        func();
+        const auto elapsed = std::chrono::steady_clock::now() - start;
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed - (callbacks_ - callbacks));
+    }
+    timestamp_t next_arrival() const;
+    bool any_waiting() const;
+
+    scheduler_t* scheduler_;
+    virtual_clock_t clock_;
+    duration_t yield_;
+    std::mt19937_64 random_;
+    timestamp_t now_;
+    timestamp_t origin_;
+    timestamp_t busy_until_;
+    duration_t busy_;
+    duration_t stalled_;  // GPU idle while commands are waiting
+    uint64_t dispatches_;
+    uint64_t replenishes_;
+    uint64_t polls_;  // busy wait iterations
+    std::chrono::steady_clock::duration callbacks_;
+    int depth_;
+    std::chrono::nanoseconds dispatch_time_;
+    std::chrono::nanoseconds replenish_time_;
+    std::vector<std::unique_ptr<tenant_t>> tenants_;
+};
+
+timestamp_t virtual_clock_t::now() const {
+    return sim_->now();
+}
+
+void virtual_clock_t::sleep(const duration_t& duration) {
+    sim_->poll();
+    sim_->advance_to(sim_->now() + duration);
+}
+
+void virtual_clock_t::yield() {
+    sim_->poll();
+    sim_->advance_to(sim_->now() + sim_->yield_time());
+}
+
+tenant_t::tenant_t(simulator_t* sim, uint32_t id, const distribution_t& dist)
+    : sim_(sim)
+    , id_(id)
+    , dist_(dist)
+    , waiting_(false)
+    , arrived_()
+    , next_arrival_(sim->now())
+    , submits_()
+    , gpu_time_()
+    , demand_()
+    , pending_kernel_()
+    , latencies_()
+{
+}
+
+duration_t tenant_t::kernel() {
+    double us = dist_.a;
+    switch (dist_.kind) {
+    case distribution_t::CONSTANT:
+        break;
+    case distribution_t::UNIFORM:
+        us = std::uniform_real_distribution<double>(dist_.a, dist_.b)(sim_->random());
+        break;
+    case distribution_t::EXPONENTIAL:
+        us = std::exponential_distribution<double>(1.0 / dist_.a)(sim_->random());
+        break;
+    case distribution_t::LOGNORMAL:
+        us = std::lognormal_distribution<double>(std::log(dist_.a) - dist_.b * dist_.b / 2, dist_.b)(sim_->random());
+        break;
+    }
+    return nanoseconds(std::max<int64_t>(1, std::llround(us * 1000)));
+}
+
+void tenant_t::arrive() {
+    waiting_ = true;
+    arrived_ = sim_->now();
+    next_arrival_ = timestamp_t::max();
+    pending_kernel_ = kernel();
+    demand_ += pending_kernel_.total_microseconds();
+    command cmd = {};
+    sim_->arrive(this, cmd);
+}
+
+void tenant_t::fire(const command& cmd) {
+    simulator_t::callback_t callback(sim_);
+    const timestamp_t end = sim_->execute(pending_kernel_);
+    waiting_ = false;
+    ++submits_;
+    gpu_time_ += pending_kernel_.total_microseconds();
+    latencies_.push_back((end - arrived_).total_microseconds());
+    next_arrival_ = end + microseconds(std::llround(dist_.think));
+}
+
+bool tenant_t::is_active() {
+    return sim_->gpu_active();
+}
+
+timestamp_t simulator_t::next_arrival() const {
+    timestamp_t result(timestamp_t::max());
+    for (const auto& tenant : tenants_) {
+        result = std::min(result, tenant->next_arrival());
+    }
+    return result;
+}
+
+bool simulator_t::any_waiting() const {
+    for (const auto& tenant : tenants_) {
+        if (tenant->waiting()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void simulator_t::advance_to(const timestamp_t& time) {
+    while (now_ < time) {
+        const timestamp_t next = std::min(next_arrival(), time);
+        if (now_ < next) {
+            // the waiting set does not change until the next arrival
+            if (any_waiting() && busy_until_ < next) {
+                stalled_ += next - std::max(now_, busy_until_);
+            }
+            now_ = next;
+        }
+        for (const auto& tenant : tenants_) {
+            if (tenant->next_arrival() <= now_) {
+                // enqueue is done by the session thread
+                callback_t callback(this);
+                tenant->arrive();
+            }
+        }
+    }
+}
+
+timestamp_t simulator_t::execute(const duration_t& kernel) {
+    // the GPU runs fired commands one by one
+    busy_until_ = std::max(now_, busy_until_) + kernel;
+    busy_ += kernel;
+    return busy_until_;
+}
+
+void simulator_t::run(const duration_t& time) {
+    const timestamp_t end = now_ + time;
+    const duration_t period = scheduler_->replenish_period();
+    const duration_t sample = scheduler_->sample_period();
+    timestamp_t next_replenish = now_ + period;
+    timestamp_t next_sample = now_ + sample;
+
+    // arrivals at the origin, and priming the GPU idle timer as run() does
+    advance_to(now_ + microseconds(1));
+    scheduler_->dispatch(false);
+
+    bool idle = false;
+    while (now_ < end) {
+        // The replenisher and the sampler threads wake at their period
+        // boundaries. Selection runs as soon as the previous command
+        // completes, so the one that came due meanwhile is applied after
+        // the next dispatch, not before it.
+        const bool replenish = !period.is_zero() && next_replenish <= now_;
+        const bool sampling = !sample.is_zero() && next_sample <= now_;
+        if (scheduler_->has_pending()) {
+            dispatch_time_ += measure([this, idle] { scheduler_->dispatch(idle); });
+            ++dispatches_;
+            idle = false;
+        } else if (!replenish && !sampling) {
+            timestamp_t wake = std::min(next_arrival(), end);
+            if (!period.is_zero()) {
+                wake = std::min(wake, next_replenish);
+            }
+            if (!sample.is_zero()) {
+                wake = std::min(wake, next_sample);
+            }
+            idle = true;
+            advance_to(std::max(wake, now_ + microseconds(1)));
+        }
+        if (replenish) {
+            replenish_time_ += measure([this] { scheduler_->replenish_once(); });
+            ++replenishes_;
+            next_replenish = now_ + period;
+        }
+        if (sampling) {
+            scheduler_->sample_once();
+            next_sample = now_ + sample;
+        }
+    }
+}
+
+static double percentile(const std::vector<double>& sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    const std::size_t index = std::min<std::size_t>(sorted.size() - 1, std::ceil(p * sorted.size()) - 1);
+    return sorted[index];
+}
+
+void simulator_t::report(const char* name) const {
+    const double elapsed = (now_ - origin_).total_microseconds();
+    // commands fired to the GPU may run over the end
+    const double busy = (busy_ - std::max(busy_until_ - now_, duration_t())).total_microseconds();
+    double sum = 0;
+    double squares = 0;
+    std::printf("scheduler: %s, simulated %.3fs\n", name, elapsed / 1e6);
+    std::printf("%-4s %-24s %10s %10s %8s %10s %10s %10s %10s\n",
+                "id", "kernel", "submits", "gpu(ms)", "share", "p50(us)", "p90(us)", "p99(us)", "max(us)");
+    for (const auto& tenant : tenants_) {
+        sum += tenant->gpu_time();
+        squares += tenant->gpu_time() * tenant->gpu_time();
+    }
+    for (const auto& tenant : tenants_) {
+        std::vector<double> sorted(*tenant->latencies());
+        std::sort(sorted.begin(), sorted.end());
+        const double share = tenant->gpu_time() / std::max(1.0, sum);
+        std::printf("%-4" PRIu32 " %-24s %10" PRIu64 " %10.1f %7.1f%% %10.0f %10.0f %10.0f %10.0f\n",
+                    tenant->id(), tenant->distribution().spec.c_str(), tenant->submits(),
+                    tenant->gpu_time() / 1e3, share * 100,
+                    percentile(sorted, 0.5), percentile(sorted, 0.9), percentile(sorted, 0.99),
+                    sorted.empty() ? 0 : sorted.back());
+    }
+    // Jain's index over the GPU time. Tenants which do not saturate their
+    // share lower it, so compare it with backlogged tenants.
+    const double jain = squares == 0 ? 0 : (sum * sum) / (tenants_.size() * squares);
+    std::printf("jain's fairness index: %.4f\n", jain);
+    std::printf("gpu utilization: %.2f%%\n", busy * 100.0 / elapsed);
+    std::printf("gpu idle with waiting commands: %.2f%%\n", stalled_.total_microseconds() * 100.0 / elapsed);
+    // host time of the scheduler thread. dispatch includes the busy wait
+    // for the completion, so it grows with polls
+    std::printf("scheduler overhead: %" PRIu64 " dispatches %.0fns/dispatch (%.1f polls/dispatch), %" PRIu64 " replenishes %.0fns/replenish\n",
+                dispatches_,
+                dispatches_ ? dispatch_time_.count() / static_cast<double>(dispatches_) : 0.0,
+                dispatches_ ? polls_ / static_cast<double>(dispatches_) : 0.0,
+                replenishes_,
+                replenishes_ ? replenish_time_.count() / static_cast<double>(replenishes_) : 0.0);
+}
+
+}  // namespace a3
+
+int main(int argc, char** argv) {
+    namespace c = a3;
+    c::cmdline::Parser cmd("a3-sched-bench");
+
+    cmd.Add("help", "help", 'h', "print this message");
+    cmd.Add<std::string>("scheduler", "scheduler", 's', "credit, band, fifo or direct", false, "credit");
+    cmd.Add<std::string>("tenants", "tenants", 0, "space separated kernel distributions of tenants", false, "const:200 const:2000 exp:1000/500");
+    cmd.Add<uint64_t>("time", "time", 0, "simulated time (ms)", false, 5000);
+    cmd.Add<uint64_t>("period", "period", 0, "replenish period (us)", false, 50);
+    cmd.Add<uint64_t>("sample", "sample", 0, "sampling period (ms)", false, 100);
+    cmd.Add<uint64_t>("wait", "wait", 0, "FIFO polling interval (us)", false, 50);
+    cmd.Add<uint64_t>("yield", "yield", 0, "virtual time consumed by a yield (us)", false, 1);
+    cmd.Add<uint64_t>("seed", "seed", 0, "random seed", false, 0);
+
+    if (!cmd.Parse(argc, argv)) {
+        std::fprintf(stderr, "%s\n%s", cmd.error().c_str(), cmd.usage().c_str());
+        return 1;
+    }
+
+    if (cmd.Exist("help")) {
+        std::fputs(cmd.usage().c_str(), stdout);
+        return 1;
+    }
+
+    const std::string name = cmd.Get<std::string>("scheduler");
+    const c::duration_t period = c::microseconds(cmd.Get<uint64_t>("period"));
+    const c::duration_t sample = c::milliseconds(cmd.Get<uint64_t>("sample"));
+    std::unique_ptr<c::scheduler_t> scheduler;
+    if (name == "credit") {
+        scheduler.reset(new c::credit_scheduler_t(period, sample));
+    } else if (name == "band") {
+        scheduler.reset(new c::band_scheduler_t(period, sample));
+    } else if (name == "fifo") {
+        scheduler.reset(new c::fifo_scheduler_t(c::microseconds(cmd.Get<uint64_t>("wait")), period, sample));
+    } else if (name == "direct") {
+        scheduler.reset(new c::direct_scheduler_t());
+    } else {
+        std::fprintf(stderr, "unknown scheduler %s\n", name.c_str());
+        return 1;
+    }
+
+    if (cmd.Get<uint64_t>("yield") == 0) {
+        std::fprintf(stderr, "yield should be at least 1us\n");
+        return 1;
+    }
+
+    c::simulator_t sim(scheduler.get(), c::microseconds(cmd.Get<uint64_t>("yield")), cmd.Get<uint64_t>("seed"));
+    std::istringstream ss(cmd.Get<std::string>("tenants"));
+    for (std::string spec; ss >> spec;) {
+        c::distribution_t dist;
+        if (!c::parse_distribution(spec, &dist)) {
+            std::fprintf(stderr, "invalid tenant %s\n", spec.c_str());
+            return 1;
+        }
+        sim.add_tenant(dist);
+    }
+
+    sim.run(c::milliseconds(cmd.Get<uint64_t>("time")));
+    sim.report(name.c_str());
+    return 0;
+}
+/* vim: set sw=4 ts=4 et tw=80 : */
@@ -40,16 +40,21 @@
 #include "ignore_unused_variable_warning.h"
 namespace a3 {
 
-channel::channel(int id)
+// upper bound of the NVC0 graph context image pointed by ramin fctx
+static const uint64_t kGRAPH_CONTEXT_SIZE = 0x80000;
+
+channel::channel(int id, std::size_t channels)
     : id_(id)
     , enabled_(false)
     , tlb_flush_needed_(false)
+    , deferred_(false)
     , ramin_address_()
     , shared_address_()
     , table_(new shadow_page_table(id))
-    , shadow_ramin_(new page(1))
-    , original_(A3_DOMAIN_CHANNELS)
+    , shadow_ramin_(new page(1, true))
+    , original_(channels)
     , derived_(&original_)
+    , policy_()
 {
 }
 
@@ -89,24 +94,37 @@ void channel::shadow(context* ctx) {
         page_directory_virt = mmio::read64(&pmem, ramin_address() + 0x0200);
         page_directory_phys = ctx->get_phys_address(page_directory_virt);
         page_directory_size = mmio::read64(&pmem, ramin_address() + 0x0208);
+        if (page_directory_phys == UINT64_MAX) {
+            A3_LOG("id %d page directory 0x%" PRIX64 " cannot be backed\n", id(), page_directory_virt);
+            return;
+        }
         mmio::write64(shadow_ramin(), 0x0200, page_directory_phys);
         mmio::write64(shadow_ramin(), 0x0208, page_directory_size);
 
         A3_LOG("id %d virt 0x%" PRIX64 " phys 0x%" PRIX64 " size %" PRIu64 "\n", id(), page_directory_virt, page_directory_phys, page_directory_size);
     }
 
-    // fctx
+    // fctx and mpeg ctx are read linearly by the GPU, so they should be
+    // contiguous on the host
     const uint64_t fctx_virt = mmio::read64(&pmem, ramin_address() + 0x08);
-    const uint64_t fctx_phys = ctx->get_phys_address(fctx_virt);
+    const uint64_t fctx_phys = ctx->get_phys_address_range(fctx_virt, kGRAPH_CONTEXT_SIZE);
+    if (fctx_phys == UINT64_MAX) {
+        A3_LOG("id %d fctx 0x%" PRIX64 " cannot be backed\n", id(), fctx_virt);
+        return;
+    }
     mmio::write64(shadow_ramin(), 0x08, fctx_phys);
 
     // mpeg ctx
     const uint64_t mpeg_ctx_limit_virt = pmem.read32(ramin_address() + 0x60 + 0x04);
-    const uint64_t mpeg_ctx_limit_phys = ctx->get_phys_address(mpeg_ctx_limit_virt);
-    shadow_ramin()->write32(0x60 + 0x04, mpeg_ctx_limit_phys);
-
     const uint64_t mpeg_ctx_virt = pmem.read32(ramin_address() + 0x60 + 0x08);
-    const uint64_t mpeg_ctx_phys = ctx->get_phys_address(mpeg_ctx_virt);
+    const uint64_t mpeg_ctx_size = (mpeg_ctx_limit_virt > mpeg_ctx_virt) ? (mpeg_ctx_limit_virt - mpeg_ctx_virt + 1) : 1;
+    const uint64_t mpeg_ctx_phys = ctx->get_phys_address_range(mpeg_ctx_virt, mpeg_ctx_size);
+    if (mpeg_ctx_phys == UINT64_MAX) {
+        A3_LOG("id %d mpeg ctx 0x%" PRIX64 " cannot be backed\n", id(), mpeg_ctx_virt);
+        return;
+    }
+    const uint64_t mpeg_ctx_limit_phys = (mpeg_ctx_limit_virt > mpeg_ctx_virt) ? (mpeg_ctx_phys + mpeg_ctx_size - 1) : ctx->get_phys_address(mpeg_ctx_limit_virt);
+    shadow_ramin()->write32(0x60 + 0x04, mpeg_ctx_limit_phys);
     shadow_ramin()->write32(0x60 + 0x08, mpeg_ctx_phys);
 
     // TODO(Yusuke Suzuki):
@@ -181,6 +199,14 @@ void channel::remove_overridden_shadow(context* ctx) {
     write_shadow_page_table(ctx, table()->shadow_address());
 }
 
+void channel::submit(context* ctx, const command& cmd) {
+    submitted_ = cmd.value;
+    ctx->instruments()->increment_submit_times();
+    if (policy()->submitted() && a3::flags::adaptive_shadowing) {
+        ctx->instruments()->shadowing_mode_changed(id(), lazy_shadowing());
+    }
+}
+
 void channel::tlb_flush_needed() {
     tlb_flush_needed_ = true;
 }
@@ -4,6 +4,7 @@
 #include <boost/noncopyable.hpp>
 #include <boost/dynamic_bitset.hpp>
 #include "a3.h"
+#include "shadowing_policy.h"
 namespace a3 {
 class shadow_page_table;
 class context;
@@ -13,7 +14,7 @@ class channel : private boost::noncopyable {
  public:
     typedef boost::dynamic_bitset<> page_table_reuse_t;
 
-    channel(int id);
+    channel(int id, std::size_t channels);
     uint64_t refresh(context* ctx, uint64_t addr);
     shadow_page_table* table() { return table_.get(); }
     const shadow_page_table* table() const { return table_.get(); }
@@ -26,6 +27,16 @@ class channel : private boost::noncopyable {
 
     void flush(context* ctx);
     void tlb_flush_needed();
+    void defer_flush() { deferred_ = true; }
+    bool deferred() const { return deferred_; }
+    void flush_deferred(context* ctx) {
+        if (deferred()) {
+            flush(ctx);
+        }
+    }
+    shadowing_policy_t* policy() { return &policy_; }
+    const shadowing_policy_t* policy() const { return &policy_; }
+    bool lazy_shadowing() const { return policy_.lazy(); }
 
     void write_shadow_page_table(context* ctx, uint64_t shadow);
     void override_shadow(context* ctx, uint64_t shadow, page_table_reuse_t* reuse);
@@ -38,21 +49,21 @@ class channel : private boost::noncopyable {
         return &original_;
     }
 
-    void submit(context* ctx, const command& cmd) {
-        submitted_ = cmd.value;
-    }
+    void submit(context* ctx, const command& cmd);
 
     uint32_t submitted() const { return submitted_; }
 
  private:
     void clear_tlb_flush_needed() {
         tlb_flush_needed_ = false;
+        deferred_ = false;
     }
     bool detach(context* ctx, uint64_t addr);
     void attach(context* ctx, uint64_t addr);
     int id_;
     bool enabled_;
     bool tlb_flush_needed_;
+    bool deferred_;
     uint64_t ramin_address_;
     uint64_t shared_address_;
     uint32_t submitted_;
@@ -61,6 +72,7 @@ class channel : private boost::noncopyable {
 
     page_table_reuse_t original_;
     page_table_reuse_t* derived_;
+    shadowing_policy_t policy_;
 };
 
 }  // namespace a3
@@ -0,0 +1,106 @@
+#ifndef A3_CHECKPOINT_H_
+#define A3_CHECKPOINT_H_
+#include <cstdint>
+#include <vector>
+#include <boost/noncopyable.hpp>
+#include <boost/dynamic_bitset.hpp>
+#include "a3.h"
+#include "vram_partition.h"
+namespace a3 {
+
+// Checkpoint stream of one context. The stream is a sequence of records, a
+// checkpoint_record_t followed by size bytes of payload.
+//
+//   HEADER     checkpoint_header_t, first record of the stream
+//   CHUNK      guest VRAM chunk at index * kVRAM_CHUNK_SIZE
+//   ZERO       zero filled guest VRAM chunk at index, no payload
+//   REGISTERS  (offset, value) uint32_t pairs of non zero shadow registers
+//   RAMIN      guest RAMIN address (uint64_t) of the channel index. BAR1 and
+//              BAR3 channels follow the channels of the slot
+//   END        last record of the stream, no payload
+//
+// A chunk may be sent more than once while pre-copying, the last one wins.
+struct checkpoint_record_t {
+    enum tag_t {
+        HEADER = 0,
+        CHUNK,
+        ZERO,
+        REGISTERS,
+        RAMIN,
+        END
+    };
+
+    uint32_t tag;
+    uint32_t size;
+    uint64_t index;
+};
+
+struct checkpoint_header_t {
+    static const uint32_t kMAGIC = 0x50433341;  // "A3CP"
+    static const uint32_t kVERSION = 1;
+
+    uint32_t magic;
+    uint32_t version;
+    uint64_t memory_size;
+    uint32_t channels;
+    uint32_t reserved;
+};
+
+// Guest VRAM chunks written since they were last sent. CPU writes are trapped
+// and marked one by one. The GPU may write anywhere in the partition, so a
+// submission marks all chunks. Once frozen, only the chunks dirty at that
+// point are left to send.
+class dirty_tracker_t : private boost::noncopyable {
+ public:
+    explicit dirty_tracker_t(uint64_t chunks)
+        : dirty_(chunks)
+        , header_(false)
+        , frozen_(false)
+    {
+        dirty_.set();
+    }
+
+    void mark(uint64_t virt) {
+        const uint64_t index = virt / kVRAM_CHUNK_SIZE;
+        if (!frozen_ && index < dirty_.size()) {
+            dirty_.set(index);
+        }
+    }
+
+    void mark_all() {
+        if (!frozen_) {
+            dirty_.set();
+        }
+    }
+
+    void freeze() { frozen_ = true; }
+    bool frozen() const { return frozen_; }
+
+    // true only on the first call, the stream starts with the header
+    bool take_header() {
+        const bool result = !header_;
+        header_ = true;
+        return result;
+    }
+
+    // moves up to max dirty chunk indices to indices
+    void take(std::size_t max, std::vector<uint64_t>* indices) {
+        for (std::size_t index = dirty_.find_first();
+             index != boost::dynamic_bitset<>::npos && indices->size() < max;
+             index = dirty_.find_next(index)) {
+            dirty_.reset(index);
+            indices->push_back(index);
+        }
+    }
+
+    std::size_t count() const { return dirty_.count(); }
+
+ private:
+    boost::dynamic_bitset<> dirty_;
+    bool header_;
+    bool frozen_;
+};
+
+}  // namespace a3
+#endif  // A3_CHECKPOINT_H_
+/* vim: set sw=4 ts=4 et tw=80 : */
@@ -21,8 +21,13 @@
  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
  * THE SOFTWARE.
  */
+#include <cstdlib>
 #include "a3.h"
 #include "chipset.h"
+#include "chipset_traits.h"
+#include "context.h"
+#include "device_bar1.h"
+#include "playlist.h"
 #include "registers.h"
 namespace a3 {
 
@@ -44,5 +49,34 @@ chipset_t::chipset_t(uint32_t boot0)
     }
 }
 
+template<typename Chipset>
+class chipset_dispatch_impl_t : public chipset_dispatch_t {
+ public:
+    virtual bool handle(context* ctx, const command& cmd) const {
+        return ctx->dispatch<Chipset>(cmd);
+    }
+
+    virtual void submit(context* ctx, const command& cmd) const {
+        device()->bar1()->write<Chipset>(ctx, cmd);
+    }
+
+    virtual playlist_t* create_playlist() const {
+        return new chipset_playlist_t<Chipset>();
+    }
+};
+
+chipset_dispatch_t* create_chipset_dispatch(card_type_t type) {
+    switch (type) {
+#define V(card, traits)\
+    case card:\
+        return new chipset_dispatch_impl_t<traits>();
+    A3_CHIPSET_TRAITS_LIST(V)
+#undef V
+    default:
+        A3_FATAL(stderr, "unsupported chipset\n");
+        std::exit(1);
+    }
+}
+
 }  // namespace a3
 /* vim: set sw=4 ts=4 et tw=80 : */
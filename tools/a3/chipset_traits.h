@@ -0,0 +1,59 @@
+#ifndef A3_CHIPSET_TRAITS_H_
+#define A3_CHIPSET_TRAITS_H_
+#include <cstddef>
+#include <cstdint>
+#include <boost/noncopyable.hpp>
+#include "a3.h"
+#include "chipset.h"
+namespace a3 {
+
+class context;
+class playlist_t;
+
+// Compile time constants of a GPU family. The per-command paths are templates
+// on them and device_t::initialize picks the instantiation of the detected
+// chipset once, so offsets fold to constants.
+struct nvc0_traits_t {
+    static const uint32_t kPFIFO = 0x003000;          // channel RAMIN / status
+    static const uint32_t kCHANNEL_WINDOW = 0x001000;  // BAR1 area per channel
+    static const std::size_t kENGINES = 1;
+    static const std::size_t kRUNLIST_PAGES = 1;
+    static const uint32_t kRUNLIST_STATUS = 0x4;
+
+    static std::size_t engine(uint32_t cmd) { return 0; }
+};
+
+struct nve0_traits_t {
+    static const uint32_t kPFIFO = 0x800000;
+    static const uint32_t kCHANNEL_WINDOW = 0x000200;
+    static const std::size_t kENGINES = 7;
+    static const std::size_t kRUNLIST_PAGES = 8;
+    static const uint32_t kRUNLIST_STATUS = 0x0;
+
+    static std::size_t engine(uint32_t cmd) { return cmd >> 20; }
+};
+
+// V(card, traits), every template on traits is instantiated for each
+#define A3_CHIPSET_TRAITS_LIST(V)\
+    V(card::NVC0, nvc0_traits_t)\
+    V(card::NVE0, nve0_traits_t)\
+
+// Entry points instantiated for the chipset of the device.
+class chipset_dispatch_t : private boost::noncopyable {
+ public:
+    virtual ~chipset_dispatch_t() { }
+
+    // MMIO command of the guest, returns true if the reply is awaited
+    virtual bool handle(context* ctx, const command& cmd) const = 0;
+
+    // submission to the device BAR1, with the device mutex held
+    virtual void submit(context* ctx, const command& cmd) const = 0;
+
+    virtual playlist_t* create_playlist() const = 0;
+};
+
+chipset_dispatch_t* create_chipset_dispatch(card_type_t type);
+
+}  // namespace a3
+#endif  // A3_CHIPSET_TRAITS_H_
+/* vim: set sw=4 ts=4 et tw=80 : */
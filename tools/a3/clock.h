@@ -0,0 +1,44 @@
+#ifndef A3_CLOCK_H_
+#define A3_CLOCK_H_
+#include <boost/thread.hpp>
+#include <boost/noncopyable.hpp>
+#include "duration.h"
+#include "tsc.h"
+namespace a3 {
+
+// Time source of the schedulers. The daemon uses the monotonic TSC clock,
+// and the scheduler simulator (bench/sched_bench.cc) replaces it with a
+// virtual one.
+class clock_source_t : private boost::noncopyable {
+ public:
+    virtual ~clock_source_t() { }
+    virtual timestamp_t now() const = 0;
+    virtual void sleep(const duration_t& duration) = 0;
+    virtual void yield() = 0;
+
+    static clock_source_t* system();
+};
+
+class system_clock_t : public clock_source_t {
+ public:
+    virtual timestamp_t now() const {
+        return timestamp_t(tsc_t::instance().now());
+    }
+
+    virtual void sleep(const duration_t& duration) {
+        boost::this_thread::sleep(duration.to_posix());
+    }
+
+    virtual void yield() {
+        boost::this_thread::yield();
+    }
+};
+
+inline clock_source_t* clock_source_t::system() {
+    static system_clock_t clock;
+    return &clock;
+}
+
+}  // namespace a3
+#endif  // A3_CLOCK_H_
+/* vim: set sw=4 ts=4 et tw=80 : */
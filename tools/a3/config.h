@@ -3,6 +3,7 @@
 
 #define A3_VERSION "0.0.1"
 #define A3_ENDPOINT "/tmp/a3_endpoint"
+#define A3_METRICS_ENDPOINT "/tmp/a3_metrics"
 #define A3_1G 0x40000000ULL
 #define A3_2G (A3_1G * 2)
 
@@ -15,11 +16,9 @@
 
 // Because BAR3 effective area is limited to 16MB
 #define A3_BAR3_TOTAL_SIZE (16 * (1ULL << 20))
-#define A3_BAR3_ARENA_SIZE (A3_BAR3_TOTAL_SIZE / A3_VM_NUM)
 
 #define A3_BAR1_TOTAL_SIZE (128ULL * (1ULL << 20))
 #define A3_BAR1_POLL_AREA_SIZE (A3_CHANNELS * 0x1000ULL)  /* POLL AREA is reserved, 512KB */
-#define A3_BAR1_ARENA_SIZE ((A3_BAR1_TOTAL_SIZE - A3_BAR1_POLL_AREA_SIZE) / A3_VM_NUM)
 
 #define NOUVEAU_PV_REG_BAR 4
 #define NOUVEAU_PV_SLOT_SIZE 0x1000ULL
@@ -38,6 +37,7 @@
     V(NOUVEAU_PV_OP_MEM_ALLOC)\
     V(NOUVEAU_PV_OP_MEM_FREE)\
     V(NOUVEAU_PV_OP_BAR3_PGT)\
+    V(NOUVEAU_PV_OP_MIRROR_PGT)\
 
 #endif  // A3_CONFIG_H_
 /* vim: set sw=4 ts=4 et tw=80 : */
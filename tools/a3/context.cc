@@ -29,6 +29,7 @@
 #include "session.h"
 #include "context.h"
 #include "device.h"
+#include "chipset_traits.h"
 #include "bit_mask.h"
 #include "registers.h"
 #include "barrier.h"
@@ -39,7 +40,10 @@
 #include "software_page_table.h"
 #include "page_table.h"
 #include "pv_page.h"
+#include "pv_mirror.h"
 #include "utility.h"
+#include "timer.h"
+#include "flags.h"
 #include "ignore_unused_variable_warning.h"
 namespace a3 {
 
@@ -48,6 +52,8 @@ context::context(session* s, bool through)
     , through_(through)
     , initialized_(false)
     , id_()
+    , partition_()
+    , vram_()
     , bar1_channel_()
     , bar3_channel_()
     , channels_()
@@ -56,36 +62,53 @@ context::context(session* s, bool through)
     , reg32_()
     , ramin_channel_map_()
     , bar3_address_()
-    , pfifo_()
     , instruments_(new instruments_t(this))
     , para_virtualized_(false)
     , pv32_()
     , guest_()
+    , mirrors_()
     , pgds_()
     , pv_bar1_pgd_()
     , pv_bar1_large_pgt_()
     , pv_bar1_small_pgt_()
     , pv_bar3_pgd_()
     , pv_bar3_pgt_()
-    , band_mutex_()
-    , budget_()
-    , bandwidth_()
-    , bandwidth_used_()
-    , sampling_bandwidth_used_()
-    , sampling_bandwidth_used_100_()
-    , suspended_()
+    , residency_mutex_()
+    , last_access_()
+    , evicted_(false)
+    , swapped_bytes_(0)
+    , moved_(false)
+    , swapped_()
+    , swapped_ramins_()
+    , dirty_()
+    , submitted_(false)
+    , loading_(false)
+    , replay_(false)
 {
 }
 
 context::~context() {
+    // the evictor picks contexts under the device mutex, so that it is not
+    // touching this once release_virt unlinks it
+    mutex_t::scoped_lock residency(residency_mutex_);
     if (initialized_) {
         device()->release_virt(id_, this);
-        A3_LOG("END and release GPU id %u\n", id_);
+        // no scheduler or evictor reaches this anymore, so return the VRAM
+        // chunks to the pool now rather than after the members are gone
+        vram_.reset();
+        A3_LOG("END and release GPU id %u, scrubbing in background\n", id_);
     }
 }
 
 void context::initialize(int dom, bool para) {
     id_ = device()->acquire_virt(this);
+    if (id_ == UINT32_MAX) {
+        A3_FATAL(stderr, "no free GPU slot for domid %d\n", dom);
+        buffer()->value = id_;
+        return;
+    }
+    partition_ = &partition_t::slot(id_);
+    vram_.reset(new vram_mapping_t(partition(), device()->vram_partition(), device()->scrubber()));
     domid_ = dom;
     para_virtualized_ = para;
     if (para_virtualized()) {
@@ -93,11 +116,18 @@ void context::initialize(int dom, bool para) {
     }
     bar1_channel_.reset(new bar1_channel_t(this));
     bar3_channel_.reset(new bar3_channel_t(this));
-    barrier_.reset(new barrier::table(get_address_shift(), vram_size()));
-    reg32_.reset(new uint32_t[A3_BAR0_SIZE / sizeof(uint32_t)]);
+    barrier_.reset(new barrier::table(vram()->host_base(), vram()->host_size()));
+    reg32_.reset(new uint32_t[A3_BAR0_SIZE / sizeof(uint32_t)]());
+    channels_.resize(domain_channels());
+    int64_t lazy = 0;
     for (std::size_t i = 0, iz = channels_.size(); i < iz; ++i) {
-        channels_[i].reset(new channel(i));
+        channels_[i].reset(new channel(i, domain_channels()));
+        if (channels_[i]->lazy_shadowing()) {
+            ++lazy;
+        }
     }
+    instruments_->metrics()->lazy_channels.set(lazy);
+    pgds_.resize(domain_channels(), nullptr);
     initialized_ = true;
     A3_LOG("INIT domid %d & GPU id %u with %s\n", domid(), id(), para_virtualized() ? "Para-virt" : "Full-virt");
     buffer()->value = id();
@@ -106,6 +136,14 @@ void context::initialize(int dom, bool para) {
 
 // main entry
 bool context::handle(const command& cmd) {
+    mutex_t::scoped_lock residency(residency_mutex_);
+    if (evicted_) {
+        restore();
+    }
+    if (flags::evict_idle) {
+        last_access_ = clock_source_t::system()->now();
+    }
+
     if (cmd.type == command::TYPE_INIT) {
         initialize(cmd.value, cmd.offset != 0);
         return false;
@@ -152,6 +190,10 @@ bool context::handle(const command& cmd) {
                 A3_LOG("clear context shadowing utilizations\n");
             }
             break;
+
+        case command::UTILITY_BAR3_ARENA_SIZE:
+            buffer()->value = initialized_ ? bar3_arena_size() : 0;
+            break;
         }
         return false;
     }
@@ -172,15 +214,23 @@ bool context::handle(const command& cmd) {
         return false;
     }
 
+    return device()->dispatch()->handle(this, cmd);
+}
+
+template<typename Chipset>
+bool context::dispatch(const command& cmd) {
+    timer_t timer;
+    timer.start();
+
     bool wait = false;
     if (cmd.type == command::TYPE_WRITE) {
         switch (cmd.bar()) {
         case command::BAR0:
-            write_bar0(cmd);
+            write_bar0<Chipset>(cmd);
             A3_LOG("BAR0 write 0x%" PRIx32 " 0x%" PRIx32 "\n", cmd.offset, cmd.value);
             break;
         case command::BAR1:
-            write_bar1(cmd);
+            write_bar1<Chipset>(cmd);
             A3_LOG("BAR1 write 0x%" PRIx32 " 0x%" PRIx32 "\n", cmd.offset, cmd.value);
             break;
         case command::BAR3:
@@ -198,11 +248,11 @@ bool context::handle(const command& cmd) {
         wait = true;
         switch (cmd.bar()) {
         case command::BAR0:
-            read_bar0(cmd);
+            read_bar0<Chipset>(cmd);
             A3_LOG("BAR0 read  0x%" PRIx32 " 0x%" PRIx32 "\n", cmd.offset, buffer()->value);
             break;
         case command::BAR1:
-            read_bar1(cmd);
+            read_bar1<Chipset>(cmd);
             A3_LOG("BAR1 read  0x%" PRIx32 " 0x%" PRIx32 "\n", cmd.offset, buffer()->value);
             break;
         case command::BAR3:
@@ -216,9 +266,22 @@ bool context::handle(const command& cmd) {
     }
     inspect(cmd, buffer()->value);
 
+    if ((cmd.type == command::TYPE_WRITE || cmd.type == command::TYPE_READ) && cmd.bar() <= command::BAR4) {
+        const context_metrics_t::direction_t dir =
+            (cmd.type == command::TYPE_WRITE) ? context_metrics_t::WRITE : context_metrics_t::READ;
+        mmio_metrics_t* metrics = instruments()->metrics()->mmio(cmd.bar(), dir);
+        metrics->commands.increment();
+        metrics->latency.observe(timer.elapsed());
+    }
+
     return wait;
 }
 
+#define V(card, traits)\
+    template bool context::dispatch<traits>(const command& cmd);
+A3_CHIPSET_TRAITS_LIST(V)
+#undef V
+
 void context::playlist_update(uint32_t reg_addr, uint32_t cmd) {
     const uint64_t address = get_phys_address(bit_mask<28, uint64_t>(reg_addr) << 12);
     device()->playlist_update(this, address, cmd);
@@ -255,9 +318,10 @@ void context::flush_tlb(uint32_t vspace, uint32_t trigger) {
     const uint64_t page_directory = get_phys_address(bit_mask<40, uint64_t>(static_cast<uint64_t>(vspace) << 8));
 
     uint64_t already = 0;
+    bool deferred = false;
     channel::page_table_reuse_t* reuse;
 
-    // A3_FATAL(stdout, "flush times %" PRIu64 "\n", increment_flush_times());
+    instruments()->increment_flush_times();
     A3_LOG("TLB flush 0x%" PRIX64 " pd\n", page_directory);
 
     // rescan page tables
@@ -285,8 +349,12 @@ void context::flush_tlb(uint32_t vspace, uint32_t trigger) {
             A3_LOG("channel id %" PRIu64 " => 0x%" PRIx64 "\n", i, channel->table()->page_directory_address());
             if (channel->table()->page_directory_address() == page_directory) {
                 channel->tlb_flush_needed();
+                channel->policy()->flushed();
                 if (already) {
                     channel->override_shadow(this, already, reuse);
+                    if (deferred) {
+                        channel->defer_flush();
+                    }
                 } else {
                     if (channel->is_overridden_shadow()) {
                         channel->remove_overridden_shadow(this);
@@ -295,7 +363,15 @@ void context::flush_tlb(uint32_t vspace, uint32_t trigger) {
                     channel->table()->allocate_shadow_address();
                     already = channel->table()->shadow_address();
                     reuse = channel->generate_original();
-                    if (!a3::flags::lazy_shadowing) {
+                    if (channel->lazy_shadowing()) {
+                        // rescan is deferred until this channel is fired.
+                        // If the previous one is still pending, we can skip it.
+                        if (channel->deferred()) {
+                            instruments()->increment_rescans_avoided();
+                        }
+                        channel->defer_flush();
+                        deferred = true;
+                    } else {
                         channel->flush(this);
                     }
                 }
@@ -324,7 +400,7 @@ struct page_entry context::guest_to_host(const struct page_entry& entry) {
             const uint64_t h_address = get_phys_address(g_address);
             const uint64_t h_field = h_address >> 12;
             result.address = (uint32_t)(h_field);
-            if (!(get_address_shift() <= h_address && h_address < (get_address_shift() + vram_size()))) {
+            if (g_address >= vram_size() || h_address == UINT64_MAX) {
                 // invalid address
                 A3_LOG("  invalid addr 0x%" PRIx64 " to 0x%" PRIx64 "\n", g_address, h_address);
                 result.present = false;
@@ -1,12 +1,13 @@
 #ifndef A3_CONTEXT_H_
 #define A3_CONTEXT_H_
 #include <array>
+#include <atomic>
 #include <memory>
 #include <queue>
+#include <vector>
 #include <boost/unordered_map.hpp>
 #include <boost/noncopyable.hpp>
 #include <boost/ptr_container/ptr_unordered_map.hpp>
-#include <boost/intrusive/list_hook.hpp>
 #include "a3.h"
 #include "lock.h"
 #include "channel.h"
@@ -16,8 +17,11 @@
 #include "page_table.h"
 #include "instruments.h"
 #include "duration.h"
-#include "pfifo.h"
 #include "poll_area.h"
+#include "partition.h"
+#include "vram_partition.h"
+#include "sched_entity.h"
+#include "checkpoint.h"
 namespace a3 {
 namespace barrier {
 class table;
@@ -25,19 +29,27 @@ class table;
 
 struct slot_t;
 class pv_page;
+class pv_mirror_t;
 
-class context : private boost::noncopyable, public boost::intrusive::list_base_hook<> {
+class context : private boost::noncopyable, public sched_entity_t {
  public:
     typedef boost::unordered_multimap<uint64_t, channel*> channel_map;
 
     context(session* session, bool through);
     virtual ~context();
     bool handle(const command& command);
+    // BAR commands, instantiated per chipset_traits
+    template<typename Chipset>
+    bool dispatch(const command& command);
+    template<typename Chipset>
     void write_bar0(const command& command);
+    template<typename Chipset>
     void write_bar1(const command& command);
     void write_bar3(const command& command);
     void write_bar4(const command& command);
+    template<typename Chipset>
     void read_bar0(const command& command);
+    template<typename Chipset>
     void read_bar1(const command& command);
     void read_bar3(const command& command);
     void read_bar4(const command& command);
@@ -54,21 +66,41 @@ class context : private boost::noncopyable, public boost::intrusive::list_base_h
     const barrier::table* barrier() const { return barrier_.get(); }
     channel_map* ramin_channel_map() { return &ramin_channel_map_; }
     const channel_map* ramin_channel_map() const { return &ramin_channel_map_; }
-    uint64_t vram_size() const { return A3_MEMORY_SIZE; }
-    uint64_t get_address_shift() const {
-        return id() * vram_size();
+    const partition_slot_t& partition() const { return *partition_; }
+    uint64_t vram_size() const { return partition().memory_size; }
+    uint32_t domain_channels() const { return partition().channels; }
+    uint64_t bar3_arena_base() const { return partition().bar3_base; }
+    uint64_t bar3_arena_size() const { return partition().bar3_size; }
+    vram_mapping_t* vram() { return vram_.get(); }
+    const vram_mapping_t* vram() const { return vram_.get(); }
+    uint64_t get_phys_address(uint64_t virt) {
+        return vram()->translate(virt);
     }
-    uint64_t get_phys_address(uint64_t virt) const {
-        return virt + get_address_shift();
+    // host address of the object the GPU reads linearly, backed by
+    // contiguous host chunks. UINT64_MAX if it cannot be.
+    uint64_t get_phys_address_range(uint64_t virt, uint64_t size) {
+        return vram()->translate(virt, size);
     }
     uint64_t get_virt_address(uint64_t phys) const {
-        return phys - get_address_shift();
+        return vram()->reverse(phys);
+    }
+    // phys + offset in the guest view. Guest contiguous memory is not always
+    // contiguous on the host, so tables should be walked with this.
+    uint64_t get_phys_address(uint64_t phys, uint64_t offset) {
+        if (!vram()->dynamic()) {
+            return phys + offset;
+        }
+        const uint64_t virt = get_virt_address(phys);
+        if (virt == UINT64_MAX) {
+            return UINT64_MAX;
+        }
+        return get_phys_address(virt + offset);
     }
     uint32_t get_phys_channel_id(uint32_t virt) const {
-        return virt + id() * A3_DOMAIN_CHANNELS;
+        return virt + partition().channel_base;
     }
     uint32_t get_virt_channel_id(uint32_t phys) const {
-        return phys - id() * A3_DOMAIN_CHANNELS;
+        return phys - partition().channel_base;
     }
     uint32_t id() const { return id_; }
     int domid() const { return domid_; }
@@ -90,27 +122,39 @@ class context : private boost::noncopyable, public boost::intrusive::list_base_h
 
     instruments_t* instruments() const { return instruments_.get(); }
 
-    // BAND
-    bool enqueue(const command& cmd);
-    bool dequeue(command* cmd);
-    bool is_suspended();
-    duration_t budget() const { return budget_; }
-    duration_t bandwidth() const { return bandwidth_; }
-    duration_t bandwidth_used() const { return bandwidth_used_; }
-    duration_t sampling_bandwidth_used() const { return sampling_bandwidth_used_; }
-    duration_t sampling_bandwidth_used_100() const { return sampling_bandwidth_used_100_; }
-    void replenish(const duration_t& credit, const duration_t& threshold, const duration_t& bandwidth, bool idle);
-    void clear_sampling_bandwidth_used(uint64_t point);
-    mutex_t& band_mutex() { return band_mutex_; }
-    void update_budget(const duration_t& credit);
+    // sched_entity_t
+    virtual void fire(const command& cmd);
+    virtual bool is_active();
 
     uint32_t& reg32(uint64_t offset) {
         return reg32_[offset / sizeof(uint32_t)];
     }
-    pfifo_t* pfifo() { return &pfifo_; }
-    const pfifo_t* pfifo() const { return &pfifo_; }
     const poll_area_t* poll_area() const { return &poll_area_; }
 
+    // VRAM eviction. The evictor holds residency_mutex while evicting, and
+    // commands are handled with it held, restoring the VRAM first.
+    mutex_t& residency_mutex() { return residency_mutex_; }
+    timestamp_t last_access() const { return last_access_; }
+    bool evictable() const;
+    void evict();
+    bool evicted() const { return evicted_; }
+    uint64_t swapped() const { return swapped_bytes_; }
+
+    // checkpoint stream, see checkpoint.h. checkpoint returns the number of
+    // dirty chunks left or command::kCHECKPOINT_FAILED.
+    uint32_t checkpoint(uint32_t op, std::vector<uint8_t>* out);
+    bool load_checkpoint(const std::vector<uint8_t>& in);
+    // called on CPU writes to the guest VRAM
+    void mark_dirty(uint64_t phys) {
+        if (dirty_) {
+            dirty_->mark(get_virt_address(phys));
+        }
+    }
+
+ protected:
+    virtual void on_dequeue(const duration_t& waited);
+    virtual void on_update_budget(const duration_t& credit);
+
  private:
     void initialize(int domid, bool para);
     void playlist_update(uint32_t reg_addr, uint32_t cmd);
@@ -130,21 +174,39 @@ class context : private boost::noncopyable, public boost::intrusive::list_base_h
         return it->second;
     }
     int pv_map(pv_page* pgt, uint32_t index, uint64_t guest, uint64_t host);
+    int pv_mirror(pv_page* pgt, uint64_t address);
+    void pv_reconcile(pv_mirror_t* mirror);
+    void restore();
+    void rebase();
+    void replay();
+    void checkpoint_chunks(std::vector<uint8_t>* out);
+    void checkpoint_state(std::vector<uint8_t>* out);
+    bool load_record(const checkpoint_record_t& record, const uint8_t* payload);
+
+    static const uint64_t kRAMIN_NONE = UINT64_MAX;
+
+    // evicted guest VRAM chunk. data is null if the chunk was zero filled.
+    struct swapped_chunk_t {
+        uint64_t index;
+        uint32_t chunk;
+        std::unique_ptr<uint32_t[]> data;
+    };
 
     session* session_;
     bool through_;
     bool initialized_;
     int domid_;
     uint32_t id_;  // virtualized GPU id
+    const partition_slot_t* partition_;
+    std::unique_ptr<vram_mapping_t> vram_;
     std::unique_ptr<bar1_channel_t> bar1_channel_;
     std::unique_ptr<bar3_channel_t> bar3_channel_;
-    std::array<std::unique_ptr<channel>, A3_DOMAIN_CHANNELS> channels_;
+    std::vector<std::unique_ptr<channel>> channels_;
     std::unique_ptr<barrier::table> barrier_;
     poll_area_t poll_area_;
     std::unique_ptr<uint32_t[]> reg32_;
     channel_map ramin_channel_map_;
     uint64_t bar3_address_;
-    pfifo_t pfifo_;
 
     // instruments_t
     std::unique_ptr<instruments_t> instruments_;
@@ -154,21 +216,26 @@ class context : private boost::noncopyable, public boost::intrusive::list_base_h
     std::unique_ptr<uint32_t[]> pv32_;
     uint8_t* guest_;
     boost::ptr_unordered_map<const uint32_t, pv_page> allocated_;
-    std::array<pv_page*, A3_DOMAIN_CHANNELS> pgds_;
+    boost::ptr_unordered_map<const uint32_t, pv_mirror_t> mirrors_;  // by PGT id
+    std::vector<pv_page*> pgds_;
     pv_page* pv_bar1_pgd_;
     pv_page* pv_bar1_large_pgt_;
     pv_page* pv_bar1_small_pgt_;
     pv_page* pv_bar3_pgd_;
     pv_page* pv_bar3_pgt_;
-
-    // only touched by BAND scheduler
-    mutex_t band_mutex_;
-    duration_t budget_;
-    duration_t bandwidth_;
-    duration_t bandwidth_used_;
-    duration_t sampling_bandwidth_used_;
-    duration_t sampling_bandwidth_used_100_;
-    std::queue<command> suspended_;
+    // eviction
+    mutex_t residency_mutex_;
+    timestamp_t last_access_;
+    std::atomic<bool> evicted_;
+    std::atomic<uint64_t> swapped_bytes_;
+    bool moved_;
+    std::vector<swapped_chunk_t> swapped_;
+    std::vector<uint64_t> swapped_ramins_;  // guest address, channels, BAR1, BAR3
+    // checkpoint
+    std::unique_ptr<dirty_tracker_t> dirty_;
+    std::atomic<bool> submitted_;
+    bool loading_;
+    bool replay_;
 };
 
 }  // namespace a3
@@ -27,6 +27,7 @@
 #include <unistd.h>
 #include "a3.h"
 #include "context.h"
+#include "chipset_traits.h"
 #include "registers.h"
 #include "barrier.h"
 #include "bit_mask.h"
@@ -38,6 +39,7 @@
 #include "ignore_unused_variable_warning.h"
 namespace a3 {
 
+template<typename Chipset>
 void context::write_bar0(const command& cmd) {
     switch (cmd.offset) {
     case 0x001700: {
@@ -100,7 +102,7 @@ void context::write_bar0(const command& cmd) {
         }
     case 0x002634: {
             // channel kill
-            if (cmd.value >= A3_DOMAIN_CHANNELS) {
+            if (cmd.value >= domain_channels()) {
                 return;
             }
             const uint32_t phys = get_phys_channel_id(cmd.value);
@@ -220,9 +222,7 @@ void context::write_bar0(const command& cmd) {
                     A3_SYNCHRONIZED(device()->mutex()) {
                         for (iter_t it = range.first; it != range.second; ++it) {
                             const uint32_t res = bit_clear<28>(data) | (it->second->shadow_ramin()->address() >> 12);
-                            if (a3::flags::lazy_shadowing) {
-                                it->second->flush(this);
-                            }
+                            it->second->flush_deferred(this);
                             A3_LOG("    channel %d ramin graph with cmd %" PRIX32 " with addr %" PRIX64 " : %" PRIX32 " => %" PRIX32 "\n", it->second->id(), cmd.value, it->second->shadow_ramin()->address(), data, res);
 
                             // Because we doesn't recognize PCOPY engine initialization
@@ -273,7 +273,7 @@ void context::write_bar0(const command& cmd) {
     case 0x610010: {
             // NV50 PDISPLAY OBJECTS
             reg32(cmd.offset) = cmd.value;
-            const uint32_t value = cmd.value + (get_address_shift() >> 8);
+            const uint32_t value = get_phys_address(static_cast<uint64_t>(cmd.value) << 8) >> 8;
             registers::write32(cmd.offset, value);
             return;
         }
@@ -281,10 +281,13 @@ void context::write_bar0(const command& cmd) {
 
     // pmem / PMEM
     if (0x700000 <= cmd.offset && cmd.offset < 0x800000) {
-        const uint64_t base = get_phys_address(static_cast<uint64_t>(reg32(0x1700)) << 16);
-        const uint64_t addr = base + (cmd.offset - 0x700000);
+        const uint64_t addr = get_phys_address((static_cast<uint64_t>(reg32(0x1700)) << 16) + (cmd.offset - 0x700000));
+        if (addr == UINT64_MAX) {
+            return;
+        }
         pmem::accessor pmem;
         pmem.write(addr, cmd.value, cmd.size());
+        mark_dirty(addr);
         barrier::page_entry* entry = nullptr;
         // A3_LOG("write to PMEM 0x%" PRIX64 " 0x%" PRIX32 " 0x%" PRIX64 " 0x%" PRIx32 "\n", base, cmd.offset - 0x700000, addr, cmd.value);
         if (barrier()->lookup(addr, &entry, false)) {
@@ -295,9 +298,9 @@ void context::write_bar0(const command& cmd) {
     }
 
     // PFIFO
-    // Since NVE0 has different range, we need to create 2 pathes.
-    if (pfifo_.in_range(cmd.offset)) {
-        pfifo_.write(this, cmd);
+    // range differs per chipset, see chipset_traits.h
+    if (pfifo_t::in_range<Chipset>(cmd.offset)) {
+        pfifo_t::write<Chipset>(this, cmd);
         return;
     }
 
@@ -305,6 +308,7 @@ void context::write_bar0(const command& cmd) {
     regs.write(cmd.offset, cmd.value, cmd.size());
 }
 
+template<typename Chipset>
 void context::read_bar0(const command& cmd) {
     switch (cmd.offset) {
     case 0x001700:
@@ -351,7 +355,7 @@ void context::read_bar0(const command& cmd) {
 
     case 0x022438:
         // memory controller size
-        buffer()->value = A3_MEMORY_CTL_NUM;
+        buffer()->value = partition().memory_ctl_num;
         return;
 
     case 0x100cb8:
@@ -381,7 +385,7 @@ void context::read_bar0(const command& cmd) {
 
     case 0x121c74:
         // memory controller size
-        buffer()->value = A3_MEMORY_CTL_NUM;
+        buffer()->value = partition().memory_ctl_num;
         return;
 
     case 0x409500:
@@ -397,7 +401,7 @@ void context::read_bar0(const command& cmd) {
     case 0x409b00: {
             // graph IRQ channel instance
             const uint32_t value = registers::read32(cmd.offset);
-            buffer()->value = value - (get_address_shift() >> 12);
+            buffer()->value = bit_clear<28>(value) | (get_virt_address(bit_mask<28, uint64_t>(value) << 12) >> 12);
             return;
         }
 
@@ -419,8 +423,11 @@ void context::read_bar0(const command& cmd) {
 
     // pmem / PMEM
     if (0x700000 <= cmd.offset && cmd.offset < 0x800000) {
-        const uint64_t base = get_phys_address(static_cast<uint64_t>(reg32(0x1700)) << 16);
-        const uint64_t addr = base + (cmd.offset - 0x700000);
+        const uint64_t addr = get_phys_address((static_cast<uint64_t>(reg32(0x1700)) << 16) + (cmd.offset - 0x700000));
+        if (addr == UINT64_MAX) {
+            buffer()->value = 0;
+            return;
+        }
         pmem::accessor pmem;
         buffer()->value = pmem.read(addr, cmd.size());
         barrier::page_entry* entry = nullptr;
@@ -433,9 +440,9 @@ void context::read_bar0(const command& cmd) {
     }
 
     // PFIFO
-    // Since NVE0 has different range, we need to create 2 pathes.
-    if (pfifo_.in_range(cmd.offset)) {
-        buffer()->value = pfifo_.read(this, cmd);
+    // range differs per chipset, see chipset_traits.h
+    if (pfifo_t::in_range<Chipset>(cmd.offset)) {
+        buffer()->value = pfifo_t::read<Chipset>(this, cmd);
         return;
     }
 
@@ -450,7 +457,7 @@ void context::read_bar0(const command& cmd) {
             case 0x11520c:
             case 0x11620c:
             case 0x10f20c:  // bsize (it should be equal to psize for uniform memory layout)
-                buffer()->value = A3_MEMORY_CTL_PART >> 20;
+                buffer()->value = partition().memory_ctl_part >> 20;
                 return;
         }
     }
@@ -508,14 +515,18 @@ uint32_t context::encode_to_shadow_ramin(uint32_t value) {
     } else {
         for (iter_t it = range.first; it != range.second; ++it) {
             A3_LOG("encode: virt %" PRIX64 " to shadow ramin %" PRIX64 "\n", virt, it->second->shadow_ramin()->address());
-            if (a3::flags::lazy_shadowing) {
-                it->second->flush(this);
-            }
+            it->second->flush_deferred(this);
             return bit_clear<28>(value) | (it->second->shadow_ramin()->address() >> 12);
         }
     }
     return value;
 }
 
+#define V(card, traits)\
+    template void context::write_bar0<traits>(const command& cmd);\
+    template void context::read_bar0<traits>(const command& cmd);
+A3_CHIPSET_TRAITS_LIST(V)
+#undef V
+
 }  // namespace a3
 /* vim: set sw=4 ts=4 et tw=80 : */
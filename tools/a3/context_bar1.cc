@@ -24,6 +24,7 @@
 #include <cstdint>
 #include "a3.h"
 #include "context.h"
+#include "chipset_traits.h"
 #include "pmem.h"
 #include "shadow_page_table.h"
 #include "software_page_table.h"
@@ -32,19 +33,18 @@
 #include "poll_area.h"
 namespace a3 {
 
+template<typename Chipset>
 void context::write_bar1(const command& cmd) {
-    if (poll_area_.in_range(this, cmd.offset)) {
+    if (poll_area_.in_range<Chipset>(domain_channels(), cmd.offset)) {
         const poll_area_t::channel_and_offset_t res =
-            poll_area_.extract_channel_and_offset(this, cmd.offset);
+            poll_area_.extract_channel_and_offset<Chipset>(cmd.offset);
         switch (res.offset) {
         case 0x8C: {
                 channel* chan = channels(res.channel);
                 if (!para_virtualized()) {
                     // A3_LOG("FIRE for channel %" PRIu32 "\n", res.channel);
                     // When target TLB is not flushed, we should flush it lazily
-                    if (a3::flags::lazy_shadowing) {
-                        chan->flush(this);
-                    }
+                    chan->flush_deferred(this);
                 }
                 chan->submit(this, cmd);
                 A3_SYNCHRONIZED(device()->mutex()) {
@@ -55,7 +55,7 @@ void context::write_bar1(const command& cmd) {
 
         default:
             A3_SYNCHRONIZED(device()->mutex()) {
-                device()->bar1()->write(this, cmd);
+                device()->bar1()->write<Chipset>(this, cmd);
             }
             break;
         }
@@ -67,6 +67,7 @@ void context::write_bar1(const command& cmd) {
     if (gphys != UINT64_MAX) {
         pmem::accessor pmem;
         pmem.write(gphys, cmd.value, cmd.size());
+        mark_dirty(gphys);
         barrier::page_entry* entry = nullptr;
         if (barrier()->lookup(gphys, &entry, false)) {
             // found
@@ -77,10 +78,11 @@ void context::write_bar1(const command& cmd) {
     // A3_LOG("VM BAR1 invalid write 0x%" PRIX32 " access\n", cmd.offset);
 }
 
+template<typename Chipset>
 void context::read_bar1(const command& cmd) {
-    if (poll_area_.in_range(this, cmd.offset)) {
+    if (poll_area_.in_range<Chipset>(domain_channels(), cmd.offset)) {
         const poll_area_t::channel_and_offset_t res =
-            poll_area_.extract_channel_and_offset(this, cmd.offset);
+            poll_area_.extract_channel_and_offset<Chipset>(cmd.offset);
         switch (res.offset) {
         case 0x8C: {
                 buffer()->value = channels(res.channel)->submitted();
@@ -89,7 +91,7 @@ void context::read_bar1(const command& cmd) {
 
         default: {
                 A3_SYNCHRONIZED(device()->mutex()) {
-                    buffer()->value = device()->bar1()->read(this, cmd);
+                    buffer()->value = device()->bar1()->read<Chipset>(this, cmd);
                 }
             }
             break;
@@ -116,5 +118,11 @@ void context::read_bar1(const command& cmd) {
     buffer()->value = 0xFFFFFFFF;
 }
 
+#define V(card, traits)\
+    template void context::write_bar1<traits>(const command& cmd);\
+    template void context::read_bar1<traits>(const command& cmd);
+A3_CHIPSET_TRAITS_LIST(V)
+#undef V
+
 }  // namespace a3
 /* vim: set sw=4 ts=4 et tw=80 : */
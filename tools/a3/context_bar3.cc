@@ -36,6 +36,7 @@ void context::write_bar3(const command& cmd) {
     if (gphys != UINT64_MAX) {
         pmem::accessor pmem;
         pmem.write(gphys, cmd.value, cmd.size());
+        mark_dirty(gphys);
         barrier::page_entry* entry = nullptr;
         if (barrier()->lookup(gphys, &entry, false)) {
             // found
@@ -22,7 +22,10 @@
  * THE SOFTWARE.
  */
 #include <cstdint>
+#include <vector>
+#include <sys/mman.h>
 #include "a3.h"
+#include "xen.h"
 #include "context.h"
 #include "pmem.h"
 #include "registers.h"
@@ -33,8 +36,10 @@
 #include "pv_slot.h"
 #include "page.h"
 #include "pv_page.h"
+#include "pv_mirror.h"
 #include "device_bar1.h"
 #include "device_bar3.h"
+#include "timer.h"
 namespace a3 {
 namespace {
 
@@ -78,6 +83,62 @@ int context::pv_map(pv_page* pgt, uint32_t index, uint64_t guest, uint64_t host)
     return 0;
 }
 
+int context::pv_mirror(pv_page* pgt, uint64_t address) {
+    mirrors_.erase(pgt->id());
+    if (!address) {
+        // detached, back to hypercalls
+        return 0;
+    }
+    if (address % kPAGE_SIZE) {
+        return -EINVAL;
+    }
+
+    const uint64_t size = pv_mirror_t::mapping_size(pgt->size());
+    uint8_t* mapping = nullptr;
+    A3_SYNCHRONIZED(device()->mutex()) {
+        mapping = reinterpret_cast<uint8_t*>(a3_xen_map_foreign_range(device()->xl_ctx(), domid(), size, PROT_READ | PROT_WRITE, address >> 12));
+    }
+    if (!mapping) {
+        return -ENOMEM;
+    }
+
+    pv_mirror_t* mirror = new pv_mirror_t(pgt, mapping);
+    const uint32_t id = pgt->id();
+    mirrors_.insert(id, mirror);
+
+    // the guest fills the mirror before attaching it
+    mirror->mark_all();
+    pv_reconcile(mirror);
+    return 0;
+}
+
+void context::pv_reconcile(pv_mirror_t* mirror) {
+    pv_page* pgt = mirror->pgt();
+    const bool bar = pgt == pv_bar1_large_pgt_ || pgt == pv_bar1_small_pgt_ || pgt == pv_bar3_pgt_;
+    std::vector<uint32_t> words;
+    const uint64_t reconciled = mirror->reconcile([&](uint64_t first, uint64_t count) {
+        if (bar) {
+            // BAR tables are reflected to the device shadow one by one
+            for (uint64_t index = first; index < first + count; ++index) {
+                struct page_entry gpte;
+                gpte.raw = mirror->entry(index);
+                pv_map(pgt, index, gpte.raw, guest_to_host(gpte).raw);
+            }
+            return;
+        }
+        words.resize(count * 2);
+        for (uint64_t i = 0; i < count; ++i) {
+            struct page_entry gpte;
+            gpte.raw = mirror->entry(first + i);
+            const struct page_entry hpte = guest_to_host(gpte);
+            words[i * 2 + 0] = lower32(hpte.raw);
+            words[i * 2 + 1] = upper32(hpte.raw);
+        }
+        device()->write_pmem_block(pgt->address() + first * sizeof(uint64_t), words.data(), words.size() * sizeof(uint32_t));
+    });
+    instruments()->metrics()->mirrored.increment(reconciled);
+}
+
 int context::a3_call(const command& cmd, slot_t* slot) {
     instruments()->hypercall(cmd, slot);
     switch (slot->u8[0]) {
@@ -97,6 +158,9 @@ int context::a3_call(const command& cmd, slot_t* slot) {
                     pv_bar1_pgd_ = pgd;
                 }
             } else {
+                if (static_cast<uint32_t>(cid) >= pgds_.size()) {
+                    return -EINVAL;
+                }
                 pgds_[cid] = pgd;
             }
         }
@@ -259,6 +323,11 @@ int context::a3_call(const command& cmd, slot_t* slot) {
                 return -EINVAL;
             }
 
+            // PTEs written to the mirrors since the last flush
+            for (auto it = mirrors_.begin(), last = mirrors_.end(); it != last; ++it) {
+                pv_reconcile(it->second);
+            }
+
             if (pgd == pv_bar1_pgd_) {
                 A3_SYNCHRONIZED(device()->mutex()) {
                     device()->bar1()->flush();
@@ -294,8 +363,7 @@ int context::a3_call(const command& cmd, slot_t* slot) {
 
     case NOUVEAU_PV_OP_MEM_ALLOC: {
             const uint32_t size = slot->u32[1];
-            pv_page* p(new pv_page(round_up(size, kPAGE_SIZE) / kPAGE_SIZE));
-            p->clear();
+            pv_page* p(new pv_page(round_up(size, kPAGE_SIZE) / kPAGE_SIZE, true));
             const uint32_t id = p->id();
             ASSERT(id != 0 && "id should not equal to 0");
             slot->u32[1] = id;
@@ -305,6 +373,7 @@ int context::a3_call(const command& cmd, slot_t* slot) {
         return 0;
 
     case NOUVEAU_PV_OP_MEM_FREE: {
+            mirrors_.erase(slot->u32[1]);
             allocated_.erase(slot->u32[1]);
         }
         return 0;
@@ -319,6 +388,17 @@ int context::a3_call(const command& cmd, slot_t* slot) {
         }
         return 0;
 
+    case NOUVEAU_PV_OP_MIRROR_PGT: {
+            // u64[1] is the guest physical address of the mirror, 0 detaches
+            pv_page* pgt = lookup_by_pv_id(slot->u32[1]);
+            if (!pgt) {
+                A3_LOG("INVALID... [%u]\n", static_cast<unsigned>(slot->u32[1]));
+                return -EINVAL;
+            }
+            return pv_mirror(pgt, slot->u64[1]);
+        }
+        return 0;
+
     default:
         return -EINVAL;
     }
@@ -355,7 +435,11 @@ void context::write_bar4(const command& cmd) {
             // lookup slot
             slot_t* slot = reinterpret_cast<slot_t*>(guest_ + NOUVEAU_PV_SLOT_SIZE * pos);
             // result code
+            const uint32_t op = slot->u8[0];
+            timer_t timer;
+            timer.start();
             slot->u32[0] = a3_call(cmd, slot);
+            instruments()->metrics()->hypercall(op)->latency.observe(timer.elapsed());
         }
         break;
     }
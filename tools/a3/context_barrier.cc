@@ -46,9 +46,7 @@ void context::write_barrier(uint64_t addr, const command& cmd) {
         for (iter_t it = range.first; it != range.second; ++it) {
             A3_LOG("write reflect shadow 0x%" PRIX64 " : rest 0x%" PRIX64 "\n", it->second->shadow_ramin()->address(), rest);
             if (cmd.value) {
-                if (a3::flags::lazy_shadowing) {
-                    it->second->flush(this);
-                }
+                it->second->flush_deferred(this);
             }
             it->second->shadow_ramin()->write(rest, cmd.value, cmd.size());
         }
@@ -0,0 +1,275 @@
+/*
+ * A3 context checkpoint
+ *
+ * Copyright (c) 2012-2013 Yusuke Suzuki
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <cstdint>
+#include <cstring>
+#include <cinttypes>
+#include "a3.h"
+#include "lock.h"
+#include "context.h"
+#include "checkpoint.h"
+#include "device.h"
+#include "bit_mask.h"
+namespace a3 {
+
+static const std::size_t kBLOCK_CHUNKS = 64;  // 8MB of the stream per block
+
+static void append(std::vector<uint8_t>* out, uint32_t tag, uint64_t index, const void* data, uint32_t size) {
+    const checkpoint_record_t record = { tag, size, index };
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&record);
+    out->insert(out->end(), bytes, bytes + sizeof(record));
+    if (size) {
+        bytes = static_cast<const uint8_t*>(data);
+        out->insert(out->end(), bytes, bytes + size);
+    }
+}
+
+// Handled with the residency mutex held, so trapped writes and blocks of the
+// stream do not interleave.
+uint32_t context::checkpoint(uint32_t op, std::vector<uint8_t>* out) {
+    mutex_t::scoped_lock residency(residency_mutex_);
+    if (evicted_) {
+        restore();
+    }
+    out->clear();
+
+    if (!initialized_ || para_virtualized()) {
+        // PV page tables hold host addresses the guest has seen
+        A3_LOG("GPU id %u cannot be checkpointed\n", id());
+        return command::kCHECKPOINT_FAILED;
+    }
+
+    switch (op) {
+    case command::CHECKPOINT_START:
+        dirty_.reset(new dirty_tracker_t(vram_size() / kVRAM_CHUNK_SIZE));
+        submitted_ = false;
+        A3_LOG("GPU id %u checkpoint started\n", id());
+        return dirty_->count();
+
+    case command::CHECKPOINT_ROUND:
+    case command::CHECKPOINT_FINISH: {
+            if (!dirty_) {
+                return command::kCHECKPOINT_FAILED;
+            }
+            if (dirty_->take_header()) {
+                const checkpoint_header_t header = {
+                    checkpoint_header_t::kMAGIC,
+                    checkpoint_header_t::kVERSION,
+                    vram_size(),
+                    domain_channels(),
+                    0
+                };
+                append(out, checkpoint_record_t::HEADER, 0, &header, sizeof(header));
+            }
+            if (op == command::CHECKPOINT_FINISH && !dirty_->frozen()) {
+                // the guest is paused, but commands it submitted since the
+                // last block may have written anywhere
+                if (submitted_.exchange(false)) {
+                    dirty_->mark_all();
+                }
+                dirty_->freeze();
+            }
+            checkpoint_chunks(out);
+            const uint32_t left = dirty_->count();
+            if (op == command::CHECKPOINT_FINISH && left == 0) {
+                checkpoint_state(out);
+                dirty_.reset();
+                A3_LOG("GPU id %u checkpoint finished\n", id());
+            }
+            return left;
+        }
+    }
+    return command::kCHECKPOINT_FAILED;
+}
+
+void context::checkpoint_chunks(std::vector<uint8_t>* out) {
+    if (submitted_.exchange(false)) {
+        dirty_->mark_all();
+    }
+
+    std::vector<uint64_t> indices;
+    dirty_->take(kBLOCK_CHUNKS, &indices);
+    std::unique_ptr<uint32_t[]> data(new uint32_t[kVRAM_CHUNK_SIZE / sizeof(uint32_t)]);
+    for (const uint64_t index : indices) {
+        const uint64_t address = vram()->lookup(index);
+        if (address == UINT64_MAX) {
+            // not backed yet, so zero filled on both sides
+            continue;
+        }
+        device()->read_pmem_block(address, data.get(), kVRAM_CHUNK_SIZE);
+        if (is_zero_chunk(data.get())) {
+            append(out, checkpoint_record_t::ZERO, index, nullptr, 0);
+        } else {
+            append(out, checkpoint_record_t::CHUNK, index, data.get(), kVRAM_CHUNK_SIZE);
+        }
+    }
+}
+
+void context::checkpoint_state(std::vector<uint8_t>* out) {
+    std::vector<uint32_t> registers;
+    for (uint32_t i = 0, iz = A3_BAR0_SIZE / sizeof(uint32_t); i < iz; ++i) {
+        if (reg32_[i]) {
+            registers.push_back(i * sizeof(uint32_t));
+            registers.push_back(reg32_[i]);
+        }
+    }
+    append(out, checkpoint_record_t::REGISTERS, 0, registers.data(), registers.size() * sizeof(uint32_t));
+
+    for (std::size_t i = 0, iz = channels_.size(); i < iz; ++i) {
+        if (channels_[i]->enabled()) {
+            const uint64_t virt = get_virt_address(channels_[i]->ramin_address());
+            append(out, checkpoint_record_t::RAMIN, i, &virt, sizeof(virt));
+        }
+    }
+    if (bar1_channel()->enabled()) {
+        const uint64_t virt = get_virt_address(bar1_channel()->ramin_address());
+        append(out, checkpoint_record_t::RAMIN, channels_.size(), &virt, sizeof(virt));
+    }
+    if (bar3_channel()->enabled()) {
+        const uint64_t virt = get_virt_address(bar3_channel()->ramin_address());
+        append(out, checkpoint_record_t::RAMIN, channels_.size() + 1, &virt, sizeof(virt));
+    }
+
+    append(out, checkpoint_record_t::END, 0, nullptr, 0);
+}
+
+// Blocks come in the order they were saved. Only VRAM and the register file
+// are written here, shadows are built on the first command the guest issues
+// after resuming, see restore.
+bool context::load_checkpoint(const std::vector<uint8_t>& in) {
+    mutex_t::scoped_lock residency(residency_mutex_);
+    if (!initialized_ || para_virtualized() || dirty_) {
+        A3_LOG("GPU id %u cannot load checkpoint\n", id());
+        return false;
+    }
+
+    std::size_t offset = 0;
+    while (offset < in.size()) {
+        checkpoint_record_t record;
+        if (in.size() - offset < sizeof(record)) {
+            A3_LOG("GPU id %u checkpoint record is truncated\n", id());
+            return false;
+        }
+        std::memcpy(&record, in.data() + offset, sizeof(record));
+        offset += sizeof(record);
+        if (in.size() - offset < record.size) {
+            A3_LOG("GPU id %u checkpoint record is truncated\n", id());
+            return false;
+        }
+        if (!load_record(record, in.data() + offset)) {
+            return false;
+        }
+        offset += record.size;
+    }
+    return true;
+}
+
+bool context::load_record(const checkpoint_record_t& record, const uint8_t* payload) {
+    if (!loading_ && record.tag != checkpoint_record_t::HEADER) {
+        A3_LOG("GPU id %u checkpoint does not start with header\n", id());
+        return false;
+    }
+
+    switch (record.tag) {
+    case checkpoint_record_t::HEADER: {
+            checkpoint_header_t header;
+            if (record.size != sizeof(header)) {
+                return false;
+            }
+            std::memcpy(&header, payload, sizeof(header));
+            if (header.magic != checkpoint_header_t::kMAGIC ||
+                header.version != checkpoint_header_t::kVERSION ||
+                header.memory_size != vram_size() ||
+                header.channels != domain_channels()) {
+                A3_LOG("GPU id %u checkpoint does not fit the slot\n", id());
+                return false;
+            }
+            loading_ = true;
+            swapped_ramins_.assign(channels_.size() + 2, kRAMIN_NONE);
+            return true;
+        }
+
+    case checkpoint_record_t::CHUNK:
+    case checkpoint_record_t::ZERO: {
+            const bool zero = record.tag == checkpoint_record_t::ZERO;
+            if (record.index >= vram_size() / kVRAM_CHUNK_SIZE || record.size != (zero ? 0 : kVRAM_CHUNK_SIZE)) {
+                return false;
+            }
+            const uint64_t address = get_phys_address(record.index * kVRAM_CHUNK_SIZE);
+            if (address == UINT64_MAX) {
+                A3_LOG("GPU id %u VRAM exhausted while loading checkpoint\n", id());
+                return false;
+            }
+            if (zero) {
+                device()->clear_pmem(address, kVRAM_CHUNK_SIZE);
+            } else {
+                device()->write_pmem_block(address, reinterpret_cast<const uint32_t*>(payload), kVRAM_CHUNK_SIZE);
+            }
+            return true;
+        }
+
+    case checkpoint_record_t::REGISTERS: {
+            if (record.size % (sizeof(uint32_t) * 2)) {
+                return false;
+            }
+            for (uint32_t i = 0; i < record.size; i += sizeof(uint32_t) * 2) {
+                uint32_t pair[2];
+                std::memcpy(pair, payload + i, sizeof(pair));
+                if (pair[0] < A3_BAR0_SIZE) {
+                    reg32(pair[0]) = pair[1];
+                }
+            }
+            return true;
+        }
+
+    case checkpoint_record_t::RAMIN:
+        if (record.index >= swapped_ramins_.size() || record.size != sizeof(uint64_t)) {
+            return false;
+        }
+        std::memcpy(&swapped_ramins_[record.index], payload, sizeof(uint64_t));
+        return true;
+
+    case checkpoint_record_t::END:
+        // comes up like an evicted context whose chunks are already back
+        loading_ = false;
+        poll_area_.set_area(bit_mask<28, uint64_t>(reg32(0x2254)) << 12);
+        moved_ = true;
+        replay_ = true;
+        evicted_ = true;
+        A3_LOG("GPU id %u checkpoint loaded\n", id());
+        return true;
+    }
+    return false;
+}
+
+// Hardware state the guest set up before it was saved, applied after the
+// shadows are built.
+void context::replay() {
+    if (reg32(0x2274)) {
+        playlist_update(reg32(0x2270), reg32(0x2274));
+    }
+    A3_LOG("GPU id %u replayed playlist\n", id());
+}
+
+}  // namespace a3
+/* vim: set sw=4 ts=4 et tw=80 : */
@@ -24,68 +24,30 @@
 #include "a3.h"
 #include "lock.h"
 #include "context.h"
+#include "device.h"
+#include "chipset_traits.h"
 namespace a3 {
 
-bool context::enqueue(const command& cmd) {
-    A3_SYNCHRONIZED(band_mutex()) {
-        const bool ret = suspended_.empty();
-        suspended_.push(cmd);
-        return ret;
+void context::fire(const command& cmd) {
+    // the GPU may write the whole partition, checkpoint sends it again
+    submitted_.store(true, std::memory_order_relaxed);
+    A3_SYNCHRONIZED(device()->mutex()) {
+        device()->dispatch()->submit(this, cmd);
     }
-    return false;
 }
 
-bool context::dequeue(command* cmd) {
-    A3_SYNCHRONIZED(band_mutex()) {
-        if (suspended_.empty()) {
-            return false;
-        }
-        *cmd = suspended_.front();
-        suspended_.pop();
-        return true;
-    }
-    return false;
-}
-
-bool context::is_suspended() {
-    A3_SYNCHRONIZED(band_mutex()) {
-        return !suspended_.empty();
-    }
-    return false;
-}
-
-
-void context::update_budget(const duration_t& credit) {
-    budget_ -= credit;
-    bandwidth_used_ += credit;
-    sampling_bandwidth_used_ += credit;
-    sampling_bandwidth_used_100_ += credit;
+bool context::is_active() {
+    return device()->is_active(this);
 }
 
-void context::replenish(const duration_t& credit, const duration_t& threshold, const duration_t& bandwidth, bool idle) {
-    A3_SYNCHRONIZED(band_mutex()) {
-        budget_ += credit;
-
-        if (idle && budget_ >= bandwidth) {
-            budget_ = bandwidth;
-        } else {
-            if (budget_ > threshold) {
-                budget_ = bandwidth; // boost::posix_time::microseconds(0);
-            }
-
-            if (budget_ < (-threshold)) {
-                budget_ =  boost::posix_time::microseconds(0);
-            }
-        }
-        bandwidth_used_ = boost::posix_time::microseconds(0);
-    }
+void context::on_dequeue(const duration_t& waited) {
+    instruments()->metrics()->suspended.observe(waited);
 }
 
-void context::clear_sampling_bandwidth_used(uint64_t point) {
-    if (point % 5 == 4) {
-        sampling_bandwidth_used_ = boost::posix_time::microseconds(0);
+void context::on_update_budget(const duration_t& credit) {
+    if (credit > microseconds(0)) {
+        instruments()->metrics()->gpu_busy.increment(credit.total_microseconds());
     }
-    sampling_bandwidth_used_100_ = boost::posix_time::microseconds(0);
 }
 
 }  // namespace a3
@@ -0,0 +1,205 @@
+/*
+ * A3 Context swap
+ *
+ * Copyright (c) 2012-2013 Yusuke Suzuki
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <cstdint>
+#include <cinttypes>
+#include "a3.h"
+#include "lock.h"
+#include "context.h"
+#include "device.h"
+#include "device_bar1.h"
+#include "device_bar3.h"
+#include "flags.h"
+#include "scrubber.h"
+#include "timer.h"
+namespace a3 {
+
+const uint64_t context::kRAMIN_NONE;
+
+bool context::evictable() const {
+    // PV page tables hold host addresses the guest has seen. Checkpointed
+    // contexts are copied out, so they stay resident.
+    return initialized_ && !para_virtualized() && vram()->dynamic() && !evicted_ && !dirty_;
+}
+
+// Pages out the guest VRAM to host memory. Host chunks are scrubbed and
+// returned to the pool, so that other contexts can use them. The channels
+// stay in the playlist, the context is idle and has nothing to run.
+void context::evict() {
+    ASSERT(evictable());
+
+    // host addresses of channel RAMINs may change when restored
+    swapped_ramins_.assign(channels_.size() + 2, kRAMIN_NONE);
+    for (std::size_t i = 0, iz = channels_.size(); i < iz; ++i) {
+        if (channels_[i]->enabled()) {
+            swapped_ramins_[i] = get_virt_address(channels_[i]->ramin_address());
+        }
+    }
+    if (bar1_channel()->enabled()) {
+        swapped_ramins_[channels_.size()] = get_virt_address(bar1_channel()->ramin_address());
+    }
+    if (bar3_channel()->enabled()) {
+        swapped_ramins_[channels_.size() + 1] = get_virt_address(bar3_channel()->ramin_address());
+    }
+
+    // With --bar3-remapping the guest reaches its BAR3 arena through Xen
+    // mappings without trapping. They are removed before the chunks behind
+    // them go to other contexts, so BAR3 accesses trap and restore first.
+    if (flags::bar3_remapping) {
+        A3_SYNCHRONIZED(device()->mutex()) {
+            device()->bar3()->unmap_xen_page_batch(this, 0, bar3_arena_size() / kPAGE_SIZE);
+        }
+    }
+
+    vram_partition_t* pool = device()->vram_partition();
+    uint64_t bytes = 0;
+    uint64_t zeros = 0;
+    for (uint64_t index = 0, iz = vram()->chunks(); index < iz; ++index) {
+        const uint32_t chunk = vram()->unmap(index);
+        if (chunk == kVRAM_CHUNK_INVALID) {
+            continue;
+        }
+        const uint64_t address = vram()->host_address(chunk);
+        swapped_chunk_t swapped = { index, chunk, std::unique_ptr<uint32_t[]>(new uint32_t[kVRAM_CHUNK_SIZE / sizeof(uint32_t)]) };
+        device()->read_pmem_block(address, swapped.data.get(), kVRAM_CHUNK_SIZE);
+        if (is_zero_chunk(swapped.data.get())) {
+            swapped.data.reset();
+            ++zeros;
+        } else {
+            bytes += kVRAM_CHUNK_SIZE;
+        }
+        device()->scrubber()->scrub(address, kVRAM_CHUNK_SIZE, [pool, chunk] {
+            pool->release(chunk);
+        });
+        swapped_.push_back(std::move(swapped));
+    }
+
+    swapped_bytes_ = bytes;
+    evicted_ = true;
+    instruments()->metrics()->evictions.increment();
+    instruments()->metrics()->swapped_out.increment(bytes);
+    A3_LOG("GPU id %u evicted %" PRIu64 " chunks, %" PRIu64 " zero filled\n", id(), static_cast<uint64_t>(swapped_.size()), zeros);
+}
+
+// Called on the first command after eviction, before it is handled. So a
+// doorbell reaches the scheduler after VRAM is back. A loaded checkpoint
+// comes up evicted with nothing swapped, so its shadows are built here too.
+void context::restore() {
+    timer_t timer;
+    timer.start();
+
+    uint64_t bytes = 0;
+    std::size_t restored = 0;
+    for (std::size_t iz = swapped_.size(); restored < iz; ++restored) {
+        const swapped_chunk_t& swapped = swapped_[restored];
+        const uint32_t chunk = vram()->map(swapped.index, swapped.chunk);
+        if (chunk == kVRAM_CHUNK_INVALID) {
+            break;
+        }
+        moved_ |= chunk != swapped.chunk;
+        const uint64_t address = vram()->host_address(chunk);
+        if (swapped.data) {
+            device()->write_pmem_block(address, swapped.data.get(), kVRAM_CHUNK_SIZE);
+            bytes += kVRAM_CHUNK_SIZE;
+        } else {
+            device()->clear_pmem(address, kVRAM_CHUNK_SIZE);
+        }
+    }
+    swapped_.erase(swapped_.begin(), swapped_.begin() + restored);
+    swapped_bytes_ -= bytes;
+    instruments()->metrics()->swapped_in.increment(bytes);
+
+    if (!swapped_.empty()) {
+        // retried on the next command
+        A3_LOG("GPU id %u VRAM exhausted, %" PRIu64 " chunks left evicted\n", id(), static_cast<uint64_t>(swapped_.size()));
+        return;
+    }
+
+    evicted_ = false;
+    if (moved_) {
+        rebase();
+        moved_ = false;
+    }
+    if (replay_) {
+        replay();
+        replay_ = false;
+    }
+    if (flags::bar3_remapping && bar3_channel()->enabled()) {
+        // maps the BAR3 arena to the guest again
+        A3_SYNCHRONIZED(device()->mutex()) {
+            device()->bar3()->shadow(this, bar3_channel()->page_directory_address());
+            device()->bar3()->flush();
+        }
+    }
+    instruments()->metrics()->restores.increment();
+    instruments()->metrics()->restoring.observe(timer.elapsed());
+    A3_LOG("GPU id %u restored\n", id());
+}
+
+// Some chunks came back to other host chunks. Shadows derived from the host
+// addresses are built again.
+void context::rebase() {
+    for (std::size_t i = 0, iz = channels_.size(); i < iz; ++i) {
+        if (swapped_ramins_[i] == kRAMIN_NONE) {
+            continue;
+        }
+        const uint64_t phys = get_phys_address(swapped_ramins_[i]);
+        if (phys != channels_[i]->ramin_address()) {
+            channels_[i]->refresh(this, phys);
+        } else {
+            channels_[i]->shadow(this);
+        }
+    }
+
+    if (swapped_ramins_[channels_.size()] != kRAMIN_NONE) {
+        const uint64_t phys = get_phys_address(swapped_ramins_[channels_.size()]);
+        if (phys != bar1_channel()->ramin_address()) {
+            bar1_channel()->refresh(this, phys);
+        } else {
+            bar1_channel()->shadow(this);
+        }
+        A3_SYNCHRONIZED(device()->mutex()) {
+            device()->bar1()->refresh();
+        }
+    }
+
+    if (swapped_ramins_[channels_.size() + 1] != kRAMIN_NONE) {
+        const uint64_t phys = get_phys_address(swapped_ramins_[channels_.size() + 1]);
+        if (phys != bar3_channel()->ramin_address()) {
+            bar3_channel()->refresh(this, phys);
+        } else {
+            bar3_channel()->shadow(this);
+        }
+        A3_SYNCHRONIZED(device()->mutex()) {
+            device()->bar3()->refresh();
+        }
+    }
+
+    A3_SYNCHRONIZED(device()->mutex()) {
+        device()->bar1()->refresh_poll_area();
+    }
+    A3_LOG("GPU id %u rebased shadows\n", id());
+}
+
+}  // namespace a3
+/* vim: set sw=4 ts=4 et tw=80 : */
@@ -23,9 +23,6 @@
  */
 #include <cstdint>
 #include "a3.h"
-#include "context.h"
-#include "device.h"
-#include "device_bar1.h"
 #include "credit_scheduler.h"
 namespace a3 {
 
@@ -66,7 +63,7 @@ void credit_scheduler_t::stop() {
     }
 }
 
-void credit_scheduler_t::enqueue(context* ctx, const command& cmd) {
+void credit_scheduler_t::enqueue(sched_entity_t* ctx, const command& cmd) {
     // on arrival
     ctx->enqueue(cmd);
     A3_SYNCHRONIZED(counter_mutex_) {
@@ -75,84 +72,86 @@ void credit_scheduler_t::enqueue(context* ctx, const command& cmd) {
     }
 }
 
+void credit_scheduler_t::on_unregister_context(sched_entity_t* ctx) {
+    if (current_ == ctx) {
+        current_ = nullptr;
+    }
+    const std::size_t discarded = ctx->discard();
+    A3_SYNCHRONIZED(counter_mutex_) {
+        counter_ -= discarded;
+    }
+}
+
 void credit_scheduler_t::replenish() {
-    // uint64_t count = 0;
     while (true) {
-        // replenish
-        A3_SYNCHRONIZED(sched_mutex()) {
-            if (!contexts().empty()) {
-                A3_SYNCHRONIZED(fire_mutex()) {
-                    duration_t period = bandwidth_ + gpu_idle_;
-                    duration_t defaults = period_ / contexts().size();
-                    previous_bandwidth_ = period;
-                    // duration_t period = bandwidth_;
-                    if (period != boost::posix_time::microseconds(0)) {
-                        const auto budget = period / contexts().size();
-                        for (context& ctx : contexts()) {
-                            ctx.replenish(budget, budget * 2, defaults, bandwidth_ == boost::posix_time::microseconds(0));
-                        }
-                        // ++count;
+        replenish_once();
+        clock()->sleep(period_);
+        clock()->yield();
+    }
+}
+
+void credit_scheduler_t::replenish_once() {
+    A3_SYNCHRONIZED(sched_mutex()) {
+        if (!contexts().empty()) {
+            A3_SYNCHRONIZED(fire_mutex()) {
+                duration_t period = bandwidth_ + gpu_idle_;
+                duration_t defaults = period_ / contexts().size();
+                previous_bandwidth_ = period;
+                // duration_t period = bandwidth_;
+                if (period != microseconds(0)) {
+                    const auto budget = period / contexts().size();
+                    for (sched_entity_t& ctx : contexts()) {
+                        ctx.replenish(budget, budget * 2, defaults, bandwidth_ == microseconds(0));
                     }
-                    bandwidth_ = boost::posix_time::microseconds(0);
-                    gpu_idle_ = boost::posix_time::microseconds(0);
+                    // ++count;
                 }
+                bandwidth_ = microseconds(0);
+                gpu_idle_ = microseconds(0);
             }
         }
-        boost::this_thread::sleep(period_);
-        boost::this_thread::yield();
     }
 }
 
-context* credit_scheduler_t::select_next_context(bool idle) {
-    A3_SYNCHRONIZED(sched_mutex()) {
-        if (idle) {
-            gpu_idle_ += gpu_idle_timer_.elapsed();
-        }
+sched_entity_t* credit_scheduler_t::select_next_context(bool idle) {
+    if (idle) {
+        gpu_idle_ += gpu_idle_timer_.elapsed();
+    }
 
-        if (current()) {
-            // lowering priority
-            context* ctx = current();
-            if (ctx->budget() < boost::posix_time::microseconds(0)) {
-                contexts().erase(contexts_t::s_iterator_to(*ctx));
-                contexts().push_back(*ctx);
-            }
+    if (current()) {
+        // lowering priority
+        sched_entity_t* ctx = current();
+        if (ctx->budget() < microseconds(0)) {
+            contexts().erase(contexts_t::s_iterator_to(*ctx));
+            contexts().push_back(*ctx);
         }
+    }
 
-        for (context& ctx : contexts()) {
-            if (ctx.is_suspended()) {
-                return &ctx;
-            }
+    for (sched_entity_t& ctx : contexts()) {
+        if (ctx.is_suspended()) {
+            return &ctx;
         }
     }
     return nullptr;
 }
 
-void credit_scheduler_t::submit(context* ctx) {
-    A3_SYNCHRONIZED(fire_mutex()) {
-        command cmd;
-
-        ctx->dequeue(&cmd);
+void credit_scheduler_t::submit(sched_entity_t* ctx, const command& cmd) {
+    utilization_.start(clock());
+    ctx->fire(cmd);
 
-        utilization_.start();
-        A3_SYNCHRONIZED(device()->mutex()) {
-            device()->bar1()->write(ctx, cmd);
-        }
-
-        while (device()->is_active(ctx)) {
-            boost::this_thread::yield();
-        }
-
-        const auto duration = utilization_.elapsed();
-        bandwidth_ += duration;
-        sampler_->add(duration);
-        ctx->update_budget(duration);
+    while (ctx->is_active()) {
+        clock()->yield();
     }
+
+    const auto duration = utilization_.elapsed();
+    bandwidth_ += duration;
+    sampler_->add(duration);
+    ctx->update_budget(duration);
 }
 
 void credit_scheduler_t::run() {
+    gpu_idle_timer_.start(clock());
     while (true) {
         bool idle = false;
-        gpu_idle_timer_.start();
         {
             boost::unique_lock<boost::mutex> lock(counter_mutex_);
             while (!counter_) {
@@ -161,13 +160,37 @@ void credit_scheduler_t::run() {
                 cond_.wait(lock);
             }
         }
-        if ((current_ = select_next_context(idle))) {
-            A3_SYNCHRONIZED(counter_mutex_) {
-                counter_ -= 1;
-            }
-            submit(current());
+        dispatch(idle);
+    }
+}
+
+bool credit_scheduler_t::has_pending() {
+    A3_SYNCHRONIZED(counter_mutex_) {
+        return counter_ != 0;
+    }
+    return false;
+}
+
+void credit_scheduler_t::dispatch(bool idle) {
+    // Both mutexes are taken in the order unregister_context takes them.
+    // The command is dequeued before sched_mutex is dropped, so discard()
+    // does not count it again, and fire_mutex is kept until it completes,
+    // so the context is not unregistered under submit().
+    boost::unique_lock<boost::mutex> sched(sched_mutex());
+    boost::unique_lock<boost::mutex> fire(fire_mutex());
+    command cmd;
+    if ((current_ = select_next_context(idle)) && current()->dequeue(&cmd)) {
+        A3_SYNCHRONIZED(counter_mutex_) {
+            counter_ -= 1;
         }
+        sched.unlock();
+        submit(current(), cmd);
     }
+    gpu_idle_timer_.start(clock());
+}
+
+void credit_scheduler_t::sample_once() {
+    sampler_->sample();
 }
 
 }  // namespace a3
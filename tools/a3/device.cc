@@ -36,6 +36,7 @@
 #include "mmio.h"
 #include "context.h"
 #include "playlist.h"
+#include "chipset_traits.h"
 #include "registers.h"
 #include "device_bar1.h"
 #include "device_bar3.h"
@@ -46,6 +47,11 @@
 #include "credit_scheduler.h"
 #include "direct_scheduler.h"
 #include "assertion.h"
+#include "partition.h"
+#include "vram_partition.h"
+#include "page_pool.h"
+#include "scrubber.h"
+#include "evictor.h"
 
 #define NVC0_VENDOR 0x10DE
 #define NVC0_DEVICE 0x6D8
@@ -68,17 +74,22 @@ static inline unsigned int pcidev_encode_bdf(libxl_device_pci *pcidev) {
 
 device_t::device_t()
     : device_()
-    , virts_(A3_VM_NUM, -1)
-    , contexts_(A3_VM_NUM, nullptr)
+    , virts_()
+    , contexts_()
     , mutex_()
     , pmem_()
     , bars_()
     , bar1_()
     , bar3_()
     , vram_()
+    , vram_partition_()
+    , page_pool_()
+    , scrubber_()
     , playlist_()
     , scheduler_()
     , chipset_()
+    , dispatch_()
+    , evictor_()
     , domid_(-1)
     , xl_ctx_()
     , xl_logger_()
@@ -171,11 +182,24 @@ void device_t::initialize(const bdf& bdf) {
 
     A3_LOG("PCI device catch\n");
 
+    // init virtualized GPU slots, partition is configured before
+    virts_.resize(partition_t::vms(), true);
+    contexts_.resize(partition_t::vms(), nullptr);
+    partition_t::dump();
+
     // init chipset
     chipset_.reset(new chipset_t(read(0, 0x0000, sizeof(uint32_t))));
+    dispatch_.reset(create_chipset_dispatch(chipset_->type()));
 
     // init vram
     vram_.reset(new vram_manager_t(A3_HYPERVISOR_DEVICE_MEM_BASE, A3_HYPERVISOR_DEVICE_MEM_SIZE));
+    if (flags::dynamic_vram) {
+        vram_partition_.reset(new vram_partition_t(0, A3_GUEST_MEMORY_TOTAL));
+    }
+    scrubber_.reset(new scrubber_t());
+    scrubber_->start();
+    page_pool_.reset(new page_pool_t());
+    page_pool_->start();
 
     // init bar1 device
     bar1_.reset(new device_bar1(bars_[1]));
@@ -197,11 +221,7 @@ void device_t::initialize(const bdf& bdf) {
     }
 
     // init playlist
-    if (device()->chipset()->type() == card::NVC0) {
-        playlist_.reset(new nvc0_playlist_t());
-    } else {
-        playlist_.reset(new nve0_playlist_t());
-    }
+    playlist_.reset(dispatch_->create_playlist());
 
     // init pmem
     pmem_ = read(0, 0x1700, sizeof(uint32_t));
@@ -211,35 +231,58 @@ void device_t::initialize(const bdf& bdf) {
     // Direct
     // scheduler_.reset(new direct_scheduler_t());
     // FIFO
-    // scheduler_.reset(new fifo_scheduler_t(boost::posix_time::microseconds(50), boost::posix_time::milliseconds(500), boost::posix_time::milliseconds(100)));
-    // scheduler_.reset(new fifo_scheduler_t(boost::posix_time::microseconds(50), boost::posix_time::milliseconds(500), boost::posix_time::milliseconds(500)));
+    // scheduler_.reset(new fifo_scheduler_t(microseconds(50), milliseconds(500), milliseconds(100)));
+    // scheduler_.reset(new fifo_scheduler_t(microseconds(50), milliseconds(500), milliseconds(500)));
     // BAND
-    // scheduler_.reset(new band_scheduler_t(boost::posix_time::microseconds(50), boost::posix_time::milliseconds(500)));
-    // scheduler_.reset(new band_scheduler_t(boost::posix_time::microseconds(50), boost::posix_time::milliseconds(100)));
+    // scheduler_.reset(new band_scheduler_t(microseconds(50), milliseconds(500)));
+    // scheduler_.reset(new band_scheduler_t(microseconds(50), milliseconds(100)));
     // Credit
-    // scheduler_.reset(new credit_scheduler_t(boost::posix_time::microseconds(50), boost::posix_time::milliseconds(500)));
-    scheduler_.reset(new credit_scheduler_t(boost::posix_time::microseconds(50), boost::posix_time::milliseconds(100)));
+    // scheduler_.reset(new credit_scheduler_t(microseconds(50), milliseconds(500)));
+    scheduler_.reset(new credit_scheduler_t(microseconds(50), milliseconds(100)));
     scheduler_->start();
 
+    // init evictor
+    if (flags::evict_idle) {
+        evictor_.reset(new evictor_t(milliseconds(flags::evict_idle)));
+        evictor_->start();
+    }
+
     A3_LOG("NV%02X device initialized\n", chipset()->detail());
 }
 
 uint32_t device_t::acquire_virt(context* ctx) {
     mutex_t::scoped_lock lock(mutex());
     const boost::dynamic_bitset<>::size_type pos = virts_.find_first();
-    if (pos != virts_.npos) {
-        virts_.set(pos, 0);
-        contexts_[pos] = ctx;
+    if (pos == virts_.npos) {
+        return UINT32_MAX;
     }
+    virts_.set(pos, 0);
+    contexts_[pos] = ctx;
     scheduler_->register_context(ctx);
     return pos;
 }
 
 void device_t::release_virt(uint32_t virt, context* ctx) {
-    mutex_t::scoped_lock lock(mutex());
-    virts_.set(virt, 1);
+    // unregistering waits for the submission in flight, which takes the
+    // device mutex to fire
     scheduler_->unregister_context(ctx);
-    contexts_[virt] = nullptr;
+    A3_SYNCHRONIZED(mutex()) {
+        contexts_[virt] = nullptr;
+        bar3()->release(ctx);
+    }
+
+    // the slot is reused after the guest VRAM slab is scrubbed. With dynamic
+    // VRAM, chunks are scrubbed one by one when the mapping is released.
+    const partition_slot_t& slot = partition_t::slot(virt);
+    if (!flags::dynamic_vram) {
+        scrubber_->scrub(slot.memory_base, slot.memory_size, scrubber_t::callback_t());
+    }
+    scrubber_->post([this, virt] {
+        A3_SYNCHRONIZED(mutex()) {
+            virts_.set(virt, 1);
+        }
+        A3_LOG("GPU id %u scrubbed\n", virt);
+    });
 }
 
 uint32_t device_t::read(int bar, uint32_t offset, std::size_t size) {
@@ -288,13 +331,12 @@ bool device_t::is_active(context* ctx) {
 }
 
 void device_t::fire(context* ctx, const command& cmd) {
-    scheduler_->enqueue(ctx, cmd);
+    scheduler_->doorbell(ctx, cmd);
 }
 
-void device_t::playlist_update(context* ctx, uint32_t address, uint32_t cmd) {
-    A3_SYNCHRONIZED(mutex()) {
-        playlist_->update(ctx, address, cmd);
-    }
+// playlist takes the device mutex only to write the committed runlist
+void device_t::playlist_update(context* ctx, uint64_t address, uint32_t cmd) {
+    playlist_->update(ctx, address, cmd);
 }
 
 uint32_t device_t::read_pmem(uint64_t addr, std::size_t size) {
@@ -322,6 +364,56 @@ void device_t::write_pmem(uint64_t addr, uint32_t val, std::size_t size) {
     }
 }
 
+template<typename Func>
+void device_t::for_each_pmem_window(uint64_t addr, uint64_t size, Func func) {
+    ASSERT((addr % sizeof(uint32_t)) == 0 && (size % sizeof(uint32_t)) == 0);
+    const uint64_t end = addr + size;
+    while (addr < end) {
+        // PRAMIN window is 1MB, so the window register is touched once per
+        // window instead of checked per word
+        const uint64_t window_end = (addr | 0x000000fffffULL) + 1;
+        const uint64_t last = (window_end < end) ? window_end : end;
+        A3_SYNCHRONIZED(mutex()) {
+            const uint64_t shifted = ((addr & 0xffffff00000ULL) >> 16);
+            if (shifted != pmem_) {
+                // change pmem
+                pmem_ = shifted;
+                write(0, 0x1700, shifted, sizeof(uint32_t));
+            }
+            func(0x700000 + (addr & 0x000000fffffULL), addr, last - addr);
+        }
+        addr = last;
+    }
+}
+
+void device_t::clear_pmem(uint64_t addr, uint64_t size) {
+    for_each_pmem_window(addr, size, [this](uint64_t offset, uint64_t, uint64_t size) {
+        for (const uint64_t end = offset + size; offset < end; offset += sizeof(uint32_t)) {
+            mmio::write32(bars_[0].addr, offset, 0);
+        }
+    });
+}
+
+void device_t::read_pmem_block(uint64_t addr, uint32_t* data, uint64_t size) {
+    const uint64_t base = addr;
+    for_each_pmem_window(addr, size, [this, base, data](uint64_t offset, uint64_t addr, uint64_t size) {
+        uint32_t* out = data + (addr - base) / sizeof(uint32_t);
+        for (const uint64_t end = offset + size; offset < end; offset += sizeof(uint32_t)) {
+            *out++ = mmio::read32(bars_[0].addr, offset);
+        }
+    });
+}
+
+void device_t::write_pmem_block(uint64_t addr, const uint32_t* data, uint64_t size) {
+    const uint64_t base = addr;
+    for_each_pmem_window(addr, size, [this, base, data](uint64_t offset, uint64_t addr, uint64_t size) {
+        const uint32_t* in = data + (addr - base) / sizeof(uint32_t);
+        for (const uint64_t end = offset + size; offset < end; offset += sizeof(uint32_t)) {
+            mmio::write32(bars_[0].addr, offset, *in++);
+        }
+    });
+}
+
 device_t* device() {
     return &boost::details::pool::singleton_default<device_t>::instance();
 }
@@ -16,9 +16,14 @@ namespace a3 {
 class device_bar1;
 class device_bar3;
 class vram_manager_t;
+class vram_partition_t;
+class page_pool_t;
+class scrubber_t;
+class evictor_t;
 class vram_t;
 class context;
 class playlist_t;
+class chipset_dispatch_t;
 class scheduler_t;
 
 class device_t : private boost::noncopyable {
@@ -44,6 +49,11 @@ class device_t : private boost::noncopyable {
     void write(int bar, uint32_t offset, uint32_t val, std::size_t size);
     uint32_t read_pmem(uint64_t addr, std::size_t size);
     void write_pmem(uint64_t addr, uint32_t val, std::size_t size);
+    // zero fills [addr, addr + size) of pmem
+    void clear_pmem(uint64_t addr, uint64_t size);
+    // copies [addr, addr + size) of pmem from / to data
+    void read_pmem_block(uint64_t addr, uint32_t* data, uint64_t size);
+    void write_pmem_block(uint64_t addr, const uint32_t* data, uint64_t size);
     uint32_t pmem() const { return pmem_; }
     void set_pmem(uint32_t pmem) { pmem_ = pmem; }
     device_bar1* bar1() { return bar1_.get(); }
@@ -53,18 +63,28 @@ class device_t : private boost::noncopyable {
     vram_t* malloc(std::size_t n);
     void free(vram_t* mem);
     const std::vector<context*>& contexts() const { return contexts_; }
+    vram_partition_t* vram_partition() { return vram_partition_.get(); }
+    page_pool_t* page_pool() { return page_pool_.get(); }
+    scrubber_t* scrubber() { return scrubber_.get(); }
+    scheduler_t* scheduler() { return scheduler_.get(); }
     const chipset_t* chipset() const { return chipset_.get(); }
+    const chipset_dispatch_t* dispatch() const { return dispatch_.get(); }
 
     // VT-d
     int domid() const { return domid_; }
     bool is_active(context* ctx);
     void fire(context* ctx, const command& cmd);
 
-    void playlist_update(context* ctx, uint32_t address, uint32_t cmd);
+    void playlist_update(context* ctx, uint64_t address, uint32_t cmd);
 
     libxl_ctx* xl_ctx() const { return xl_ctx_; }
 
  private:
+    // calls func(BAR0 offset, addr, size) per PRAMIN window, with the window
+    // register set and the device mutex held
+    template<typename Func>
+    void for_each_pmem_window(uint64_t addr, uint64_t size, Func func);
+
     struct pci_device* device_;
     boost::dynamic_bitset<> virts_;
     std::vector<context*> contexts_;
@@ -74,9 +94,14 @@ class device_t : private boost::noncopyable {
     std::unique_ptr<device_bar1> bar1_;
     std::unique_ptr<device_bar3> bar3_;
     std::unique_ptr<vram_manager_t> vram_;
+    std::unique_ptr<vram_partition_t> vram_partition_;
+    std::unique_ptr<page_pool_t> page_pool_;  // released before vram_
+    std::unique_ptr<scrubber_t> scrubber_;    // released before vram_
     std::unique_ptr<playlist_t> playlist_;
     std::unique_ptr<scheduler_t> scheduler_;
     std::unique_ptr<chipset_t> chipset_;
+    std::unique_ptr<chipset_dispatch_t> dispatch_;
+    std::unique_ptr<evictor_t> evictor_;
     int domid_;
 
     // libxl
@@ -24,6 +24,7 @@
 #include <cstdint>
 #include <cinttypes>
 #include "bit_mask.h"
+#include "chipset_traits.h"
 #include "device_table.h"
 #include "pmem.h"
 #include "shadow_page_table.h"
@@ -79,7 +80,7 @@ void device_bar1::refresh_poll_area() {
 
 void device_bar1::shadow(context* ctx) {
     A3_LOG("%" PRIu32 " BAR1 shadowed\n", ctx->id());
-    for (uint32_t vcid = 0; vcid < A3_DOMAIN_CHANNELS; ++vcid) {
+    for (uint32_t vcid = 0; vcid < ctx->domain_channels(); ++vcid) {
         const uint64_t offset = vcid * range_ + ctx->poll_area()->area();
         const uint32_t pcid = ctx->get_phys_channel_id(vcid);
         const uint64_t virt = pcid * range_;
@@ -113,21 +114,23 @@ void device_bar1::flush() {
     }
 }
 
+template<typename Chipset>
 void device_bar1::write(context* ctx, const command& cmd) {
     uint64_t offset = cmd.offset - ctx->poll_area()->area();
-    offset += range_ * ctx->id() * A3_DOMAIN_CHANNELS;
+    offset += Chipset::kCHANNEL_WINDOW * ctx->get_phys_channel_id(0);
     device()->write(1, offset, cmd.value, cmd.size());
 }
 
+template<typename Chipset>
 uint32_t device_bar1::read(context* ctx, const command& cmd) {
     uint64_t offset = cmd.offset - ctx->poll_area()->area();
-    offset += range_ * ctx->id() * A3_DOMAIN_CHANNELS;
+    offset += Chipset::kCHANNEL_WINDOW * ctx->get_phys_channel_id(0);
     return device()->read(1, offset, cmd.size());
 }
 
 void device_bar1::pv_scan(context* ctx) {
     A3_LOG("%" PRIu32 " BAR1 shadowed\n", ctx->id());
-    for (uint32_t vcid = 0; vcid < A3_DOMAIN_CHANNELS; ++vcid) {
+    for (uint32_t vcid = 0; vcid < ctx->domain_channels(); ++vcid) {
         const uint64_t offset = vcid * range_ + ctx->poll_area()->area();
         const uint32_t pcid = ctx->get_phys_channel_id(vcid);
         const uint64_t virt = pcid * range_;
@@ -145,9 +148,15 @@ void device_bar1::pv_reflect_entry(context* ctx, bool big, uint32_t index, uint6
     entry.raw = host;
     if (big) {
     } else {
-        map(((ctx->id() * A3_DOMAIN_CHANNELS) + index) * range_, entry);
+        map(ctx->get_phys_channel_id(index) * range_, entry);
     }
 }
 
+#define V(card, traits)\
+    template void device_bar1::write<traits>(context* ctx, const command& cmd);\
+    template uint32_t device_bar1::read<traits>(context* ctx, const command& cmd);
+A3_CHIPSET_TRAITS_LIST(V)
+#undef V
+
 }  // namespace a3
 /* vim: set sw=4 ts=4 et tw=80 : */
@@ -24,7 +24,9 @@ class device_bar1 : private boost::noncopyable {
     void refresh_poll_area();
     void shadow(context* ctx);
     void flush();
+    template<typename Chipset>
     void write(context* ctx, const command& cmd);
+    template<typename Chipset>
     uint32_t read(context* ctx, const command& cmd);
     void pv_scan(context* ctx);
     void pv_reflect_entry(context* ctx, bool big, uint32_t index, uint64_t entry);
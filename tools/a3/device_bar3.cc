@@ -70,7 +70,7 @@ void device_bar3::refresh() {
 
 void device_bar3::map_xen_page(context* ctx, uint64_t offset) {
     const uint64_t guest = ctx->bar3_address() + offset;
-    const uint64_t host = address() + ctx->id() * A3_BAR3_ARENA_SIZE + offset;
+    const uint64_t host = address() + ctx->bar3_arena_base() + offset;
     // A3_LOG("mapping %" PRIx64 " to %" PRIx64 "\n", guest, host);
     if (a3::flags::bar3_remapping) {
         a3_xen_add_memory_mapping(device()->xl_ctx(), ctx->domid(), guest >> kPAGE_SHIFT, host >> kPAGE_SHIFT, 1);
@@ -79,7 +79,7 @@ void device_bar3::map_xen_page(context* ctx, uint64_t offset) {
 
 void device_bar3::unmap_xen_page(context* ctx, uint64_t offset) {
     const uint64_t guest = ctx->bar3_address() + offset;
-    const uint64_t host = address() + ctx->id() * A3_BAR3_ARENA_SIZE + offset;
+    const uint64_t host = address() + ctx->bar3_arena_base() + offset;
     // A3_LOG("unmapping %" PRIx64 " to %" PRIx64 "\n", guest, host);
     if (a3::flags::bar3_remapping) {
         a3_xen_remove_memory_mapping(device()->xl_ctx(), ctx->domid(), guest >> kPAGE_SHIFT, host >> kPAGE_SHIFT, 1);
@@ -88,7 +88,7 @@ void device_bar3::unmap_xen_page(context* ctx, uint64_t offset) {
 
 void device_bar3::map_xen_page_batch(context* ctx, uint64_t offset, uint32_t count) {
     const uint64_t guest = ctx->bar3_address() + offset;
-    const uint64_t host = address() + ctx->id() * A3_BAR3_ARENA_SIZE + offset;
+    const uint64_t host = address() + ctx->bar3_arena_base() + offset;
     A3_LOG("batch mapping %" PRIx64 " to %" PRIx64 " %" PRIu32 "\n", guest, host, count);
     if (a3::flags::bar3_remapping) {
         a3_xen_add_memory_mapping(device()->xl_ctx(), ctx->domid(), guest >> kPAGE_SHIFT, host >> kPAGE_SHIFT, count);
@@ -97,7 +97,7 @@ void device_bar3::map_xen_page_batch(context* ctx, uint64_t offset, uint32_t cou
 
 void device_bar3::unmap_xen_page_batch(context* ctx, uint64_t offset, uint32_t count) {
     const uint64_t guest = ctx->bar3_address() + offset;
-    const uint64_t host = address() + ctx->id() * A3_BAR3_ARENA_SIZE + offset;
+    const uint64_t host = address() + ctx->bar3_arena_base() + offset;
     A3_LOG("batch unmapping %" PRIx64 " to %" PRIx64 " %" PRIu32 "\n", guest, host, count);
     if (a3::flags::bar3_remapping) {
         a3_xen_remove_memory_mapping(device()->xl_ctx(), ctx->domid(), guest >> kPAGE_SHIFT, host >> kPAGE_SHIFT, count);
@@ -114,11 +114,11 @@ void device_bar3::map(uint64_t index, const struct page_entry& entry) {
 void device_bar3::shadow(context* ctx, uint64_t phys) {
     A3_LOG("%" PRIu32 " BAR3 shadowed\n", ctx->id());
     // At first remove all
-    unmap_xen_page_batch(ctx, 0, A3_BAR3_ARENA_SIZE / 0x1000);
+    unmap_xen_page_batch(ctx, 0, ctx->bar3_arena_size() / 0x1000);
 
     // FIXME(Yusuke Suzuki): optimize it
-    for (uint64_t address = 0; address < A3_BAR3_ARENA_SIZE; address += kPAGE_SIZE) {
-        const uint64_t virt = ctx->id() * A3_BAR3_ARENA_SIZE + address;
+    for (uint64_t address = 0; address < ctx->bar3_arena_size(); address += kPAGE_SIZE) {
+        const uint64_t virt = ctx->bar3_arena_base() + address;
         struct software_page_entry entry;
         const uint64_t gphys = resolve(ctx, address, &entry);
         const uint64_t index = virt / kPAGE_SIZE;
@@ -140,8 +140,8 @@ void device_bar3::shadow(context* ctx, uint64_t phys) {
 }
 
 void device_bar3::reset_barrier(context* ctx, uint64_t old, uint64_t addr, bool old_remap) {
-    const uint64_t shift = ctx->id() * A3_BAR3_ARENA_SIZE / kPAGE_SIZE;
-    for (uint64_t index = 0, iz = A3_BAR3_ARENA_SIZE / kPAGE_SIZE; index < iz; ++index) {
+    const uint64_t shift = ctx->bar3_arena_base() / kPAGE_SIZE;
+    for (uint64_t index = 0, iz = ctx->bar3_arena_size() / kPAGE_SIZE; index < iz; ++index) {
         const uint64_t hindex = shift + index;
         const uint64_t target = software_[hindex];
         if (target == old && old_remap) {
@@ -152,6 +152,18 @@ void device_bar3::reset_barrier(context* ctx, uint64_t old, uint64_t addr, bool
     }
 }
 
+void device_bar3::release(context* ctx) {
+    large_.erase(ctx->bar3_arena_base() / kLARGE_PAGE_SIZE,
+              (ctx->bar3_arena_base() + ctx->bar3_arena_size()) / kLARGE_PAGE_SIZE);
+    small_.erase(ctx->bar3_arena_base() / kSMALL_PAGE_SIZE,
+              (ctx->bar3_arena_base() + ctx->bar3_arena_size()) / kSMALL_PAGE_SIZE);
+    const struct page_entry entry = { };
+    for (uint64_t address = 0; address < ctx->bar3_arena_size(); address += kPAGE_SIZE) {
+        map((ctx->bar3_arena_base() + address) / kPAGE_SIZE, entry);
+    }
+    flush();
+}
+
 void device_bar3::flush() {
     A3_SYNCHRONIZED(device()->mutex()) {
         const uint32_t engine = 1 | 4;
@@ -163,52 +175,44 @@ void device_bar3::flush() {
 
 uint64_t device_bar3::resolve(context* ctx, uint64_t gvaddr, struct software_page_entry* result) {
     const uint32_t dir = gvaddr / kPAGE_DIRECTORY_COVERED_SIZE;
-    if (dir != 0) {
+    if (dir != 0 || gvaddr >= ctx->bar3_arena_size()) {
         return UINT64_MAX;
     }
 
-    const uint64_t hvaddr = gvaddr + ctx->id() * A3_BAR3_ARENA_SIZE;
-    {
-        const uint64_t index = hvaddr / kSMALL_PAGE_SIZE;
-        const uint64_t rest = hvaddr % kSMALL_PAGE_SIZE;
-        if (small_.size() > index) {
-            const struct software_page_entry& entry = small_[index];
-            if (entry.present()) {
-                if (result) {
-                    *result = entry;
-                }
-                const uint64_t address = entry.phys().address;
-                return (address << 12) + rest;
-            }
+    const uint64_t hvaddr = gvaddr + ctx->bar3_arena_base();
+    if (const struct software_page_entry* entry = small_.lookup(hvaddr / kSMALL_PAGE_SIZE)) {
+        if (result) {
+            *result = *entry;
         }
+        const uint64_t address = entry->phys().address;
+        return (address << 12) + hvaddr % kSMALL_PAGE_SIZE;
     }
 
-    {
-        const uint64_t index = hvaddr / kLARGE_PAGE_SIZE;
-        const uint64_t rest = hvaddr % kLARGE_PAGE_SIZE;
-        if (large_.size() > index) {
-            const struct software_page_entry& entry = large_[index];
-            if (entry.present()) {
-                if (result) {
-                    *result = entry;
-                }
-                const uint64_t address = entry.phys().address;
-                return (address << 12) + rest;
-            }
+    if (const struct software_page_entry* entry = large_.lookup(hvaddr / kLARGE_PAGE_SIZE)) {
+        if (result) {
+            *result = *entry;
         }
+        const uint64_t address = entry->phys().address;
+        return (address << 12) + hvaddr % kLARGE_PAGE_SIZE;
     }
 
     return UINT64_MAX;
 }
 
 void device_bar3::pv_reflect(context* ctx, uint32_t index, uint64_t guest, uint64_t host) {
+    if (index >= ctx->bar3_arena_size() / kPAGE_SIZE) {
+        return;
+    }
+
     // software page table
-    const uint64_t hindex = index + ((ctx->id() * A3_BAR3_ARENA_SIZE) / kPAGE_SIZE);
+    const uint64_t hindex = index + (ctx->bar3_arena_base() / kPAGE_SIZE);
     const uint64_t goffset = (index * kPAGE_SIZE);
     struct page_entry entry;
 
     entry.raw = guest;
-    small_[hindex].refresh(ctx, entry);
+    struct software_page_entry software;
+    software.refresh(ctx, entry);
+    small_.store(hindex, software);
 
     entry.raw = host;
 
@@ -235,13 +239,20 @@ void device_bar3::pv_reflect_batch(context* ctx, uint32_t index, uint64_t guest,
     boost::logic::tribool mode = boost::logic::indeterminate;
     int32_t range = -1;
     uint64_t init_page = -1;
+    const uint64_t pages = ctx->bar3_arena_size() / kPAGE_SIZE;
+    if (index >= pages) {
+        return;
+    }
+    count = std::min<uint64_t>(count, pages - index);
     for (uint32_t i = 0; i < count; ++i, guest += next) {
-        const uint64_t hindex = index + i + ((ctx->id() * A3_BAR3_ARENA_SIZE) / kPAGE_SIZE);
+        const uint64_t hindex = index + i + (ctx->bar3_arena_base() / kPAGE_SIZE);
         const uint64_t goffset = ((index + i) * kPAGE_SIZE);
         struct page_entry gentry;
         gentry.raw = guest;
-        small_[hindex].refresh(ctx, gentry);
         const struct page_entry entry = ctx->guest_to_host(gentry);
+        struct software_page_entry software;
+        software.assign(entry);
+        small_.store(hindex, software);
         map(hindex, entry);
         if (entry.raw) {
             barrier::page_entry* barrier_entry = nullptr;
@@ -289,50 +300,55 @@ void device_bar3::pv_reflect_batch(context* ctx, uint32_t index, uint64_t guest,
 
 void device_bar3::refresh_table(context* ctx, uint64_t phys) {
     pmem::accessor pmem;
-    if (!phys) {
+    if (!phys || phys == UINT64_MAX) {
         return;
     }
 
     // TODO(Yusuke Suzuki): validation needed
     struct page_directory dir = page_directory::create(&pmem, phys);
-    if (dir.large_page_table_present) {
-        const uint64_t address = ctx->get_phys_address(static_cast<uint64_t>(dir.large_page_table_address) << 12);
-        const std::size_t count = std::min<std::size_t>(A3_BAR3_ARENA_SIZE/ kLARGE_PAGE_SIZE, page_directory::large_size_count(dir));
+    // a table on a chunk that cannot be backed is treated as absent
+    const uint64_t large_address = dir.large_page_table_present ? ctx->get_phys_address(static_cast<uint64_t>(dir.large_page_table_address) << 12) : UINT64_MAX;
+    if (large_address != UINT64_MAX) {
+        const std::size_t count = std::min<std::size_t>(ctx->bar3_arena_size() / kLARGE_PAGE_SIZE, page_directory::large_size_count(dir));
         ASSERT(count <= kLARGE_PAGE_COUNT);
         for (std::size_t i = 0; i < count; ++i) {
-            const uint64_t hindex = i + ((ctx->id() * A3_BAR3_ARENA_SIZE) / kLARGE_PAGE_SIZE);
+            const uint64_t hindex = i + (ctx->bar3_arena_base() / kLARGE_PAGE_SIZE);
             const uint64_t item = 0x8 * i;
             struct page_entry entry;
-            if (page_entry::create(&pmem, address + item, &entry)) {
-                large_[hindex].refresh(ctx, entry);
+            const uint64_t entry_address = ctx->get_phys_address(large_address, item);
+            if (entry_address != UINT64_MAX && page_entry::create(&pmem, entry_address, &entry)) {
+                struct software_page_entry software;
+                software.refresh(ctx, entry);
+                large_.store(hindex, software);
             } else {
-                large_[hindex].clear();
+                large_.erase(hindex);
             }
         }
     } else {
-        struct software_page_entry entry = { };
-        std::fill(large_.begin() + ((ctx->id() * A3_BAR3_ARENA_SIZE) / kLARGE_PAGE_SIZE),
-                  large_.begin() + (((ctx->id() + 1)* A3_BAR3_ARENA_SIZE) / kLARGE_PAGE_SIZE), entry);
+        large_.erase(ctx->bar3_arena_base() / kLARGE_PAGE_SIZE,
+                  (ctx->bar3_arena_base() + ctx->bar3_arena_size()) / kLARGE_PAGE_SIZE);
     }
 
-    if (dir.small_page_table_present) {
-        const uint64_t address = ctx->get_phys_address(static_cast<uint64_t>(dir.small_page_table_address) << 12);
-        const std::size_t count = A3_BAR3_ARENA_SIZE / kSMALL_PAGE_SIZE;
+    const uint64_t small_address = dir.small_page_table_present ? ctx->get_phys_address(static_cast<uint64_t>(dir.small_page_table_address) << 12) : UINT64_MAX;
+    if (small_address != UINT64_MAX) {
+        const std::size_t count = ctx->bar3_arena_size() / kSMALL_PAGE_SIZE;
         ASSERT(count <= kSMALL_PAGE_COUNT);
         for (std::size_t i = 0; i < count; ++i) {
-            const uint64_t hindex = i + ((ctx->id() * A3_BAR3_ARENA_SIZE) / kSMALL_PAGE_SIZE);
+            const uint64_t hindex = i + (ctx->bar3_arena_base() / kSMALL_PAGE_SIZE);
             const uint64_t item = 0x8 * i;
             struct page_entry entry;
-            if (page_entry::create(&pmem, address + item, &entry)) {
-                small_[hindex].refresh(ctx, entry);
+            const uint64_t entry_address = ctx->get_phys_address(small_address, item);
+            if (entry_address != UINT64_MAX && page_entry::create(&pmem, entry_address, &entry)) {
+                struct software_page_entry software;
+                software.refresh(ctx, entry);
+                small_.store(hindex, software);
             } else {
-                small_[hindex].clear();
+                small_.erase(hindex);
             }
         }
     } else {
-        struct software_page_entry entry = { };
-        std::fill(small_.begin() + ((ctx->id() * A3_BAR3_ARENA_SIZE) / kSMALL_PAGE_SIZE),
-                  small_.begin() + (((ctx->id() + 1)* A3_BAR3_ARENA_SIZE) / kSMALL_PAGE_SIZE), entry);
+        small_.erase(ctx->bar3_arena_base() / kSMALL_PAGE_SIZE,
+                  (ctx->bar3_arena_base() + ctx->bar3_arena_size()) / kSMALL_PAGE_SIZE);
     }
 }
 
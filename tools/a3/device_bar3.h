@@ -9,6 +9,7 @@
 #include "device.h"
 #include "page_table.h"
 #include "size.h"
+#include "radix_tree.h"
 #include "software_page_table.h"
 namespace a3 {
 
@@ -23,6 +24,8 @@ class device_bar3 : private boost::noncopyable {
     void refresh_table(context* ctx, uint64_t phys);
     void shadow(context* ctx, uint64_t phys);
     void reset_barrier(context* ctx, uint64_t old, uint64_t addr, bool old_remap);
+    // drops the arena of the context being destroyed
+    void release(context* ctx);
     page* directory() { return &directory_; }
 
     uint64_t size() const { return size_; }
@@ -47,8 +50,10 @@ class device_bar3 : private boost::noncopyable {
     page directory_;
     page entries_;
     std::vector<uint64_t> software_;
-    std::array<software_page_entry, A3_BAR3_TOTAL_SIZE / kLARGE_PAGE_SIZE> large_;
-    std::array<software_page_entry, A3_BAR3_TOTAL_SIZE / kSMALL_PAGE_SIZE> small_;
+    radix_tree_t<software_page_entry, 7> large_;
+    radix_tree_t<software_page_entry, 12> small_;
+    static_assert((A3_BAR3_TOTAL_SIZE / kLARGE_PAGE_SIZE) == (1 << 7), "large_ should cover BAR3");
+    static_assert((A3_BAR3_TOTAL_SIZE / kSMALL_PAGE_SIZE) == (1 << 12), "small_ should cover BAR3");
 };
 
 }  // namespace a3
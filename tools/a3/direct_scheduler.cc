@@ -24,15 +24,10 @@
 #include <cstdint>
 #include "a3.h"
 #include "direct_scheduler.h"
-#include "context.h"
-#include "device.h"
-#include "device_bar1.h"
 namespace a3 {
 
-void direct_scheduler_t::enqueue(context* ctx, const command& cmd) {
-    A3_SYNCHRONIZED(device()->mutex()) {
-        device()->bar1()->write(ctx, cmd);
-    }
+void direct_scheduler_t::enqueue(sched_entity_t* ctx, const command& cmd) {
+    ctx->fire(cmd);
 }
 
 }  // namespace a3
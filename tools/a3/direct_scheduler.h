@@ -4,11 +4,9 @@
 #include "scheduler.h"
 namespace a3 {
 
-class context;
-
 class direct_scheduler_t : public scheduler_t {
  public:
-    virtual void enqueue(context* ctx, const command& cmd);
+    virtual void enqueue(sched_entity_t* ctx, const command& cmd);
 };
 
 }  // namespace a3
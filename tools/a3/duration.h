@@ -1,9 +1,82 @@
 #ifndef A3_DURATION_H_
 #define A3_DURATION_H_
+#include <cstdint>
+#include <limits>
 #include <boost/date_time/posix_time/posix_time_types.hpp>
 namespace a3 {
 
-typedef boost::posix_time::time_duration duration_t;
+// Signed duration in nanoseconds. Budgets of short kernels are well below
+// a microsecond apart, so accounting keeps full resolution and only the
+// readers round.
+class duration_t {
+ public:
+    duration_t() : ns_(0) { }
+    explicit duration_t(int64_t ns) : ns_(ns) { }
+
+    int64_t total_nanoseconds() const { return ns_; }
+    int64_t total_microseconds() const { return ns_ / 1000; }
+    int64_t total_milliseconds() const { return ns_ / 1000000; }
+    bool is_zero() const { return ns_ == 0; }
+
+    // for boost::this_thread::sleep
+    boost::posix_time::time_duration to_posix() const {
+        return boost::posix_time::microseconds(total_microseconds());
+    }
+
+    duration_t& operator+=(const duration_t& rhs) { ns_ += rhs.ns_; return *this; }
+    duration_t& operator-=(const duration_t& rhs) { ns_ -= rhs.ns_; return *this; }
+    duration_t& operator*=(int64_t rhs) { ns_ *= rhs; return *this; }
+    duration_t& operator/=(int64_t rhs) { ns_ /= rhs; return *this; }
+    duration_t operator-() const { return duration_t(-ns_); }
+
+    friend duration_t operator+(duration_t lhs, const duration_t& rhs) { return lhs += rhs; }
+    friend duration_t operator-(duration_t lhs, const duration_t& rhs) { return lhs -= rhs; }
+    friend duration_t operator*(duration_t lhs, int64_t rhs) { return lhs *= rhs; }
+    friend duration_t operator/(duration_t lhs, int64_t rhs) { return lhs /= rhs; }
+
+    friend bool operator==(const duration_t& lhs, const duration_t& rhs) { return lhs.ns_ == rhs.ns_; }
+    friend bool operator!=(const duration_t& lhs, const duration_t& rhs) { return lhs.ns_ != rhs.ns_; }
+    friend bool operator<(const duration_t& lhs, const duration_t& rhs) { return lhs.ns_ < rhs.ns_; }
+    friend bool operator<=(const duration_t& lhs, const duration_t& rhs) { return lhs.ns_ <= rhs.ns_; }
+    friend bool operator>(const duration_t& lhs, const duration_t& rhs) { return lhs.ns_ > rhs.ns_; }
+    friend bool operator>=(const duration_t& lhs, const duration_t& rhs) { return lhs.ns_ >= rhs.ns_; }
+
+ private:
+    int64_t ns_;
+};
+
+inline duration_t nanoseconds(int64_t value) { return duration_t(value); }
+inline duration_t microseconds(int64_t value) { return duration_t(value * 1000); }
+inline duration_t milliseconds(int64_t value) { return duration_t(value * 1000000); }
+inline duration_t seconds(int64_t value) { return duration_t(value * 1000000000); }
+
+// Point of the monotonic clock, nanoseconds from an unspecified origin. The
+// default value is the origin and precedes every point read from a clock.
+class timestamp_t {
+ public:
+    timestamp_t() : ns_(0) { }
+    explicit timestamp_t(int64_t ns) : ns_(ns) { }
+
+    int64_t total_nanoseconds() const { return ns_; }
+    static timestamp_t max() { return timestamp_t(std::numeric_limits<int64_t>::max()); }
+
+    timestamp_t& operator+=(const duration_t& rhs) { ns_ += rhs.total_nanoseconds(); return *this; }
+    timestamp_t& operator-=(const duration_t& rhs) { ns_ -= rhs.total_nanoseconds(); return *this; }
+
+    friend timestamp_t operator+(timestamp_t lhs, const duration_t& rhs) { return lhs += rhs; }
+    friend timestamp_t operator-(timestamp_t lhs, const duration_t& rhs) { return lhs -= rhs; }
+    friend duration_t operator-(const timestamp_t& lhs, const timestamp_t& rhs) { return duration_t(lhs.ns_ - rhs.ns_); }
+
+    friend bool operator==(const timestamp_t& lhs, const timestamp_t& rhs) { return lhs.ns_ == rhs.ns_; }
+    friend bool operator!=(const timestamp_t& lhs, const timestamp_t& rhs) { return lhs.ns_ != rhs.ns_; }
+    friend bool operator<(const timestamp_t& lhs, const timestamp_t& rhs) { return lhs.ns_ < rhs.ns_; }
+    friend bool operator<=(const timestamp_t& lhs, const timestamp_t& rhs) { return lhs.ns_ <= rhs.ns_; }
+    friend bool operator>(const timestamp_t& lhs, const timestamp_t& rhs) { return lhs.ns_ > rhs.ns_; }
+    friend bool operator>=(const timestamp_t& lhs, const timestamp_t& rhs) { return lhs.ns_ >= rhs.ns_; }
+
+ private:
+    int64_t ns_;
+};
 
 }  // namespace a3
 #endif  // A3_DURATION_H_
@@ -0,0 +1,101 @@
+/*
+ * A3 Evictor
+ *
+ * Copyright (c) 2012-2013 Yusuke Suzuki
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <algorithm>
+#include <vector>
+#include "a3.h"
+#include "evictor.h"
+#include "context.h"
+#include "device.h"
+#include "scheduler.h"
+namespace a3 {
+
+evictor_t::evictor_t(const duration_t& window)
+    : window_(window)
+    , thread_()
+{
+}
+
+evictor_t::~evictor_t() {
+    stop();
+}
+
+void evictor_t::start() {
+    if (thread_) {
+        stop();
+    }
+    thread_.reset(new boost::thread(&evictor_t::run, this));
+}
+
+void evictor_t::stop() {
+    if (thread_) {
+        thread_->interrupt();
+        thread_->join();
+        thread_.reset();
+    }
+}
+
+std::size_t evictor_t::evict_once() {
+    const timestamp_t deadline = clock_source_t::system()->now() - window_;
+    const std::vector<sched_entity_t*> idle = device()->scheduler()->idle_entities(deadline);
+    if (idle.empty()) {
+        return 0;
+    }
+
+    // contexts are picked under the device mutex. A context being destroyed
+    // holds its residency mutex until it is unlinked from the device.
+    std::vector<context*> victims;
+    A3_SYNCHRONIZED(device()->mutex()) {
+        for (context* ctx : device()->contexts()) {
+            if (!ctx || std::find(idle.begin(), idle.end(), ctx) == idle.end()) {
+                continue;
+            }
+            if (!ctx->residency_mutex().try_lock()) {
+                // handling a command
+                continue;
+            }
+            if (ctx->evictable() && ctx->last_access() < deadline) {
+                victims.push_back(ctx);
+            } else {
+                ctx->residency_mutex().unlock();
+            }
+        }
+    }
+
+    for (context* ctx : victims) {
+        ctx->evict();
+        ctx->residency_mutex().unlock();
+    }
+    return victims.size();
+}
+
+void evictor_t::run() {
+    const duration_t interval = window_ / 4;
+    while (true) {
+        boost::this_thread::sleep(interval.to_posix());
+        evict_once();
+    }
+}
+
+}  // namespace a3
+/* vim: set sw=4 ts=4 et tw=80 : */
@@ -0,0 +1,35 @@
+#ifndef A3_EVICTOR_H_
+#define A3_EVICTOR_H_
+#include <memory>
+#include <boost/noncopyable.hpp>
+#include <boost/thread.hpp>
+#include "a3.h"
+#include "duration.h"
+namespace a3 {
+
+// Pages out the VRAM of idle contexts with --evict-idle.
+//
+// A context is idle when the scheduler has seen no doorbell from it for the
+// window, nothing of it is queued or in flight, and no command was handled
+// in the window. Evicted contexts are restored by their next command, see
+// context_swap.cc.
+class evictor_t : private boost::noncopyable {
+ public:
+    explicit evictor_t(const duration_t& window);
+    ~evictor_t();
+    void start();
+    void stop();
+
+    // single pass, returns the number of evicted contexts
+    std::size_t evict_once();
+
+ private:
+    void run();
+
+    duration_t window_;
+    std::unique_ptr<boost::thread> thread_;
+};
+
+}  // namespace a3
+#endif  // A3_EVICTOR_H_
+/* vim: set sw=4 ts=4 et tw=80 : */
@@ -24,10 +24,6 @@
 #include <cstdint>
 #include "a3.h"
 #include "fifo_scheduler.h"
-#include "context.h"
-#include "registers.h"
-#include "device.h"
-#include "device_bar1.h"
 #include "ignore_unused_variable_warning.h"
 namespace a3 {
 
@@ -65,62 +61,97 @@ void fifo_scheduler_t::stop() {
 }
 
 void fifo_scheduler_t::replenish() {
-    // uint64_t count = 0;
     while (true) {
-        // replenish
-        A3_SYNCHRONIZED(sched_mutex()) {
-            if (!contexts().empty()) {
-                A3_SYNCHRONIZED(fire_mutex()) {
-                    duration_t period = bandwidth_ + gpu_idle_;
-                    duration_t defaults = period_ / contexts().size();
-                    if (period != boost::posix_time::microseconds(0)) {
-                        const auto budget = period / contexts().size();
-                        for (context& ctx: contexts()) {
-                            ctx.replenish(budget, period_, defaults, bandwidth_ == boost::posix_time::microseconds(0));
-                        }
-                        // ++count;
+        replenish_once();
+        clock()->sleep(period_);
+        clock()->yield();
+    }
+}
+
+void fifo_scheduler_t::replenish_once() {
+    A3_SYNCHRONIZED(sched_mutex()) {
+        if (!contexts().empty()) {
+            A3_SYNCHRONIZED(fire_mutex()) {
+                duration_t period = bandwidth_ + gpu_idle_;
+                duration_t defaults = period_ / contexts().size();
+                if (period != microseconds(0)) {
+                    const auto budget = period / contexts().size();
+                    for (sched_entity_t& ctx: contexts()) {
+                        ctx.replenish(budget, period_, defaults, bandwidth_ == microseconds(0));
                     }
-                    bandwidth_ = boost::posix_time::microseconds(0);
-                    gpu_idle_ = boost::posix_time::microseconds(0);
+                    // ++count;
                 }
+                bandwidth_ = microseconds(0);
+                gpu_idle_ = microseconds(0);
             }
         }
-        boost::this_thread::sleep(period_);
-        boost::this_thread::yield();
     }
 }
 
-void fifo_scheduler_t::enqueue(context* ctx, const command& cmd) {
+void fifo_scheduler_t::enqueue(sched_entity_t* ctx, const command& cmd) {
     A3_SYNCHRONIZED(fire_mutex()) {
         queue_.push(fire_t(ctx, cmd));
         cond_.notify_one();
     }
 }
 
+void fifo_scheduler_t::on_unregister_context(sched_entity_t* ctx) {
+    std::queue<fire_t> rest;
+    for (; !queue_.empty(); queue_.pop()) {
+        if (queue_.front().first != ctx) {
+            rest.push(queue_.front());
+        }
+    }
+    queue_.swap(rest);
+}
+
+bool fifo_scheduler_t::is_queued(sched_entity_t* ctx) {
+    std::queue<fire_t> rest(queue_);
+    for (; !rest.empty(); rest.pop()) {
+        if (rest.front().first == ctx) {
+            return true;
+        }
+    }
+    return false;
+}
+
 void fifo_scheduler_t::run() {
-    boost::condition_variable_any cond;
-    boost::unique_lock<boost::mutex> lock(fire_mutex());
     while (true) {
-        fire_t handle;
-        while (queue_.empty()) {
-            cond_.wait(lock);
+        {
+            boost::unique_lock<boost::mutex> lock(fire_mutex());
+            while (queue_.empty()) {
+                cond_.wait(lock);
+            }
         }
-        handle = queue_.front();
-        queue_.pop();
+        dispatch(false);
+    }
+}
 
-        lock.unlock();
-        utilization_.start();
+bool fifo_scheduler_t::has_pending() {
+    A3_SYNCHRONIZED(fire_mutex()) {
+        return !queue_.empty();
+    }
+    return false;
+}
 
-        A3_SYNCHRONIZED(device()->mutex()) {
-            device()->bar1()->write(handle.first, handle.second);
+void fifo_scheduler_t::dispatch(bool idle) {
+    fire_t handle;
+    A3_SYNCHRONIZED(fire_mutex()) {
+        if (queue_.empty()) {
+            return;
         }
+        handle = queue_.front();
+        queue_.pop();
+    }
 
-        lock.lock();
+    utilization_.start(clock());
+    handle.first->fire(handle.second);
 
-        while (device()->is_active(handle.first)) {
-            cond.timed_wait(lock, wait_);
-        }
+    while (handle.first->is_active()) {
+        clock()->sleep(wait_);
+    }
 
+    A3_SYNCHRONIZED(fire_mutex()) {
         const auto duration = utilization_.elapsed();
         bandwidth_ += duration;
         sampler_->add(duration);
@@ -128,5 +159,9 @@ void fifo_scheduler_t::run() {
     }
 }
 
+void fifo_scheduler_t::sample_once() {
+    sampler_->sample();
+}
+
 }  // namespace a3
 /* vim: set sw=4 ts=4 et tw=80 : */
@@ -4,7 +4,7 @@
 #include <memory>
 #include <boost/thread.hpp>
 #include "a3.h"
-#include "context.h"
+#include "sched_entity.h"
 #include "sampler.h"
 #include "scheduler.h"
 #include "duration.h"
@@ -17,10 +17,20 @@ class fifo_scheduler_t : public scheduler_t {
     virtual ~fifo_scheduler_t();
     virtual void start();
     virtual void stop();
-    virtual void enqueue(context* ctx, const command& cmd);
+    virtual void enqueue(sched_entity_t* ctx, const command& cmd);
+    virtual bool has_pending();
+    virtual void dispatch(bool idle);
+    virtual void replenish_once();
+    virtual void sample_once();
+    virtual duration_t replenish_period() const { return period_; }
+    virtual duration_t sample_period() const { return sampler_->period(); }
+
+ protected:
+    virtual void on_unregister_context(sched_entity_t* ctx);
+    virtual bool is_queued(sched_entity_t* ctx);
 
  private:
-    typedef std::pair<context*, command> fire_t;
+    typedef std::pair<sched_entity_t*, command> fire_t;
     void run();
     void replenish();
     void sampling();
@@ -27,6 +27,10 @@
 namespace a3 {
 
 bool flags::lazy_shadowing = false;
+bool flags::adaptive_shadowing = false;
 bool flags::bar3_remapping = false;
+bool flags::dynamic_vram = false;
+uint32_t flags::evict_idle = 0;
+uint32_t flags::mmio_share = 50;
 
 }  // namespace a3
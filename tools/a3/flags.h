@@ -1,11 +1,16 @@
 #ifndef A3_FLAGS_H_
 #define A3_FLAGS_H_
+#include <cstdint>
 namespace a3 {
 
 class flags {
  public:
     static bool lazy_shadowing;
+    static bool adaptive_shadowing;
     static bool bar3_remapping;
+    static bool dynamic_vram;
+    static uint32_t evict_idle;  // ms, 0 disables eviction
+    static uint32_t mmio_share;  // % of one CPU per session, 0 disables throttling
 };
 
 }  // namespace a3
@@ -32,16 +32,27 @@ instruments_t::instruments_t(context* ctx)
     : ctx_(ctx)
     , flush_times_()
     , shadowing_times_()
-    , shadowing_(boost::posix_time::microseconds(0))
+    , submit_times_()
+    , rescans_avoided_()
+    , shadowing_(microseconds(0))
     , hypercalls_()
+    , metrics_()
 {
 }
 
 void instruments_t::hypercall(const command& cmd, slot_t* slot) {
     ++hypercalls_;
+    metrics_.hypercall(slot->u8[0])->commands.increment();
     // A3_FATAL(stdout, "[hypercalls] %" PRIu64 "\n", hypercalls_);
     A3_LOG("A3 call from [%" PRIu32 "] %d : %s\n", ctx_->id(), static_cast<int>(slot->u8[0]), kPV_OPS_STRING[slot->u8[0]]);
 }
 
+void instruments_t::shadowing_mode_changed(int channel, bool lazy) {
+    metrics_.lazy_channels.add(lazy ? 1 : -1);
+    metrics_.shadowing_transitions.increment();
+    A3_LOG("context %" PRIu32 " channel %d switches to %s shadowing (flush/submit %f, rescans avoided %" PRIu64 ")\n",
+           ctx_->id(), channel, lazy ? "lazy" : "eager", flush_submit_ratio(), rescans_avoided_);
+}
+
 }  // namespace a3
 /* vim: set sw=4 ts=4 et tw=80 : */
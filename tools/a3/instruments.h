@@ -4,6 +4,7 @@
 #include "a3.h"
 #include "duration.h"
 #include "pv_slot.h"
+#include "metrics.h"
 namespace a3 {
 
 class context;
@@ -13,6 +14,7 @@ class instruments_t : private boost::noncopyable {
     instruments_t(context* ctx);
 
     uint64_t increment_flush_times() {
+        metrics_.tlb_flushes.increment();
         return ++flush_times_;
     }
 
@@ -20,7 +22,34 @@ class instruments_t : private boost::noncopyable {
         return ++shadowing_times_;
     }
 
+    uint64_t increment_submit_times() {
+        metrics_.submits.increment();
+        return ++submit_times_;
+    }
+
+    uint64_t increment_rescans_avoided() {
+        metrics_.rescans_avoided.increment();
+        return ++rescans_avoided_;
+    }
+
+    uint64_t flush_times() const { return flush_times_; }
+    uint64_t shadowing_times() const { return shadowing_times_; }
+    uint64_t submit_times() const { return submit_times_; }
+    uint64_t rescans_avoided() const { return rescans_avoided_; }
+
+    // flushes per submit in this context
+    double flush_submit_ratio() const {
+        if (!submit_times_) {
+            return 0.0;
+        }
+        return static_cast<double>(flush_times_) / submit_times_;
+    }
+
+    void shadowing_mode_changed(int channel, bool lazy);
+
     duration_t increment_shadowing(const duration_t& time) {
+        metrics_.shadow_rescans.increment();
+        metrics_.shadowing.observe(time);
         shadowing_ += time;
         return shadowing_;
     }
@@ -28,21 +57,31 @@ class instruments_t : private boost::noncopyable {
     void clear_shadowing_utilization() {
         flush_times_ = 0;
         shadowing_times_ = 0;
-        shadowing_ = boost::posix_time::microseconds(0);
+        submit_times_ = 0;
+        rescans_avoided_ = 0;
+        shadowing_ = microseconds(0);
     }
 
     void hypercall(const command& cmd, slot_t* slot);
 
+    context_metrics_t* metrics() { return &metrics_; }
+    const context_metrics_t* metrics() const { return &metrics_; }
+
  private:
     context* ctx_;
 
     // shadowing utilization
     uint64_t flush_times_;
     uint64_t shadowing_times_;
+    uint64_t submit_times_;
+    uint64_t rescans_avoided_;
     duration_t shadowing_;
 
     // hypercalls
     uint64_t hypercalls_;
+
+    // exported by metrics endpoint, never cleared
+    context_metrics_t metrics_;
 };
 
 }  // namespace a3
@@ -30,6 +30,9 @@
 #include "context.h"
 #include "device.h"
 #include "cmdline.h"
+#include "partition.h"
+#include "metrics_server.h"
+#include "bench/bringup_bench.h"
 namespace a3 {
 
 class server {
@@ -76,7 +79,14 @@ int main(int argc, char** argv) {
     cmd.Add("version", "version", 'v', "print the version");
     cmd.Add("through", "through", 't', "through I/O");
     cmd.Add("lazy-shadowing", "lazy-shadowing", 0, "Enable lazy shadowing");
+    cmd.Add("adaptive-shadowing", "adaptive-shadowing", 0, "Choose eager or lazy shadowing per channel");
     cmd.Add("bar3-remapping", "bar3-remapping", 0, "Enable BAR3 remapping");
+    cmd.Add("dynamic-vram", "dynamic-vram", 0, "Back guest VRAM with chunks on demand");
+    cmd.Add<uint32_t>("evict-idle", "evict-idle", 0, "page out VRAM of contexts without doorbells for N ms (needs --dynamic-vram)", false, 0);
+    cmd.Add<uint32_t>("mmio-share", "mmio-share", 0, "MMIO handling time of a session under contention, % of one CPU (0 disables)", false, 50);
+    cmd.Add<uint32_t>("vms", "vms", 0, "number of VMs sharing the device", false, A3_VM_NUM);
+    cmd.Add<std::string>("partition", "partition", 0, "partition file, \"<memory MB> <channels>\" per VM", false);
+    cmd.Add<uint32_t>("bench-bringup", "bench-bringup", 0, "measure VRAM page bring-up of N contexts and exit", false, 8);
     cmd.set_footer("[program_file] [arguments]");
 
     if (!cmd.Parse(argc, argv)) {
@@ -108,14 +118,37 @@ int main(int argc, char** argv) {
 
     // set flags
     a3::flags::lazy_shadowing = cmd.Exist("lazy-shadowing");
+    a3::flags::adaptive_shadowing = cmd.Exist("adaptive-shadowing");
     a3::flags::bar3_remapping = cmd.Exist("bar3-remapping");
+    a3::flags::dynamic_vram = cmd.Exist("dynamic-vram");
+    a3::flags::evict_idle = cmd.Get<uint32_t>("evict-idle");
+    a3::flags::mmio_share = cmd.Get<uint32_t>("mmio-share");
+    if (a3::flags::evict_idle && !a3::flags::dynamic_vram) {
+        A3_FATAL(stderr, "--evict-idle requires --dynamic-vram\n");
+        return 1;
+    }
+
+    // partition device resources
+    const bool partitioned = cmd.Exist("partition") ?
+        c::partition_t::configure(cmd.Get<std::string>("partition")) :
+        c::partition_t::configure(cmd.Get<uint32_t>("vms"));
+    if (!partitioned) {
+        return 1;
+    }
 
     c::device()->initialize(bdf);
 
+    if (cmd.Exist("bench-bringup")) {
+        c::run_bringup_bench(cmd.Get<uint32_t>("bench-bringup"), c::partition_t::slot(0).channels);
+        return 0;
+    }
+
     ::unlink(A3_ENDPOINT);
+    ::unlink(A3_METRICS_ENDPOINT);
     try {
         boost::asio::io_service io_service;
         c::server s(io_service, A3_ENDPOINT, cmd.Exist("through"));
+        c::metrics_server_t metrics(io_service, A3_METRICS_ENDPOINT);
         io_service.run();
     } catch (std::exception& e) {
         A3_FPRINTF(stderr, "Exception: %s\n", e.what());
@@ -0,0 +1,383 @@
+/*
+ * A3 metrics
+ *
+ * Copyright (c) 2012-2013 Yusuke Suzuki
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <cstdio>
+#include <cstdarg>
+#include <algorithm>
+#include <array>
+#include <cinttypes>
+#include <string>
+#include <vector>
+#include "a3.h"
+#include "metrics.h"
+#include "context.h"
+#include "device.h"
+#include "vram_partition.h"
+namespace a3 {
+namespace {
+
+static const command::bar_t kBARS[] = {
+    command::BAR0, command::BAR1, command::BAR3, command::BAR4
+};
+static const std::size_t kBARS_COUNT = sizeof(kBARS) / sizeof(kBARS[0]);
+
+static const char* const kDIRECTIONS[] = { "read", "write" };
+
+// values copied under the device mutex, formatted after it is released
+struct histogram_snapshot_t {
+    void take(const histogram_t& h) {
+        for (std::size_t i = 0; i < histogram_t::kBUCKETS; ++i) {
+            buckets[i] = h.bucket(i);
+        }
+        count = h.count();
+        sum = h.sum();
+    }
+
+    std::array<uint64_t, histogram_t::kBUCKETS> buckets;
+    uint64_t count;
+    uint64_t sum;
+};
+
+struct mmio_snapshot_t {
+    void take(const mmio_metrics_t& m) {
+        commands = m.commands.value();
+        latency.take(m.latency);
+    }
+
+    uint64_t commands;
+    histogram_snapshot_t latency;
+};
+
+struct context_snapshot_t {
+    uint32_t id;
+    int domid;
+    bool para_virtualized;
+    bool has_vram;
+    bool evicted;
+    std::array<std::array<mmio_snapshot_t, 2>, kBARS_COUNT> mmio;
+    std::array<mmio_snapshot_t, kPV_OPS_COUNT + 1> hypercalls;
+    uint64_t mirrored;
+    uint64_t tlb_flushes;
+    uint64_t shadow_rescans;
+    uint64_t rescans_avoided;
+    int64_t lazy_channels;
+    uint64_t shadowing_transitions;
+    uint64_t submits;
+    histogram_snapshot_t shadowing;
+    histogram_snapshot_t suspended;
+    uint64_t gpu_busy;
+    uint64_t mmio_busy;
+    uint64_t throttled;
+    uint64_t throttled_wait;
+    int64_t budget;
+    uint64_t vram_bytes;
+    uint64_t swapped;
+    uint64_t evictions;
+    uint64_t restores;
+    uint64_t swapped_out;
+    uint64_t swapped_in;
+    histogram_snapshot_t restoring;
+};
+
+static void take_snapshot(const context* ctx, context_snapshot_t* out) {
+    const context_metrics_t* m = ctx->instruments()->metrics();
+    out->id = ctx->id();
+    out->domid = ctx->domid();
+    out->para_virtualized = ctx->para_virtualized();
+    for (std::size_t b = 0; b < kBARS_COUNT; ++b) {
+        for (int dir = 0; dir < 2; ++dir) {
+            out->mmio[b][dir].take(*m->mmio(kBARS[b], static_cast<context_metrics_t::direction_t>(dir)));
+        }
+    }
+    for (std::size_t op = 0; op <= kPV_OPS_COUNT; ++op) {
+        out->hypercalls[op].take(*m->hypercall(op));
+    }
+    out->mirrored = m->mirrored.value();
+    out->tlb_flushes = m->tlb_flushes.value();
+    out->shadow_rescans = m->shadow_rescans.value();
+    out->rescans_avoided = m->rescans_avoided.value();
+    out->lazy_channels = m->lazy_channels.value();
+    out->shadowing_transitions = m->shadowing_transitions.value();
+    out->submits = m->submits.value();
+    out->shadowing.take(m->shadowing);
+    out->suspended.take(m->suspended);
+    out->gpu_busy = m->gpu_busy.value();
+    out->mmio_busy = m->mmio_busy.value();
+    out->throttled = m->throttled.value();
+    out->throttled_wait = m->throttled_wait.value();
+    out->budget = ctx->budget().total_microseconds();
+    out->has_vram = ctx->vram();
+    out->vram_bytes = 0;
+    if (ctx->vram()) {
+        out->vram_bytes = ctx->vram()->dynamic() ? ctx->vram()->allocated() : ctx->vram_size();
+    }
+    out->evicted = ctx->evicted();
+    out->swapped = ctx->swapped();
+    out->evictions = m->evictions.value();
+    out->restores = m->restores.value();
+    out->swapped_out = m->swapped_out.value();
+    out->swapped_in = m->swapped_in.value();
+    out->restoring.take(m->restoring);
+}
+
+class writer_t {
+ public:
+    explicit writer_t(std::string* out) : out_(out) { }
+
+    void header(const char* name, const char* type, const char* help) {
+        printf("# HELP %s %s\n", name, help);
+        printf("# TYPE %s %s\n", name, type);
+    }
+
+    void value(const char* name, const std::string& labels, uint64_t value) {
+        if (labels.empty()) {
+            printf("%s %" PRIu64 "\n", name, value);
+            return;
+        }
+        printf("%s{%s} %" PRIu64 "\n", name, labels.c_str(), value);
+    }
+
+    void seconds(const char* name, const std::string& labels, double value) {
+        printf("%s{%s} %.6f\n", name, labels.c_str(), value);
+    }
+
+    void histogram(const char* name, const std::string& labels, const histogram_snapshot_t& h) {
+        uint64_t cumulative = 0;
+        for (std::size_t i = 0; i < histogram_t::kBUCKETS; ++i) {
+            cumulative += h.buckets[i];
+            if (i + 1 == histogram_t::kBUCKETS) {
+                printf("%s_bucket{%s,le=\"+Inf\"} %" PRIu64 "\n", name, labels.c_str(), cumulative);
+            } else {
+                printf("%s_bucket{%s,le=\"%.6f\"} %" PRIu64 "\n", name, labels.c_str(), histogram_t::bound(i) / 1e6, cumulative);
+            }
+        }
+        printf("%s_sum{%s} %.6f\n", name, labels.c_str(), h.sum / 1e6);
+        printf("%s_count{%s} %" PRIu64 "\n", name, labels.c_str(), h.count);
+    }
+
+ private:
+    void printf(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+        char buffer[512];
+        va_list args;
+        va_start(args, format);
+        const int ret = std::vsnprintf(buffer, sizeof(buffer), format, args);
+        va_end(args);
+        if (ret > 0) {
+            out_->append(buffer, std::min<std::size_t>(ret, sizeof(buffer) - 1));
+        }
+    }
+
+    std::string* out_;
+};
+
+static std::string context_labels(const context_snapshot_t& ctx) {
+    char buffer[64];
+    std::snprintf(buffer, sizeof(buffer), "vm=\"%" PRIu32 "\",domid=\"%d\"", ctx.id, ctx.domid);
+    return buffer;
+}
+
+static std::string mmio_labels(const context_snapshot_t& ctx, std::size_t bar, int dir) {
+    char buffer[64];
+    std::snprintf(buffer, sizeof(buffer), ",bar=\"%d\",dir=\"%s\"", static_cast<int>(kBARS[bar]), kDIRECTIONS[dir]);
+    return context_labels(ctx) + buffer;
+}
+
+static std::string op_labels(const context_snapshot_t& ctx, std::size_t op) {
+    return context_labels(ctx) + ",op=\"" + (op < kPV_OPS_COUNT ? kPV_OPS_STRING[op] : "UNKNOWN") + "\"";
+}
+
+}  // namespace anonymous
+
+std::string render_metrics() {
+    // copy the values while contexts cannot be destroyed, and keep the
+    // device mutex away from formatting
+    std::vector<context_snapshot_t> contexts;
+    A3_SYNCHRONIZED(device()->mutex()) {
+        for (const context* ctx : device()->contexts()) {
+            if (ctx) {
+                contexts.emplace_back();
+                take_snapshot(ctx, &contexts.back());
+            }
+        }
+    }
+
+    std::string out;
+    writer_t w(&out);
+
+    w.header("a3_contexts", "gauge", "Number of running contexts.");
+    w.value("a3_contexts", "", contexts.size());
+
+    w.header("a3_mmio_commands_total", "counter", "MMIO commands handled by BAR and direction.");
+    for (const context_snapshot_t& ctx : contexts) {
+        for (std::size_t bar = 0; bar < kBARS_COUNT; ++bar) {
+            for (int dir = 0; dir < 2; ++dir) {
+                w.value("a3_mmio_commands_total", mmio_labels(ctx, bar, dir), ctx.mmio[bar][dir].commands);
+            }
+        }
+    }
+
+    w.header("a3_mmio_latency_seconds", "histogram", "MMIO command handling time.");
+    for (const context_snapshot_t& ctx : contexts) {
+        for (std::size_t bar = 0; bar < kBARS_COUNT; ++bar) {
+            for (int dir = 0; dir < 2; ++dir) {
+                w.histogram("a3_mmio_latency_seconds", mmio_labels(ctx, bar, dir), ctx.mmio[bar][dir].latency);
+            }
+        }
+    }
+
+    w.header("a3_hypercalls_total", "counter", "PV hypercalls by operation.");
+    for (const context_snapshot_t& ctx : contexts) {
+        if (ctx.para_virtualized) {
+            for (std::size_t op = 0; op <= kPV_OPS_COUNT; ++op) {
+                w.value("a3_hypercalls_total", op_labels(ctx, op), ctx.hypercalls[op].commands);
+            }
+        }
+    }
+
+    w.header("a3_hypercall_latency_seconds", "histogram", "PV hypercall handling time.");
+    for (const context_snapshot_t& ctx : contexts) {
+        if (ctx.para_virtualized) {
+            for (std::size_t op = 0; op <= kPV_OPS_COUNT; ++op) {
+                w.histogram("a3_hypercall_latency_seconds", op_labels(ctx, op), ctx.hypercalls[op].latency);
+            }
+        }
+    }
+
+    w.header("a3_pv_mirror_entries_total", "counter", "PTEs reconciled from guest mirrors on flush.");
+    for (const context_snapshot_t& ctx : contexts) {
+        if (ctx.para_virtualized) {
+            w.value("a3_pv_mirror_entries_total", context_labels(ctx), ctx.mirrored);
+        }
+    }
+
+    w.header("a3_tlb_flushes_total", "counter", "TLB flushes requested by the guest.");
+    for (const context_snapshot_t& ctx : contexts) {
+        w.value("a3_tlb_flushes_total", context_labels(ctx), ctx.tlb_flushes);
+    }
+
+    w.header("a3_shadow_rescans_total", "counter", "Shadow page table rescans.");
+    for (const context_snapshot_t& ctx : contexts) {
+        w.value("a3_shadow_rescans_total", context_labels(ctx), ctx.shadow_rescans);
+    }
+
+    w.header("a3_shadow_rescans_avoided_total", "counter", "Rescans coalesced by lazy shadowing.");
+    for (const context_snapshot_t& ctx : contexts) {
+        w.value("a3_shadow_rescans_avoided_total", context_labels(ctx), ctx.rescans_avoided);
+    }
+
+    w.header("a3_shadowing_lazy_channels", "gauge", "Channels in lazy shadowing mode.");
+    for (const context_snapshot_t& ctx : contexts) {
+        w.value("a3_shadowing_lazy_channels", context_labels(ctx), ctx.lazy_channels);
+    }
+
+    w.header("a3_shadowing_mode_transitions_total", "counter", "Adaptive shadowing mode switches.");
+    for (const context_snapshot_t& ctx : contexts) {
+        w.value("a3_shadowing_mode_transitions_total", context_labels(ctx), ctx.shadowing_transitions);
+    }
+
+    w.header("a3_submits_total", "counter", "Command submissions.");
+    for (const context_snapshot_t& ctx : contexts) {
+        w.value("a3_submits_total", context_labels(ctx), ctx.submits);
+    }
+
+    w.header("a3_shadowing_seconds", "histogram", "Shadow page table rescan time.");
+    for (const context_snapshot_t& ctx : contexts) {
+        w.histogram("a3_shadowing_seconds", context_labels(ctx), ctx.shadowing);
+    }
+
+    w.header("a3_suspended_seconds", "histogram", "Time submissions are queued before fired.");
+    for (const context_snapshot_t& ctx : contexts) {
+        w.histogram("a3_suspended_seconds", context_labels(ctx), ctx.suspended);
+    }
+
+    w.header("a3_gpu_busy_seconds_total", "counter", "GPU time used by the context.");
+    for (const context_snapshot_t& ctx : contexts) {
+        w.seconds("a3_gpu_busy_seconds_total", context_labels(ctx), ctx.gpu_busy / 1e6);
+    }
+
+    w.header("a3_mmio_busy_seconds_total", "counter", "Host time spent handling MMIO commands.");
+    for (const context_snapshot_t& ctx : contexts) {
+        w.seconds("a3_mmio_busy_seconds_total", context_labels(ctx), ctx.mmio_busy / 1e6);
+    }
+
+    w.header("a3_mmio_throttled_total", "counter", "Commands delayed by the MMIO token bucket.");
+    for (const context_snapshot_t& ctx : contexts) {
+        w.value("a3_mmio_throttled_total", context_labels(ctx), ctx.throttled);
+    }
+
+    w.header("a3_mmio_throttled_seconds_total", "counter", "Time commands waited for MMIO tokens.");
+    for (const context_snapshot_t& ctx : contexts) {
+        w.seconds("a3_mmio_throttled_seconds_total", context_labels(ctx), ctx.throttled_wait / 1e6);
+    }
+
+    w.header("a3_budget_seconds", "gauge", "Remaining scheduler budget.");
+    for (const context_snapshot_t& ctx : contexts) {
+        w.seconds("a3_budget_seconds", context_labels(ctx), ctx.budget / 1e6);
+    }
+
+    w.header("a3_vram_allocated_bytes", "gauge", "Host VRAM backing the context.");
+    for (const context_snapshot_t& ctx : contexts) {
+        if (ctx.has_vram) {
+            w.value("a3_vram_allocated_bytes", context_labels(ctx), ctx.vram_bytes);
+        }
+    }
+
+    w.header("a3_vram_resident", "gauge", "1 if the context VRAM is resident, 0 if evicted.");
+    for (const context_snapshot_t& ctx : contexts) {
+        w.value("a3_vram_resident", context_labels(ctx), ctx.evicted ? 0 : 1);
+    }
+
+    w.header("a3_vram_swapped_bytes", "gauge", "Host memory holding the evicted VRAM.");
+    for (const context_snapshot_t& ctx : contexts) {
+        w.value("a3_vram_swapped_bytes", context_labels(ctx), ctx.swapped);
+    }
+
+    w.header("a3_vram_evictions_total", "counter", "VRAM evictions of the idle context.");
+    for (const context_snapshot_t& ctx : contexts) {
+        w.value("a3_vram_evictions_total", context_labels(ctx), ctx.evictions);
+    }
+
+    w.header("a3_vram_restores_total", "counter", "VRAM restores on the command after eviction.");
+    for (const context_snapshot_t& ctx : contexts) {
+        w.value("a3_vram_restores_total", context_labels(ctx), ctx.restores);
+    }
+
+    w.header("a3_vram_swapped_out_bytes_total", "counter", "VRAM copied to host memory.");
+    for (const context_snapshot_t& ctx : contexts) {
+        w.value("a3_vram_swapped_out_bytes_total", context_labels(ctx), ctx.swapped_out);
+    }
+
+    w.header("a3_vram_swapped_in_bytes_total", "counter", "VRAM copied back from host memory.");
+    for (const context_snapshot_t& ctx : contexts) {
+        w.value("a3_vram_swapped_in_bytes_total", context_labels(ctx), ctx.swapped_in);
+    }
+
+    w.header("a3_vram_restore_seconds", "histogram", "Time to restore the evicted VRAM.");
+    for (const context_snapshot_t& ctx : contexts) {
+        w.histogram("a3_vram_restore_seconds", context_labels(ctx), ctx.restoring);
+    }
+    return out;
+}
+
+}  // namespace a3
+/* vim: set sw=4 ts=4 et tw=80 : */
@@ -0,0 +1,139 @@
+#ifndef A3_METRICS_H_
+#define A3_METRICS_H_
+#include <cstdint>
+#include <array>
+#include <atomic>
+#include <string>
+#include <boost/noncopyable.hpp>
+#include "a3.h"
+#include "duration.h"
+#include "pv_slot.h"
+namespace a3 {
+
+// Lock-free metrics. Writers are the session thread of the context and
+// scheduler threads, the reader is the metrics endpoint.
+
+class counter_t : private boost::noncopyable {
+ public:
+    counter_t() : value_(0) { }
+    void increment(uint64_t value = 1) {
+        value_.fetch_add(value, std::memory_order_relaxed);
+    }
+    uint64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+ private:
+    std::atomic<uint64_t> value_;
+};
+
+class gauge_t : private boost::noncopyable {
+ public:
+    gauge_t() : value_(0) { }
+    void set(int64_t value) { value_.store(value, std::memory_order_relaxed); }
+    void add(int64_t value) { value_.fetch_add(value, std::memory_order_relaxed); }
+    int64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+ private:
+    std::atomic<int64_t> value_;
+};
+
+// latency histogram in microseconds
+class histogram_t : private boost::noncopyable {
+ public:
+    static const std::size_t kBUCKETS = 16;
+
+    // upper bounds (us) of buckets, the last one is +Inf
+    static uint64_t bound(std::size_t i) {
+        static const uint64_t kBOUNDS[kBUCKETS - 1] = {
+            1, 2, 5, 10, 20, 50, 100, 200, 500,
+            1000, 2000, 5000, 10000, 50000, 100000
+        };
+        return kBOUNDS[i];
+    }
+
+    histogram_t() : buckets_(), count_(0), sum_(0) { }
+
+    void observe(const duration_t& time) {
+        const int64_t us = time.total_microseconds();
+        observe(us < 0 ? 0 : static_cast<uint64_t>(us));
+    }
+
+    void observe(uint64_t us) {
+        std::size_t i = 0;
+        while (i < kBUCKETS - 1 && us > bound(i)) {
+            ++i;
+        }
+        buckets_[i].fetch_add(1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add(us, std::memory_order_relaxed);
+    }
+
+    uint64_t bucket(std::size_t i) const { return buckets_[i].load(std::memory_order_relaxed); }
+    uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+    uint64_t sum() const { return sum_.load(std::memory_order_relaxed); }
+
+ private:
+    std::array<std::atomic<uint64_t>, kBUCKETS> buckets_;
+    std::atomic<uint64_t> count_;
+    std::atomic<uint64_t> sum_;
+};
+
+struct mmio_metrics_t {
+    counter_t commands;
+    histogram_t latency;
+};
+
+static const std::size_t kPV_OPS_COUNT = sizeof(kPV_OPS_STRING) / sizeof(kPV_OPS_STRING[0]);
+
+// metrics of one context
+class context_metrics_t : private boost::noncopyable {
+ public:
+    enum direction_t {
+        READ = 0,
+        WRITE = 1
+    };
+
+    mmio_metrics_t* mmio(command::bar_t bar, direction_t dir) {
+        return &mmio_[bar][dir];
+    }
+    const mmio_metrics_t* mmio(command::bar_t bar, direction_t dir) const {
+        return &mmio_[bar][dir];
+    }
+
+    // out of range ops are counted in the last entry
+    mmio_metrics_t* hypercall(uint32_t op) {
+        return &hypercalls_[op < kPV_OPS_COUNT ? op : kPV_OPS_COUNT];
+    }
+    const mmio_metrics_t* hypercall(uint32_t op) const {
+        return &hypercalls_[op < kPV_OPS_COUNT ? op : kPV_OPS_COUNT];
+    }
+
+    counter_t tlb_flushes;
+    counter_t mirrored;  // PTEs
+    counter_t shadow_rescans;
+    counter_t rescans_avoided;
+    counter_t submits;
+    gauge_t lazy_channels;
+    counter_t shadowing_transitions;
+    histogram_t shadowing;
+    histogram_t suspended;
+    counter_t gpu_busy;  // us
+    counter_t mmio_busy;       // us
+    counter_t throttled;
+    counter_t throttled_wait;  // us
+    counter_t evictions;
+    counter_t restores;
+    counter_t swapped_out;  // bytes
+    counter_t swapped_in;   // bytes
+    histogram_t restoring;
+
+ private:
+    std::array<std::array<mmio_metrics_t, 2>, command::BAR4 + 1> mmio_;
+    std::array<mmio_metrics_t, kPV_OPS_COUNT + 1> hypercalls_;
+};
+
+// render all contexts in the text exposition format
+std::string render_metrics();
+
+}  // namespace a3
+#endif  // A3_METRICS_H_
+/* vim: set sw=4 ts=4 et tw=80 : */
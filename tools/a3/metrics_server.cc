@@ -0,0 +1,63 @@
+/*
+ * A3 metrics server
+ *
+ * Copyright (c) 2012-2013 Yusuke Suzuki
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+#include "a3.h"
+#include "metrics.h"
+#include "metrics_server.h"
+namespace a3 {
+
+metrics_server_t::metrics_server_t(boost::asio::io_service& io_service, const char* endpoint)
+    : io_service_(io_service)
+    , acceptor_(io_service, boost::asio::local::stream_protocol::endpoint(endpoint))
+{
+    start_accept();
+}
+
+void metrics_server_t::start_accept() {
+    boost::shared_ptr<socket_t> socket = boost::make_shared<socket_t>(io_service_);
+    acceptor_.async_accept(
+        *socket,
+        boost::bind(&metrics_server_t::handle_accept, this, socket, boost::asio::placeholders::error));
+}
+
+void metrics_server_t::handle_accept(boost::shared_ptr<socket_t> socket, const boost::system::error_code& error) {
+    if (!error) {
+        boost::shared_ptr<std::string> body = boost::make_shared<std::string>(render_metrics());
+        boost::asio::async_write(
+            *socket,
+            boost::asio::buffer(*body),
+            boost::bind(&metrics_server_t::handle_write, this, socket, body, boost::asio::placeholders::error));
+    }
+    start_accept();
+}
+
+void metrics_server_t::handle_write(boost::shared_ptr<socket_t> socket, boost::shared_ptr<std::string> body, const boost::system::error_code& error) {
+    boost::system::error_code ignored;
+    socket->shutdown(socket_t::shutdown_both, ignored);
+    socket->close(ignored);
+}
+
+}  // namespace a3
+/* vim: set sw=4 ts=4 et tw=80 : */
@@ -0,0 +1,30 @@
+#ifndef A3_METRICS_SERVER_H_
+#define A3_METRICS_SERVER_H_
+#include <string>
+#include <boost/noncopyable.hpp>
+#include <boost/asio.hpp>
+#include <boost/shared_ptr.hpp>
+#include "a3.h"
+namespace a3 {
+
+// Serves metrics in the text exposition format on a UNIX socket.
+// Each connection receives one snapshot, e.g.
+//   socat - UNIX-CONNECT:/tmp/a3_metrics
+class metrics_server_t : private boost::noncopyable {
+ public:
+    metrics_server_t(boost::asio::io_service& io_service, const char* endpoint);
+
+ private:
+    typedef boost::asio::local::stream_protocol::socket socket_t;
+
+    void start_accept();
+    void handle_accept(boost::shared_ptr<socket_t> socket, const boost::system::error_code& error);
+    void handle_write(boost::shared_ptr<socket_t> socket, boost::shared_ptr<std::string> body, const boost::system::error_code& error);
+
+    boost::asio::io_service& io_service_;
+    boost::asio::local::stream_protocol::acceptor acceptor_;
+};
+
+}  // namespace a3
+#endif  // A3_METRICS_SERVER_H_
+/* vim: set sw=4 ts=4 et tw=80 : */
@@ -0,0 +1,118 @@
+/*
+ * A3 MMIO throttle
+ *
+ * Copyright (c) 2012-2013 Yusuke Suzuki
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <time.h>
+#include <boost/thread.hpp>
+#include "a3.h"
+#include "mmio_throttle.h"
+#include "metrics.h"
+namespace a3 {
+
+std::atomic<uint32_t> mmio_throttle_t::pending_(0);
+std::atomic<uint32_t> mmio_throttle_t::throttled_(0);
+
+mmio_throttle_t::mmio_throttle_t(uint32_t share, context_metrics_t* metrics)
+    : share_(share)
+    , metrics_(metrics)
+    , tokens_(kBURST)
+    , refilled_(clock_source_t::system()->now())
+    , started_()
+    , pending_self_(false)
+    , throttled_self_(false)
+{
+}
+
+mmio_throttle_t::~mmio_throttle_t() {
+    // the session thread may be interrupted while waiting
+    if (throttled_self_) {
+        throttled_.fetch_sub(1);
+    }
+    if (pending_self_) {
+        pending_.fetch_sub(1);
+    }
+}
+
+void mmio_throttle_t::refill(const timestamp_t& now) {
+    const int64_t elapsed = (now - refilled_).total_microseconds();
+    refilled_ = now;
+    if (elapsed > 0) {
+        tokens_ += elapsed * share_ / 100;
+        if (tokens_ > kBURST) {
+            tokens_ = kBURST;
+        }
+    }
+}
+
+bool mmio_throttle_t::contended() const {
+    // another session within its budget has a command. This session is
+    // counted in pending_, and in throttled_ only while it waits.
+    return pending_.load() > throttled_.load() + (throttled_self_ ? 0 : 1);
+}
+
+int64_t mmio_throttle_t::thread_time() {
+    struct timespec ts;
+    ::clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+void mmio_throttle_t::admit() {
+    pending_self_ = true;
+    pending_.fetch_add(1);
+    if (share_) {
+        wait();
+    }
+    started_ = thread_time();
+}
+
+void mmio_throttle_t::wait() {
+    refill(clock_source_t::system()->now());
+    if (tokens_ >= 0 || !contended()) {
+        return;
+    }
+
+    const timestamp_t start = refilled_;
+    metrics_->throttled.increment();
+    throttled_self_ = true;
+    throttled_.fetch_add(1);
+    while (tokens_ < 0 && contended()) {
+        const int64_t wait = (-tokens_ * 100) / share_ + 1;
+        boost::this_thread::sleep(microseconds(wait < kPOLL ? wait : kPOLL).to_posix());
+        refill(clock_source_t::system()->now());
+    }
+    throttled_self_ = false;
+    throttled_.fetch_sub(1);
+    metrics_->throttled_wait.increment((refilled_ - start).total_microseconds());
+}
+
+void mmio_throttle_t::charge() {
+    const int64_t us = thread_time() - started_;
+    metrics_->mmio_busy.increment(us);
+    if (share_) {
+        tokens_ -= us;
+    }
+    pending_self_ = false;
+    pending_.fetch_sub(1);
+}
+
+}  // namespace a3
+/* vim: set sw=4 ts=4 et tw=80 : */
@@ -0,0 +1,57 @@
+#ifndef A3_MMIO_THROTTLE_H_
+#define A3_MMIO_THROTTLE_H_
+#include <cstdint>
+#include <atomic>
+#include <boost/noncopyable.hpp>
+#include "a3.h"
+#include "clock.h"
+#include "duration.h"
+namespace a3 {
+
+class context_metrics_t;
+
+// Token bucket on the host CPU time a session spends handling MMIO commands.
+// The time is the thread CPU time, so that waiting for the device mutex held
+// by other sessions is not charged.
+//
+// Tokens (us) are refilled at share percent of one CPU, up to kBURST. A
+// session out of tokens waits before handling the next command, but only
+// while another session within its budget has a command to handle. So a
+// session alone on the device is never throttled, and noisy sessions
+// throttled together do not wait for each other.
+class mmio_throttle_t : private boost::noncopyable {
+ public:
+    static const int64_t kBURST = 20000;  // us
+    static const int64_t kPOLL = 100;     // us
+
+    mmio_throttle_t(uint32_t share, context_metrics_t* metrics);
+    ~mmio_throttle_t();
+
+    // called after a command is received, may wait
+    void admit();
+
+    // called after the command is handled
+    void charge();
+
+ private:
+    static int64_t thread_time();  // us
+    void wait();
+    void refill(const timestamp_t& now);
+    bool contended() const;
+
+    // sessions having a received command, and those of them out of tokens
+    static std::atomic<uint32_t> pending_;
+    static std::atomic<uint32_t> throttled_;
+
+    uint32_t share_;
+    context_metrics_t* metrics_;
+    int64_t tokens_;
+    timestamp_t refilled_;
+    int64_t started_;
+    bool pending_self_;
+    bool throttled_self_;
+};
+
+}  // namespace a3
+#endif  // A3_MMIO_THROTTLE_H_
+/* vim: set sw=4 ts=4 et tw=80 : */
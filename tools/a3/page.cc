@@ -25,26 +25,34 @@
 #include "a3.h"
 #include "page.h"
 #include "pmem.h"
+#include "page_pool.h"
+#include "scrubber.h"
 namespace a3 {
 
-page::page(std::size_t n)
+page::page(std::size_t n, bool zeroed)
     : vram_() {
+    if (zeroed) {
+        vram_ = device()->page_pool()->allocate(n);
+        return;
+    }
     A3_SYNCHRONIZED(device()->mutex()) {
         vram_ = device()->malloc(n);
     }
 }
 
 page::~page() {
+    // returned to the device after zero filled
+    if (scrubber_t* scrubber = device()->scrubber()) {
+        scrubber->release(vram_);
+        return;
+    }
     A3_SYNCHRONIZED(device()->mutex()) {
         device()->free(vram_);
     }
 }
 
 void page::clear() {
-    pmem::accessor pmem;
-    for (std::size_t i = 0; i < (size() / sizeof(uint32_t)); i += sizeof(uint32_t)) {
-        pmem.write32(address() + i, 0);
-    }
+    device()->clear_pmem(address(), size());
 }
 
 void page::write32(uint64_t offset, uint32_t value) {
@@ -7,7 +7,8 @@ namespace a3 {
 
 class page : private boost::noncopyable {
  public:
-    page(std::size_t n = 1);
+    // zeroed pages are taken from the device page pool
+    explicit page(std::size_t n = 1, bool zeroed = false);
     ~page();
     void clear();
     uint64_t address() const { return vram_->address(); }
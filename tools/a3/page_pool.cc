@@ -0,0 +1,153 @@
+/*
+ * A3 Page Pool
+ *
+ * Copyright (c) 2012-2013 Yusuke Suzuki
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <cstdint>
+#include "a3.h"
+#include "page_pool.h"
+#include "device.h"
+#include "vram.h"
+namespace a3 {
+
+page_pool_t::page_pool_t()
+    : classes_()
+    , thread_()
+    , mutex_()
+    , cond_()
+    , hits_(0)
+    , misses_(0)
+{
+    // channel RAMIN
+    classes_[0].pages = 1;
+    classes_[0].target = A3_CHANNELS;
+    // shadow page directory
+    classes_[1].pages = 0x10;
+    classes_[1].target = A3_CHANNELS;
+}
+
+page_pool_t::~page_pool_t() {
+    stop();
+    A3_SYNCHRONIZED(device()->mutex()) {
+        for (class_t& cls : classes_) {
+            for (vram_t* mem : cls.blocks) {
+                device()->free(mem);
+            }
+            cls.blocks.clear();
+        }
+    }
+}
+
+void page_pool_t::start() {
+    if (thread_) {
+        stop();
+    }
+    thread_.reset(new boost::thread(&page_pool_t::run, this));
+}
+
+void page_pool_t::stop() {
+    if (thread_) {
+        thread_->interrupt();
+        thread_->join();
+        thread_.reset();
+    }
+}
+
+page_pool_t::class_t* page_pool_t::lookup(std::size_t n) {
+    for (class_t& cls : classes_) {
+        if (cls.pages == n) {
+            return &cls;
+        }
+    }
+    return nullptr;
+}
+
+page_pool_t::class_t* page_pool_t::next_to_fill() {
+    // the emptiest class first
+    class_t* result = nullptr;
+    for (class_t& cls : classes_) {
+        if (cls.blocks.size() < cls.target && (!result || cls.blocks.size() * result->target < result->blocks.size() * cls.target)) {
+            result = &cls;
+        }
+    }
+    return result;
+}
+
+vram_t* page_pool_t::allocate(std::size_t n) {
+    if (class_t* cls = lookup(n)) {
+        boost::unique_lock<boost::mutex> lock(mutex_);
+        if (!cls->blocks.empty()) {
+            vram_t* mem = cls->blocks.back();
+            cls->blocks.pop_back();
+            hits_.fetch_add(1, std::memory_order_relaxed);
+            cond_.notify_all();
+            return mem;
+        }
+    }
+    misses_.fetch_add(1, std::memory_order_relaxed);
+    vram_t* mem = nullptr;
+    A3_SYNCHRONIZED(device()->mutex()) {
+        mem = device()->malloc(n);
+        device()->clear_pmem(mem->address(), mem->n() * kPAGE_SIZE);
+    }
+    return mem;
+}
+
+void page_pool_t::wait_filled() {
+    boost::unique_lock<boost::mutex> lock(mutex_);
+    while (next_to_fill()) {
+        cond_.wait(lock);
+    }
+}
+
+void page_pool_t::run() {
+    while (true) {
+        class_t* cls = nullptr;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex_);
+            while (!(cls = next_to_fill())) {
+                cond_.wait(lock);
+            }
+        }
+
+        vram_t* mem = nullptr;
+        A3_SYNCHRONIZED(device()->mutex()) {
+            mem = device()->malloc(cls->pages);
+        }
+
+        // low priority, release the device between slices
+        const uint64_t size = mem->n() * kPAGE_SIZE;
+        for (uint64_t offset = 0; offset < size; offset += kSLICE) {
+            device()->clear_pmem(mem->address() + offset, (size - offset < kSLICE) ? size - offset : kSLICE);
+            boost::this_thread::yield();
+        }
+
+        {
+            boost::unique_lock<boost::mutex> lock(mutex_);
+            cls->blocks.push_back(mem);
+            cond_.notify_all();
+        }
+        boost::this_thread::interruption_point();
+    }
+}
+
+}  // namespace a3
+/* vim: set sw=4 ts=4 et tw=80 : */
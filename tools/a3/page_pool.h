@@ -0,0 +1,63 @@
+#ifndef A3_PAGE_POOL_H_
+#define A3_PAGE_POOL_H_
+#include <cstdint>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <boost/noncopyable.hpp>
+#include <boost/thread.hpp>
+#include "a3.h"
+namespace a3 {
+
+class vram_t;
+
+// Pool of zero filled VRAM blocks.
+//
+// Channel RAMIN, shadow page directories and PV pages are allocated and
+// zero filled on every context bring-up. The filler thread keeps zeroed
+// blocks of these sizes ready, so that bring-up does not wait for PRAMIN
+// writes. Clearing is done in small slices, so that the device mutex is not
+// held long by the filler.
+class page_pool_t : private boost::noncopyable {
+ public:
+    static const uint64_t kSLICE = 0x10000;
+
+    page_pool_t();
+    ~page_pool_t();
+    void start();
+    void stop();
+
+    // returns zero filled n pages. When no zeroed block is pooled, it is
+    // allocated and cleared in place.
+    vram_t* allocate(std::size_t n);
+
+    // blocks until every class is filled up, used by the bring-up bench
+    void wait_filled();
+
+    uint64_t hits() const { return hits_.load(std::memory_order_relaxed); }
+    uint64_t misses() const { return misses_.load(std::memory_order_relaxed); }
+
+ private:
+    struct class_t {
+        std::size_t pages;
+        std::size_t target;
+        std::vector<vram_t*> blocks;
+    };
+    static const std::size_t kCLASSES = 2;
+
+    void run();
+    class_t* lookup(std::size_t n);
+    class_t* next_to_fill();
+
+    std::array<class_t, kCLASSES> classes_;
+    std::unique_ptr<boost::thread> thread_;
+    boost::mutex mutex_;
+    boost::condition_variable cond_;
+    std::atomic<uint64_t> hits_;
+    std::atomic<uint64_t> misses_;
+};
+
+}  // namespace a3
+#endif  // A3_PAGE_POOL_H_
+/* vim: set sw=4 ts=4 et tw=80 : */
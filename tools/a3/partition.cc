@@ -0,0 +1,169 @@
+/*
+ * A3 partition
+ *
+ * Copyright (c) 2012-2013 Yusuke Suzuki
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <cstdio>
+#include <algorithm>
+#include <cinttypes>
+#include <fstream>
+#include <sstream>
+#include "a3.h"
+#include "partition.h"
+#include "page_table.h"
+#include "flags.h"
+namespace a3 {
+
+static const uint64_t kMB = 1ULL << 20;
+
+static uint64_t floor_pow2(uint64_t value) {
+    uint64_t result = 1;
+    while ((result << 1) <= value) {
+        result <<= 1;
+    }
+    return result;
+}
+
+std::vector<partition_slot_t>& partition_t::slots() {
+    static std::vector<partition_slot_t> slots;
+    return slots;
+}
+
+bool partition_t::configure(uint32_t vms) {
+    if (vms == 0 || vms > A3_CHANNELS) {
+        A3_FATAL(stderr, "invalid VM number %" PRIu32 ", should be 1 - %d\n", vms, A3_CHANNELS);
+        return false;
+    }
+    const uint64_t memory = (A3_GUEST_MEMORY_TOTAL / vms) & ~(kMB - 1);
+    const request_t request = { memory, memory, A3_CHANNELS / vms };
+    return layout(std::vector<request_t>(vms, request));
+}
+
+bool partition_t::configure(const std::string& file) {
+    std::ifstream stream(file.c_str());
+    if (!stream) {
+        A3_FATAL(stderr, "cannot open partition file %s\n", file.c_str());
+        return false;
+    }
+    std::vector<request_t> requests;
+    std::string line;
+    for (uint32_t lineno = 1; std::getline(stream, line); ++lineno) {
+        const std::string::size_type pos = line.find_first_not_of(" \t");
+        if (pos == std::string::npos || line[pos] == '#') {
+            continue;
+        }
+        std::istringstream ss(line);
+        uint64_t memory = 0;
+        uint32_t channels = 0;
+        if (!(ss >> memory >> channels)) {
+            A3_FATAL(stderr, "%s:%" PRIu32 ": expected \"<memory MB> <channels> [quota MB]\"\n", file.c_str(), lineno);
+            return false;
+        }
+        uint64_t quota = memory;
+        if (!(ss >> quota)) {
+            quota = memory;
+        }
+        const request_t request = { memory * kMB, quota * kMB, channels };
+        requests.push_back(request);
+    }
+    return layout(requests);
+}
+
+bool partition_t::layout(const std::vector<request_t>& requests) {
+    if (requests.empty() || requests.size() > A3_CHANNELS) {
+        A3_FATAL(stderr, "invalid VM number %" PRIu64 ", should be 1 - %d\n", static_cast<uint64_t>(requests.size()), A3_CHANNELS);
+        return false;
+    }
+
+    // BAR3 arena is exposed to the guest as PCI BAR, so it should be power of 2
+    const uint64_t bar3_size = floor_pow2(A3_BAR3_TOTAL_SIZE / requests.size());
+    if (bar3_size < kLARGE_PAGE_SIZE) {
+        A3_FATAL(stderr, "BAR3 arena is too small for %" PRIu64 " VMs\n", static_cast<uint64_t>(requests.size()));
+        return false;
+    }
+
+    std::vector<partition_slot_t> result;
+    uint64_t memory_base = 0;
+    uint32_t channel_base = 0;
+    for (std::size_t i = 0; i < requests.size(); ++i) {
+        uint64_t size = requests[i].memory;
+        const uint32_t channels = requests[i].channels;
+        if (size < kMB || channels == 0) {
+            A3_FATAL(stderr, "VM %" PRIu64 " requires at least 1MB memory and 1 channel\n", static_cast<uint64_t>(i));
+            return false;
+        }
+
+        // guest sees memory as memory controller partitions
+        partition_slot_t slot;
+        slot.memory_ctl_part = std::min<uint64_t>(A3_MEMORY_CTL_PART, size);
+        slot.memory_ctl_num = size / slot.memory_ctl_part;
+        size = slot.memory_ctl_part * slot.memory_ctl_num;
+
+        slot.memory_base = memory_base;
+        slot.memory_size = size;
+        slot.memory_quota = std::min(requests[i].quota, size);
+        slot.channel_base = channel_base;
+        slot.channels = channels;
+        slot.bar3_base = bar3_size * i;
+        slot.bar3_size = bar3_size;
+
+        if (flags::dynamic_vram) {
+            // backed on demand, so slots may overcommit the area
+            if (slot.memory_quota > A3_GUEST_MEMORY_TOTAL) {
+                A3_FATAL(stderr, "VM %" PRIu64 " quota exceeds %" PRIu64 "MB\n", static_cast<uint64_t>(i), static_cast<uint64_t>(A3_GUEST_MEMORY_TOTAL / kMB));
+                return false;
+            }
+            slot.memory_base = 0;
+        } else {
+            memory_base += size;
+        }
+        channel_base += channels;
+        result.push_back(slot);
+    }
+
+    if (memory_base > A3_GUEST_MEMORY_TOTAL) {
+        A3_FATAL(stderr, "total memory %" PRIu64 "MB exceeds %" PRIu64 "MB\n", memory_base / kMB, static_cast<uint64_t>(A3_GUEST_MEMORY_TOTAL / kMB));
+        return false;
+    }
+
+    if (channel_base > A3_CHANNELS) {
+        A3_FATAL(stderr, "total channels %" PRIu32 " exceeds %d\n", channel_base, A3_CHANNELS);
+        return false;
+    }
+
+    slots().swap(result);
+    return true;
+}
+
+void partition_t::dump() {
+    for (uint32_t i = 0, iz = vms(); i < iz; ++i) {
+        const partition_slot_t& s = slot(i);
+        A3_LOG("VM %" PRIu32 ": memory 0x%" PRIx64 " - 0x%" PRIx64 " (%" PRIu32 " x %" PRIu64 "MB, quota %" PRIu64 "MB) channels %" PRIu32 " - %" PRIu32 " BAR3 0x%" PRIx64 " - 0x%" PRIx64 "\n",
+               i,
+               s.memory_base, s.memory_base + s.memory_size,
+               s.memory_ctl_num, s.memory_ctl_part / kMB, s.memory_quota / kMB,
+               s.channel_base, s.channel_base + s.channels,
+               s.bar3_base, s.bar3_base + s.bar3_size);
+    }
+}
+
+}  // namespace a3
+/* vim: set sw=4 ts=4 et tw=80 : */
@@ -0,0 +1,51 @@
+#ifndef A3_PARTITION_H_
+#define A3_PARTITION_H_
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "a3.h"
+namespace a3 {
+
+// Resources assigned to one virtualized GPU (slot).
+struct partition_slot_t {
+    uint64_t memory_base;   // offset from 0 of the device memory
+    uint64_t memory_size;   // size guest sees
+    uint64_t memory_quota;  // host memory backing it with --dynamic-vram
+    uint64_t memory_ctl_part;
+    uint32_t memory_ctl_num;
+    uint32_t channel_base;
+    uint32_t channels;
+    uint64_t bar3_base;     // offset in BAR3 effective area
+    uint64_t bar3_size;
+};
+
+// Decides how the device memory, channels and BAR3 area are split into slots.
+// Configured once in main before the device is initialized.
+class partition_t {
+ public:
+    // uniform partitioning, split resources into vms equal slots
+    static bool configure(uint32_t vms);
+
+    // partitioning from file. Each line is "<memory MB> <channels> [quota MB]"
+    // and describes one slot. Empty lines and lines starting with '#' are
+    // ignored. Quota defaults to memory and is meaningful with --dynamic-vram.
+    static bool configure(const std::string& file);
+
+    static uint32_t vms() { return slots().size(); }
+    static const partition_slot_t& slot(uint32_t id) { return slots()[id]; }
+
+    static void dump();
+
+ private:
+    struct request_t {
+        uint64_t memory;
+        uint64_t quota;
+        uint32_t channels;
+    };
+    static bool layout(const std::vector<request_t>& requests);
+    static std::vector<partition_slot_t>& slots();
+};
+
+}  // namespace a3
+#endif  // A3_PARTITION_H_
+/* vim: set sw=4 ts=4 et tw=80 : */
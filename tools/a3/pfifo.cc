@@ -23,29 +23,20 @@
  */
 #include "a3.h"
 #include "pfifo.h"
+#include "chipset_traits.h"
 #include "device.h"
 #include "context.h"
 #include "registers.h"
 #include "bit_mask.h"
 namespace a3 {
 
-pfifo_t::pfifo_t()
-    : total_channels_(A3_CHANNELS)
-    , channels_(A3_DOMAIN_CHANNELS)
-    , range_(device()->chipset()->type() == card::NVC0 ? 0x003000 : 0x800000)
-{
-}
-
-bool pfifo_t::in_range(uint32_t offset) const {
-    return offset >= range() && (offset - range()) <= total_channels() * 8;
-}
-
+template<typename Chipset>
 void pfifo_t::write(context* ctx, command cmd) {
     // channel status access
     // we should shift access target by guest VM
-    const bool ramin_area = ((cmd.offset - range()) % 0x8) == 0;
-    const uint32_t virt_channel_id = (cmd.offset - range()) / 0x8;
-    if (virt_channel_id >= channels()) {
+    const bool ramin_area = ((cmd.offset - Chipset::kPFIFO) % 0x8) == 0;
+    const uint32_t virt_channel_id = (cmd.offset - Chipset::kPFIFO) / 0x8;
+    if (virt_channel_id >= ctx->domain_channels()) {
         // these channels cannot be used
 
         if (ramin_area) {
@@ -81,13 +72,14 @@ void pfifo_t::write(context* ctx, command cmd) {
     return;
 }
 
+template<typename Chipset>
 uint32_t pfifo_t::read(context* ctx, command cmd) {
-    ASSERT(in_range(cmd.offset));
+    ASSERT(in_range<Chipset>(cmd.offset));
     // channel status access
     // we should shift access target by guest VM
-    const bool ramin_area = ((cmd.offset - range()) % 0x8) == 0;
-    const uint32_t virt_channel_id = (cmd.offset - range()) / 0x8;
-    if (virt_channel_id >= channels()) {
+    const bool ramin_area = ((cmd.offset - Chipset::kPFIFO) % 0x8) == 0;
+    const uint32_t virt_channel_id = (cmd.offset - Chipset::kPFIFO) / 0x8;
+    if (virt_channel_id >= ctx->domain_channels()) {
         // these channels cannot be used
 
         if (ramin_area) {
@@ -114,5 +106,11 @@ uint32_t pfifo_t::read(context* ctx, command cmd) {
     }
 }
 
+#define V(card, traits)\
+    template void pfifo_t::write<traits>(context* ctx, command cmd);\
+    template uint32_t pfifo_t::read<traits>(context* ctx, command cmd);
+A3_CHIPSET_TRAITS_LIST(V)
+#undef V
+
 }  // namespace a3
 /* vim: set sw=4 ts=4 et tw=80 : */
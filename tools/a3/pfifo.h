@@ -7,21 +7,19 @@ namespace a3 {
 class device_t;
 class context;
 
+// Channel RAMIN / status pairs of PFIFO at Chipset::kPFIFO.
 class pfifo_t {
  public:
-    pfifo_t();
-    inline uint32_t channels() const { return channels_; }
-    bool in_range(uint32_t offset) const;
-    void write(context* ctx, command cmd);
-    uint32_t read(context* ctx, command cmd);
+    template<typename Chipset>
+    static bool in_range(uint32_t offset) {
+        return offset >= Chipset::kPFIFO && (offset - Chipset::kPFIFO) <= A3_CHANNELS * 8;
+    }
 
- private:
-    inline uint32_t total_channels() const { return total_channels_; }
-    inline uint32_t range() const { return range_; }
+    template<typename Chipset>
+    static void write(context* ctx, command cmd);
 
-    uint32_t total_channels_;
-    uint32_t channels_;
-    uint32_t range_;
+    template<typename Chipset>
+    static uint32_t read(context* ctx, command cmd);
 };
 
 }  // namespace a3
@@ -22,16 +22,19 @@
  * THE SOFTWARE.
  */
 #include <cstdio>
+#include <algorithm>
 #include "a3.h"
 #include "page.h"
 #include "playlist.h"
 #include "context.h"
-#include "pmem.h"
+#include "device.h"
 #include "bit_mask.h"
 #include "registers.h"
 #include "make_unique.h"
 namespace a3 {
 
+static const uint64_t kENTRY_SIZE = 0x8;
+
 void flush_bar() {
     // flush
     registers::accessor regs;
@@ -41,61 +44,151 @@ void flush_bar() {
     }
 }
 
-template<typename engine_t>
-void playlist_update(context* ctx, engine_t* engine, uint64_t address, uint32_t cmd, uint32_t status) {
-    // scan fifo and update values
-    pmem::accessor pmem;
+std::size_t runlist_t::commit(const channels_t& channels, uint32_t select) {
+    registers::accessor regs;
+    if (pages_[cursor_ & 0x1] && channels == committed_ && select == committed_select_) {
+        regs.write32(0x2270, pages_[cursor_ & 0x1]->address() >> 12);
+        regs.write32(0x2274, select | static_cast<uint32_t>(channels.count()));
+        A3_LOG("playlist commit unchanged\n");
+        return 0;
+    }
+    committed_ = channels;
+    committed_select_ = select;
 
-    // at first, clear ctx channel enables
-    for (uint32_t i = 0; i < A3_DOMAIN_CHANNELS; ++i) {
-        const uint32_t cid = ctx->get_phys_channel_id(i);
-        // A3_LOG("1: playlist update id %u\n", cid);
-        engine->set(cid, false);
+    cursor_ ^= 1;
+    const int index = cursor_ & 0x1;
+    if (!pages_[index]) {
+        pages_[index] = make_unique<page>(size_);
     }
+    page* page = pages_[index].get();
+    std::vector<uint32_t>& image = images_[index];
 
-    const uint32_t count = bit_mask<8, uint32_t>(cmd);
-    A3_LOG("playlist update %u\n", count);
+    entries_.clear();
+    for (uint32_t i = 0; i < A3_CHANNELS; ++i) {
+        if (channels[i]) {
+            entries_.push_back(i);
+            entries_.push_back(status_);
+        }
+    }
+
+    // the back page holds the list committed two times before, so only
+    // runs of entries differing from it are written
+    std::size_t written = 0;
+    const std::size_t size = entries_.size();
+    for (std::size_t i = 0; i < size;) {
+        if (i < image.size() && image[i] == entries_[i]) {
+            ++i;
+            continue;
+        }
+        std::size_t end = i + 1;
+        while (end < size && !(end < image.size() && image[end] == entries_[end])) {
+            ++end;
+        }
+        device()->write_pmem_block(page->address() + i * sizeof(uint32_t), entries_.data() + i, (end - i) * sizeof(uint32_t));
+        written += end - i;
+        i = end;
+    }
+    if (image.size() < size) {
+        image.resize(size);
+    }
+    std::copy(entries_.begin(), entries_.end(), image.begin());
+
+    const uint32_t count = size / 2;
+    regs.write32(0x2270, page->address() >> 12);
+    regs.write32(0x2274, select | count);
+    A3_LOG("playlist commit %x with %u channels, %u words written\n", static_cast<unsigned>(page->address() >> 12), count, static_cast<unsigned>(written));
+    return written;
+}
+
+playlist_t::playlist_t(std::size_t engines, std::size_t pages, uint32_t status)
+    : mutex_()
+    , cond_()
+    , engines_()
+    , committing_(false)
+    , requested_(0)
+    , committed_(0)
+{
+    for (std::size_t i = 0; i < engines; ++i) {
+        engines_.push_back(make_unique<runlist_t>(pages, status));
+    }
+}
 
-    if (!count) {
+void playlist_t::update(context* ctx, uint64_t address, uint32_t cmd) {
+    const std::size_t eng = engine(cmd);
+    if (eng >= engines()) {
+        A3_LOG("playlist invalid engine %u\n", cmd >> 20);
         return;
     }
 
-    page* page = engine->toggle();
+    // read the guest playlist in blocks, it may cross host chunks
+    const uint32_t count = bit_mask<8, uint32_t>(cmd);
+    std::vector<uint32_t> words(count * kENTRY_SIZE / sizeof(uint32_t));
+    for (uint64_t offset = 0, size = count * kENTRY_SIZE; offset < size;) {
+        const uint64_t phys = ctx->get_phys_address(address, offset);
+        if (phys == UINT64_MAX) {
+            A3_LOG("playlist out of VRAM\n");
+            return;
+        }
+        const uint64_t length = std::min<uint64_t>(size - offset, kVRAM_CHUNK_SIZE - phys % kVRAM_CHUNK_SIZE);
+        device()->read_pmem_block(phys, words.data() + offset / sizeof(uint32_t), length);
+        offset += length;
+    }
 
+    runlist_t::channels_t channels;
     for (uint32_t i = 0; i < count; ++i) {
-        const uint32_t vid = pmem.read32(address + i * 0x8);
-        const uint32_t cid = ctx->get_phys_channel_id(vid);
-        A3_LOG("2: playlist update id %u => %u / %u\n", i, cid, vid);
-        engine->set(cid, true);
+        const uint32_t vid = words[i * kENTRY_SIZE / sizeof(uint32_t)];
+        if (vid >= ctx->domain_channels()) {
+            A3_LOG("playlist invalid channel %u\n", vid);
+            continue;
+        }
+        channels.set(ctx->get_phys_channel_id(vid));
     }
+    A3_LOG("playlist update %u\n", count);
 
-    uint32_t phys_count = 0;
-    for (uint32_t i = 0; i < A3_CHANNELS; ++i) {
-        if (engine->get(i)) {
-            page->write32(phys_count * 0x8 + 0x0, i);
-            page->write32(phys_count * 0x8 + 0x4, status);
-            ++phys_count;
-        }
+    boost::mutex::scoped_lock lock(mutex_);
+    runlist_t* list = engines_[eng].get();
+    for (uint32_t i = 0; i < ctx->domain_channels(); ++i) {
+        const uint32_t cid = ctx->get_phys_channel_id(i);
+        list->set(cid, channels[cid]);
     }
+    list->set_select((cmd >> 20) << 20);
+    list->request();
 
-    const uint64_t shadow = page->address();
-    const uint32_t phys_cmd = ((cmd >> 20) << 20) | phys_count;
-    registers::accessor regs;
-    A3_LOG("playlist address shadow %x provided %x\n", static_cast<unsigned>(shadow >> 12), static_cast<unsigned>(address >> 12));
-    regs.write32(0x2270, shadow >> 12);
-    regs.write32(0x2274, phys_cmd);
-    A3_LOG("playlist cmd from %x to %x\n", cmd, phys_cmd);
+    const uint64_t ticket = ++requested_;
+    while (committed_ < ticket) {
+        if (committing_) {
+            cond_.wait(lock);
+            continue;
+        }
+        commit(&lock);
+    }
 }
 
-void nvc0_playlist_t::update(context* ctx, uint64_t address, uint32_t cmd) {
-    playlist_update(ctx, &engine_, address, cmd, 0x4);
-}
+// The committer takes the runlists changed so far, writes them without the
+// playlist mutex, and wakes up updates covered by it.
+void playlist_t::commit(boost::mutex::scoped_lock* lock) {
+    committing_ = true;
+    const uint64_t target = requested_;
+    std::vector<std::pair<runlist_t*, std::pair<runlist_t::channels_t, uint32_t>>> lists;
+    for (const std::unique_ptr<runlist_t>& list : engines_) {
+        if (list->dirty()) {
+            lists.push_back(std::make_pair(list.get(), std::make_pair(list->channels(), list->select())));
+            list->clear_dirty();
+        }
+    }
+    lock->unlock();
+
+    A3_SYNCHRONIZED(device()->mutex()) {
+        for (const auto& list : lists) {
+            list.first->commit(list.second.first, list.second.second);
+        }
+    }
 
-void nve0_playlist_t::update(context* ctx, uint64_t address, uint32_t cmd) {
-    const uint32_t eng = (cmd >> 20);
-    ASSERT(eng < engines_.size());
-    A3_LOG("playlist engine %u\n",eng);
-    playlist_update(ctx, &engines_[eng], address, cmd, 0x0);
+    lock->lock();
+    A3_LOG("playlist %u updates in one commit\n", static_cast<unsigned>(target - committed_));
+    committed_ = target;
+    committing_ = false;
+    cond_.notify_all();
 }
 
 }  // namespace a3
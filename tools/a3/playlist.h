@@ -1,68 +1,115 @@
 #ifndef A3_PLAYLIST_H_
 #define A3_PLAYLIST_H_
+#include <array>
 #include <bitset>
+#include <memory>
+#include <vector>
 #include <boost/noncopyable.hpp>
+#include <boost/thread.hpp>
 #include "a3.h"
-#include "make_unique.h"
 #include "page.h"
 namespace a3 {
 
 class page;
 class context;
 
-template<size_t N>
-struct engine_t {
+// Runlist of one engine. The merged list is kept in host memory and double
+// buffered on the device. Each page remembers what was written to it, so a
+// commit only writes the entries which differ from the back page. A commit
+// of the list already on the device only writes the registers again, so the
+// hardware still acknowledges the guest update.
+class runlist_t : private boost::noncopyable {
  public:
-    engine_t()
+    typedef std::bitset<A3_CHANNELS> channels_t;
+
+    runlist_t(std::size_t pages, uint32_t status)
         : channels_()
+        , select_()
+        , dirty_(false)
+        , committed_()
+        , committed_select_()
         , pages_()
+        , images_()
+        , entries_()
+        , size_(pages)
+        , status_(status)
         , cursor_()
     {
     }
 
-    page* toggle() {
-        cursor_ ^= 1;
-        const int index = cursor_ & 0x1;
-        if (!pages_[index]) {
-            pages_[index] = make_unique<page>(N);
+    // under the playlist mutex
+    void set(uint32_t cid, bool val) {
+        if (channels_[cid] != val) {
+            channels_.set(cid, val);
+            dirty_ = true;
         }
-        return pages_[index].get();
     }
-
-    void set(int index, bool val) {
-        channels_.set(index, val);
+    void set_select(uint32_t select) {
+        if (select_ != select) {
+            select_ = select;
+            dirty_ = true;
+        }
     }
+    // every guest update is committed, even when it changes nothing
+    void request() { dirty_ = true; }
+    bool dirty() const { return dirty_; }
+    const channels_t& channels() const { return channels_; }
+    uint32_t select() const { return select_; }
+    void clear_dirty() { dirty_ = false; }
+
+    // by the committer only, with the device mutex held. returns the
+    // number of written words
+    std::size_t commit(const channels_t& channels, uint32_t select);
 
-    bool get(int index) {
-        return channels_[index];
-    }
  private:
-    std::bitset<A3_CHANNELS> channels_;
+    channels_t channels_;
+    uint32_t select_;  // upper bits of PLAYLIST_WR_LEN
+    bool dirty_;
+    channels_t committed_;
+    uint32_t committed_select_;
     std::array<std::unique_ptr<page>, 2> pages_;
+    std::array<std::vector<uint32_t>, 2> images_;
+    std::vector<uint32_t> entries_;
+    std::size_t size_;
+    uint32_t status_;
     int cursor_;
 };
 
+// Physical playlist shared by all contexts. A guest update is applied to
+// the merged runlist of the engine as the delta of its channels. Updates
+// arriving while a commit is in flight are written by the next commit
+// together, and each update returns once a commit covering it is done.
 class playlist_t : private boost::noncopyable {
  public:
-    virtual void update(context* ctx, uint64_t address, uint32_t cmd) = 0;
-};
+    playlist_t(std::size_t engines, std::size_t pages, uint32_t status);
+    virtual ~playlist_t() { }
+    void update(context* ctx, uint64_t address, uint32_t cmd);
+
+ protected:
+    // engine index of cmd, indices not below engines() are rejected
+    virtual std::size_t engine(uint32_t cmd) const = 0;
+    std::size_t engines() const { return engines_.size(); }
 
-class nvc0_playlist_t : public playlist_t {
- public:
-    nvc0_playlist_t() : engine_() { }
-    virtual void update(context* ctx, uint64_t address, uint32_t cmd);
  private:
-    engine_t<1> engine_;
+    void commit(boost::mutex::scoped_lock* lock);
+
+    boost::mutex mutex_;
+    boost::condition_variable cond_;
+    std::vector<std::unique_ptr<runlist_t>> engines_;
+    bool committing_;
+    uint64_t requested_;
+    uint64_t committed_;
 };
 
-class nve0_playlist_t : public playlist_t {
+template<typename Chipset>
+class chipset_playlist_t : public playlist_t {
  public:
-    static const int NR_ENGINES = 7;
-
-    nve0_playlist_t() : engines_() { }
-    virtual void update(context* ctx, uint64_t address, uint32_t cmd);
- private:
-    std::array<engine_t<8>, NR_ENGINES> engines_;
+    chipset_playlist_t()
+        : playlist_t(Chipset::kENGINES, Chipset::kRUNLIST_PAGES, Chipset::kRUNLIST_STATUS)
+    {
+    }
+ protected:
+    virtual std::size_t engine(uint32_t cmd) const { return Chipset::engine(cmd); }
 };
 
 }  // namespace a3
@@ -24,41 +24,12 @@
 #include <cstdint>
 #include "a3.h"
 #include "poll_area.h"
-#include "context.h"
-#include "device_bar1.h"
 namespace a3 {
 
 poll_area_t::poll_area_t()
-    : per_size_(device()->chipset()->type() == card::NVC0 ? 0x1000 : 0x200)
-    , area_()
+    : area_()
 {
 }
 
-bool poll_area_t::in_range(context* ctx, uint64_t offset) const {
-    return area_ <= offset &&
-        offset < area_ + (ctx->pfifo()->channels() * per_size_);
-}
-
-poll_area_t::channel_and_offset_t poll_area_t::extract_channel_and_offset(context* ctx, uint64_t offset) const {
-    channel_and_offset_t result = {};
-    const uint64_t sub = offset - area_;
-    result.channel = sub / per_size_;
-    result.offset = sub % per_size_;
-    return result;
-}
-
-void poll_area_t::write(context* ctx, const command& cmd) {
-    A3_SYNCHRONIZED(device()->mutex()) {
-        device()->bar1()->write(ctx, cmd);
-    }
-}
-
-uint32_t poll_area_t::read(context* ctx, const command& cmd) {
-    A3_SYNCHRONIZED(device()->mutex()) {
-        return device()->bar1()->read(ctx, cmd);
-    }
-    return 0;
-}
-
 }  // namespace a3
 /* vim: set sw=4 ts=4 et tw=80 : */
@@ -5,8 +5,6 @@
 #include "a3.h"
 namespace a3 {
 
-class context;
-
 class poll_area_t {
  public:
     struct channel_and_offset_t {
@@ -16,11 +14,20 @@ class poll_area_t {
 
     poll_area_t();
 
-    bool in_range(context* ctx, uint64_t offset) const;
-    channel_and_offset_t extract_channel_and_offset(context* ctx, uint64_t offset) const;
+    // the area holds Chipset::kCHANNEL_WINDOW bytes per channel
+    template<typename Chipset>
+    bool in_range(uint32_t channels, uint64_t offset) const {
+        return area_ <= offset && offset < area_ + (channels * Chipset::kCHANNEL_WINDOW);
+    }
 
-    void write(context* ctx, const command& cmd);
-    uint32_t read(context* ctx, const command& cmd);
+    template<typename Chipset>
+    channel_and_offset_t extract_channel_and_offset(uint64_t offset) const {
+        channel_and_offset_t result = {};
+        const uint64_t sub = offset - area_;
+        result.channel = sub / Chipset::kCHANNEL_WINDOW;
+        result.offset = sub % Chipset::kCHANNEL_WINDOW;
+        return result;
+    }
 
     void set_area(uint64_t area) {
         A3_LOG("POLL_AREA 0x%" PRIX64 "\n", area);
@@ -29,7 +36,6 @@ class poll_area_t {
     uint64_t area() const { return area_; }
 
  private:
-    uint32_t per_size_;
     uint64_t area_;
 };
 
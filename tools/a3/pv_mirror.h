@@ -0,0 +1,100 @@
+#ifndef A3_PV_MIRROR_H_
+#define A3_PV_MIRROR_H_
+#include <cstdint>
+#include <sys/mman.h>
+#include <boost/noncopyable.hpp>
+#include "a3.h"
+#include "page_table.h"
+#include "pv_page.h"
+namespace a3 {
+
+// Guest writable mirror of a PV page table, mapped from guest memory.
+//
+//   [0, size)             guest PTEs, same layout as the page table
+//   [size, size + bitmap) dirty bitmap, bit i set after PTE i is written
+//
+// The guest writes PTEs without hypercalls. A3 validates and translates the
+// dirty entries into the page table on NOUVEAU_PV_OP_VM_FLUSH. Each bitmap
+// word is taken atomically, so a PTE written while reconciling is marked
+// again and picked up by the next flush.
+class pv_mirror_t : private boost::noncopyable {
+ public:
+    pv_mirror_t(pv_page* pgt, uint8_t* mapping)
+        : pgt_(pgt)
+        , mapping_(mapping)
+        , entries_(pgt->size() / sizeof(uint64_t))
+    {
+    }
+
+    ~pv_mirror_t() {
+        munmap(mapping_, mapping_size(pgt_->size()));
+    }
+
+    // bytes to map for a page table of size bytes
+    static uint64_t mapping_size(uint64_t size) {
+        const uint64_t entries = size / sizeof(uint64_t);
+        const uint64_t bitmap = ((entries + 63) / 64) * sizeof(uint64_t);
+        return size + ((bitmap + kPAGE_SIZE - 1) & ~(kPAGE_SIZE - 1));
+    }
+
+    pv_page* pgt() const { return pgt_; }
+    uint64_t entries() const { return entries_; }
+
+    uint64_t entry(uint64_t index) const {
+        return reinterpret_cast<const volatile uint64_t*>(mapping_)[index];
+    }
+
+    // calls func(first, count) per run of dirty entries and clears them.
+    // returns the number of reconciled entries
+    template<typename Func>
+    uint64_t reconcile(Func func) {
+        uint64_t* bitmap = reinterpret_cast<uint64_t*>(mapping_ + pgt_->size());
+        uint64_t total = 0;
+        uint64_t first = 0;
+        uint64_t count = 0;
+        for (uint64_t word = 0; word * 64 < entries_; ++word) {
+            uint64_t bits = __atomic_load_n(bitmap + word, __ATOMIC_RELAXED);
+            if (bits) {
+                bits = __atomic_exchange_n(bitmap + word, 0, __ATOMIC_ACQUIRE);
+            }
+            for (; bits; bits &= bits - 1) {
+                const uint64_t index = word * 64 + __builtin_ctzll(bits);
+                if (index >= entries_) {
+                    break;
+                }
+                if (count && first + count == index) {
+                    ++count;
+                    continue;
+                }
+                if (count) {
+                    func(first, count);
+                    total += count;
+                }
+                first = index;
+                count = 1;
+            }
+        }
+        if (count) {
+            func(first, count);
+            total += count;
+        }
+        return total;
+    }
+
+    // marks every entry, the whole table is reconciled on the next flush
+    void mark_all() {
+        uint64_t* bitmap = reinterpret_cast<uint64_t*>(mapping_ + pgt_->size());
+        for (uint64_t word = 0; word * 64 < entries_; ++word) {
+            __atomic_store_n(bitmap + word, ~static_cast<uint64_t>(0), __ATOMIC_RELAXED);
+        }
+    }
+
+ private:
+    pv_page* pgt_;
+    uint8_t* mapping_;
+    uint64_t entries_;
+};
+
+}  // namespace a3
+#endif  // A3_PV_MIRROR_H_
+/* vim: set sw=4 ts=4 et tw=80 : */
@@ -7,10 +7,11 @@ namespace a3 {
 
 class pv_page : public page {
  public:
-    typedef std::bitset<A3_DOMAIN_CHANNELS + 2> bitset_t;
+    // domain channels are decided at runtime, but never exceed A3_CHANNELS
+    typedef std::bitset<A3_CHANNELS + 2> bitset_t;
 
-    static const int kBAR1 = A3_DOMAIN_CHANNELS;
-    static const int kBAR3 = A3_DOMAIN_CHANNELS + 1;
+    static const int kBAR1 = A3_CHANNELS;
+    static const int kBAR3 = A3_CHANNELS + 1;
 
     enum page_type_t {
         TYPE_NONE,
@@ -18,8 +19,8 @@ class pv_page : public page {
         TYPE_PGD
     };
 
-    pv_page(std::size_t n)
-    : page(n)
+    pv_page(std::size_t n, bool zeroed = false)
+    : page(n, zeroed)
     , page_type_(TYPE_NONE)
     , channel_bitset_()
     {}
@@ -37,7 +38,7 @@ class pv_page : public page {
 
  private:
     page_type_t page_type_;
-    std::bitset<A3_DOMAIN_CHANNELS + 2> channel_bitset_;
+    bitset_t channel_bitset_;
 };
 
 }  // namespace a3
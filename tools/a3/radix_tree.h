@@ -3,64 +3,300 @@
 #include <cstdint>
 #include <array>
 #include <memory>
+#include <vector>
+#include <boost/noncopyable.hpp>
+#include "assertion.h"
 namespace a3 {
 
-class radix_tree_t {
+// Fixed size node allocator. Nodes are carved from chunks and released nodes
+// are kept in the free list, so refreshing a table does not hit malloc.
+// Chunks grow geometrically, so that sparse tables stay small. Chunks are
+// returned once all nodes are released, for example when the context owning
+// a range of the tree goes away.
+template<typename Node>
+class node_pool_t : private boost::noncopyable {
  public:
-  static const uint64_t STAGE_BIT = 10;
-  static const uint64_t MASK = (1 << STAGE_BIT) - 1;
-
-  struct next_t { virtual ~next_t() { } };
-  struct entries_t : public next_t {
-    std::array<uint64_t, (1 << STAGE_BIT)> array;
-  };
-  struct stage_t : public next_t {
-    std::array<std::shared_ptr<next_t>, (1 << STAGE_BIT)> array;
-  };
-
-  radix_tree_t()
-      : first_()
-  {
-  }
-
-  uint64_t lookup(uint64_t address) {
-    if (entries_t* stage = lookup_entries(address, false)) {
-      const uint32_t index = address & MASK;
-      return static_cast<entries_t*>(stage)->array[index];
-    }
-    return 0;
-  }
-
-  void insert(uint64_t address, uint64_t value) {
-    entries_t* stage = lookup_entries(address, true);
-    ASSERT(stage);
-    const uint32_t index = address & MASK;
-    static_cast<entries_t*>(stage)->array[index] = value;
-  }
+    static const std::size_t kMAX_CHUNK = 16;
+
+    node_pool_t() : chunks_(), free_(), used_(), reserved_() { }
+
+    Node* allocate() {
+        if (free_.empty()) {
+            const std::size_t count = (reserved_ == 0) ? 1 : (reserved_ < kMAX_CHUNK) ? reserved_ : kMAX_CHUNK;
+            chunks_.emplace_back(new Node[count]);
+            for (std::size_t i = 0; i < count; ++i) {
+                free_.push_back(&chunks_.back()[count - i - 1]);
+            }
+            reserved_ += count;
+        }
+        Node* node = free_.back();
+        free_.pop_back();
+        node->reset();
+        ++used_;
+        return node;
+    }
+
+    void release(Node* node) {
+        if (--used_ == 0) {
+            chunks_.clear();
+            free_.clear();
+            reserved_ = 0;
+            return;
+        }
+        free_.push_back(node);
+    }
+
+    std::size_t used() const { return used_; }
+    std::size_t reserved() const { return reserved_; }
+
+ private:
+    std::vector<std::unique_ptr<Node[]>> chunks_;
+    std::vector<Node*> free_;
+    std::size_t used_;
+    std::size_t reserved_;
+};
+
+// Sparse array of T indexed by Bits bit index.
+//
+// Leaves hold 512 entries and are allocated when the first present entry is
+// stored, and released when the last one is erased. T() is the absent entry
+// and T should provide present(). Lookups walk at most 3 stages for 32bit
+// indices without touching any reference count.
+template<typename T, unsigned Bits>
+class radix_tree_t : private boost::noncopyable {
+ public:
+    static const unsigned kLEAF_BITS = 9;
+    static const unsigned kSTAGE_BITS = 10;
+    static const uint64_t kLEAF_SIZE = 1ULL << kLEAF_BITS;
+    static const uint64_t kLEAF_MASK = kLEAF_SIZE - 1;
+    static const uint64_t kSTAGE_SIZE = 1ULL << kSTAGE_BITS;
+    static const uint64_t kSTAGE_MASK = kSTAGE_SIZE - 1;
+    static const unsigned kDEPTH = (Bits <= kLEAF_BITS) ? 1 : (Bits - kLEAF_BITS + kSTAGE_BITS - 1) / kSTAGE_BITS;
+    static const uint64_t kSIZE = 1ULL << Bits;
+
+    radix_tree_t()
+        : root_()
+        , stages_()
+        , leaves_()
+    {
+        root_.reset();
+    }
+
+    ~radix_tree_t() {
+        clear();
+    }
+
+    // returns nullptr if the entry is not present
+    const T* lookup(uint64_t index) const {
+        if (index >= kSIZE) {
+            return nullptr;
+        }
+        const stage_t* stage = &root_;
+        for (unsigned level = 0; level + 1 < kDEPTH; ++level) {
+            stage = static_cast<const stage_t*>(stage->next[slot(index, level)]);
+            if (!stage) {
+                return nullptr;
+            }
+        }
+        const leaf_t* leaf = static_cast<const leaf_t*>(stage->next[slot(index, kDEPTH - 1)]);
+        if (!leaf) {
+            return nullptr;
+        }
+        const T& entry = leaf->entries[index & kLEAF_MASK];
+        return entry.present() ? &entry : nullptr;
+    }
+
+    // storing an absent entry erases it
+    void store(uint64_t index, const T& value) {
+        if (!value.present()) {
+            erase(index);
+            return;
+        }
+        ASSERT(index < kSIZE);
+        stage_t* stage = &root_;
+        for (unsigned level = 0; level + 1 < kDEPTH; ++level) {
+            void*& next = stage->next[slot(index, level)];
+            if (!next) {
+                next = stages_.allocate();
+                ++stage->used;
+            }
+            stage = static_cast<stage_t*>(next);
+        }
+        void*& next = stage->next[slot(index, kDEPTH - 1)];
+        if (!next) {
+            next = leaves_.allocate();
+            ++stage->used;
+        }
+        leaf_t* leaf = static_cast<leaf_t*>(next);
+        T& entry = leaf->entries[index & kLEAF_MASK];
+        if (!entry.present()) {
+            ++leaf->present;
+        }
+        entry = value;
+    }
+
+    void erase(uint64_t index) {
+        if (index >= kSIZE) {
+            return;
+        }
+        std::array<stage_t*, kDEPTH> path;
+        stage_t* stage = &root_;
+        for (unsigned level = 0; level + 1 < kDEPTH; ++level) {
+            path[level] = stage;
+            stage = static_cast<stage_t*>(stage->next[slot(index, level)]);
+            if (!stage) {
+                return;
+            }
+        }
+        path[kDEPTH - 1] = stage;
+        leaf_t* leaf = static_cast<leaf_t*>(stage->next[slot(index, kDEPTH - 1)]);
+        if (!leaf) {
+            return;
+        }
+        T& entry = leaf->entries[index & kLEAF_MASK];
+        if (!entry.present()) {
+            return;
+        }
+        entry = T();
+        if (--leaf->present) {
+            return;
+        }
+        leaves_.release(leaf);
+        prune(index, path);
+    }
+
+    // erases [first, last). Leaves fully covered are dropped without
+    // touching their entries.
+    void erase(uint64_t first, uint64_t last) {
+        last = (last < kSIZE) ? last : kSIZE;
+        while (first < last) {
+            const uint64_t leaf_end = (first | kLEAF_MASK) + 1;
+            if ((first & kLEAF_MASK) == 0 && leaf_end <= last) {
+                drop_leaf(first);
+            } else {
+                for (const uint64_t end = (leaf_end < last) ? leaf_end : last; first < end; ++first) {
+                    erase(first);
+                }
+            }
+            first = leaf_end;
+        }
+    }
+
+    void clear() {
+        clear_stage(&root_, 0);
+    }
+
+    // calls func(index, entry) for present entries in [first, last)
+    template<typename Func>
+    void for_each(uint64_t first, uint64_t last, Func func) const {
+        last = (last < kSIZE) ? last : kSIZE;
+        while (first < last) {
+            const uint64_t leaf_end = (first | kLEAF_MASK) + 1;
+            const uint64_t end = (leaf_end < last) ? leaf_end : last;
+            if (const leaf_t* leaf = find_leaf(first)) {
+                if (leaf->present) {
+                    for (; first < end; ++first) {
+                        const T& entry = leaf->entries[first & kLEAF_MASK];
+                        if (entry.present()) {
+                            func(first, entry);
+                        }
+                    }
+                }
+            }
+            first = leaf_end;
+        }
+    }
+
+    // host memory held by the tree
+    std::size_t memory() const {
+        return stages_.reserved() * sizeof(stage_t) + leaves_.reserved() * sizeof(leaf_t);
+    }
 
  private:
-  entries_t* lookup_entries(uint64_t address, bool create) {
-    next_t* stage = &first_;
-    for (uint32_t i = 0; i < 3; ++i) {
-      const uint32_t index = (address >> (STAGE_BIT * (3 - i))) & MASK;
-      stage_t* current = static_cast<stage_t*>(stage);
-      if (!current->array[index]) {
-        if (!create) {
-          return nullptr;
-        }
-        if (i == 3) {
-          current->array[index] = std::shared_ptr<next_t>(new entries_t());
-        } else {
-          current->array[index] = std::shared_ptr<next_t>(new stage_t());
-        }
-      }
-      stage = current->array[index].get();
-    }
-    return static_cast<entries_t*>(stage);
-  }
-
-  stage_t first_;
+    struct stage_t {
+        std::array<void*, kSTAGE_SIZE> next;
+        uint32_t used;
+        void reset() {
+            next.fill(nullptr);
+            used = 0;
+        }
+    };
+
+    struct leaf_t {
+        std::array<T, kLEAF_SIZE> entries;
+        uint32_t present;
+        void reset() {
+            entries.fill(T());
+            present = 0;
+        }
+    };
+
+    static uint64_t slot(uint64_t index, unsigned level) {
+        return (index >> (kLEAF_BITS + kSTAGE_BITS * (kDEPTH - 1 - level))) & kSTAGE_MASK;
+    }
+
+    const leaf_t* find_leaf(uint64_t index) const {
+        const stage_t* stage = &root_;
+        for (unsigned level = 0; level + 1 < kDEPTH; ++level) {
+            stage = static_cast<const stage_t*>(stage->next[slot(index, level)]);
+            if (!stage) {
+                return nullptr;
+            }
+        }
+        return static_cast<const leaf_t*>(stage->next[slot(index, kDEPTH - 1)]);
+    }
+
+    void drop_leaf(uint64_t index) {
+        std::array<stage_t*, kDEPTH> path;
+        stage_t* stage = &root_;
+        for (unsigned level = 0; level + 1 < kDEPTH; ++level) {
+            path[level] = stage;
+            stage = static_cast<stage_t*>(stage->next[slot(index, level)]);
+            if (!stage) {
+                return;
+            }
+        }
+        path[kDEPTH - 1] = stage;
+        if (leaf_t* leaf = static_cast<leaf_t*>(stage->next[slot(index, kDEPTH - 1)])) {
+            leaves_.release(leaf);
+            prune(index, path);
+        }
+    }
+
+    // unlinks the released leaf at index and empty stages above it
+    void prune(uint64_t index, const std::array<stage_t*, kDEPTH>& path) {
+        for (unsigned level = kDEPTH; level-- > 0;) {
+            stage_t* stage = path[level];
+            stage->next[slot(index, level)] = nullptr;
+            if (--stage->used || level == 0) {
+                return;
+            }
+            stages_.release(stage);
+        }
+    }
+
+    void clear_stage(stage_t* stage, unsigned level) {
+        for (void*& next : stage->next) {
+            if (!next) {
+                continue;
+            }
+            if (level + 1 < kDEPTH) {
+                stage_t* child = static_cast<stage_t*>(next);
+                clear_stage(child, level + 1);
+                stages_.release(child);
+            } else {
+                leaves_.release(static_cast<leaf_t*>(next));
+            }
+            next = nullptr;
+        }
+        stage->used = 0;
+    }
+
+    stage_t root_;
+    node_pool_t<stage_t> stages_;
+    node_pool_t<leaf_t> leaves_;
 };
 
 }  // namespace a3
 #endif  // A3_RADIX_TREE_H_
+/* vim: set sw=4 ts=4 et tw=80 : */
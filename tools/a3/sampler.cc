@@ -23,7 +23,6 @@
  */
 #include <cstdint>
 #include "a3.h"
-#include "context.h"
 #include "scheduler.h"
 #include "sampler.h"
 namespace a3 {
@@ -34,6 +33,8 @@ sampler_t::sampler_t(scheduler_t* scheduler, duration_t sample)
     , thread_(nullptr)
     , bandwidth_100_()
     , bandwidth_500_()
+    , count_()
+    , points_()
 {
 }
 
@@ -57,36 +58,39 @@ void sampler_t::add(const duration_t& time) {
 }
 
 void sampler_t::run() {
-    bandwidth_100_ = boost::posix_time::microseconds(0);
-    bandwidth_500_ = boost::posix_time::microseconds(0);
-    uint64_t count = 0;
-    uint64_t points = 0;
+    bandwidth_100_ = microseconds(0);
+    bandwidth_500_ = microseconds(0);
+    count_ = 0;
+    points_ = 0;
     while (true) {
-        // sampling
-        A3_SYNCHRONIZED(scheduler_->sched_mutex()) {
-            if (!scheduler_->contexts().empty()) {
-                A3_SYNCHRONIZED(scheduler_->fire_mutex()) {
-                    if (bandwidth_500_ != boost::posix_time::microseconds(0)) {
-                        // A3_FATAL(stdout, "UTIL: LOG %" PRIu64 "\n", count);
-                        for (context& ctx : scheduler_->contexts()) {
-                            // A3_FATAL(stdout, "UTIL[100]: %d => %f\n", ctx.id(), (static_cast<double>(ctx.sampling_bandwidth_used_100().total_microseconds()) / sampling_bandwidth_100_.total_microseconds()));
-                            if (points % 5 == 4) {
-                                // A3_FATAL(stdout, "UTIL[500]: %d => %f\n", ctx.id(), (static_cast<double>(ctx.sampling_bandwidth_used().total_microseconds()) / sampling_bandwidth_.total_microseconds()));
-                            }
-                            ctx.clear_sampling_bandwidth_used(points);
+        sample();
+        scheduler_->clock()->sleep(sample_);
+        scheduler_->clock()->yield();
+    }
+}
+
+void sampler_t::sample() {
+    A3_SYNCHRONIZED(scheduler_->sched_mutex()) {
+        if (!scheduler_->contexts().empty()) {
+            A3_SYNCHRONIZED(scheduler_->fire_mutex()) {
+                if (bandwidth_500_ != microseconds(0)) {
+                    // A3_FATAL(stdout, "UTIL: LOG %" PRIu64 "\n", count_);
+                    for (sched_entity_t& ctx : scheduler_->contexts()) {
+                        // A3_FATAL(stdout, "UTIL[100]: %d => %f\n", ctx.id(), (static_cast<double>(ctx.sampling_bandwidth_used_100().total_microseconds()) / sampling_bandwidth_100_.total_microseconds()));
+                        if (points_ % 5 == 4) {
+                            // A3_FATAL(stdout, "UTIL[500]: %d => %f\n", ctx.id(), (static_cast<double>(ctx.sampling_bandwidth_used().total_microseconds()) / sampling_bandwidth_.total_microseconds()));
                         }
-                        ++count;
-                        points = (points + 1) % 5;
-                    }
-                    bandwidth_100_ = boost::posix_time::microseconds(0);
-                    if (points % 5 == 4) {
-                        bandwidth_500_ = boost::posix_time::microseconds(0);
+                        ctx.clear_sampling_bandwidth_used(points_);
                     }
+                    ++count_;
+                    points_ = (points_ + 1) % 5;
+                }
+                bandwidth_100_ = microseconds(0);
+                if (points_ % 5 == 4) {
+                    bandwidth_500_ = microseconds(0);
                 }
             }
         }
-        boost::this_thread::sleep(sample_);
-        boost::this_thread::yield();
     }
 }
 
@@ -15,6 +15,8 @@ class sampler_t : private boost::noncopyable {
     void start();
     void stop();
     void run();
+    void sample();
+    const duration_t& period() const { return sample_; }
 
  private:
     scheduler_t* scheduler_;
@@ -22,6 +24,8 @@ class sampler_t : private boost::noncopyable {
     std::unique_ptr<boost::thread> thread_;
     duration_t bandwidth_100_;
     duration_t bandwidth_500_;
+    uint64_t count_;
+    uint64_t points_;
 };
 
 }  // namespace a3
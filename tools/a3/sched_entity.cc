@@ -0,0 +1,131 @@
+/*
+ * A3 sched entity
+ *
+ * Copyright (c) 2013 Yusuke Suzuki
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "a3.h"
+#include "lock.h"
+#include "sched_entity.h"
+namespace a3 {
+
+sched_entity_t::sched_entity_t()
+    : band_mutex_()
+    , clock_(clock_source_t::system())
+    , budget_()
+    , bandwidth_()
+    , bandwidth_used_()
+    , sampling_bandwidth_used_()
+    , sampling_bandwidth_used_100_()
+    , suspended_()
+    , doorbell_()
+{
+}
+
+bool sched_entity_t::enqueue(const command& cmd) {
+    A3_SYNCHRONIZED(band_mutex()) {
+        const bool ret = suspended_.empty();
+        const suspended_t entry = { cmd, clock_->now() };
+        suspended_.push(entry);
+        return ret;
+    }
+    return false;
+}
+
+bool sched_entity_t::dequeue(command* cmd) {
+    A3_SYNCHRONIZED(band_mutex()) {
+        if (suspended_.empty()) {
+            return false;
+        }
+        const suspended_t& entry = suspended_.front();
+        *cmd = entry.cmd;
+        on_dequeue(clock_->now() - entry.enqueued);
+        suspended_.pop();
+        return true;
+    }
+    return false;
+}
+
+std::size_t sched_entity_t::discard() {
+    A3_SYNCHRONIZED(band_mutex()) {
+        const std::size_t count = suspended_.size();
+        suspended_ = std::queue<suspended_t>();
+        return count;
+    }
+    return 0;
+}
+
+timestamp_t sched_entity_t::doorbell() const {
+    A3_SYNCHRONIZED(band_mutex_) {
+        return doorbell_;
+    }
+    return timestamp_t();
+}
+
+void sched_entity_t::set_doorbell(const timestamp_t& time) {
+    A3_SYNCHRONIZED(band_mutex()) {
+        doorbell_ = time;
+    }
+}
+
+bool sched_entity_t::is_suspended() {
+    A3_SYNCHRONIZED(band_mutex()) {
+        return !suspended_.empty();
+    }
+    return false;
+}
+
+
+void sched_entity_t::update_budget(const duration_t& credit) {
+    budget_ -= credit;
+    on_update_budget(credit);
+    bandwidth_used_ += credit;
+    sampling_bandwidth_used_ += credit;
+    sampling_bandwidth_used_100_ += credit;
+}
+
+void sched_entity_t::replenish(const duration_t& credit, const duration_t& threshold, const duration_t& bandwidth, bool idle) {
+    A3_SYNCHRONIZED(band_mutex()) {
+        budget_ += credit;
+
+        if (idle && budget_ >= bandwidth) {
+            budget_ = bandwidth;
+        } else {
+            if (budget_ > threshold) {
+                budget_ = bandwidth; // microseconds(0);
+            }
+
+            if (budget_ < (-threshold)) {
+                budget_ =  microseconds(0);
+            }
+        }
+        bandwidth_used_ = microseconds(0);
+    }
+}
+
+void sched_entity_t::clear_sampling_bandwidth_used(uint64_t point) {
+    if (point % 5 == 4) {
+        sampling_bandwidth_used_ = microseconds(0);
+    }
+    sampling_bandwidth_used_100_ = microseconds(0);
+}
+
+}  // namespace a3
+/* vim: set sw=4 ts=4 et tw=80 : */
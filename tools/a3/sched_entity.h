@@ -0,0 +1,71 @@
+#ifndef A3_SCHED_ENTITY_H_
+#define A3_SCHED_ENTITY_H_
+#include <queue>
+#include <boost/intrusive/list_hook.hpp>
+#include "a3.h"
+#include "lock.h"
+#include "clock.h"
+#include "duration.h"
+namespace a3 {
+
+// What schedulers see of a GPU tenant: the suspended commands and the BAND
+// accounting. context is the tenant of the daemon, and the scheduler
+// simulator provides synthetic ones.
+class sched_entity_t : public boost::intrusive::list_base_hook<> {
+ public:
+    sched_entity_t();
+    virtual ~sched_entity_t() { }
+
+    // submits the command to the GPU
+    virtual void fire(const command& cmd) = 0;
+    // returns true while the GPU is executing the fired command
+    virtual bool is_active() = 0;
+
+    // BAND
+    bool enqueue(const command& cmd);
+    bool dequeue(command* cmd);
+    bool is_suspended();
+    // drops suspended commands and returns the number of them
+    std::size_t discard();
+    // arrival time of the last doorbell, stamped by the scheduler
+    timestamp_t doorbell() const;
+    void set_doorbell(const timestamp_t& time);
+    duration_t budget() const { return budget_; }
+    duration_t bandwidth() const { return bandwidth_; }
+    duration_t bandwidth_used() const { return bandwidth_used_; }
+    duration_t sampling_bandwidth_used() const { return sampling_bandwidth_used_; }
+    duration_t sampling_bandwidth_used_100() const { return sampling_bandwidth_used_100_; }
+    void replenish(const duration_t& credit, const duration_t& threshold, const duration_t& bandwidth, bool idle);
+    void clear_sampling_bandwidth_used(uint64_t point);
+    mutex_t& band_mutex() { return band_mutex_; }
+    void update_budget(const duration_t& credit);
+    // suspended commands are stamped with the clock of the scheduler. It
+    // is the monotonic TSC clock until the entity is registered.
+    void set_clock(clock_source_t* clock) { clock_ = clock; }
+
+ protected:
+    // time the command waited in the suspended queue
+    virtual void on_dequeue(const duration_t& waited) { }
+    // GPU time consumed by the fired command
+    virtual void on_update_budget(const duration_t& credit) { }
+
+ private:
+    // only touched by BAND scheduler
+    mutable mutex_t band_mutex_;
+    clock_source_t* clock_;
+    duration_t budget_;
+    duration_t bandwidth_;
+    duration_t bandwidth_used_;
+    duration_t sampling_bandwidth_used_;
+    duration_t sampling_bandwidth_used_100_;
+    struct suspended_t {
+        command cmd;
+        timestamp_t enqueued;
+    };
+    std::queue<suspended_t> suspended_;
+    timestamp_t doorbell_;
+};
+
+}  // namespace a3
+#endif  // A3_SCHED_ENTITY_H_
+/* vim: set sw=4 ts=4 et tw=80 : */
@@ -24,18 +24,44 @@
 #include <cstdint>
 #include "a3.h"
 #include "scheduler.h"
-#include "context.h"
 namespace a3 {
 
-void scheduler_t::register_context(context* ctx) {
+void scheduler_t::register_context(sched_entity_t* ctx) {
     A3_SYNCHRONIZED(sched_mutex()) {
         contexts().push_back(*ctx);
+        ctx->set_clock(clock());
+        ctx->set_doorbell(clock()->now());
+        on_register_context(ctx);
     }
 }
 
-void scheduler_t::unregister_context(context* ctx) {
+void scheduler_t::doorbell(sched_entity_t* ctx, const command& cmd) {
+    ctx->set_doorbell(clock()->now());
+    enqueue(ctx, cmd);
+}
+
+std::vector<sched_entity_t*> scheduler_t::idle_entities(const timestamp_t& deadline) {
+    std::vector<sched_entity_t*> result;
+    A3_SYNCHRONIZED(sched_mutex()) {
+        // submissions hold fire_mutex until the GPU finishes
+        A3_SYNCHRONIZED(fire_mutex()) {
+            for (sched_entity_t& ctx : contexts()) {
+                if (ctx.doorbell() < deadline && !is_queued(&ctx)) {
+                    result.push_back(&ctx);
+                }
+            }
+        }
+    }
+    return result;
+}
+
+void scheduler_t::unregister_context(sched_entity_t* ctx) {
     A3_SYNCHRONIZED(sched_mutex()) {
-        contexts().erase(contexts_t::s_iterator_to(*ctx));
+        // waits for the submission in flight
+        A3_SYNCHRONIZED(fire_mutex()) {
+            contexts().erase(contexts_t::s_iterator_to(*ctx));
+            on_unregister_context(ctx);
+        }
     }
 }
 
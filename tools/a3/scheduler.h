@@ -1,33 +1,63 @@
 #ifndef A3_SCHEDULER_H_
 #define A3_SCHEDULER_H_
 #include <queue>
+#include <vector>
 #include <boost/noncopyable.hpp>
 #include <boost/intrusive/list.hpp>
 #include "a3.h"
-#include "context.h"
+#include "clock.h"
+#include "duration.h"
+#include "sched_entity.h"
 namespace a3 {
 
 class scheduler_t : private boost::noncopyable {
  public:
-    typedef boost::intrusive::list<context> contexts_t;
+    typedef boost::intrusive::list<sched_entity_t> contexts_t;
 
+    scheduler_t() : clock_(clock_source_t::system()) { }
     virtual ~scheduler_t() { }
     virtual void start() { }
     virtual void stop() { }
-    virtual void enqueue(context* ctx, const command& cmd) = 0;
+    virtual void enqueue(sched_entity_t* ctx, const command& cmd) = 0;
 
-    void register_context(context* ctx);
-    void unregister_context(context* ctx);
+    // entry of doorbells, stamps ctx and enqueues the command
+    void doorbell(sched_entity_t* ctx, const command& cmd);
+
+    // registered entities with no doorbell since deadline and no command
+    // queued or in flight
+    std::vector<sched_entity_t*> idle_entities(const timestamp_t& deadline);
+
+    // Single iterations of the scheduler threads. The threads are loops of
+    // these, and the scheduler simulator calls them with a virtual clock
+    // instead of starting the threads.
+    virtual bool has_pending() { return false; }
+    virtual void dispatch(bool idle) { }
+    virtual void replenish_once() { }
+    virtual void sample_once() { }
+    virtual duration_t replenish_period() const { return duration_t(); }
+    virtual duration_t sample_period() const { return duration_t(); }
+
+    void register_context(sched_entity_t* ctx);
+    void unregister_context(sched_entity_t* ctx);
     contexts_t& contexts() { return contexts_; }
     const contexts_t& contexts() const { return contexts_; }
     boost::mutex& fire_mutex() { return fire_mutex_; }
     boost::mutex& sched_mutex() { return sched_mutex_; }
+    clock_source_t* clock() const { return clock_; }
+    // should be set before start
+    void set_clock(clock_source_t* clock) { clock_ = clock; }
 
  protected:
-    virtual void on_register_context(context* ctx) { }
-    virtual void on_unregister_context(context* ctx) { }
+    // called with sched_mutex held
+    virtual void on_register_context(sched_entity_t* ctx) { }
+    // drops commands and references of ctx, called with sched_mutex and
+    // fire_mutex held
+    virtual void on_unregister_context(sched_entity_t* ctx) { }
+    // called with sched_mutex and fire_mutex held
+    virtual bool is_queued(sched_entity_t* ctx) { return ctx->is_suspended(); }
 
  private:
+    clock_source_t* clock_;
     contexts_t contexts_;
     boost::mutex fire_mutex_;
     boost::mutex sched_mutex_;
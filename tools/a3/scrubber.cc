@@ -0,0 +1,114 @@
+/*
+ * A3 Scrubber
+ *
+ * Copyright (c) 2012-2013 Yusuke Suzuki
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <cstdint>
+#include "a3.h"
+#include "scrubber.h"
+#include "device.h"
+#include "vram.h"
+namespace a3 {
+
+scrubber_t::scrubber_t()
+    : queue_()
+    , thread_()
+    , mutex_()
+    , cond_()
+    , pending_(0)
+    , scrubbed_(0)
+{
+}
+
+scrubber_t::~scrubber_t() {
+    stop();
+    // nothing is leaked to the allocators uncleared
+    for (const job_t& job : queue_) {
+        process(job, false);
+    }
+    queue_.clear();
+}
+
+void scrubber_t::start() {
+    if (thread_) {
+        stop();
+    }
+    thread_.reset(new boost::thread(&scrubber_t::run, this));
+}
+
+void scrubber_t::stop() {
+    if (thread_) {
+        thread_->interrupt();
+        thread_->join();
+        thread_.reset();
+    }
+}
+
+void scrubber_t::scrub(uint64_t address, uint64_t size, const callback_t& done) {
+    const job_t job = { address, size, done };
+    pending_.fetch_add(size, std::memory_order_relaxed);
+    boost::unique_lock<boost::mutex> lock(mutex_);
+    queue_.push_back(job);
+    cond_.notify_one();
+}
+
+void scrubber_t::release(vram_t* mem) {
+    scrub(mem->address(), mem->n() * kPAGE_SIZE, [mem] {
+        A3_SYNCHRONIZED(device()->mutex()) {
+            device()->free(mem);
+        }
+    });
+}
+
+void scrubber_t::process(const job_t& job, bool background) {
+    for (uint64_t offset = 0; offset < job.size; offset += kSLICE) {
+        const uint64_t size = (job.size - offset < kSLICE) ? job.size - offset : kSLICE;
+        device()->clear_pmem(job.address + offset, size);
+        scrubbed_.fetch_add(size, std::memory_order_relaxed);
+        pending_.fetch_sub(size, std::memory_order_relaxed);
+        if (background) {
+            // low priority, let sessions take the device mutex
+            boost::this_thread::yield();
+        }
+    }
+    if (job.done) {
+        job.done();
+    }
+}
+
+void scrubber_t::run() {
+    while (true) {
+        job_t job;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex_);
+            while (queue_.empty()) {
+                cond_.wait(lock);
+            }
+            job = queue_.front();
+            queue_.pop_front();
+        }
+        process(job, true);
+        boost::this_thread::interruption_point();
+    }
+}
+
+}  // namespace a3
+/* vim: set sw=4 ts=4 et tw=80 : */
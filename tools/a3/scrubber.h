@@ -0,0 +1,65 @@
+#ifndef A3_SCRUBBER_H_
+#define A3_SCRUBBER_H_
+#include <cstdint>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <boost/noncopyable.hpp>
+#include <boost/thread.hpp>
+#include "a3.h"
+namespace a3 {
+
+class vram_t;
+
+// Zero fills VRAM released by ended contexts in the background.
+//
+// Freed pages, guest VRAM chunks and the guest VRAM slab of a slot are
+// queued here instead of being returned directly, and are given back to
+// their allocator only after they are cleared. So context teardown does not
+// wait for clearing, and no tenant sees data of the previous one. Jobs are
+// processed in order, and cleared in slices releasing the device mutex
+// between them.
+class scrubber_t : private boost::noncopyable {
+ public:
+    typedef std::function<void()> callback_t;
+    static const uint64_t kSLICE = 0x10000;
+
+    scrubber_t();
+    ~scrubber_t();
+    void start();
+    void stop();
+
+    // clears [address, address + size) and calls done after that
+    void scrub(uint64_t address, uint64_t size, const callback_t& done);
+
+    // calls done after all queued jobs are finished
+    void post(const callback_t& done) { scrub(0, 0, done); }
+
+    // clears pages and returns them to the device
+    void release(vram_t* mem);
+
+    uint64_t pending() const { return pending_.load(std::memory_order_relaxed); }
+    uint64_t scrubbed() const { return scrubbed_.load(std::memory_order_relaxed); }
+
+ private:
+    struct job_t {
+        uint64_t address;
+        uint64_t size;
+        callback_t done;
+    };
+
+    void run();
+    void process(const job_t& job, bool background);
+
+    std::deque<job_t> queue_;
+    std::unique_ptr<boost::thread> thread_;
+    boost::mutex mutex_;
+    boost::condition_variable cond_;
+    std::atomic<uint64_t> pending_;   // bytes
+    std::atomic<uint64_t> scrubbed_;  // bytes
+};
+
+}  // namespace a3
+#endif  // A3_SCRUBBER_H_
+/* vim: set sw=4 ts=4 et tw=80 : */
@@ -24,6 +24,8 @@
 #include <cstdio>
 #include "session.h"
 #include "context.h"
+#include "flags.h"
+#include "mmio_throttle.h"
 namespace a3 {
 
 session::session(boost::asio::io_service& io_service)
@@ -32,6 +34,8 @@ session::session(boost::asio::io_service& io_service)
     , thread_(nullptr)
     , req_queue_(nullptr)
     , res_queue_(nullptr)
+    , throttle_()
+    , stream_()
 {
 }
 
@@ -57,7 +61,10 @@ void session::main() {
     for (;;) {
         command cmd;
         req_queue_->receive(&cmd, sizeof(command), size, priority);
-        if (ctx()->handle(cmd)) {
+        throttle_->admit();
+        const bool wait = ctx()->handle(cmd);
+        throttle_->charge();
+        if (wait) {
             // res queue is needed
             res_queue_->send(buffer(), sizeof(command), 0);
         }
@@ -99,6 +106,7 @@ void session::initialize(uint32_t id) {
         res_queue_.reset(new interprocess::message_queue(interprocess::create_only, name.data(), 0x100000, sizeof(a3::command)));
     }
 
+    throttle_.reset(new mmio_throttle_t(flags::mmio_share, ctx()->instruments()->metrics()));
     thread_.reset(new boost::thread(&session::main, this));
 }
 
@@ -108,6 +116,10 @@ void session::handle_read(const boost::system::error_code& error) {
         return;
     }
     const command command(*buffer());
+    if (command.type == command::TYPE_CHECKPOINT) {
+        handle_checkpoint(command);
+        return;
+    }
     ctx()->handle(command);
 
     // handle command
@@ -117,6 +129,46 @@ void session::handle_read(const boost::system::error_code& error) {
 	boost::bind(&session::handle_write, this, boost::asio::placeholders::error));
 }
 
+// checkpoint blocks are streamed over the socket after the reply
+void session::handle_checkpoint(const command& cmd) {
+    if (cmd.value == command::CHECKPOINT_LOAD) {
+        stream_.resize(cmd.offset);
+        boost::asio::async_read(
+            socket_,
+            boost::asio::buffer(stream_),
+            boost::bind(&session::handle_load, this, boost::asio::placeholders::error));
+        return;
+    }
+
+    buffer()->offset = ctx()->checkpoint(cmd.value, &stream_);
+    buffer()->value = stream_.size();
+    std::vector<boost::asio::const_buffer> buffers;
+    buffers.push_back(boost::asio::buffer(&buffer_, kCommandSize));
+    buffers.push_back(boost::asio::buffer(stream_));
+    boost::asio::async_write(
+        socket_,
+        buffers,
+        boost::bind(&session::handle_write, this, boost::asio::placeholders::error));
+}
+
+void session::handle_load(const boost::system::error_code& error) {
+    if (error) {
+        delete this;
+        return;
+    }
+
+    buffer()->value = 0;
+    buffer()->offset = 0;
+    if (!ctx()->load_checkpoint(stream_)) {
+        buffer()->offset = command::kCHECKPOINT_FAILED;
+    }
+    stream_.clear();
+    boost::asio::async_write(
+        socket_,
+        boost::asio::buffer(&buffer_, kCommandSize),
+        boost::bind(&session::handle_write, this, boost::asio::placeholders::error));
+}
+
 void session::handle_write(const boost::system::error_code& error) {
     if (error) {
         delete this;
@@ -1,6 +1,7 @@
 #ifndef A3_SESSION_H_
 #define A3_SESSION_H_
 #include <memory>
+#include <vector>
 #include <boost/noncopyable.hpp>
 #include <boost/bind.hpp>
 #include <boost/asio.hpp>
@@ -12,6 +13,7 @@
 namespace a3 {
 
 class context;
+class mmio_throttle_t;
 
 class session : private boost::noncopyable {
  public:
@@ -28,6 +30,8 @@ class session : private boost::noncopyable {
  private:
     void handle_read(const boost::system::error_code& error);
     void handle_write(const boost::system::error_code& error);
+    void handle_checkpoint(const command& command);
+    void handle_load(const boost::system::error_code& error);
     void main();
 
     boost::asio::local::stream_protocol::socket socket_;
@@ -36,6 +40,8 @@ class session : private boost::noncopyable {
     std::unique_ptr<boost::thread> thread_;
     std::unique_ptr<interprocess::message_queue> req_queue_;
     std::unique_ptr<interprocess::message_queue> res_queue_;
+    std::unique_ptr<mmio_throttle_t> throttle_;
+    std::vector<uint8_t> stream_;  // checkpoint block
 };
 
 
@@ -52,8 +52,7 @@ void shadow_page_table::set_high_size(uint32_t value) {
 
 void shadow_page_table::allocate_shadow_address() {
     if (!phys()) {
-        phys_.reset(new page(0x10));
-        phys_->clear();
+        phys_.reset(new page(0x10, true));
     }
 }
 
@@ -102,7 +101,13 @@ void shadow_page_table::refresh_page_directories(context* ctx, uint64_t address)
     }
 
     for (uint64_t offset = 0, index = 0; offset < 0x10000; offset += 0x8, ++index) {
-        const struct page_directory res = page_directory::create(&pmem, page_directory_address() + offset);
+        const uint64_t entry_address = ctx->get_phys_address(page_directory_address(), offset);
+        if (entry_address == UINT64_MAX) {
+            phys()->write32(offset, 0);
+            phys()->write32(offset + 0x4, 0);
+            continue;
+        }
+        const struct page_directory res = page_directory::create(&pmem, entry_address);
         if (res.large_page_table_present || res.small_page_table_present) {
             // A3_LOG("  dir 0x%010" PRIx64 "\n", index * kPAGE_DIRECTORY_COVERED_SIZE);
         }
@@ -115,13 +120,15 @@ void shadow_page_table::refresh_page_directories(context* ctx, uint64_t address)
 
 struct page_directory shadow_page_table::refresh_directory(context* ctx, pmem::accessor* pmem, const struct page_directory& dir) {
     struct page_directory result(dir);
-    if (dir.large_page_table_present) {
-        const uint64_t address = ctx->get_phys_address(static_cast<uint64_t>(dir.large_page_table_address) << 12);
+    // a table on a chunk that cannot be backed is treated as absent
+    const uint64_t large_address = dir.large_page_table_present ? ctx->get_phys_address(static_cast<uint64_t>(dir.large_page_table_address) << 12) : UINT64_MAX;
+    if (large_address != UINT64_MAX) {
         page* large_page = allocate_large_page();
         for (uint64_t i = 0, iz = page_directory::large_size_count(dir); i < iz; ++i) {
             const uint64_t item = 0x8 * i;
             struct page_entry entry;
-            if (page_entry::create(pmem, address + item, &entry)) {
+            const uint64_t entry_address = ctx->get_phys_address(large_address, item);
+            if (entry_address != UINT64_MAX && page_entry::create(pmem, entry_address, &entry)) {
                 struct page_entry res = refresh_entry(ctx, pmem, entry);
                 large_page->write32(item, res.word0);
                 large_page->write32(item + 0x4, res.word1);
@@ -136,13 +143,14 @@ struct page_directory shadow_page_table::refresh_directory(context* ctx, pmem::a
         result.word0 = 0;
     }
 
-    if (dir.small_page_table_present) {
-        const uint64_t address = ctx->get_phys_address(static_cast<uint64_t>(dir.small_page_table_address) << 12);
+    const uint64_t small_address = dir.small_page_table_present ? ctx->get_phys_address(static_cast<uint64_t>(dir.small_page_table_address) << 12) : UINT64_MAX;
+    if (small_address != UINT64_MAX) {
         page* small_page = allocate_small_page();
         for (uint64_t i = 0, iz = kSMALL_PAGE_COUNT; i < iz; ++i) {
             const uint64_t item = 0x8 * i;
             struct page_entry entry;
-            if (page_entry::create(pmem, address + item, &entry)) {
+            const uint64_t entry_address = ctx->get_phys_address(small_address, item);
+            if (entry_address != UINT64_MAX && page_entry::create(pmem, entry_address, &entry)) {
                 struct page_entry res = refresh_entry(ctx, pmem, entry);
                 small_page->write32(item, res.word0);
                 small_page->write32(item + 0x4, res.word1);
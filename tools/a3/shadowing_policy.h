@@ -0,0 +1,76 @@
+#ifndef A3_SHADOWING_POLICY_H_
+#define A3_SHADOWING_POLICY_H_
+#include <cstdint>
+#include "a3.h"
+#include "flags.h"
+namespace a3 {
+
+// Per channel decision between eager and lazy shadowing.
+//
+// Eager shadowing rescans the page tables in flush_tlb, so the submission
+// path never pays for it. Lazy shadowing defers the rescan until the channel
+// is fired, which coalesces the rescans of guests that flush TLB many times
+// between submissions. We track the flush-to-submit ratio of the channel as
+// EWMA and choose the mode from it.
+class shadowing_policy_t {
+ public:
+    enum mode_t {
+        MODE_EAGER,
+        MODE_LAZY
+    };
+
+    // fixed point with 8bit fraction
+    static const uint32_t kONE = 0x100;
+    // switch to lazy when more than 1.5 flushes per submit are observed,
+    // and back to eager when it goes under 1.125 (hysteresis)
+    static const uint32_t kLAZY_THRESHOLD = kONE + kONE / 2;
+    static const uint32_t kEAGER_THRESHOLD = kONE + kONE / 8;
+    static const uint32_t kMAX_SAMPLE = 64;
+
+    shadowing_policy_t()
+        : mode_(MODE_EAGER)
+        , flushes_()
+        , ratio_(kONE)
+    {
+    }
+
+    mode_t mode() const {
+        if (a3::flags::adaptive_shadowing) {
+            return mode_;
+        }
+        return a3::flags::lazy_shadowing ? MODE_LAZY : MODE_EAGER;
+    }
+
+    bool lazy() const { return mode() == MODE_LAZY; }
+
+    // EWMA of flushes per submit
+    uint32_t ratio() const { return ratio_; }
+
+    void flushed() {
+        if (flushes_ < kMAX_SAMPLE) {
+            ++flushes_;
+        }
+    }
+
+    // returns true if mode is changed
+    bool submitted() {
+        ratio_ = (ratio_ * 7 + flushes_ * kONE) / 8;
+        flushes_ = 0;
+        const mode_t previous = mode_;
+        if (mode_ == MODE_EAGER && ratio_ > kLAZY_THRESHOLD) {
+            mode_ = MODE_LAZY;
+        } else if (mode_ == MODE_LAZY && ratio_ < kEAGER_THRESHOLD) {
+            mode_ = MODE_EAGER;
+        }
+        return previous != mode_;
+    }
+
+ private:
+    mode_t mode_;
+    uint32_t flushes_;
+    uint32_t ratio_;
+};
+
+}  // namespace a3
+#endif  // A3_SHADOWING_POLICY_H_
+/* vim: set sw=4 ts=4 et tw=80 : */
@@ -30,11 +30,12 @@
 #include "pv_page.h"
 #include "context.h"
 #include "ignore_unused_variable_warning.h"
-#include "radix_tree.h"
 namespace a3 {
 
 software_page_table::software_page_table(uint32_t channel_id, bool para, uint64_t predefined_max)
     : directories_()
+    , large_entries_()
+    , small_entries_()
     , size_(0)
     , channel_id_(channel_id)
     , predefined_max_(predefined_max)
@@ -44,7 +45,7 @@ software_page_table::software_page_table(uint32_t channel_id, bool para, uint64_
     }
     if (para) {
         // initialize directory at this time
-        directories_.resize(page_directory_size());
+        directories_ = page_directory_size();
     }
 }
 
@@ -77,217 +78,182 @@ bool software_page_table::refresh(context* ctx, uint64_t page_directory_address,
 void software_page_table::refresh_page_directories(context* ctx, uint64_t address) {
     pmem::accessor pmem;
     page_directory_address_ = address;
-    directories_.resize(page_directory_size());
-    std::size_t i = 0;
-    const std::size_t count = directories_.size();
+    const uint32_t count = page_directory_size();
+    if (count < directories_) {
+        // drop entries of the shrunk directories
+        large_entries_.erase(static_cast<uint64_t>(count) * kLARGE_PAGE_COUNT, static_cast<uint64_t>(directories_) * kLARGE_PAGE_COUNT);
+        small_entries_.erase(static_cast<uint64_t>(count) * kSMALL_PAGE_COUNT, static_cast<uint64_t>(directories_) * kSMALL_PAGE_COUNT);
+    }
+    directories_ = count;
     std::size_t remain = size() % kPAGE_DIRECTORY_COVERED_SIZE;
     if (!remain) {
         remain = kPAGE_DIRECTORY_COVERED_SIZE;
     }
-    for (software_page_directories::iterator it = directories_.begin(), last = directories_.end(); it != last; ++it, ++i) {
+    for (uint32_t i = 0; i < count; ++i) {
         const uint64_t item = 0x8 * i;
+        const uint64_t entry_address = ctx->get_phys_address(page_directory_address(), item);
+        const struct page_directory dir = (entry_address != UINT64_MAX) ? page_directory::create(&pmem, entry_address) : page_directory();
         if (!predefined_max_) {
-            it->refresh(ctx, &pmem, page_directory::create(&pmem, page_directory_address() + item), kPAGE_DIRECTORY_COVERED_SIZE);
+            refresh_directory(ctx, &pmem, i, dir, kPAGE_DIRECTORY_COVERED_SIZE);
         } else {
             if ((i + 1) == count) {
-                it->refresh(ctx, &pmem, page_directory::create(&pmem, page_directory_address() + item), remain);
+                refresh_directory(ctx, &pmem, i, dir, remain);
             } else {
-                it->refresh(ctx, &pmem, page_directory::create(&pmem, page_directory_address() + item), kPAGE_DIRECTORY_COVERED_SIZE);
+                refresh_directory(ctx, &pmem, i, dir, kPAGE_DIRECTORY_COVERED_SIZE);
             }
         }
     }
 
-    A3_LOG("scan page table of channel id 0x%" PRIi32 " : pd 0x%" PRIX64 " size %" PRIu64 "\n", channel_id(), page_directory_address(), directories_.size());
+    A3_LOG("scan page table of channel id 0x%" PRIi32 " : pd 0x%" PRIX64 " size %" PRIu32 " entries %" PRIu64 "KB\n", channel_id(), page_directory_address(), count, static_cast<uint64_t>(memory() >> 10));
     // dump();
 }
 
-void software_page_table::software_page_directory::refresh(context* ctx, pmem::accessor* pmem, const struct page_directory& dir, std::size_t remain) {
-    if (dir.large_page_table_present) {
-        const uint64_t address = ctx->get_phys_address(static_cast<uint64_t>(dir.large_page_table_address) << 12);
-        if (!large_entries()) {
-            large_entries_.reset(new software_page_entries(kLARGE_PAGE_COUNT));
-        }
+void software_page_table::refresh_directory(context* ctx, pmem::accessor* pmem, uint32_t index, const struct page_directory& dir, std::size_t remain) {
+    const uint64_t large_base = static_cast<uint64_t>(index) * kLARGE_PAGE_COUNT;
+    // a table on a chunk that cannot be backed is treated as absent
+    const uint64_t large_address = dir.large_page_table_present ? ctx->get_phys_address(static_cast<uint64_t>(dir.large_page_table_address) << 12) : UINT64_MAX;
+    if (large_address != UINT64_MAX) {
         const std::size_t count = std::min(remain / kLARGE_PAGE_SIZE, page_directory::large_size_count(dir));
         ASSERT(count <= kLARGE_PAGE_COUNT);
         for (std::size_t i = 0; i < count; ++i) {
             const uint64_t item = 0x8 * i;
             struct page_entry entry;
-            if (page_entry::create(pmem, address + item, &entry)) {
-                (*large_entries_)[i].refresh(ctx, entry);
+            const uint64_t entry_address = ctx->get_phys_address(large_address, item);
+            if (entry_address != UINT64_MAX && page_entry::create(pmem, entry_address, &entry)) {
+                struct software_page_entry result;
+                result.refresh(ctx, entry);
+                large_entries_.store(large_base + i, result);
             } else {
-                (*large_entries_)[i].clear();
+                large_entries_.erase(large_base + i);
             }
         }
     } else {
-        large_entries_.reset();
+        large_entries_.erase(large_base, large_base + kLARGE_PAGE_COUNT);
     }
 
-    if (dir.small_page_table_present) {
-        const uint64_t address = ctx->get_phys_address(static_cast<uint64_t>(dir.small_page_table_address) << 12);
-        if (!small_entries()) {
-            small_entries_.reset(new software_page_entries(kSMALL_PAGE_COUNT));
-        }
+    const uint64_t small_base = static_cast<uint64_t>(index) * kSMALL_PAGE_COUNT;
+    const uint64_t small_address = dir.small_page_table_present ? ctx->get_phys_address(static_cast<uint64_t>(dir.small_page_table_address) << 12) : UINT64_MAX;
+    if (small_address != UINT64_MAX) {
         const std::size_t count = remain / kSMALL_PAGE_SIZE;
         ASSERT(count <= kSMALL_PAGE_COUNT);
         for (std::size_t i = 0; i < count; ++i) {
             const uint64_t item = 0x8 * i;
             struct page_entry entry;
-            if (page_entry::create(pmem, address + item, &entry)) {
-                (*small_entries_)[i].refresh(ctx, entry);
+            const uint64_t entry_address = ctx->get_phys_address(small_address, item);
+            if (entry_address != UINT64_MAX && page_entry::create(pmem, entry_address, &entry)) {
+                struct software_page_entry result;
+                result.refresh(ctx, entry);
+                small_entries_.store(small_base + i, result);
             } else {
-                (*small_entries_)[i].clear();
+                small_entries_.erase(small_base + i);
             }
         }
     } else {
-        small_entries_.reset();
+        small_entries_.erase(small_base, small_base + kSMALL_PAGE_COUNT);
     }
 }
 
 uint64_t software_page_table::resolve(uint64_t virtual_address, struct software_page_entry* result) {
     const uint32_t index = virtual_address / kPAGE_DIRECTORY_COVERED_SIZE;
-    if (directories_.size() <= index) {
+    if (directories_ <= index) {
         return UINT64_MAX;
     }
-    return directories_[index].resolve(virtual_address - index * kPAGE_DIRECTORY_COVERED_SIZE, result);
-}
 
-uint64_t software_page_table::software_page_directory::resolve(uint64_t offset, struct software_page_entry* result) {
-    if (small_entries()) {
-        const uint64_t index = offset / kSMALL_PAGE_SIZE;
-        const uint64_t rest = offset % kSMALL_PAGE_SIZE;
-        if (small_entries_->size() > index) {
-            const struct software_page_entry& entry = (*small_entries_)[index];
-            if (entry.present()) {
-                if (result) {
-                    *result = entry;
-                }
-                const uint64_t address = entry.phys().address;
-                return (address << 12) + rest;
-            }
+    if (const struct software_page_entry* entry = small_entries_.lookup(virtual_address / kSMALL_PAGE_SIZE)) {
+        if (result) {
+            *result = *entry;
         }
+        const uint64_t address = entry->phys().address;
+        return (address << 12) + virtual_address % kSMALL_PAGE_SIZE;
     }
 
-    if (large_entries()) {
-        const uint64_t index = offset / kLARGE_PAGE_SIZE;
-        const uint64_t rest = offset % kLARGE_PAGE_SIZE;
-        if (large_entries_->size() > index) {
-            const struct software_page_entry& entry = (*large_entries_)[index];
-            if (entry.present()) {
-                if (result) {
-                    *result = entry;
-                }
-                const uint64_t address = entry.phys().address;
-                return (address << 12) + rest;
-            }
+    if (const struct software_page_entry* entry = large_entries_.lookup(virtual_address / kLARGE_PAGE_SIZE)) {
+        if (result) {
+            *result = *entry;
         }
+        const uint64_t address = entry->phys().address;
+        return (address << 12) + virtual_address % kLARGE_PAGE_SIZE;
     }
 
     return UINT64_MAX;
 }
 
-void software_page_table::dump() const {
-    std::size_t i = 0;
-    for (software_page_directories::const_iterator it = directories_.begin(),
-         iz = directories_.end(); it != iz; ++it, ++i) {
-        const struct software_page_directory& dir = *it;
-        if (dir.large_entries()) {
-            std::size_t j = 0;
-            for (software_page_directory::software_page_entries::const_iterator jt = dir.large_entries()->begin(),
-                 jz = dir.large_entries()->end(); jt != jz; ++jt, ++j) {
-                if (jt->present()) {
-                    const uint64_t address = jt->phys().address;
-                    ignore_unused_variable_warning(address);
-                    A3_LOG("  PTE 0x%" PRIX64 " - 0x%" PRIX64 " => 0x%" PRIX64 " - 0x%" PRIX64 " [%s] type [%d]\n",
-                              kPAGE_DIRECTORY_COVERED_SIZE * i + kLARGE_PAGE_SIZE * j,
-                              kPAGE_DIRECTORY_COVERED_SIZE * i + kLARGE_PAGE_SIZE * (j + 1) - 1,
-                              (address << 12),
-                              (address << 12) + kLARGE_PAGE_SIZE - 1,
-                              jt->phys().read_only ? "RO" : "RW",
-                              jt->phys().target);
-                }
-            }
-        }
+static void dump_entry(uint64_t virt, uint64_t size, const struct software_page_entry& entry) {
+    const uint64_t address = entry.phys().address;
+    ignore_unused_variable_warning(address);
+    A3_LOG("  PTE 0x%" PRIX64 " - 0x%" PRIX64 " => 0x%" PRIX64 " - 0x%" PRIX64 " [%s] type [%d]\n",
+              virt,
+              virt + size - 1,
+              (address << 12),
+              (address << 12) + size - 1,
+              entry.phys().read_only ? "RO" : "RW",
+              entry.phys().target);
+}
 
-        if (dir.small_entries()) {
-            std::size_t j = 0;
-            for (software_page_directory::software_page_entries::const_iterator jt = dir.small_entries()->begin(),
-                 jz = dir.small_entries()->end(); jt != jz; ++jt, ++j) {
-                if (jt->present()) {
-                    const uint64_t address = jt->phys().address;
-                    ignore_unused_variable_warning(address);
-                    A3_LOG("  PTE 0x%" PRIX64 " - 0x%" PRIX64 " => 0x%" PRIX64 " - 0x%" PRIX64 " [%s] type [%d]\n",
-                              kPAGE_DIRECTORY_COVERED_SIZE * i + kSMALL_PAGE_SIZE * j,
-                              kPAGE_DIRECTORY_COVERED_SIZE * i + kSMALL_PAGE_SIZE * (j + 1) - 1,
-                              (address << 12),
-                              (address << 12) + kSMALL_PAGE_SIZE - 1,
-                              jt->phys().read_only ? "RO" : "RW",
-                              jt->phys().target);
-                }
-            }
-        }
+void software_page_table::dump() const {
+    for (uint32_t i = 0; i < directories_; ++i) {
+        large_entries_.for_each(static_cast<uint64_t>(i) * kLARGE_PAGE_COUNT, static_cast<uint64_t>(i + 1) * kLARGE_PAGE_COUNT, [](uint64_t index, const struct software_page_entry& entry) {
+            dump_entry(index * kLARGE_PAGE_SIZE, kLARGE_PAGE_SIZE, entry);
+        });
+        small_entries_.for_each(static_cast<uint64_t>(i) * kSMALL_PAGE_COUNT, static_cast<uint64_t>(i + 1) * kSMALL_PAGE_COUNT, [](uint64_t index, const struct software_page_entry& entry) {
+            dump_entry(index * kSMALL_PAGE_SIZE, kSMALL_PAGE_SIZE, entry);
+        });
     }
 }
 
-void software_page_table::software_page_directory::pv_reflect(context* ctx, bool big, uint32_t index, uint64_t guest) {
+void software_page_table::pv_reflect_entry(context* ctx, uint32_t d, bool big, uint32_t index, uint64_t guest) {
+    if (d >= directories_ || index >= (big ? kLARGE_PAGE_COUNT : kSMALL_PAGE_COUNT)) {
+        return;
+    }
     struct page_entry entry;
     entry.raw = guest;
+    struct software_page_entry result;
+    result.refresh(ctx, entry);
     if (big) {
-        if (!large_entries()) {
-            large_entries_.reset(new software_page_entries(kLARGE_PAGE_COUNT));
-        }
-        (*large_entries_)[index].refresh(ctx, entry);
+        large_entries_.store(static_cast<uint64_t>(d) * kLARGE_PAGE_COUNT + index, result);
     } else {
-        if (!small_entries()) {
-            small_entries_.reset(new software_page_entries(kSMALL_PAGE_COUNT));
-        }
-        (*small_entries_)[index].refresh(ctx, entry);
+        small_entries_.store(static_cast<uint64_t>(d) * kSMALL_PAGE_COUNT + index, result);
     }
 }
 
-void software_page_table::pv_reflect_entry(context* ctx, uint32_t d, bool big, uint32_t index, uint64_t entry) {
-    struct software_page_directory& dir = directories_[d];
-    dir.pv_reflect(ctx, big, index, entry);
-}
-
-void software_page_table::software_page_directory::pv_scan(context* ctx, bool big, pv_page* pgt, std::size_t remain) {
+void software_page_table::pv_scan(context* ctx, uint32_t d, bool big, pv_page* pgt) {
+    if (d >= directories_) {
+        return;
+    }
+    const std::size_t remain = predefined_max_;
     if (big) {
-        if (!large_entries()) {
-            large_entries_.reset(new software_page_entries(kLARGE_PAGE_COUNT));
-        }
+        const uint64_t base = static_cast<uint64_t>(d) * kLARGE_PAGE_COUNT;
         const std::size_t count = remain / kLARGE_PAGE_SIZE;
         ASSERT(count <= kLARGE_PAGE_COUNT);
         for (std::size_t i = 0; i < count; ++i) {
             const uint64_t item = 0x8 * i;
             struct page_entry entry;
             if (page_entry::create(pgt, item, &entry)) {
-                (*large_entries_)[i].assign(entry);
+                struct software_page_entry result;
+                result.assign(entry);
+                large_entries_.store(base + i, result);
             } else {
-                (*large_entries_)[i].clear();
+                large_entries_.erase(base + i);
             }
         }
     } else {
-        if (!small_entries()) {
-            small_entries_.reset(new software_page_entries(kSMALL_PAGE_COUNT));
-        }
+        const uint64_t base = static_cast<uint64_t>(d) * kSMALL_PAGE_COUNT;
         const std::size_t count = remain / kSMALL_PAGE_SIZE;
         ASSERT(count <= kSMALL_PAGE_COUNT);
         for (std::size_t i = 0; i < count; ++i) {
             const uint64_t item = 0x8 * i;
             struct page_entry entry;
             if (page_entry::create(pgt, item, &entry)) {
-                (*small_entries_)[i].assign(entry);
+                struct software_page_entry result;
+                result.assign(entry);
+                small_entries_.store(base + i, result);
             } else {
-                (*small_entries_)[i].clear();
+                small_entries_.erase(base + i);
             }
         }
     }
 }
 
-void software_page_table::pv_scan(context* ctx, uint32_t d, bool big, pv_page* pgt) {
-    struct software_page_directory& dir = directories_[d];
-    dir.pv_scan(ctx, big, pgt, predefined_max_);
-}
-
 void software_page_entry::refresh(context* ctx, const struct page_entry& entry) {
     phys_ = ctx->guest_to_host(entry);
 }
@@ -1,10 +1,9 @@
 #ifndef A3_SOFTWARE_PAGE_TABLE_H_
 #define A3_SOFTWARE_PAGE_TABLE_H_
 #include <cstdint>
-#include <vector>
-#include <memory>
-#include <boost/shared_ptr.hpp>
+#include <boost/noncopyable.hpp>
 #include "page_table.h"
+#include "radix_tree.h"
 namespace a3 {
 class context;
 class page;
@@ -27,26 +26,16 @@ class software_page_entry {
     struct page_entry phys_;
 };
 
-class software_page_table {
- private:
-    class software_page_directory {
-     public:
-        typedef std::vector<software_page_entry> software_page_entries;
-
-        void refresh(context* ctx, pmem::accessor* pmem, const struct page_directory& dir, std::size_t remain);
-        uint64_t resolve(uint64_t offset, struct software_page_entry* result);
-        const software_page_entries* large_entries() const { return large_entries_.get(); }
-        const software_page_entries* small_entries() const { return small_entries_.get(); }
-        void pv_reflect(context* ctx, bool big, uint32_t index, uint64_t entry);
-        void pv_scan(context* ctx, bool big, pv_page* pgt, std::size_t remain);
-
-     private:
-        boost::shared_ptr<software_page_entries> large_entries_;
-        boost::shared_ptr<software_page_entries> small_entries_;
-    };
-    typedef std::vector<software_page_directory> software_page_directories;
-
+// Guest page table shadowed in software. Entries of all page directories are
+// kept in sparse radix trees indexed by the page number in the whole virtual
+// space, so only the touched 2MB (small) / 64MB (large) ranges hold memory.
+class software_page_table : private boost::noncopyable {
  public:
+    typedef radix_tree_t<software_page_entry, 28> small_entries_t;
+    typedef radix_tree_t<software_page_entry, 23> large_entries_t;
+    static_assert(small_entries_t::kSIZE == static_cast<uint64_t>(kMAX_PAGE_DIRECTORIES) * kSMALL_PAGE_COUNT, "small entries should cover the whole virtual space");
+    static_assert(large_entries_t::kSIZE == static_cast<uint64_t>(kMAX_PAGE_DIRECTORIES) * kLARGE_PAGE_COUNT, "large entries should cover the whole virtual space");
+
     software_page_table(uint32_t channel_id, bool para, uint64_t predefined_max = 0);
     bool refresh(context* ctx, uint64_t page_directory_address, uint64_t page_limit);
     void refresh_page_directories(context* ctx, uint64_t address);
@@ -61,6 +50,8 @@ class software_page_table {
     uint64_t resolve(uint64_t virtual_address, struct software_page_entry* result);
     uint64_t page_directory_address() const { return page_directory_address_; }
     void dump() const;
+    // host memory held by entries
+    std::size_t memory() const { return large_entries_.memory() + small_entries_.memory(); }
 
     void pv_reflect_entry(context* ctx, uint32_t dir, bool big, uint32_t index, uint64_t entry);
     void pv_scan(context* ctx, uint32_t dir, bool big, pv_page* pgt);
@@ -70,7 +61,11 @@ class software_page_table {
         return (((x) + (y - 1)) & ~(y - 1));
     }
 
-    software_page_directories directories_;
+    void refresh_directory(context* ctx, pmem::accessor* pmem, uint32_t index, const struct page_directory& dir, std::size_t remain);
+
+    uint32_t directories_;
+    large_entries_t large_entries_;
+    small_entries_t small_entries_;
     union {
         struct {
             uint32_t low_size_ : 32;
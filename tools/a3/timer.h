@@ -2,22 +2,30 @@
 #define A3_TIMER_H_
 #include <boost/noncopyable.hpp>
 #include "a3.h"
+#include "clock.h"
 #include "duration.h"
 namespace a3 {
 
 class timer_t : private boost::noncopyable {
  public:
-    void start() {
-        start_ = boost::posix_time::microsec_clock::local_time();
+    timer_t()
+        : clock_(clock_source_t::system())
+        , start_()
+    {
+    }
+
+    void start(const clock_source_t* clock = clock_source_t::system()) {
+        clock_ = clock;
+        start_ = clock_->now();
     }
 
     duration_t elapsed() const {
-        auto now = boost::posix_time::microsec_clock::local_time();
-        return now - start_;
+        return clock_->now() - start_;
     }
 
  private:
-    boost::posix_time::ptime start_;
+    const clock_source_t* clock_;
+    timestamp_t start_;
 };
 
 }  // namespace a3
@@ -0,0 +1,99 @@
+/*
+ * A3 TSC clock
+ *
+ * Copyright (c) 2012-2013 Yusuke Suzuki
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <ctime>
+#include <cinttypes>
+#include "a3.h"
+#include "tsc.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+namespace a3 {
+
+// calibrated over this interval at the first read
+static const int64_t kCALIBRATION = 20000000;  // ns
+
+int64_t tsc_t::monotonic() {
+    struct timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+static bool has_invariant_tsc() {
+    unsigned eax, ebx, ecx, edx;
+    if (!__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) || eax < 0x80000007) {
+        return false;
+    }
+    __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+    return edx & (1U << 8);
+}
+
+// TSC sampled right around a CLOCK_MONOTONIC read, midpoint of the two
+static void sample(uint64_t* tsc, int64_t* ns) {
+    const uint64_t before = __rdtsc();
+    *ns = tsc_t::monotonic();
+    const uint64_t after = __rdtsc();
+    *tsc = before + (after - before) / 2;
+}
+#endif
+
+tsc_t::tsc_t()
+    : invariant_(false)
+    , base_(0)
+    , origin_(monotonic())
+    , mult_(0)
+    , frequency_(0)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if (!has_invariant_tsc()) {
+        A3_LOG("no invariant TSC, using CLOCK_MONOTONIC\n");
+        return;
+    }
+    uint64_t start_tsc = 0;
+    int64_t start_ns = 0;
+    sample(&start_tsc, &start_ns);
+    const struct timespec interval = { 0, kCALIBRATION };
+    ::nanosleep(&interval, nullptr);
+    uint64_t end_tsc = 0;
+    int64_t end_ns = 0;
+    sample(&end_tsc, &end_ns);
+
+    const uint64_t ticks = end_tsc - start_tsc;
+    const uint64_t ns = end_ns - start_ns;
+    if (ticks == 0 || ns == 0 || ns >> 32) {
+        return;
+    }
+    base_ = end_tsc;
+    origin_ = end_ns;
+    // the calibration interval is far below 2^32 ns and 2^34 ticks, so
+    // neither product overflows 64 bits
+    mult_ = (ns << kSHIFT) / ticks;
+    frequency_ = ticks * 1000000000 / ns;
+    invariant_ = true;
+    A3_LOG("invariant TSC %" PRIu64 " kHz\n", frequency_ / 1000);
+#endif
+}
+
+}  // namespace a3
+/* vim: set sw=4 ts=4 et tw=80 : */
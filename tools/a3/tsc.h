@@ -0,0 +1,57 @@
+#ifndef A3_TSC_H_
+#define A3_TSC_H_
+#include <cstdint>
+#include <boost/noncopyable.hpp>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+namespace a3 {
+
+// Monotonic nanosecond clock on the invariant TSC. The TSC ticks at a
+// constant rate regardless of P/C states on the hosts A3 runs on, so it is
+// calibrated once against CLOCK_MONOTONIC and then read without a syscall.
+// Without invariant TSC, CLOCK_MONOTONIC is read.
+class tsc_t : private boost::noncopyable {
+ public:
+    static const unsigned kSHIFT = 32;
+
+    static const tsc_t& instance() {
+        static const tsc_t tsc;
+        return tsc;
+    }
+
+    int64_t now() const {
+#if defined(__x86_64__) || defined(__i386__)
+        if (invariant_) {
+            const uint64_t ticks = __rdtsc() - base_;
+            return origin_ + static_cast<int64_t>(scale(ticks, mult_));
+        }
+#endif
+        return monotonic();
+    }
+
+    bool invariant() const { return invariant_; }
+    uint64_t frequency() const { return frequency_; }  // Hz, 0 without TSC
+
+    static int64_t monotonic();
+
+ private:
+    tsc_t();
+
+    // (ticks * mult) >> 32 as four 32x32 products, i386 has no __int128
+    static uint64_t scale(uint64_t ticks, uint64_t mult) {
+        const uint64_t th = ticks >> 32, tl = ticks & 0xffffffffULL;
+        const uint64_t mh = mult >> 32, ml = mult & 0xffffffffULL;
+        return ((th * mh) << 32) + th * ml + tl * mh + ((tl * ml) >> 32);
+    }
+
+    bool invariant_;
+    uint64_t base_;       // TSC at origin_
+    int64_t origin_;      // CLOCK_MONOTONIC ns at calibration
+    uint64_t mult_;       // ns per tick << kSHIFT
+    uint64_t frequency_;
+};
+
+}  // namespace a3
+#endif  // A3_TSC_H_
+/* vim: set sw=4 ts=4 et tw=80 : */
@@ -0,0 +1,296 @@
+/*
+ * A3 VRAM partition
+ *
+ * Copyright (c) 2012-2013 Yusuke Suzuki
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <cstdint>
+#include <cinttypes>
+#include <algorithm>
+#include "a3.h"
+#include "vram_partition.h"
+#include "scrubber.h"
+namespace a3 {
+
+vram_partition_t::vram_partition_t(uint64_t base, uint64_t size)
+    : mutex_()
+    , base_(base)
+    , size_(size)
+    , used_(0)
+    , free_(size / kVRAM_CHUNK_SIZE)
+{
+    free_.set();
+}
+
+uint32_t vram_partition_t::allocate(uint32_t hint) {
+    A3_SYNCHRONIZED(mutex_) {
+        boost::dynamic_bitset<>::size_type pos = free_.npos;
+        if (hint < free_.size() && free_[hint]) {
+            pos = hint;
+        } else {
+            pos = free_.find_first();
+        }
+        if (pos == free_.npos) {
+            return kVRAM_CHUNK_INVALID;
+        }
+        free_.reset(pos);
+        ++used_;
+        return pos;
+    }
+    return kVRAM_CHUNK_INVALID;
+}
+
+uint32_t vram_partition_t::allocate_run(uint32_t count, uint32_t hint) {
+    if (count == 1) {
+        return allocate(hint);
+    }
+    A3_SYNCHRONIZED(mutex_) {
+        typedef boost::dynamic_bitset<>::size_type size_type;
+        const size_type size = free_.size();
+        size_type pos = (hint < size && free_[hint]) ? hint : free_.find_first();
+        while (pos != free_.npos && pos + count <= size) {
+            size_type end = pos;
+            while (end < pos + count && free_[end]) {
+                ++end;
+            }
+            if (end == pos + count) {
+                for (size_type i = pos; i < end; ++i) {
+                    free_.reset(i);
+                }
+                used_ += count;
+                return pos;
+            }
+            pos = free_.find_next(end);
+        }
+        return kVRAM_CHUNK_INVALID;
+    }
+    return kVRAM_CHUNK_INVALID;
+}
+
+bool vram_partition_t::claim(uint32_t chunk) {
+    A3_SYNCHRONIZED(mutex_) {
+        if (chunk >= free_.size() || !free_[chunk]) {
+            return false;
+        }
+        free_.reset(chunk);
+        ++used_;
+        return true;
+    }
+    return false;
+}
+
+void vram_partition_t::release(uint32_t chunk) {
+    A3_SYNCHRONIZED(mutex_) {
+        ASSERT(!free_[chunk]);
+        free_.set(chunk);
+        --used_;
+    }
+}
+
+vram_mapping_t::vram_mapping_t(const partition_slot_t& slot, vram_partition_t* pool, scrubber_t* scrubber)
+    : mutex_()
+    , pool_(pool)
+    , scrubber_(scrubber)
+    , base_(pool ? pool->base() : slot.memory_base)
+    , size_(pool ? pool->size() : slot.memory_size)
+    , quota_(slot.memory_quota / kVRAM_CHUNK_SIZE)
+    , allocated_(0)
+    , forward_()
+    , backward_()
+{
+    if (dynamic()) {
+        forward_.resize(slot.memory_size / kVRAM_CHUNK_SIZE, kVRAM_CHUNK_INVALID);
+        backward_.resize(pool->chunks(), kVRAM_CHUNK_INVALID);
+    }
+}
+
+vram_mapping_t::~vram_mapping_t() {
+    if (!dynamic()) {
+        return;
+    }
+    vram_partition_t* pool = pool_;
+    boost::unique_lock<mutex_t> lock(mutex_);
+    for (uint32_t& chunk : forward_) {
+        if (chunk != kVRAM_CHUNK_INVALID) {
+            const uint32_t released = chunk;
+            scrubber_->scrub(host_address(chunk), kVRAM_CHUNK_SIZE, [pool, released] {
+                pool->release(released);
+            });
+            chunk = kVRAM_CHUNK_INVALID;
+        }
+    }
+    A3_LOG("VRAM releasing %" PRIu32 " chunks after scrubbing\n", allocated_);
+}
+
+uint64_t vram_mapping_t::translate(uint64_t virt, uint64_t size) {
+    if (!dynamic()) {
+        return virt + base_;
+    }
+    const uint64_t first = virt / kVRAM_CHUNK_SIZE;
+    if (first >= forward_.size()) {
+        return UINT64_MAX;
+    }
+    const uint64_t last = std::min<uint64_t>((virt + std::max<uint64_t>(size, 1) - 1) / kVRAM_CHUNK_SIZE, forward_.size() - 1);
+    const uint32_t count = last - first + 1;
+    A3_SYNCHRONIZED(mutex_) {
+        // common case, a single backed chunk
+        if (count == 1 && forward_[first] != kVRAM_CHUNK_INVALID) {
+            return host_address(forward_[first]) + virt % kVRAM_CHUNK_SIZE;
+        }
+
+        // chunks already backed fix the position of the run
+        uint64_t start = UINT64_MAX;
+        uint32_t missing = 0;
+        for (uint64_t index = first; index <= last; ++index) {
+            const uint32_t chunk = forward_[index];
+            if (chunk == kVRAM_CHUNK_INVALID) {
+                ++missing;
+                continue;
+            }
+            if (start == UINT64_MAX) {
+                if (chunk < index - first) {
+                    return UINT64_MAX;
+                }
+                start = chunk - (index - first);
+            } else if (chunk != start + (index - first)) {
+                A3_LOG("VRAM 0x%" PRIx64 " with 0x%" PRIx64 " is scattered on the host\n", virt, size);
+                return UINT64_MAX;
+            }
+        }
+
+        if (missing) {
+            if (allocated_ + missing > quota_) {
+                A3_LOG("VRAM quota exceeded 0x%" PRIx64 "\n", virt);
+                return UINT64_MAX;
+            }
+            if (start == UINT64_MAX) {
+                const uint32_t hint = (first > 0 && forward_[first - 1] != kVRAM_CHUNK_INVALID) ? forward_[first - 1] + 1 : kVRAM_CHUNK_INVALID;
+                const uint32_t run = pool_->allocate_run(count, hint);
+                if (run == kVRAM_CHUNK_INVALID) {
+                    A3_LOG("VRAM exhausted 0x%" PRIx64 " with 0x%" PRIx64 "\n", virt, size);
+                    return UINT64_MAX;
+                }
+                start = run;
+            } else {
+                for (uint64_t index = first; index <= last; ++index) {
+                    if (forward_[index] == kVRAM_CHUNK_INVALID && !pool_->claim(start + (index - first))) {
+                        // roll back the chunks taken by this call
+                        for (uint64_t i = first; i < index; ++i) {
+                            if (forward_[i] == kVRAM_CHUNK_INVALID) {
+                                pool_->release(start + (i - first));
+                            }
+                        }
+                        A3_LOG("VRAM 0x%" PRIx64 " cannot grow contiguously\n", virt);
+                        return UINT64_MAX;
+                    }
+                }
+            }
+            for (uint64_t index = first; index <= last; ++index) {
+                if (forward_[index] == kVRAM_CHUNK_INVALID) {
+                    const uint32_t chunk = start + (index - first);
+                    forward_[index] = chunk;
+                    backward_[chunk] = index;
+                    ++allocated_;
+                }
+            }
+        }
+        return host_address(start) + virt % kVRAM_CHUNK_SIZE;
+    }
+    return UINT64_MAX;
+}
+
+uint64_t vram_mapping_t::reverse(uint64_t phys) const {
+    if (!dynamic()) {
+        return phys - base_;
+    }
+    if (phys < base_ || phys >= base_ + backward_.size() * kVRAM_CHUNK_SIZE) {
+        return UINT64_MAX;
+    }
+    A3_SYNCHRONIZED(mutex_) {
+        const uint32_t index = backward_[(phys - base_) / kVRAM_CHUNK_SIZE];
+        if (index == kVRAM_CHUNK_INVALID) {
+            return UINT64_MAX;
+        }
+        return index * kVRAM_CHUNK_SIZE + (phys - base_) % kVRAM_CHUNK_SIZE;
+    }
+    return UINT64_MAX;
+}
+
+uint64_t vram_mapping_t::lookup(uint64_t index) const {
+    if (!dynamic()) {
+        return base_ + index * kVRAM_CHUNK_SIZE;
+    }
+    A3_SYNCHRONIZED(mutex_) {
+        return (forward_[index] != kVRAM_CHUNK_INVALID) ? host_address(forward_[index]) : UINT64_MAX;
+    }
+    return UINT64_MAX;
+}
+
+uint32_t vram_mapping_t::map(uint64_t index, uint32_t hint) {
+    A3_SYNCHRONIZED(mutex_) {
+        return (forward_[index] != kVRAM_CHUNK_INVALID) ? forward_[index] : allocate(index, hint);
+    }
+    return kVRAM_CHUNK_INVALID;
+}
+
+uint32_t vram_mapping_t::allocate(uint64_t index) {
+    // prefer the host chunk next to the guest neighbor. Physically addressed
+    // objects (ramin, contexts) spanning chunks are contiguous in most cases.
+    uint32_t hint = kVRAM_CHUNK_INVALID;
+    if (index > 0 && forward_[index - 1] != kVRAM_CHUNK_INVALID) {
+        hint = forward_[index - 1] + 1;
+    } else if (index + 1 < forward_.size() && forward_[index + 1] != kVRAM_CHUNK_INVALID) {
+        hint = forward_[index + 1] - 1;
+    }
+    return allocate(index, hint);
+}
+
+uint32_t vram_mapping_t::allocate(uint64_t index, uint32_t hint) {
+    if (allocated_ >= quota_) {
+        A3_LOG("VRAM quota exceeded 0x%" PRIx64 "\n", index * kVRAM_CHUNK_SIZE);
+        return kVRAM_CHUNK_INVALID;
+    }
+
+    const uint32_t chunk = pool_->allocate(hint);
+    if (chunk == kVRAM_CHUNK_INVALID) {
+        A3_LOG("VRAM exhausted 0x%" PRIx64 "\n", index * kVRAM_CHUNK_SIZE);
+        return kVRAM_CHUNK_INVALID;
+    }
+    forward_[index] = chunk;
+    backward_[chunk] = index;
+    ++allocated_;
+    return chunk;
+}
+
+uint32_t vram_mapping_t::unmap(uint64_t index) {
+    A3_SYNCHRONIZED(mutex_) {
+        const uint32_t chunk = forward_[index];
+        if (chunk != kVRAM_CHUNK_INVALID) {
+            forward_[index] = kVRAM_CHUNK_INVALID;
+            backward_[chunk] = kVRAM_CHUNK_INVALID;
+            --allocated_;
+        }
+        return chunk;
+    }
+    return kVRAM_CHUNK_INVALID;
+}
+
+}  // namespace a3
+/* vim: set sw=4 ts=4 et tw=80 : */
@@ -0,0 +1,127 @@
+#ifndef A3_VRAM_PARTITION_H_
+#define A3_VRAM_PARTITION_H_
+#include <cstdint>
+#include <vector>
+#include <boost/noncopyable.hpp>
+#include <boost/dynamic_bitset.hpp>
+#include "a3.h"
+#include "lock.h"
+#include "page_table.h"
+#include "partition.h"
+namespace a3 {
+
+class scrubber_t;
+
+// Guest VRAM is backed by host chunks. A chunk equals to the large page, so
+// that large pages mapped by guests are physically contiguous on the host.
+static const uint64_t kVRAM_CHUNK_SIZE = kLARGE_PAGE_SIZE;
+static const uint32_t kVRAM_CHUNK_INVALID = UINT32_MAX;
+
+// copied chunks are checked so that zero filled ones are not stored
+inline bool is_zero_chunk(const uint32_t* data) {
+    for (const uint32_t* end = data + kVRAM_CHUNK_SIZE / sizeof(uint32_t); data != end; ++data) {
+        if (*data) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Host chunk allocator over the guest memory area, shared by all contexts.
+class vram_partition_t : private boost::noncopyable {
+ public:
+    vram_partition_t(uint64_t base, uint64_t size);
+
+    // returns kVRAM_CHUNK_INVALID if the area is exhausted.
+    // hint is tried first to keep guest contiguous memory contiguous.
+    uint32_t allocate(uint32_t hint);
+    // count contiguous chunks, kVRAM_CHUNK_INVALID if no such free run
+    uint32_t allocate_run(uint32_t count, uint32_t hint);
+    // takes the specified chunk, false if it is used
+    bool claim(uint32_t chunk);
+    void release(uint32_t chunk);
+
+    uint64_t base() const { return base_; }
+    uint64_t size() const { return size_; }
+    uint32_t chunks() const { return free_.size(); }
+    uint32_t used() const { return used_; }
+
+ private:
+    mutex_t mutex_;
+    uint64_t base_;
+    uint64_t size_;
+    uint32_t used_;
+    boost::dynamic_bitset<> free_;
+};
+
+// Guest to host VRAM translation of one context.
+//
+// Without pool, the guest VRAM is a fixed slab at the slot memory_base.
+// With pool (--dynamic-vram), chunks are allocated on the first translation
+// up to the slot quota and released when the context ends.
+class vram_mapping_t : private boost::noncopyable {
+ public:
+    // released chunks are scrubbed by scrubber before returned to pool
+    vram_mapping_t(const partition_slot_t& slot, vram_partition_t* pool, scrubber_t* scrubber);
+    ~vram_mapping_t();
+
+    // returns UINT64_MAX if the chunk cannot be backed. Only the chunk
+    // including virt is contiguous on the host.
+    uint64_t translate(uint64_t virt) {
+        if (!dynamic()) {
+            return virt + base_;
+        }
+        return translate(virt, 1);
+    }
+
+    // backs [virt, virt + size) with contiguous host chunks for physically
+    // addressed objects the GPU reads linearly. returns UINT64_MAX if the
+    // range cannot be backed or is already scattered on the host.
+    uint64_t translate(uint64_t virt, uint64_t size);
+
+    // returns UINT64_MAX if phys is not owned by this context
+    uint64_t reverse(uint64_t phys) const;
+
+    bool dynamic() const { return pool_; }
+
+    // host range this context may touch, used for barrier tables
+    uint64_t host_base() const { return base_; }
+    uint64_t host_size() const { return size_; }
+
+    uint64_t allocated() const { return allocated_ * kVRAM_CHUNK_SIZE; }
+    uint64_t quota() const { return quota_ * kVRAM_CHUNK_SIZE; }
+
+    // for eviction. unmap drops the guest chunk index and returns its host
+    // chunk, which the caller releases. map backs index again, preferring
+    // the host chunk hint.
+    uint64_t chunks() const { return forward_.size(); }
+    uint32_t unmap(uint64_t index);
+    uint32_t map(uint64_t index, uint32_t hint);
+    uint64_t host_address(uint32_t chunk) const {
+        return base_ + chunk * kVRAM_CHUNK_SIZE;
+    }
+
+    // host address of the guest chunk index without backing it, UINT64_MAX
+    // if the chunk is not backed
+    uint64_t lookup(uint64_t index) const;
+
+ private:
+    uint32_t allocate(uint64_t index);
+    uint32_t allocate(uint64_t index, uint32_t hint);
+
+    // guards the tables below. Translation runs on session and scheduler
+    // threads while eviction remaps chunks.
+    mutable mutex_t mutex_;
+    vram_partition_t* pool_;
+    scrubber_t* scrubber_;
+    uint64_t base_;
+    uint64_t size_;
+    uint32_t quota_;
+    uint32_t allocated_;
+    std::vector<uint32_t> forward_;   // guest chunk => host chunk
+    std::vector<uint32_t> backward_;  // host chunk => guest chunk
+};
+
+}  // namespace a3
+#endif  // A3_VRAM_PARTITION_H_
+/* vim: set sw=4 ts=4 et tw=80 : */
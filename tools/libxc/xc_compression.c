@@ -2,7 +2,8 @@
  * xc_compression.c
  *
  * Checkpoint Compression using Page Delta Algorithm.
- * - A LRU cache of recently dirtied guest pages is maintained.
+ * - A cache of recently dirtied guest pages is maintained, replacing pages
+ * with the CLOCK algorithm.
  * - For each dirty guest page in the checkpoint, if a previous version of the
  * page exists in the cache, XOR both pages and send the non-zero sections
  * to the receiver. The cache is then updated with the newer copy of guest page.
@@ -39,6 +40,18 @@
 #include "xg_private.h"
 #include "xc_dom.h"
 
+#if defined(__i386__) || defined(__x86_64__)
+#ifdef __SSE2__
+#include <emmintrin.h>
+#define HAVE_DIFF_SSE2
+#endif
+/* AVX2 is used if the CPU has it, which needs target attributes */
+#if __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)
+#include <immintrin.h>
+#define HAVE_DIFF_AVX2
+#endif
+#endif
+
 /* Page Cache for Delta Compression*/
 #define DELTA_CACHE_SIZE (XC_PAGE_SIZE * 8192)
 
@@ -51,10 +64,13 @@ struct cache_page
 {
     char *page;
     xen_pfn_t pfn;
-    struct cache_page *next;
-    struct cache_page *prev;
+    int referenced;     /* hit since the clock hand last passed */
 };
 
+/* Sets bit i of mask[] if word i of the two pages differs. */
+typedef void diff_words_fn(const uint32_t *old, const uint32_t *new,
+                           uint64_t *mask);
+
 struct compression_ctx
 {
     /* compression buffer - holds compressed data */
@@ -69,13 +85,17 @@ struct compression_ctx
     unsigned int pfns_len;
     unsigned int pfns_index;
 
-    /* Compression Cache (LRU) */
+    /* Compression Cache (CLOCK) */
     char *cache_base;
-    struct cache_page **pfn2cache;
     struct cache_page *cache;
-    struct cache_page *page_list_head;
-    struct cache_page *page_list_tail;
+    unsigned long num_cache_pages;
+    unsigned long clock_hand;
+    /* open addressed pfn -> cache page index + 1, 0 if empty */
+    uint32_t *cache_index;
+    unsigned long index_mask;
     unsigned long dom_pfnlist_size;
+
+    diff_words_fn *diff_words;
 };
 
 #define RUNFLAG 0
@@ -108,6 +128,10 @@ struct compression_ctx
 #define FULL_PAGE SKIPFLAG
 #define FULL_PAGE_SIZE (XC_PAGE_SIZE + 1)
 #define MAX_DELTAS (XC_PAGE_SIZE/sizeof(uint32_t))
+#define MASK_WORDS (MAX_DELTAS/64)
+
+/* Twice as many slots as cache pages keeps the probe sequences short */
+#define CACHE_INDEX_SIZE (2 * DELTA_CACHE_SIZE/XC_PAGE_SIZE)
 
 /*
  * Add a pagetable page or a new page (uncached)
@@ -132,16 +156,113 @@ static int add_full_page(comp_ctx *ctx, char *srcpage, char *cache_page)
     return FULL_PAGE_SIZE;
 }
 
-static int compress_page(comp_ctx *ctx, char *srcpage, char *cache_page)
+#ifndef HAVE_DIFF_SSE2
+static void diff_words_scalar(const uint32_t *old, const uint32_t *new,
+                              uint64_t *mask)
 {
-    char *dest = (ctx->compbuf + ctx->compbuf_pos);
-    uint32_t *new, *old;
+    const uint64_t *o = (const uint64_t *)old, *n = (const uint64_t *)new;
+    unsigned int i, j;
+    uint64_t bits;
 
-    int off, runptr = 0;
-    int wascopying = 0, copying = 0, bytes_skipped = 0;
-    int complen = 0, pageoff = 0, runbytes = 0;
+    /* skipping 32 bytes at a time where nothing changed */
+    memset(mask, 0, MASK_WORDS * sizeof(*mask));
+    for (i = 0; i < MAX_DELTAS; i += 8, o += 4, n += 4)
+    {
+        if (!((o[0] ^ n[0]) | (o[1] ^ n[1]) | (o[2] ^ n[2]) | (o[3] ^ n[3])))
+            continue;
+        bits = 0;
+        for (j = 0; j < 8; j++)
+            bits |= (uint64_t)(old[i + j] != new[i + j]) << j;
+        mask[i / 64] |= bits << (i % 64);
+    }
+}
+#else
+static void diff_words_sse2(const uint32_t *old, const uint32_t *new,
+                            uint64_t *mask)
+{
+    const __m128i *o = (const __m128i *)old, *n = (const __m128i *)new;
+    unsigned int i, j;
+    uint64_t bits, same;
 
-    char runlen = 0;
+    /* 32 bytes, 8 words, at a time */
+    for (i = 0; i < MASK_WORDS; i++)
+    {
+        bits = 0;
+        for (j = 0; j < 8; j++, o += 2, n += 2)
+        {
+            same = _mm_movemask_ps(_mm_castsi128_ps(
+                       _mm_cmpeq_epi32(_mm_load_si128(o),
+                                       _mm_load_si128(n))));
+            same |= _mm_movemask_ps(_mm_castsi128_ps(
+                        _mm_cmpeq_epi32(_mm_load_si128(o + 1),
+                                        _mm_load_si128(n + 1)))) << 4;
+            bits |= (~same & 0xff) << (j * 8);
+        }
+        mask[i] = bits;
+    }
+}
+#endif
+
+#ifdef HAVE_DIFF_AVX2
+__attribute__((target("avx2")))
+static void diff_words_avx2(const uint32_t *old, const uint32_t *new,
+                            uint64_t *mask)
+{
+    const __m256i *o = (const __m256i *)old, *n = (const __m256i *)new;
+    unsigned int i, j;
+    uint64_t bits, same;
+
+    for (i = 0; i < MASK_WORDS; i++)
+    {
+        bits = 0;
+        for (j = 0; j < 8; j++, o++, n++)
+        {
+            same = _mm256_movemask_ps(_mm256_castsi256_ps(
+                       _mm256_cmpeq_epi32(_mm256_load_si256(o),
+                                          _mm256_load_si256(n))));
+            bits |= (~same & 0xff) << (j * 8);
+        }
+        mask[i] = bits;
+    }
+}
+#endif
+
+static diff_words_fn *pick_diff_words(void)
+{
+#ifdef HAVE_DIFF_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return diff_words_avx2;
+#endif
+#ifdef HAVE_DIFF_SSE2
+    return diff_words_sse2;
+#else
+    return diff_words_scalar;
+#endif
+}
+
+/* Index of the first word from off on which is not (changed ? set : clear). */
+static unsigned int run_end(const uint64_t *mask, unsigned int off,
+                            int changed)
+{
+    unsigned int i = off / 64;
+    uint64_t bits = (changed ? ~mask[i] : mask[i]) & (~0ULL << (off % 64));
+
+    while (!bits)
+    {
+        if (++i == MASK_WORDS)
+            return MAX_DELTAS;
+        bits = changed ? ~mask[i] : mask[i];
+    }
+    return i * 64 + __builtin_ctzll(bits);
+}
+
+static int compress_page(comp_ctx *ctx, char *srcpage, char *cache_page)
+{
+    char *dest = (ctx->compbuf + ctx->compbuf_pos);
+    uint64_t mask[MASK_WORDS], any = 0;
+    unsigned int off, end, runlen, runbytes, pageoff;
+    int complen = 0, changed, i;
 
     if ( (ctx->compbuf_pos + WORST_COMP_PAGE_SIZE) > ctx->compbuf_size)
         return -1;
@@ -151,136 +272,148 @@ static int compress_page(comp_ctx *ctx, char *srcpage, char *cache_page)
      * domU's page passed from xc_domain_save and cache_page is
      * a ptr to cache page (cache is page aligned).
      */
-    new = (uint32_t*)srcpage;
-    old = (uint32_t*)cache_page;
+    ctx->diff_words((uint32_t *)cache_page, (uint32_t *)srcpage, mask);
+
+    for (i = 0; i < MASK_WORDS; i++)
+        any |= mask[i];
+    if (!any)
+    {
+        /* Empty page */
+        dest[0] = EMPTY_PAGE;
+        ctx->compbuf_pos += 1;
+        return 1;
+    }
 
-    for (off = 0; off <= MAX_DELTAS; off++)
+    /* Runs of changed and unchanged words, split at LENMASK words */
+    for (off = 0; off < MAX_DELTAS; off = end)
     {
-        /*
-         * At (off == MAX_DELTAS), we are processing the last run
-         * in the page. Since there is no XORing, make wascopying != copying
-         * to satisfy the if-block below.
-         */
-        copying = ((off < MAX_DELTAS) ? (old[off] != new[off]) : !wascopying);
-
-        if (runlen)
+        changed = (mask[off / 64] >> (off % 64)) & 1;
+        end = run_end(mask, off, changed);
+
+        for (; off < end; off += runlen)
         {
-            /* switching between run types or current run is full */
-            if ( (wascopying != copying) || (runlen == LENMASK) )
+            runlen = end - off;
+            if (runlen > LENMASK)
+                runlen = LENMASK;
+            dest[complen++] = runlen | (changed ? RUNFLAG : SKIPFLAG);
+
+            if (changed)
             {
                 runbytes = runlen * sizeof(uint32_t);
-                runlen |= (wascopying ? RUNFLAG : SKIPFLAG);
-                dest[complen++] = runlen;
-
-                if (wascopying) /* RUNFLAG */
-                {
-                    pageoff = runptr * sizeof(uint32_t);
-                    memcpy(dest + complen, srcpage + pageoff, runbytes);
-                    memcpy(cache_page + pageoff, srcpage + pageoff, runbytes);
-                    complen += runbytes;
-                }
-                else /* SKIPFLAG */
-                {
-                    bytes_skipped += runbytes;
-                }
-
-                runlen = 0;
-                runptr = off;
+                pageoff = off * sizeof(uint32_t);
+                memcpy(dest + complen, srcpage + pageoff, runbytes);
+                memcpy(cache_page + pageoff, srcpage + pageoff, runbytes);
+                complen += runbytes;
             }
         }
-        runlen++;
-        wascopying = copying;
     }
+    ctx->compbuf_pos += complen;
 
-    /*
-     * Check for empty page.
-     */
-    if (bytes_skipped == XC_PAGE_SIZE)
+    return complen;
+}
+
+static unsigned long cache_hash(comp_ctx *ctx, xen_pfn_t pfn)
+{
+    return ((uint64_t)pfn * 0x9e3779b97f4a7c15ULL >> 32) & ctx->index_mask;
+}
+
+/* Slot of pfn in the cache index, or -1. */
+static long cache_index_find(comp_ctx *ctx, xen_pfn_t pfn)
+{
+    unsigned long slot = cache_hash(ctx, pfn);
+    uint32_t entry;
+
+    while ((entry = ctx->cache_index[slot]))
     {
-        complen = 1;
-        dest[0] = EMPTY_PAGE;
+        if (ctx->cache[entry - 1].pfn == pfn)
+            return slot;
+        slot = (slot + 1) & ctx->index_mask;
     }
-    ctx->compbuf_pos += complen;
+    return -1;
+}
 
-    return complen;
+static void cache_index_insert(comp_ctx *ctx, struct cache_page *item)
+{
+    unsigned long slot = cache_hash(ctx, item->pfn);
+
+    while (ctx->cache_index[slot])
+        slot = (slot + 1) & ctx->index_mask;
+    ctx->cache_index[slot] = item - ctx->cache + 1;
+}
+
+/* Empties a slot, moving back later entries of its probe sequence. */
+static void cache_index_remove(comp_ctx *ctx, unsigned long slot)
+{
+    unsigned long next = slot, home;
+
+    for (;;)
+    {
+        ctx->cache_index[slot] = 0;
+        do
+        {
+            next = (next + 1) & ctx->index_mask;
+            if (!ctx->cache_index[next])
+                return;
+            home = cache_hash(ctx,
+                              ctx->cache[ctx->cache_index[next] - 1].pfn);
+        } while (((next - home) & ctx->index_mask) <
+                 ((next - slot) & ctx->index_mask));
+        ctx->cache_index[slot] = ctx->cache_index[next];
+        slot = next;
+    }
 }
 
 static
 char *get_cache_page(comp_ctx *ctx, xen_pfn_t pfn,
                      int *israw)
 {
-    struct cache_page *item = NULL;
-
-    item = ctx->pfn2cache[pfn];
+    struct cache_page *item;
+    long slot;
 
-    if (!item)
+    slot = cache_index_find(ctx, pfn);
+    if (slot >= 0)
     {
-        *israw = 1;
+        item = &ctx->cache[ctx->cache_index[slot] - 1];
+        item->referenced = 1;
+        return item->page;
+    }
 
-        /* If the list is full, evict a page from the tail end. */
-        item = ctx->page_list_tail;
-        if (item->pfn != INVALID_P2M_ENTRY)
-            ctx->pfn2cache[item->pfn] = NULL;
+    *israw = 1;
 
-        item->pfn = pfn;
-        ctx->pfn2cache[pfn] = item;
-    }
-        
-    /* 	if requested item is in cache move to head of list */
-    if (item != ctx->page_list_head)
+    /* Evict the first page the hand finds which has not been hit since
+     * it last came round, giving the others a second chance. */
+    for (;;)
     {
-        if (item == ctx->page_list_tail)
-        {
-            /* item at tail of list. */
-            ctx->page_list_tail = item->prev;
-            (ctx->page_list_tail)->next = NULL;
-        }
-        else
-        {
-            /* item in middle of list */
-            item->prev->next = item->next;
-            item->next->prev = item->prev;
-        }
-
-        item->prev = NULL;
-        item->next = ctx->page_list_head;
-        (ctx->page_list_head)->prev = item;
-        ctx->page_list_head = item;
+        item = &ctx->cache[ctx->clock_hand];
+        if (++ctx->clock_hand == ctx->num_cache_pages)
+            ctx->clock_hand = 0;
+        if (!item->referenced)
+            break;
+        item->referenced = 0;
     }
+    if (item->pfn != INVALID_P2M_ENTRY)
+        cache_index_remove(ctx, cache_index_find(ctx, item->pfn));
+
+    item->pfn = pfn;
+    cache_index_insert(ctx, item);
 
-    return (ctx->page_list_head)->page;
+    return item->page;
 }
 
-/* Remove pagetable pages from cache and move to tail, as free pages */
+/* Remove pagetable pages from cache, freeing their slot for the clock */
 static
 void invalidate_cache_page(comp_ctx *ctx, xen_pfn_t pfn)
 {
-    struct cache_page *item = NULL;
+    struct cache_page *item;
+    long slot;
 
-    item = ctx->pfn2cache[pfn];
-    if (item)
+    slot = cache_index_find(ctx, pfn);
+    if (slot >= 0)
     {
-        if (item != ctx->page_list_tail)
-        {
-            /* item at head of list */
-            if (item == ctx->page_list_head)
-            {
-                ctx->page_list_head = (ctx->page_list_head)->next;
-                (ctx->page_list_head)->prev = NULL;
-            }
-            else /* item in middle of list */
-            {            
-                item->prev->next = item->next;
-                item->next->prev = item->prev;
-            }
-
-            item->next = NULL;
-            item->prev = ctx->page_list_tail;
-            (ctx->page_list_tail)->next = item;
-            ctx->page_list_tail = item;
-        }
-        ctx->pfn2cache[pfn] = NULL;
-        (ctx->page_list_tail)->pfn = INVALID_P2M_ENTRY;
+        item = &ctx->cache[ctx->cache_index[slot] - 1];
+        cache_index_remove(ctx, slot);
+        item->pfn = INVALID_P2M_ENTRY;
+        item->referenced = 0;
     }
 }
 
@@ -463,8 +596,8 @@ void xc_compression_free_context(xc_interface *xch, comp_ctx *ctx)
         free(ctx->sendbuf_pfns);
     if (ctx->cache_base)
         free(ctx->cache_base);
-    if (ctx->pfn2cache)
-        free(ctx->pfn2cache);
+    if (ctx->cache_index)
+        free(ctx->cache_index);
     if (ctx->cache)
         free(ctx->cache);
     free(ctx);
@@ -509,10 +642,10 @@ comp_ctx *xc_compression_create_context(xc_interface *xch,
     memset(ctx->sendbuf_pfns, -1,
            NRPAGES(PAGE_BUFFER_SIZE) * sizeof(xen_pfn_t));
 
-    ctx->pfn2cache = calloc(p2m_size, sizeof(struct cache_page *));
-    if (!ctx->pfn2cache)
+    ctx->cache_index = calloc(CACHE_INDEX_SIZE, sizeof(uint32_t));
+    if (!ctx->cache_index)
     {
-        ERROR("Could not alloc pfn2cache map\n");
+        ERROR("Could not alloc cache index\n");
         goto error;
     }
 
@@ -527,13 +660,12 @@ comp_ctx *xc_compression_create_context(xc_interface *xch,
     {
         ctx->cache[i].pfn = INVALID_P2M_ENTRY;
         ctx->cache[i].page = ctx->cache_base + i * XC_PAGE_SIZE;
-        ctx->cache[i].prev = (i == 0) ? NULL : &(ctx->cache[i - 1]);
-        ctx->cache[i].next = ((i+1) == num_cache_pages)? NULL :
-            &(ctx->cache[i + 1]);
+        ctx->cache[i].referenced = 0;
     }
-    ctx->page_list_head = &(ctx->cache[0]);
-    ctx->page_list_tail = &(ctx->cache[num_cache_pages -1]);
+    ctx->num_cache_pages = num_cache_pages;
+    ctx->index_mask = CACHE_INDEX_SIZE - 1;
     ctx->dom_pfnlist_size = p2m_size;
+    ctx->diff_words = pick_diff_words();
 
     return ctx;
 error:
@@ -25,6 +25,11 @@
 
 #include <stdlib.h>
 #include <unistd.h>
+#ifndef __MINIOS__
+#include <pthread.h>
+#include <poll.h>
+#endif
+#include <zlib.h>
 
 #include "xg_private.h"
 #include "xg_save_restore.h"
@@ -44,6 +49,7 @@ struct restore_ctx {
     int completed; /* Set when a consistent image is available */
     int last_checkpoint; /* Set when we should commit to the current checkpoint when it completes. */
     int compressing; /* Set when sender signals that pages would be sent compressed (for Remus) */
+    int stop_fd; /* Readable when the reader thread should stop, or -1 */
     struct domain_info_context dinfo;
 };
 
@@ -65,6 +71,24 @@ static ssize_t rdexact(xc_interface *xch, struct restore_ctx *ctx,
 
     while ( offset < size )
     {
+        if ( ctx->stop_fd != -1 ) {
+            struct pollfd pfd[2] = {
+                { .fd = fd, .events = POLLIN },
+                { .fd = ctx->stop_fd, .events = POLLIN },
+            };
+
+            if ( poll(pfd, 2, -1) == -1 ) {
+                if ( errno == EINTR )
+                    continue;
+                PERROR("read_exact_timed failed (poll)");
+                return -1;
+            }
+            if ( pfd[1].revents ) {
+                errno = ECANCELED;
+                return -1;
+            }
+        }
+
         if ( ctx->completed ) {
             /* expect a heartbeat every HEARBEAT_MS ms maximum */
             tv.tv_sec = HEARTBEAT_MS / 1000;
@@ -716,12 +740,131 @@ static void pagebuf_free(pagebuf_t* buf)
     }
 }
 
+/*
+ * Reads the rest of an XC_SAVE_ID_PACKED_BATCH, whose pfn types are at
+ * buf->pfn_types[first] onwards, and expands it into buf->pages as if it
+ * had been sent as a +ve chunk.
+ */
+static int pagebuf_get_packed(xc_interface *xch, struct restore_ctx *ctx,
+                              pagebuf_t *buf, int fd, int first, int count,
+                              int countpages, uint32_t flags)
+{
+    uint8_t zero[MAX_BATCH_SIZE / 8];
+    unsigned long pagetype;
+    char *pages, *comp = NULL;
+    uint32_t comp_len;
+    int i, slot, src, nr_data;
+    void *ptmp;
+    z_stream zs;
+
+    if ( RDEXACT(fd, zero, (count + 7) / 8) )
+    {
+        PERROR("Error when reading zero page bitmap");
+        return -1;
+    }
+
+    nr_data = countpages;
+    for ( i = 0; i < count; i++ )
+    {
+        pagetype = buf->pfn_types[first + i] & XEN_DOMCTL_PFINFO_LTAB_MASK;
+        if ( (zero[i / 8] & (1 << (i % 8))) &&
+             pagetype != XEN_DOMCTL_PFINFO_XTAB &&
+             pagetype != XEN_DOMCTL_PFINFO_XALLOC )
+            nr_data--;
+    }
+
+    if ( !countpages )
+        return count;
+
+    if ( !(ptmp = realloc(buf->pages,
+                          (buf->nr_physpages + countpages) * PAGE_SIZE)) )
+    {
+        ERROR("Could not (re)allocate page buffer");
+        return -1;
+    }
+    buf->pages = ptmp;
+    pages = (char *)buf->pages + buf->nr_physpages * PAGE_SIZE;
+    buf->nr_physpages += countpages;
+
+    /* the pages which were sent go to the start of the space for the batch */
+    if ( !(flags & XC_PACKED_DEFLATED) )
+    {
+        if ( RDEXACT(fd, pages, nr_data * PAGE_SIZE) )
+        {
+            PERROR("Error when reading pages");
+            return -1;
+        }
+    }
+    else
+    {
+        if ( RDEXACT(fd, &comp_len, sizeof(comp_len)) )
+        {
+            PERROR("Error when reading deflated page size");
+            return -1;
+        }
+        if ( comp_len > nr_data * PAGE_SIZE || !(comp = malloc(comp_len)) )
+        {
+            ERROR("Could not allocate %u bytes for deflated pages", comp_len);
+            return -1;
+        }
+        if ( RDEXACT(fd, comp, comp_len) )
+        {
+            PERROR("Error when reading deflated pages");
+            free(comp);
+            return -1;
+        }
+
+        memset(&zs, 0, sizeof(zs));
+        if ( inflateInit(&zs) != Z_OK )
+        {
+            ERROR("Could not set up inflating pages");
+            free(comp);
+            return -1;
+        }
+        zs.next_in = (Bytef *)comp;
+        zs.avail_in = comp_len;
+        zs.next_out = (Bytef *)pages;
+        zs.avail_out = nr_data * PAGE_SIZE;
+        i = inflate(&zs, Z_FINISH);
+        inflateEnd(&zs);
+        free(comp);
+        if ( i != Z_STREAM_END || zs.total_out != nr_data * PAGE_SIZE )
+        {
+            ERROR("Corrupt deflated pages (rc=%d, %lu bytes)",
+                  i, zs.total_out);
+            errno = EINVAL;
+            return -1;
+        }
+    }
+
+    /* spread them out from the end, filling in the zero pages */
+    slot = countpages;
+    src = nr_data;
+    for ( i = count - 1; i >= 0; i-- )
+    {
+        pagetype = buf->pfn_types[first + i] & XEN_DOMCTL_PFINFO_LTAB_MASK;
+        if ( pagetype == XEN_DOMCTL_PFINFO_XTAB ||
+             pagetype == XEN_DOMCTL_PFINFO_XALLOC )
+            continue;
+        slot--;
+        if ( zero[i / 8] & (1 << (i % 8)) )
+            memset(pages + slot * PAGE_SIZE, 0, PAGE_SIZE);
+        else if ( --src != slot )
+            memcpy(pages + slot * PAGE_SIZE, pages + src * PAGE_SIZE,
+                   PAGE_SIZE);
+    }
+
+    return count;
+}
+
 static int pagebuf_get_one(xc_interface *xch, struct restore_ctx *ctx,
                            pagebuf_t* buf, int fd, uint32_t dom)
 {
     int count, countpages, oldcount, i;
     void* ptmp;
     unsigned long compbuf_size;
+    uint32_t packed_flags = 0;
+    int packed = 0;
 
     if ( RDEXACT(fd, &count, sizeof(count)) )
     {
@@ -932,6 +1075,21 @@ static int pagebuf_get_one(xc_interface *xch, struct restore_ctx *ctx,
         DPRINTF("read generation id buffer address");
         return pagebuf_get_one(xch, ctx, buf, fd, dom);
 
+    case XC_SAVE_ID_PACKED_BATCH:
+        if ( RDEXACT(fd, &count, sizeof(count)) ||
+             RDEXACT(fd, &packed_flags, sizeof(packed_flags)) )
+        {
+            PERROR("Error when reading packed batch header");
+            return -1;
+        }
+        if ( buf->compressing )
+        {
+            ERROR("Packed batch in a compressed checkpoint");
+            errno = EINVAL;
+            return -1;
+        }
+        packed = 1;
+        /* fall through */
     default:
         if ( (count > MAX_BATCH_SIZE) || (count < 0) ) {
             ERROR("Max batch size exceeded (%d). Giving up.", count);
@@ -966,6 +1124,10 @@ static int pagebuf_get_one(xc_interface *xch, struct restore_ctx *ctx,
             ||(buf->pfn_types[i] & XEN_DOMCTL_PFINFO_LTAB_MASK) == XEN_DOMCTL_PFINFO_XALLOC)
             --countpages;
 
+    if (packed)
+        return pagebuf_get_packed(xch, ctx, buf, fd, oldcount, count,
+                                  countpages, packed_flags);
+
     if (!countpages)
         return count;
 
@@ -1016,6 +1178,224 @@ static int pagebuf_get(xc_interface *xch, struct restore_ctx *ctx,
     return rc;
 }
 
+#ifndef __MINIOS__
+/*
+ * During the first pass a reader thread reads batches ahead while this one
+ * allocates, maps and fills the previous ones. The reader parses into the
+ * pagebuf as before, so records other than batches land there, but hands
+ * the pfn types and pages of each batch over in a slot.
+ */
+#define READER_SLOTS 4
+
+struct reader_slot {
+    unsigned long *pfn_types;
+    void *pages;
+    unsigned int nr_pages, nr_physpages;
+    int verify;
+};
+
+struct restore_reader {
+    xc_interface *xch;
+    struct restore_ctx *ctx;
+    pagebuf_t *buf;
+    int fd;
+    uint32_t dom;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    /* written to stop a read in progress, see rdexact() */
+    int wake[2];
+    /* full slots are slots[head] onwards */
+    struct reader_slot slots[READER_SLOTS];
+    unsigned int head, count;
+    int done, rc;
+    int stop;
+};
+
+static void *restore_reader_thread(void *arg)
+{
+    struct restore_reader *rd = arg;
+    struct reader_slot *slot;
+    unsigned long *pfn_types;
+    void *pages;
+    int rc;
+
+    for ( ; ; )
+    {
+        pthread_mutex_lock(&rd->lock);
+        rc = rd->stop;
+        pthread_mutex_unlock(&rd->lock);
+        if ( rc )
+            return NULL;
+
+        rd->buf->nr_physpages = rd->buf->nr_pages = 0;
+        rc = pagebuf_get_one(rd->xch, rd->ctx, rd->buf, rd->fd, rd->dom);
+
+        pthread_mutex_lock(&rd->lock);
+        if ( rd->stop )
+        {
+            pthread_mutex_unlock(&rd->lock);
+            return NULL;
+        }
+        if ( rc <= 0 )
+        {
+            rd->done = 1;
+            rd->rc = rc;
+            pthread_cond_broadcast(&rd->cond);
+            pthread_mutex_unlock(&rd->lock);
+            return NULL;
+        }
+
+        while ( rd->count == READER_SLOTS && !rd->stop )
+            pthread_cond_wait(&rd->cond, &rd->lock);
+        if ( rd->stop )
+        {
+            pthread_mutex_unlock(&rd->lock);
+            return NULL;
+        }
+
+        /* swap buffers with the free slot */
+        slot = &rd->slots[(rd->head + rd->count) % READER_SLOTS];
+        pfn_types = slot->pfn_types;
+        pages = slot->pages;
+        slot->pfn_types = rd->buf->pfn_types;
+        slot->pages = rd->buf->pages;
+        slot->nr_pages = rd->buf->nr_pages;
+        slot->nr_physpages = rd->buf->nr_physpages;
+        slot->verify = rd->buf->verify;
+        rd->buf->pfn_types = pfn_types;
+        rd->buf->pages = pages;
+
+        rd->count++;
+        pthread_cond_broadcast(&rd->cond);
+        pthread_mutex_unlock(&rd->lock);
+    }
+}
+
+static int restore_reader_start(struct restore_reader *rd, xc_interface *xch,
+                                struct restore_ctx *ctx, pagebuf_t *buf,
+                                int fd, uint32_t dom)
+{
+    memset(rd, 0, sizeof(*rd));
+    rd->xch = xch;
+    rd->ctx = ctx;
+    rd->buf = buf;
+    rd->fd = fd;
+    rd->dom = dom;
+    if ( pipe(rd->wake) )
+        return -1;
+    pthread_mutex_init(&rd->lock, NULL);
+    pthread_cond_init(&rd->cond, NULL);
+    ctx->stop_fd = rd->wake[0];
+
+    if ( pthread_create(&rd->thread, NULL, restore_reader_thread, rd) )
+    {
+        ctx->stop_fd = -1;
+        pthread_cond_destroy(&rd->cond);
+        pthread_mutex_destroy(&rd->lock);
+        close(rd->wake[0]);
+        close(rd->wake[1]);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Points batch at the next batch read, returns 1. Returns 0 once the pages
+ * are all read and the other records are in the pagebuf, -1 on error.
+ */
+static int restore_reader_next(struct restore_reader *rd, pagebuf_t *batch)
+{
+    struct reader_slot *slot;
+    int rc;
+
+    pthread_mutex_lock(&rd->lock);
+    while ( !rd->count && !rd->done )
+        pthread_cond_wait(&rd->cond, &rd->lock);
+
+    if ( rd->count )
+    {
+        slot = &rd->slots[rd->head];
+        batch->pfn_types = slot->pfn_types;
+        batch->pages = slot->pages;
+        batch->nr_pages = slot->nr_pages;
+        batch->nr_physpages = slot->nr_physpages;
+        batch->verify = slot->verify;
+        rc = 1;
+    }
+    else
+        rc = rd->rc;
+    pthread_mutex_unlock(&rd->lock);
+
+    return rc;
+}
+
+/* Done with the batch from restore_reader_next(). */
+static void restore_reader_put(struct restore_reader *rd)
+{
+    pthread_mutex_lock(&rd->lock);
+    rd->head = (rd->head + 1) % READER_SLOTS;
+    rd->count--;
+    pthread_cond_broadcast(&rd->cond);
+    pthread_mutex_unlock(&rd->lock);
+}
+
+static void restore_reader_stop(struct restore_reader *rd)
+{
+    xc_interface *xch = rd->xch;
+    unsigned int i;
+
+    /*
+     * The reader checks stop between records. A read in progress sees the
+     * wake pipe and fails, and the reader then stops.
+     */
+    pthread_mutex_lock(&rd->lock);
+    rd->stop = 1;
+    pthread_cond_broadcast(&rd->cond);
+    pthread_mutex_unlock(&rd->lock);
+    if ( write(rd->wake[1], "", 1) != 1 )
+        PERROR("failed to wake the reader");
+    pthread_join(rd->thread, NULL);
+    rd->ctx->stop_fd = -1;
+    close(rd->wake[0]);
+    close(rd->wake[1]);
+
+    for ( i = 0; i < READER_SLOTS; i++ )
+    {
+        free(rd->slots[i].pfn_types);
+        free(rd->slots[i].pages);
+    }
+    pthread_cond_destroy(&rd->cond);
+    pthread_mutex_destroy(&rd->lock);
+}
+#else
+struct restore_reader {
+    int unused;
+};
+
+static int restore_reader_start(struct restore_reader *rd, xc_interface *xch,
+                                struct restore_ctx *ctx, pagebuf_t *buf,
+                                int fd, uint32_t dom)
+{
+    return -1;
+}
+
+static int restore_reader_next(struct restore_reader *rd, pagebuf_t *batch)
+{
+    return -1;
+}
+
+static void restore_reader_put(struct restore_reader *rd)
+{
+}
+
+static void restore_reader_stop(struct restore_reader *rd)
+{
+}
+#endif
+
 static int apply_batch(xc_interface *xch, uint32_t dom, struct restore_ctx *ctx,
                        xen_pfn_t* region_mfn, unsigned long* pfn_type, int pae_extended_cr3,
                        unsigned int hvm, struct xc_mmu* mmu,
@@ -1372,6 +1752,10 @@ int xc_domain_restore(xc_interface *xch, int io_fd, uint32_t dom,
 
     pagebuf_t pagebuf;
     tailbuf_t tailbuf, tmptail;
+    /* batches of the first pass, read ahead by the reader */
+    struct restore_reader reader;
+    pagebuf_t readbuf, *curbuf;
+    int reading = 0;
     struct toolstack_data_t tdata, tdatatmp;
     void* vcpup;
     uint64_t console_pfn = 0;
@@ -1383,11 +1767,13 @@ int xc_domain_restore(xc_interface *xch, int io_fd, uint32_t dom,
     struct domain_info_context *dinfo = &ctx->dinfo;
 
     pagebuf_init(&pagebuf);
+    pagebuf_init(&readbuf);
     memset(&tailbuf, 0, sizeof(tailbuf));
     tailbuf.ishvm = hvm;
     memset(&tdata, 0, sizeof(tdata));
 
     memset(ctx, 0, sizeof(*ctx));
+    ctx->stop_fd = -1;
 
     ctxt = xc_hypercall_buffer_alloc(xch, ctxt, sizeof(*ctxt));
 
@@ -1494,6 +1880,9 @@ int xc_domain_restore(xc_interface *xch, int io_fd, uint32_t dom,
      * We uncanonicalise page tables as we go.
      */
 
+    /* Read the first pass in another thread, if we can */
+    reading = !restore_reader_start(&reader, xch, ctx, &pagebuf, io_fd, dom);
+
     n = m = 0;
  loadpages:
     for ( ; ; )
@@ -1502,7 +1891,16 @@ int xc_domain_restore(xc_interface *xch, int io_fd, uint32_t dom,
 
         xc_report_progress_step(xch, n, dinfo->p2m_size);
 
-        if ( !ctx->completed ) {
+        curbuf = &pagebuf;
+        if ( !ctx->completed && reading ) {
+            frc = restore_reader_next(&reader, &readbuf);
+            if ( frc < 0 ) {
+                PERROR("Error when reading batch");
+                goto out;
+            }
+            if ( frc > 0 )
+                curbuf = &readbuf;
+        } else if ( !ctx->completed ) {
             pagebuf.nr_physpages = pagebuf.nr_pages = 0;
             pagebuf.compbuf_pos = pagebuf.compbuf_size = 0;
             if ( pagebuf_get_one(xch, ctx, &pagebuf, io_fd, dom) < 0 ) {
@@ -1510,7 +1908,7 @@ int xc_domain_restore(xc_interface *xch, int io_fd, uint32_t dom,
                 goto out;
             }
         }
-        j = pagebuf.nr_pages;
+        j = curbuf->nr_pages;
 
         DBGPRINTF("batch %d\n",j);
 
@@ -1575,7 +1973,7 @@ int xc_domain_restore(xc_interface *xch, int io_fd, uint32_t dom,
             int brc;
 
             brc = apply_batch(xch, dom, ctx, region_mfn, pfn_type,
-                              pae_extended_cr3, hvm, mmu, &pagebuf, curbatch,
+                              pae_extended_cr3, hvm, mmu, curbuf, curbatch,
                               superpages);
             if ( brc < 0 )
                 goto out;
@@ -1585,8 +1983,12 @@ int xc_domain_restore(xc_interface *xch, int io_fd, uint32_t dom,
             curbatch += MAX_BATCH_SIZE;
         }
 
-        pagebuf.nr_physpages = pagebuf.nr_pages = 0;
-        pagebuf.compbuf_pos = pagebuf.compbuf_size = 0;
+        if ( curbuf == &readbuf ) {
+            restore_reader_put(&reader);
+        } else {
+            pagebuf.nr_physpages = pagebuf.nr_pages = 0;
+            pagebuf.compbuf_pos = pagebuf.compbuf_size = 0;
+        }
 
         n += j; /* crude stats */
 
@@ -1602,6 +2004,12 @@ int xc_domain_restore(xc_interface *xch, int io_fd, uint32_t dom,
         }
     }
 
+    /* The reader stopped at the end of the pages */
+    if ( reading ) {
+        restore_reader_stop(&reader);
+        reading = 0;
+    }
+
     /*
      * Ensure we flush all machphys updates before potential PAE-specific
      * reallocations below.
@@ -2202,6 +2610,8 @@ int xc_domain_restore(xc_interface *xch, int io_fd, uint32_t dom,
     rc = 0;
 
  out:
+    if ( reading )
+        restore_reader_stop(&reader);
     if ( (rc != 0) && (dom != 0) )
         xc_domain_destroy(xch, dom);
     xc_hypercall_buffer_free(xch, ctxt);
@@ -25,6 +25,10 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <sys/time.h>
+#ifndef __MINIOS__
+#include <pthread.h>
+#endif
+#include <zlib.h>
 
 #include "xc_private.h"
 #include "xc_bitops.h"
@@ -43,6 +47,9 @@
 */
 #define DEF_MAX_ITERS   29   /* limit us to 30 times round loop   */
 #define DEF_MAX_FACTOR   3   /* never send more than 3x p2m_size  */
+#define DEF_DOWNTIME   300   /* aim for a 300ms last iteration    */
+#define STALL_ROUNDS     2   /* give up after 2 rounds not closer */
+#define SAVE_PIPE_MAX_WORKERS 8 /* page threads, by default one per CPU */
 
 struct save_ctx {
     unsigned long hvirt_start; /* virtual starting address of the hypervisor */
@@ -315,6 +322,69 @@ static int print_stats(xc_interface *xch, uint32_t domid, int pages_sent,
     return 0;
 }
 
+/*
+** Precopy convergence. After each round we know how fast pages went out
+** and how fast the guest dirtied them meanwhile, so how long sending the
+** pages still dirty would take with the guest suspended. We suspend once
+** that is within the target downtime or, as another round would not bring
+** it much closer, once it stops improving. max_iters and max_factor still
+** bound the rounds.
+*/
+struct precopy_stats {
+    unsigned long send_rate;    /* pages/s with data on the wire, smoothed */
+    unsigned long dirty_rate;   /* pages/s, likewise */
+    unsigned long remaining;    /* pages dirty for the next round */
+    unsigned long downtime;     /* ms to send them, 0 if unknown */
+    unsigned long best;         /* least downtime predicted so far */
+    unsigned int stalled;       /* rounds without getting below 90% of it */
+};
+
+/*
+ * Exponentially weighted: the last round counts half, the one before a
+ * quarter and so on, so the rates follow a guest whose load changes.
+ */
+static unsigned long precopy_rate(unsigned long avg, unsigned long pages,
+                                  uint64_t usecs)
+{
+    unsigned long rate = pages * 1000000ULL / MAX(usecs, 1);
+
+    return avg ? (avg + rate) / 2 : rate;
+}
+
+static void precopy_update(struct precopy_stats *st, unsigned long sent,
+                           uint64_t send_usecs, unsigned long dirtied,
+                           uint64_t dirty_usecs)
+{
+    if ( sent )
+        st->send_rate = precopy_rate(st->send_rate, sent, send_usecs);
+    st->dirty_rate = precopy_rate(st->dirty_rate, dirtied, dirty_usecs);
+    st->remaining = dirtied;
+
+    if ( !st->send_rate )
+        return;
+    st->downtime = dirtied * 1000ULL / st->send_rate;
+    if ( !st->best || st->downtime * 10 < st->best * 9 )
+    {
+        st->best = st->downtime;
+        st->stalled = 0;
+    }
+    else
+        st->stalled++;
+}
+
+/* Why to stop precopy now, or NULL to do another round. */
+static const char *precopy_stop(struct precopy_stats *st,
+                                unsigned long target)
+{
+    if ( !st->send_rate )
+        return NULL;
+    if ( st->downtime <= target )
+        return "within target downtime";
+    if ( st->stalled >= STALL_ROUNDS )
+        return st->dirty_rate >= st->send_rate ?
+            "dirtying faster than sending" : "not converging";
+    return NULL;
+}
 
 static int analysis_phase(xc_interface *xch, uint32_t domid, struct save_ctx *ctx,
                           xc_hypercall_buffer_t *arr, int runs)
@@ -524,6 +594,500 @@ static int canonicalize_pagetable(struct save_ctx *ctx,
     return race;
 }
 
+#ifndef __MINIOS__
+/*
+** Pipelined page writing. The main thread still picks, maps and types
+** each batch; worker threads then build its chunk (count, pfn types and
+** canonicalised pages) and unmap it, and a writer thread sends the chunks
+** in the order of the batches. Anything else written to the stream must
+** wait for save_pipe_drain().
+**
+** With XCFLAGS_STREAM_* the workers also leave out the zero pages of each
+** batch and deflate the rest, sending it as an XC_SAVE_ID_PACKED_BATCH.
+*/
+struct save_job {
+    unsigned char *region_base;
+    unsigned int batch;
+    int last_iter;          /* buffer the chunk in the outbuf */
+    xen_pfn_t *pfn_type;    /* MAX_BATCH_SIZE entries */
+    void *chunk;            /* sized for a full batch */
+    size_t len;
+    unsigned int zero;      /* pages left out */
+    size_t raw, data;       /* page data before and after deflating */
+    int done;
+};
+
+/* Per worker state for packing batches */
+struct save_packer {
+    void *raw;              /* a full batch of pages, when deflating */
+    z_stream zs;
+};
+
+struct save_pipe {
+    xc_interface *xch;
+    struct save_ctx *ctx;
+    struct outbuf *ob;
+    int io_fd;
+    int live;
+    int pack, deflate;
+
+    unsigned int nr_workers, nr_jobs;
+    pthread_t workers[SAVE_PIPE_MAX_WORKERS];
+    pthread_t writer;
+    int has_writer;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;    /* broadcast on any change below */
+
+    /* job n is jobs[n % nr_jobs] */
+    struct save_job *jobs;
+    unsigned long submitted, started, written;
+    int error, saved_errno;
+    int stop;
+
+    /* totals of the packed batches */
+    unsigned long zero_pages;
+    unsigned long long raw_bytes, data_bytes;
+};
+
+#define SAVE_CHUNK_SIZE                                             \
+    (sizeof(int) + 2 * sizeof(uint32_t) +                           \
+     MAX_BATCH_SIZE * sizeof(unsigned long) + MAX_BATCH_SIZE / 8 +  \
+     MAX_BATCH_SIZE * PAGE_SIZE)
+
+static int page_is_zero(const void *page)
+{
+    const unsigned long *p = page;
+    unsigned int i;
+
+    for ( i = 0; i < PAGE_SIZE / sizeof(*p); i += 4 )
+        if ( p[i] | p[i + 1] | p[i + 2] | p[i + 3] )
+            return 0;
+    return 1;
+}
+
+static void save_pipe_fail(struct save_pipe *pipe)
+{
+    /* with the lock held */
+    if ( !pipe->error )
+    {
+        pipe->error = 1;
+        pipe->saved_errno = errno;
+    }
+}
+
+/*
+** Same layout as the inline path writes the batch in or, if packing,
+** an XC_SAVE_ID_PACKED_BATCH.
+*/
+static int save_pipe_build(struct save_pipe *pipe, struct save_packer *pk,
+                           struct save_job *job)
+{
+    xc_interface *xch = pipe->xch;
+    struct save_ctx *ctx = pipe->ctx;
+    char *p = job->chunk, *data;
+    unsigned long *pfns;
+    uint8_t *zero = NULL;
+    uint32_t *packed_flags = NULL, *data_len = NULL;
+    unsigned int j;
+    int race;
+
+    if ( pipe->pack )
+    {
+        int id = XC_SAVE_ID_PACKED_BATCH;
+
+        memcpy(p, &id, sizeof(id));
+        p += sizeof(id);
+    }
+    memcpy(p, &job->batch, sizeof(job->batch));
+    p += sizeof(job->batch);
+    if ( pipe->pack )
+    {
+        packed_flags = (uint32_t *)p;
+        *packed_flags = pk->raw ? XC_PACKED_DEFLATED : 0;
+        p += sizeof(*packed_flags);
+    }
+
+    pfns = (unsigned long *)p;
+    for ( j = 0; j < job->batch; j++ )
+        pfns[j] = job->pfn_type[j];
+    p += job->batch * sizeof(unsigned long);
+
+    if ( pipe->pack )
+    {
+        zero = (uint8_t *)p;
+        memset(zero, 0, (job->batch + 7) / 8);
+        p += (job->batch + 7) / 8;
+        if ( pk->raw )
+        {
+            data_len = (uint32_t *)p;
+            p += sizeof(*data_len);
+        }
+    }
+
+    /* pages to be deflated go into pk->raw first */
+    data = pk->raw ? pk->raw : p;
+    job->zero = 0;
+    for ( j = 0; j < job->batch; j++ )
+    {
+        unsigned long pfn, pagetype;
+        void *spage = job->region_base + PAGE_SIZE * j;
+
+        pfn      = job->pfn_type[j] & ~XEN_DOMCTL_PFINFO_LTAB_MASK;
+        pagetype = job->pfn_type[j] &  XEN_DOMCTL_PFINFO_LTAB_MASK;
+
+        if ( pagetype == XEN_DOMCTL_PFINFO_XTAB
+             || pagetype == XEN_DOMCTL_PFINFO_XALLOC )
+            continue;
+
+        pagetype &= XEN_DOMCTL_PFINFO_LTABTYPE_MASK;
+
+        if ( (pagetype >= XEN_DOMCTL_PFINFO_L1TAB) &&
+             (pagetype <= XEN_DOMCTL_PFINFO_L4TAB) )
+        {
+            race = canonicalize_pagetable(ctx, pagetype, pfn, spage, data);
+            if ( race && !pipe->live )
+            {
+                ERROR("Fatal PT race (pfn %lx, type %08lx)", pfn, pagetype);
+                errno = EINVAL;
+                return -1;
+            }
+            if ( zero && page_is_zero(data) )
+                goto zero_page;
+        }
+        else if ( zero && page_is_zero(spage) )
+            goto zero_page;
+        else
+            memcpy(data, spage, PAGE_SIZE);
+        data += PAGE_SIZE;
+        continue;
+
+    zero_page:
+        zero[j / 8] |= 1 << (j % 8);
+        job->zero++;
+    }
+
+    if ( !pk->raw )
+    {
+        job->raw = job->data = data - p;
+        p = data;
+    }
+    else
+    {
+        /* falls back to sending the pages as they are if they don't shrink */
+        job->raw = data - (char *)pk->raw;
+        pk->zs.next_in = pk->raw;
+        pk->zs.avail_in = job->raw;
+        pk->zs.next_out = (Bytef *)p;
+        pk->zs.avail_out = job->raw;
+        if ( deflateReset(&pk->zs) == Z_OK &&
+             deflate(&pk->zs, Z_FINISH) == Z_STREAM_END )
+            job->data = pk->zs.total_out;
+        else
+        {
+            *packed_flags &= ~XC_PACKED_DEFLATED;
+            p = (char *)data_len;
+            memcpy(p, pk->raw, job->raw);
+            job->data = job->raw;
+        }
+        if ( *packed_flags & XC_PACKED_DEFLATED )
+            *data_len = job->data;
+        p += job->data;
+    }
+
+    job->len = p - (char *)job->chunk;
+    return 0;
+}
+
+static void *save_pipe_worker(void *arg)
+{
+    struct save_pipe *pipe = arg;
+    struct save_packer pk;
+    struct save_job *job;
+    int rc, error;
+
+    /* without the memory or zlib this worker's batches are not deflated */
+    memset(&pk, 0, sizeof(pk));
+    if ( pipe->deflate && (pk.raw = malloc(MAX_BATCH_SIZE * PAGE_SIZE)) &&
+         deflateInit(&pk.zs, Z_BEST_SPEED) != Z_OK )
+    {
+        free(pk.raw);
+        pk.raw = NULL;
+    }
+
+    pthread_mutex_lock(&pipe->lock);
+    for ( ; ; )
+    {
+        while ( pipe->started == pipe->submitted && !pipe->stop )
+            pthread_cond_wait(&pipe->cond, &pipe->lock);
+        if ( pipe->started == pipe->submitted )
+            break;
+
+        job = &pipe->jobs[pipe->started++ % pipe->nr_jobs];
+        error = pipe->error;
+        pthread_mutex_unlock(&pipe->lock);
+
+        /* after an error the batch is only unmapped */
+        rc = error ? 0 : save_pipe_build(pipe, &pk, job);
+        munmap(job->region_base, job->batch * PAGE_SIZE);
+
+        pthread_mutex_lock(&pipe->lock);
+        if ( rc )
+            save_pipe_fail(pipe);
+        else if ( pipe->pack && !error )
+        {
+            pipe->zero_pages += job->zero;
+            pipe->raw_bytes += job->raw;
+            pipe->data_bytes += job->data;
+        }
+        job->done = 1;
+        pthread_cond_broadcast(&pipe->cond);
+    }
+    pthread_mutex_unlock(&pipe->lock);
+
+    if ( pk.raw )
+    {
+        deflateEnd(&pk.zs);
+        free(pk.raw);
+    }
+
+    return NULL;
+}
+
+static void *save_pipe_writer(void *arg)
+{
+    struct save_pipe *pipe = arg;
+    xc_interface *xch = pipe->xch;
+    struct save_job *job;
+    int rc, error;
+
+    pthread_mutex_lock(&pipe->lock);
+    for ( ; ; )
+    {
+        job = &pipe->jobs[pipe->written % pipe->nr_jobs];
+        while ( !(pipe->written < pipe->submitted && job->done) &&
+                !(pipe->stop && pipe->written == pipe->submitted) )
+            pthread_cond_wait(&pipe->cond, &pipe->lock);
+        if ( pipe->written == pipe->submitted )
+            break;
+        error = pipe->error;
+        pthread_mutex_unlock(&pipe->lock);
+
+        rc = 0;
+        if ( !error )
+        {
+            if ( job->last_iter )
+                rc = outbuf_hardwrite(xch, pipe->ob, pipe->io_fd,
+                                      job->chunk, job->len);
+            else if ( noncached_write(xch, pipe->ob, pipe->io_fd,
+                                      job->chunk, job->len) != job->len )
+                rc = -1;
+            if ( rc )
+                PERROR("Error when writing to state file (4p)");
+        }
+
+        pthread_mutex_lock(&pipe->lock);
+        if ( rc )
+            save_pipe_fail(pipe);
+        job->done = 0;
+        pipe->written++;
+        pthread_cond_broadcast(&pipe->cond);
+    }
+    pthread_mutex_unlock(&pipe->lock);
+
+    return NULL;
+}
+
+static void save_pipe_destroy(struct save_pipe *pipe)
+{
+    unsigned int i;
+
+    if ( !pipe )
+        return;
+
+    pthread_mutex_lock(&pipe->lock);
+    pipe->stop = 1;
+    pthread_cond_broadcast(&pipe->cond);
+    pthread_mutex_unlock(&pipe->lock);
+
+    for ( i = 0; i < pipe->nr_workers; i++ )
+        pthread_join(pipe->workers[i], NULL);
+    if ( pipe->has_writer )
+        pthread_join(pipe->writer, NULL);
+
+    for ( i = 0; i < pipe->nr_jobs; i++ )
+    {
+        free(pipe->jobs[i].pfn_type);
+        free(pipe->jobs[i].chunk);
+    }
+    free(pipe->jobs);
+    pthread_cond_destroy(&pipe->cond);
+    pthread_mutex_destroy(&pipe->lock);
+    free(pipe);
+}
+
+static struct save_pipe *save_pipe_create(xc_interface *xch,
+                                          struct save_ctx *ctx,
+                                          struct outbuf *ob, int io_fd,
+                                          int live, unsigned int nr_workers,
+                                          int pack, int deflate)
+{
+    struct save_pipe *pipe;
+    unsigned int i;
+
+    if ( !(pipe = calloc(1, sizeof(*pipe))) )
+        return NULL;
+
+    pipe->xch = xch;
+    pipe->ctx = ctx;
+    pipe->ob = ob;
+    pipe->io_fd = io_fd;
+    pipe->live = live;
+    pipe->pack = pack || deflate;
+    pipe->deflate = deflate;
+    pthread_mutex_init(&pipe->lock, NULL);
+    pthread_cond_init(&pipe->cond, NULL);
+
+    /* one being mapped, one being written and one per worker */
+    if ( !(pipe->jobs = calloc(nr_workers + 2, sizeof(*pipe->jobs))) )
+        goto err;
+    pipe->nr_jobs = nr_workers + 2;
+    for ( i = 0; i < pipe->nr_jobs; i++ )
+    {
+        pipe->jobs[i].pfn_type = malloc(MAX_BATCH_SIZE * sizeof(xen_pfn_t));
+        pipe->jobs[i].chunk = malloc(SAVE_CHUNK_SIZE);
+        if ( !pipe->jobs[i].pfn_type || !pipe->jobs[i].chunk )
+            goto err;
+    }
+
+    if ( pthread_create(&pipe->writer, NULL, save_pipe_writer, pipe) )
+        goto err;
+    pipe->has_writer = 1;
+    for ( i = 0; i < nr_workers; i++ )
+    {
+        if ( pthread_create(&pipe->workers[i], NULL, save_pipe_worker, pipe) )
+            break;
+        pipe->nr_workers++;
+    }
+    if ( pipe->nr_workers != nr_workers )
+        goto err;
+
+    return pipe;
+
+ err:
+    PERROR("Couldn't set up %u save threads", nr_workers);
+    save_pipe_destroy(pipe);
+    return NULL;
+}
+
+/* Queues a mapped batch; the pipe unmaps it. */
+static int save_pipe_submit(struct save_pipe *pipe, unsigned char *region_base,
+                            xen_pfn_t *pfn_type, unsigned int batch,
+                            int last_iter)
+{
+    struct save_job *job;
+
+    pthread_mutex_lock(&pipe->lock);
+    while ( pipe->submitted - pipe->written == pipe->nr_jobs )
+        pthread_cond_wait(&pipe->cond, &pipe->lock);
+
+    job = &pipe->jobs[pipe->submitted % pipe->nr_jobs];
+    job->region_base = region_base;
+    job->batch = batch;
+    job->last_iter = last_iter;
+    job->done = 0;
+    memcpy(job->pfn_type, pfn_type, batch * sizeof(*pfn_type));
+    pipe->submitted++;
+    pthread_cond_broadcast(&pipe->cond);
+
+    if ( pipe->error )
+    {
+        errno = pipe->saved_errno;
+        pthread_mutex_unlock(&pipe->lock);
+        return -1;
+    }
+    pthread_mutex_unlock(&pipe->lock);
+
+    return 0;
+}
+
+/* Waits for every queued batch to be written. */
+static int save_pipe_drain(struct save_pipe *pipe)
+{
+    int rc = 0;
+
+    pthread_mutex_lock(&pipe->lock);
+    while ( pipe->written != pipe->submitted )
+        pthread_cond_wait(&pipe->cond, &pipe->lock);
+    if ( pipe->error )
+    {
+        errno = pipe->saved_errno;
+        rc = -1;
+    }
+    pthread_mutex_unlock(&pipe->lock);
+
+    return rc;
+}
+
+/* Zero pages left out so far, read once the pipe is drained. */
+static unsigned long save_pipe_zero_pages(struct save_pipe *pipe)
+{
+    unsigned long zero;
+
+    pthread_mutex_lock(&pipe->lock);
+    zero = pipe->zero_pages;
+    pthread_mutex_unlock(&pipe->lock);
+
+    return zero;
+}
+
+static void save_pipe_report(struct save_pipe *pipe)
+{
+    xc_interface *xch = pipe->xch;
+
+    if ( !pipe->pack )
+        return;
+    DPRINTF("Left out %lu zero pages, other pages %s to %llu%%\n",
+            pipe->zero_pages, pipe->deflate ? "deflated" : "sent",
+            pipe->data_bytes * 100 / MAX(pipe->raw_bytes, 1));
+}
+#else
+struct save_pipe;
+
+static struct save_pipe *save_pipe_create(xc_interface *xch,
+                                          struct save_ctx *ctx,
+                                          struct outbuf *ob, int io_fd,
+                                          int live, unsigned int nr_workers,
+                                          int pack, int deflate)
+{
+    return NULL;
+}
+
+static int save_pipe_submit(struct save_pipe *pipe, unsigned char *region_base,
+                            xen_pfn_t *pfn_type, unsigned int batch,
+                            int last_iter)
+{
+    return -1;
+}
+
+static int save_pipe_drain(struct save_pipe *pipe)
+{
+    return 0;
+}
+
+static unsigned long save_pipe_zero_pages(struct save_pipe *pipe)
+{
+    return 0;
+}
+
+static void save_pipe_report(struct save_pipe *pipe)
+{
+}
+
+static void save_pipe_destroy(struct save_pipe *pipe)
+{
+}
+#endif
+
 xen_pfn_t *xc_map_m2p(xc_interface *xch,
                                  unsigned long max_mfn,
                                  int prot,
@@ -816,6 +1380,8 @@ int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom, uint32_t max_iter
     int superpages = !!hvm;
     int race = 0, sent_last_iter, skip_this_iter = 0;
     unsigned int sent_this_iter = 0;
+    /* pages of this round whose data is on the wire, for the send rate */
+    unsigned long xmit_this_iter = 0, zero_pages = 0;
     int tmem_saved = 0;
 
     /* The new domain's shared-info frame number. */
@@ -897,6 +1463,17 @@ int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom, uint32_t max_iter
 
     int completed = 0;
 
+    /* Threads building and writing the batches, unless compressing */
+    struct save_pipe *pipe = NULL;
+    unsigned int nr_threads;
+    uint64_t start_time = 0;
+
+    /* Convergence of the precopy rounds */
+    struct precopy_stats precopy;
+    unsigned long downtime_target;
+    uint64_t round_start = 0, last_clean = 0, suspend_time = 0;
+    const char *stop_reason = NULL;
+
     if ( hvm && !callbacks->switch_qemu_logdirty )
     {
         ERROR("No switch_qemu_logdirty callback provided.");
@@ -911,6 +1488,9 @@ int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom, uint32_t max_iter
     /* If no explicit control parameters given, use defaults */
     max_iters  = max_iters  ? : DEF_MAX_ITERS;
     max_factor = max_factor ? : DEF_MAX_FACTOR;
+    downtime_target = (flags >> XCFLAGS_DOWNTIME_SHIFT) & 0xffff;
+    downtime_target = downtime_target ? : DEF_DOWNTIME;
+    memset(&precopy, 0, sizeof(precopy));
 
     if ( !get_platform_info(xch, dom,
                             &ctx->max_mfn, &ctx->hvirt_start, &ctx->pt_levels, &dinfo->guest_width) )
@@ -1109,6 +1689,22 @@ int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom, uint32_t max_iter
         goto out;
     }
 
+    nr_threads = (flags >> XCFLAGS_SAVE_THREADS_SHIFT) & 0xff;
+    if ( !nr_threads )
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        nr_threads = (cpus > 2) ? cpus - 1 : 1;
+    }
+    if ( nr_threads > SAVE_PIPE_MAX_WORKERS )
+        nr_threads = SAVE_PIPE_MAX_WORKERS;
+    /* Falls back to writing from this thread if it cannot be set up */
+    pipe = save_pipe_create(xch, ctx, &ob_pagebuf, io_fd, live, nr_threads,
+                            flags & XCFLAGS_STREAM_ZERO,
+                            flags & XCFLAGS_STREAM_DEFLATE);
+    if ( pipe )
+        DPRINTF("Saving pages with %u worker threads\n", nr_threads);
+    start_time = last_clean = llgettimeofday();
+
   copypages:
 #define wrexact(fd, buf, len) write_buffer(xch, last_iter, ob, (fd), (buf), (len))
 #define wruncached(fd, live, buf, len) write_uncached(xch, last_iter, ob, (fd), (buf), (len))
@@ -1119,17 +1715,31 @@ int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom, uint32_t max_iter
     for ( ; ; )
     {
         unsigned int N, batch, run;
-        char reportbuf[80];
-
-        snprintf(reportbuf, sizeof(reportbuf),
-                 "Saving memory: iter %d (last sent %u skipped %u)",
-                 iter, sent_this_iter, skip_this_iter);
+        char reportbuf[200];
+
+        /* the round just done, up to the one suspending the domain */
+        if ( live && precopy.send_rate && (!last_iter || suspend_time) )
+            snprintf(reportbuf, sizeof(reportbuf),
+                     "Saving memory: iter %d (last sent %u skipped %u, "
+                     "sending %lu dirtying %lu pages/s, "
+                     "%lu pages left, downtime %lums)",
+                     iter, sent_this_iter, skip_this_iter,
+                     precopy.send_rate, precopy.dirty_rate,
+                     precopy.remaining, precopy.downtime);
+        else
+            snprintf(reportbuf, sizeof(reportbuf),
+                     "Saving memory: iter %d (last sent %u skipped %u)",
+                     iter, sent_this_iter, skip_this_iter);
 
         xc_report_progress_start(xch, reportbuf, dinfo->p2m_size);
+        round_start = llgettimeofday();
 
         iter++;
         sent_this_iter = 0;
         skip_this_iter = 0;
+        xmit_this_iter = 0;
+        if ( pipe )
+            zero_pages = save_pipe_zero_pages(pipe);
         N = 0;
 
         while ( N < dinfo->p2m_size )
@@ -1296,6 +1906,8 @@ int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom, uint32_t max_iter
 
                 if ( superpages && iter==1 && test_bit(gmfn, to_skip))
                     pfn_type[j] = XEN_DOMCTL_PFINFO_XALLOC;
+                else
+                    xmit_this_iter++;
 
                 /* canonicalise mfn->pfn */
                 pfn_type[j] |= pfn_batch[j];
@@ -1325,6 +1937,19 @@ int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom, uint32_t max_iter
                 continue; /* bail on this batch: no valid pages */
             }
 
+            if ( pipe && !compressing )
+            {
+                /* the pipe writes it out and unmaps it */
+                if ( save_pipe_submit(pipe, region_base, pfn_type, batch,
+                                      last_iter) )
+                {
+                    PERROR("Error when writing to state file (4p)");
+                    goto out;
+                }
+                sent_this_iter += batch;
+                continue;
+            }
+
             if ( wrexact(io_fd, &batch, sizeof(unsigned int)) )
             {
                 PERROR("Error when writing to state file (2)");
@@ -1488,6 +2113,14 @@ int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom, uint32_t max_iter
 
       skip:
 
+        if ( pipe && save_pipe_drain(pipe) )
+        {
+            PERROR("Error when writing to state file (4p)");
+            goto out;
+        }
+        if ( pipe )
+            xmit_this_iter -= save_pipe_zero_pages(pipe) - zero_pages;
+
         xc_report_progress_step(xch, dinfo->p2m_size, dinfo->p2m_size);
 
         total_sent += sent_this_iter;
@@ -1499,6 +2132,18 @@ int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom, uint32_t max_iter
             DPRINTF("Total pages sent= %ld (%.2fx)\n",
                     total_sent, ((float)total_sent)/dinfo->p2m_size );
             DPRINTF("(of which %ld were fixups)\n", needed_to_fix  );
+            DPRINTF("Sent %lluMb/s with %u worker threads\n",
+                    (unsigned long long)total_sent * PAGE_SIZE * 8 /
+                    MAX(llgettimeofday() - start_time, 1),
+                    pipe ? nr_threads : 0);
+            if ( pipe )
+                save_pipe_report(pipe);
+            if ( live && suspend_time )
+                DPRINTF("Last iteration took %llums, predicted %lums (%s)\n",
+                        (unsigned long long)
+                        (llgettimeofday() - suspend_time) / 1000,
+                        precopy.downtime, stop_reason);
+            suspend_time = 0;
         }
 
         if ( last_iter && debug )
@@ -1523,12 +2168,37 @@ int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom, uint32_t max_iter
 
         if ( live )
         {
-            if ( (iter >= max_iters) ||
-                 (sent_this_iter+skip_this_iter < 50) ||
-                 (total_sent > dinfo->p2m_size*max_factor) )
+            uint64_t now = llgettimeofday();
+            xc_shadow_op_stats_t stats;
+
+            /* the pages dirtied since the last clean are the next round */
+            if ( xc_shadow_control(xch, dom, XEN_DOMCTL_SHADOW_OP_PEEK,
+                                   NULL, 0, NULL, 0, &stats) < 0 )
             {
-                DPRINTF("Start last iteration\n");
+                PERROR("Error peeking shadow stats");
+                goto out;
+            }
+            precopy_update(&precopy, xmit_this_iter, now - round_start,
+                           stats.dirty_count, now - last_clean);
+            DPRINTF("Round %d: sending %lu dirtying %lu pages/s, "
+                    "%lu pages left, downtime %lums (target %lums)\n",
+                    iter, precopy.send_rate, precopy.dirty_rate,
+                    precopy.remaining, precopy.downtime, downtime_target);
+
+            if ( iter >= max_iters )
+                stop_reason = "iteration limit";
+            else if ( total_sent > dinfo->p2m_size*max_factor )
+                stop_reason = "sent limit";
+            else if ( sent_this_iter+skip_this_iter < 50 )
+                stop_reason = "few pages dirty";
+            else
+                stop_reason = precopy_stop(&precopy, downtime_target);
+
+            if ( stop_reason )
+            {
+                DPRINTF("Start last iteration: %s\n", stop_reason);
                 last_iter = 1;
+                suspend_time = llgettimeofday();
 
                 if ( suspend_and_state(callbacks->suspend, callbacks->data,
                                        xch, io_fd, dom, &info) )
@@ -1561,6 +2231,7 @@ int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom, uint32_t max_iter
                 PERROR("Error flushing shadow PT");
                 goto out;
             }
+            last_clean = llgettimeofday();
 
             sent_last_iter = sent_this_iter;
 
@@ -2014,6 +2685,10 @@ int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom, uint32_t max_iter
     rc = 0;
 
  out:
+    /* Nothing else may be written while batches are in flight */
+    if ( pipe && save_pipe_drain(pipe) )
+        rc = 1;
+
     completed = 1;
 
     if ( !rc && callbacks->postcopy )
@@ -2107,6 +2782,8 @@ int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom, uint32_t max_iter
     xc_hypercall_buffer_free_pages(xch, to_send, NRPAGES(bitmap_size(dinfo->p2m_size)));
     xc_hypercall_buffer_free_pages(xch, to_skip, NRPAGES(bitmap_size(dinfo->p2m_size)));
 
+    save_pipe_destroy(pipe);
+
     free(pfn_type);
     free(pfn_batch);
     free(pfn_err);
@@ -2218,7 +2218,7 @@ int xc_compression_add_page(xc_interface *xch, comp_ctx *ctx, char *page,
  * Delta compress pages in the compression buffer and inserts the
  * compressed data into the supplied compression buffer compbuf, whose
  * size is compbuf_size.
- * After compression, the pages are copied to the internal LRU cache.
+ * After compression, the pages are copied to the internal page cache.
  *
  * This function compresses as many pages as possible into the
  * supplied compression buffer. It maintains an internal iterator to
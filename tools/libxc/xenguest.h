@@ -28,6 +28,19 @@
 #define XCFLAGS_HVM       4
 #define XCFLAGS_STDVGA    8
 #define XCFLAGS_CHECKPOINT_COMPRESS    16
+/* Send batches as XC_SAVE_ID_PACKED_BATCH, leaving out zero pages and, with
+ * XCFLAGS_STREAM_DEFLATE (which implies XCFLAGS_STREAM_ZERO), deflating the
+ * others. Needs save threads and a receiver which knows the chunk type. */
+#define XCFLAGS_STREAM_ZERO            32
+#define XCFLAGS_STREAM_DEFLATE         64
+/* Downtime in ms the precopy rounds aim for before the domain is suspended,
+ * 0 for the default. */
+#define XCFLAGS_DOWNTIME_SHIFT         8
+#define XCFLAGS_DOWNTIME(ms)           (((ms) & 0xffff) << XCFLAGS_DOWNTIME_SHIFT)
+/* Threads canonicalising and writing pages alongside the one mapping them,
+ * 0 for one per other online CPU. */
+#define XCFLAGS_SAVE_THREADS_SHIFT     24
+#define XCFLAGS_SAVE_THREADS(n)        (((n) & 0xff) << XCFLAGS_SAVE_THREADS_SHIFT)
 #define X86_64_B_SIZE   64 
 #define X86_32_B_SIZE   32
 
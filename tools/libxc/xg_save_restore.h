@@ -85,6 +85,24 @@
  * If the chunk type is -ve then chunk consists of one of a number of
  * metadata types.  See definitions of XC_SAVE_ID_* below.
  *
+ * If the chunk type is XC_SAVE_ID_PACKED_BATCH then chunk contains guest
+ * memory data as for a +ve chunk, but pages which are all zero are not sent
+ * and the rest may be deflated:
+ *
+ *     unsigned int     : number of pages in batch
+ *     uint32_t         : XC_PACKED_* flags
+ *     unsigned long[]  : PFN array, as for a +ve chunk
+ *     uint8_t[]        : zero page bitmap, (number of pages + 7) / 8 bytes.
+ *                        Bit (i % 8) of byte (i / 8) is set if entry i of
+ *                        the PFN array is a zero page.
+ *     uint32_t         : size of the page data (only if XC_PACKED_DEFLATED)
+ *     page data        : PAGE_SIZE bytes for each page marked present in PFN
+ *                        array and not zero, as one zlib stream if
+ *                        XC_PACKED_DEFLATED
+ *
+ * The sender only packs batches if asked to (XCFLAGS_STREAM_*), as older
+ * receivers do not know the chunk type.
+ *
  * If chunk type is 0 then body phase is complete.
  *
  *
@@ -259,6 +277,10 @@
 #define XC_SAVE_ID_HVM_ACCESS_RING_PFN  -16
 #define XC_SAVE_ID_HVM_SHARING_RING_PFN -17
 #define XC_SAVE_ID_TOOLSTACK          -18 /* Optional toolstack specific info */
+#define XC_SAVE_ID_PACKED_BATCH       -19 /* Batch with zero pages elided */
+
+/* Flags of an XC_SAVE_ID_PACKED_BATCH chunk */
+#define XC_PACKED_DEFLATED            1 /* page data is zlib compressed */
 
 /*
 ** We process save/restore/migrate in batches of pages; the below
@@ -795,6 +795,11 @@ int libxl_domain_suspend(libxl_ctx *ctx, uint32_t domid, int fd, int flags,
     dss->type = type;
     dss->live = flags & LIBXL_SUSPEND_LIVE;
     dss->debug = flags & LIBXL_SUSPEND_DEBUG;
+    if (flags & LIBXL_SUSPEND_STREAM_ZERO)
+        dss->stream |= XCFLAGS_STREAM_ZERO;
+    if (flags & LIBXL_SUSPEND_STREAM_DEFLATE)
+        dss->stream |= XCFLAGS_STREAM_DEFLATE;
+    dss->downtime = (flags >> LIBXL_SUSPEND_DOWNTIME_SHIFT) & 0xffff;
 
     libxl__domain_suspend(egc, dss);
     return AO_INPROGRESS;
@@ -524,6 +524,14 @@ int libxl_domain_suspend(libxl_ctx *ctx, uint32_t domid, int fd,
                          LIBXL_EXTERNAL_CALLERS_ONLY;
 #define LIBXL_SUSPEND_DEBUG 1
 #define LIBXL_SUSPEND_LIVE 2
+/* Leave zero pages out of the stream, and with STREAM_DEFLATE deflate the
+ * other pages too.  The receiver must understand packed page batches. */
+#define LIBXL_SUSPEND_STREAM_ZERO 4
+#define LIBXL_SUSPEND_STREAM_DEFLATE 8
+/* Downtime in ms a live suspend aims for before the domain is paused, 0
+ * for the libxenguest default. */
+#define LIBXL_SUSPEND_DOWNTIME_SHIFT 8
+#define LIBXL_SUSPEND_DOWNTIME(ms) (((ms) & 0xffff) << LIBXL_SUSPEND_DOWNTIME_SHIFT)
 
 /* @param suspend_cancel [from xenctrl.h:xc_domain_resume( @param fast )]
  *   If this parameter is true, use co-operative resume. The guest
@@ -1202,6 +1202,7 @@ void libxl__domain_suspend(libxl__egc *egc, libxl__domain_suspend_state *dss)
     dss->xcflags = (live) ? XCFLAGS_LIVE : 0
           | (debug) ? XCFLAGS_DEBUG : 0
           | (dss->hvm) ? XCFLAGS_HVM : 0;
+    dss->xcflags |= dss->stream | XCFLAGS_DOWNTIME(dss->downtime);
 
     dss->suspend_eventchn = -1;
     dss->guest_responded = 0;
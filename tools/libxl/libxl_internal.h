@@ -2208,6 +2208,8 @@ struct libxl__domain_suspend_state {
     libxl_domain_type type;
     int live;
     int debug;
+    int stream; /* XCFLAGS_STREAM_* */
+    int downtime; /* ms, 0 for the default */
     const libxl_domain_remus_info *remus;
     /* private */
     xc_evtchn *xce; /* event channel handle */
@@ -55,6 +55,32 @@ char *libxl_domid_to_name(libxl_ctx *ctx, uint32_t domid)
     return s;
 }
 
+char **libxl_domids_to_names(libxl_ctx *ctx, const uint32_t *domids, int nb)
+{
+    char path[strlen("/local/domain") + 12];
+    uint32_t *req_ids;
+    char **names;
+    int i;
+
+    names = calloc(nb ? nb : 1, sizeof(*names));
+    req_ids = calloc(nb ? nb : 1, sizeof(*req_ids));
+    if (!names || !req_ids) {
+        free(names);
+        free(req_ids);
+        return NULL;
+    }
+
+    for (i = 0; i < nb; i++) {
+        snprintf(path, sizeof(path), "/local/domain/%d/name", domids[i]);
+        req_ids[i] = xs_read_submit(ctx->xsh, XBT_NULL, path);
+    }
+    for (i = 0; i < nb; i++)
+        names[i] = xs_read_reply(ctx->xsh, req_ids[i], NULL);
+
+    free(req_ids);
+    return names;
+}
+
 char *libxl__domid_to_name(libxl__gc *gc, uint32_t domid)
 {
     char *s = libxl_domid_to_name(libxl__gc_owner(gc), domid);
@@ -66,7 +92,8 @@ int libxl_name_to_domid(libxl_ctx *ctx, const char *name,
                         uint32_t *domid)
 {
     int i, nb_domains;
-    char *domname;
+    uint32_t *domids;
+    char **domnames;
     libxl_dominfo *dominfo;
     int ret = ERROR_INVAL;
 
@@ -74,18 +101,30 @@ int libxl_name_to_domid(libxl_ctx *ctx, const char *name,
     if (!dominfo)
         return ERROR_NOMEM;
 
+    domids = calloc(nb_domains ? nb_domains : 1, sizeof(*domids));
+    if (!domids) {
+        free(dominfo);
+        return ERROR_NOMEM;
+    }
+    for (i = 0; i < nb_domains; i++)
+        domids[i] = dominfo[i].domid;
+
+    domnames = libxl_domids_to_names(ctx, domids, nb_domains);
+    if (!domnames) {
+        ret = ERROR_NOMEM;
+        goto out;
+    }
+
     for (i = 0; i < nb_domains; i++) {
-        domname = libxl_domid_to_name(ctx, dominfo[i].domid);
-        if (!domname)
-            continue;
-        if (strcmp(domname, name) == 0) {
-            *domid = dominfo[i].domid;
+        if (ret && domnames[i] && strcmp(domnames[i], name) == 0) {
+            *domid = domids[i];
             ret = 0;
-            free(domname);
-            break;
         }
-        free(domname);
+        free(domnames[i]);
     }
+    free(domnames);
+out:
+    free(domids);
     free(dominfo);
     return ret;
 }
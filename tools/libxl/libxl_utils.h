@@ -22,6 +22,11 @@ const char *libxl_basename(const char *name); /* returns string from strdup */
 unsigned long libxl_get_required_shadow_memory(unsigned long maxmem_kb, unsigned int smp_cpus);
 int libxl_name_to_domid(libxl_ctx *ctx, const char *name, uint32_t *domid);
 char *libxl_domid_to_name(libxl_ctx *ctx, uint32_t domid);
+char **libxl_domids_to_names(libxl_ctx *ctx, const uint32_t *domids, int nb);
+  /* Names of nb domains, read from xenstore in a single round trip.
+   * Returns a mallocd array of mallocd names, NULL for a domain without
+   * one: free() each and the array.  Returns NULL if out of memory.
+   */
 int libxl_name_to_cpupoolid(libxl_ctx *ctx, const char *name, uint32_t *poolid);
 char *libxl_cpupoolid_to_name(libxl_ctx *ctx, uint32_t poolid);
 int libxl_get_stubdom_id(libxl_ctx *ctx, int guest_domid);
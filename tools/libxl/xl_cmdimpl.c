@@ -2838,19 +2838,40 @@ out:
     }
 }
 
+/* Names of the listed domains, read in one go: free() each and the array */
+static char **dominfo_names(const libxl_dominfo *info, int nb_domain)
+{
+    uint32_t *domids;
+    char **domnames;
+    int i;
+
+    domids = xmalloc(sizeof(*domids) * (nb_domain ? nb_domain : 1));
+    for (i = 0; i < nb_domain; i++)
+        domids[i] = info[i].domid;
+    domnames = libxl_domids_to_names(ctx, domids, nb_domain);
+    if (!domnames) {
+        fprintf(stderr, "libxl_domids_to_names failed.\n");
+        exit(1);
+    }
+    free(domids);
+    return domnames;
+}
+
 static void list_domains(int verbose, int context, const libxl_dominfo *info, int nb_domain)
 {
     int i;
     static const char shutdown_reason_letters[]= "-rscw";
+    char **domnames;
 
     printf("Name                                        ID   Mem VCPUs\tState\tTime(s)");
     if (verbose) printf("   UUID                            Reason-Code\tSecurity Label");
     if (context && !verbose) printf("   Security Label");
     printf("\n");
+    domnames = dominfo_names(info, nb_domain);
     for (i = 0; i < nb_domain; i++) {
         char *domname;
         unsigned shutdown_reason;
-        domname = libxl_domid_to_name(ctx, info[i].domid);
+        domname = domnames[i];
         shutdown_reason = info[i].shutdown ? info[i].shutdown_reason : 0;
         printf("%-40s %5d %5lu %5d     %c%c%c%c%c%c  %8.1f",
                 domname,
@@ -2887,12 +2908,14 @@ static void list_domains(int verbose, int context, const libxl_dominfo *info, in
         }
         putchar('\n');
     }
+    free(domnames);
 }
 
 static void list_vm(void)
 {
     libxl_vminfo *info;
-    char *domname;
+    uint32_t *domids;
+    char **domnames;
     int nb_vm, i;
 
     info = libxl_list_vm(ctx, &nb_vm);
@@ -2901,13 +2924,22 @@ static void list_vm(void)
         fprintf(stderr, "libxl_domain_infolist failed.\n");
         exit(1);
     }
+    domids = xmalloc(sizeof(*domids) * (nb_vm ? nb_vm : 1));
+    for (i = 0; i < nb_vm; i++)
+        domids[i] = info[i].domid;
+    domnames = libxl_domids_to_names(ctx, domids, nb_vm);
+    if (!domnames) {
+        fprintf(stderr, "libxl_domids_to_names failed.\n");
+        exit(1);
+    }
+    free(domids);
     printf("UUID                                  ID    name\n");
     for (i = 0; i < nb_vm; i++) {
-        domname = libxl_domid_to_name(ctx, info[i].domid);
         printf(LIBXL_UUID_FMT "  %d    %-30s\n", LIBXL_UUID_BYTES(info[i].uuid),
-            info[i].domid, domname);
-        free(domname);
+            info[i].domid, domnames[i]);
+        free(domnames[i]);
     }
+    free(domnames);
     libxl_vminfo_list_free(info, nb_vm);
 }
 
@@ -3154,7 +3186,7 @@ static void migrate_do_preamble(int send_fd, int recv_fd, pid_t child,
 }
 
 static void migrate_domain(const char *domain_spec, const char *rune,
-                           const char *override_config_file)
+                           const char *override_config_file, int flags)
 {
     pid_t child = -1;
     int rc;
@@ -3180,7 +3212,8 @@ static void migrate_domain(const char *domain_spec, const char *rune,
 
     xtl_stdiostream_adjust_flags(logger, XTL_STDIOSTREAM_HIDE_PROGRESS, 0);
 
-    rc = libxl_domain_suspend(ctx, domid, send_fd, LIBXL_SUSPEND_LIVE, NULL);
+    rc = libxl_domain_suspend(ctx, domid, send_fd,
+                              LIBXL_SUSPEND_LIVE | flags, NULL);
     if (rc) {
         fprintf(stderr, "migration sender: libxl_domain_suspend failed"
                 " (rc=%d)\n", rc);
@@ -3587,9 +3620,11 @@ int main_migrate(int argc, char **argv)
     const char *ssh_command = "ssh";
     char *rune = NULL;
     char *host;
-    int opt, daemonize = 1, monitor = 1, debug = 0;
+    int opt, daemonize = 1, monitor = 1, debug = 0, flags = 0;
+    unsigned long downtime;
+    char *endptr;
 
-    while ((opt = def_getopt(argc, argv, "FC:s:ed", "migrate", 2)) != -1) {
+    while ((opt = def_getopt(argc, argv, "FC:s:edzZD:", "migrate", 2)) != -1) {
         switch (opt) {
         case 0: case 2:
             return opt;
@@ -3609,6 +3644,20 @@ int main_migrate(int argc, char **argv)
         case 'd':
             debug = 1;
             break;
+        case 'z':
+            flags |= LIBXL_SUSPEND_STREAM_ZERO;
+            break;
+        case 'Z':
+            flags |= LIBXL_SUSPEND_STREAM_DEFLATE;
+            break;
+        case 'D':
+            downtime = strtoul(optarg, &endptr, 10);
+            if (*endptr || !downtime || downtime > 0xffff) {
+                fprintf(stderr, "invalid downtime '%s'\n", optarg);
+                return 2;
+            }
+            flags |= LIBXL_SUSPEND_DOWNTIME(downtime);
+            break;
         }
     }
 
@@ -3625,7 +3674,7 @@ int main_migrate(int argc, char **argv)
             return 1;
     }
 
-    migrate_domain(p, rune, config_filename);
+    migrate_domain(p, rune, config_filename, flags);
     return 0;
 }
 
@@ -4504,13 +4553,15 @@ int main_info(int argc, char **argv)
 static void sharing(const libxl_dominfo *info, int nb_domain)
 {
     int i;
+    char **domnames;
 
     printf("Name                                        ID   Mem Shared\n");
 
+    domnames = dominfo_names(info, nb_domain);
     for (i = 0; i < nb_domain; i++) {
         char *domname;
         unsigned shutdown_reason;
-        domname = libxl_domid_to_name(ctx, info[i].domid);
+        domname = domnames[i];
         shutdown_reason = info[i].shutdown ? info[i].shutdown_reason : 0;
         printf("%-40s %5d %5lu  %5lu\n",
                 domname,
@@ -4519,6 +4570,7 @@ static void sharing(const libxl_dominfo *info, int nb_domain)
                 (unsigned long) (info[i].shared_memkb / 1024));
         free(domname);
     }
+    free(domnames);
 }
 
 int main_sharing(int argc, char **argv)
@@ -150,7 +150,11 @@ struct cmd_spec cmd_table[] = {
       "                to sh. If empty, run <host> instead of ssh <host> xl\n"
       "                migrate-receive [-d -e]\n"
       "-e              Do not wait in the background (on <host>) for the death\n"
-      "                of the domain."
+      "                of the domain.\n"
+      "-z              Leave zero pages out of the stream.\n"
+      "-Z              Leave zero pages out and deflate the others.\n"
+      "                Both need a receiving host with the same support.\n"
+      "-D <ms>         Downtime to aim for before pausing the domain."
     },
     { "dump-core",
       &main_dump_core, 0, 1,
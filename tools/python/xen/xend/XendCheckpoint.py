@@ -23,11 +23,17 @@ from xen.xend.XendLogging import log
 from xen.xend.XendConfig import XendConfig
 from xen.xend.XendConstants import *
 from xen.xend import XendNode
+from xen.xend import XendOptions
 
 SIGNATURE = "LinuxGuestRecord"
 QEMU_SIGNATURE = "QemuDeviceModelRecord"
 dm_batch = 512
 XC_SAVE = "xc_save"
+
+# XCFLAGS_STREAM_ZERO and XCFLAGS_STREAM_DEFLATE, see xenguest.h
+XC_SAVE_STREAM_FLAGS = { 'none': 0, 'zero': 32, 'deflate': 64 }
+# XCFLAGS_DOWNTIME(ms)
+XC_SAVE_DOWNTIME_SHIFT = 8
 XC_RESTORE = "xc_restore"
 
 
@@ -118,9 +124,19 @@ def save(fd, dominfo, network, live, dst, checkpoint=False, node=-1,sock=None):
         # enabled. Passing "0" simply uses the defaults compiled into
         # libxenguest; see the comments and/or code in xc_linux_save() for
         # more information.
+        flags = int(live) | (int(hvm) << 2)
+        if network:
+            xoptions = XendOptions.instance()
+            stream = xoptions.get_xend_migration_stream()
+            if stream not in XC_SAVE_STREAM_FLAGS:
+                raise XendError("invalid xend-migration-stream '%s'" % stream)
+            flags |= XC_SAVE_STREAM_FLAGS[stream]
+            downtime = xoptions.get_xend_migration_downtime()
+            if downtime < 0 or downtime > 0xffff:
+                raise XendError("invalid xend-migration-downtime %d" % downtime)
+            flags |= downtime << XC_SAVE_DOWNTIME_SHIFT
         cmd = [xen.util.auxbin.pathTo(XC_SAVE), str(fd),
-               str(dominfo.getDomid()), "0", "0", 
-               str(int(live) | (int(hvm) << 2)) ]
+               str(dominfo.getDomid()), "0", "0", str(flags) ]
         log.debug("[xc_save]: %s", string.join(cmd))
 
         def saveInputHandler(line, tochild):
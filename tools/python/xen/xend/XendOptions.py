@@ -93,6 +93,12 @@ class XendOptions:
 
     xend_relocation_hosts_allow_default = ''
 
+    """Default page encoding of migration streams, see xend-migration-stream."""
+    xend_migration_stream_default = 'none'
+
+    """Default downtime in ms live migrations aim for, 0 for libxenguest's."""
+    xend_migration_downtime_default = 0
+
     """Default for the flag indicating whether xend should run a unix-domain
     server (deprecated)."""
     xend_unix_server_default = 'no'
@@ -286,6 +292,20 @@ class XendOptions:
         """
         return self.get_config_bool('xend-relocation-ssl', 'no')
 
+    def get_xend_migration_stream(self):
+        """How pages are sent when migrating: 'none', 'zero' to leave zero
+        pages out, or 'deflate' to also deflate the others.
+        """
+        return self.get_config_string('xend-migration-stream',
+                                      self.xend_migration_stream_default)
+
+    def get_xend_migration_downtime(self):
+        """Downtime in ms live migrations aim for before the domain is
+        paused, 0 for the libxenguest default.
+        """
+        return self.get_config_int('xend-migration-downtime',
+                                   self.xend_migration_downtime_default)
+
     def get_xend_relocation_hosts_allow(self):
         return self.get_config_string("xend-relocation-hosts-allow",
                                      self.xend_relocation_hosts_allow_default)
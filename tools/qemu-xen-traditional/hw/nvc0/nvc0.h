@@ -70,6 +70,17 @@ nvc0_state_t* nvc0_state(void* opaque);
 // construct NVC0 context
 void nvc0_context_init(nvc0_state_t* state);
 
+// BAR3 arena size of this context, nvc0_context_init should be called before
+uint64_t nvc0_context_bar3_size(nvc0_state_t* state);
+
+// Checkpoint stream of the A3 context. nvc0_context_checkpoint sets data to
+// the next block of the stream, valid until the next call, and left to the
+// number of dirty VRAM chunks. With finish, the block after the last chunk
+// holds the device state. Return -1 on failure.
+int nvc0_context_checkpoint_start(nvc0_state_t* state);
+int nvc0_context_checkpoint(nvc0_state_t* state, int finish, const uint8_t** data, uint32_t* size, uint32_t* left);
+int nvc0_context_load_checkpoint(nvc0_state_t* state, const uint8_t* data, uint32_t size);
+
 // nvc0 graph
 #define GPC_MAX 4
 #define TP_MAX 32
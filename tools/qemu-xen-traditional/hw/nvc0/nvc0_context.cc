@@ -32,8 +32,9 @@
 
 namespace nvc0 {
 
-context::context(nvc0_state_t* state, uint64_t memory_size)
-    : state_(state)
+context::context(nvc0_state_t* state)
+    : bar3_size_()
+    , state_(state)
     , pramin_()
     , io_service_()
     , socket_(io_service_)
@@ -54,6 +55,15 @@ context::context(nvc0_state_t* state, uint64_t memory_size)
     const a3::command res = send(cmd);
     id_ = res.value;
 
+    // BAR3 arena size depends on the partition a3 assigned
+    {
+        const a3::command cmd = {
+            a3::command::TYPE_UTILITY,
+            a3::command::UTILITY_BAR3_ARENA_SIZE
+        };
+        bar3_size_ = send(cmd).value;
+    }
+
     // initialize req/res queue
     std::vector<char> name(200);
     {
@@ -81,14 +91,12 @@ context::context(nvc0_state_t* state, uint64_t memory_size)
     }
 }
 
-a3::command context::send(const a3::command& cmd) {
-    boost::mutex::scoped_lock lock(socket_mutex_);
-    a3::command result = { };
+void context::write_socket(const void* data, std::size_t size) {
     while (true) {
         boost::system::error_code error;
         boost::asio::write(
             socket_,
-            boost::asio::buffer(reinterpret_cast<const char*>(&cmd), sizeof(a3::command)),
+            boost::asio::buffer(static_cast<const char*>(data), size),
             boost::asio::transfer_all(),
             error);
         if (error != boost::asio::error::make_error_code(boost::asio::error::interrupted)) {
@@ -96,20 +104,60 @@ a3::command context::send(const a3::command& cmd) {
         }
         // retry
     }
+}
+
+void context::read_socket(void* data, std::size_t size) {
     while (true) {
         boost::system::error_code error;
         boost::asio::read(
             socket_,
-            boost::asio::buffer(reinterpret_cast<char*>(&result), sizeof(a3::command)),
+            boost::asio::buffer(static_cast<char*>(data), size),
             boost::asio::transfer_all(),
             error);
         if (error != boost::asio::error::make_error_code(boost::asio::error::interrupted)) {
             break;
         }
     }
+}
+
+a3::command context::send(const a3::command& cmd) {
+    boost::mutex::scoped_lock lock(socket_mutex_);
+    a3::command result = { };
+    write_socket(&cmd, sizeof(a3::command));
+    read_socket(&result, sizeof(a3::command));
+    return result;
+}
+
+a3::command context::checkpoint(uint32_t op, std::vector<uint8_t>* block) {
+    boost::mutex::scoped_lock lock(socket_mutex_);
+    const a3::command cmd = {
+        a3::command::TYPE_CHECKPOINT,
+        op
+    };
+    a3::command result = { };
+    write_socket(&cmd, sizeof(a3::command));
+    read_socket(&result, sizeof(a3::command));
+    block->resize(result.value);
+    if (!block->empty()) {
+        read_socket(block->data(), block->size());
+    }
     return result;
 }
 
+bool context::load_checkpoint(const uint8_t* data, uint32_t size) {
+    boost::mutex::scoped_lock lock(socket_mutex_);
+    const a3::command cmd = {
+        a3::command::TYPE_CHECKPOINT,
+        a3::command::CHECKPOINT_LOAD,
+        size
+    };
+    a3::command result = { };
+    write_socket(&cmd, sizeof(a3::command));
+    write_socket(data, size);
+    read_socket(&result, sizeof(a3::command));
+    return result.offset != a3::command::kCHECKPOINT_FAILED;
+}
+
 a3::command context::message(const a3::command& cmd, bool read) {
     boost::mutex::scoped_lock lock(socket_mutex_);
     req_queue_->send(&cmd, sizeof(a3::command), 0);
@@ -140,7 +188,33 @@ void context::notify_bar3_change() {
 }  // namespace nvc0
 
 extern "C" void nvc0_context_init(nvc0_state_t* state) {
-    // currenty, 1GB
-    state->priv = static_cast<void*>(new nvc0::context(state, A3_MEMORY_SIZE));
+    state->priv = static_cast<void*>(new nvc0::context(state));
+}
+
+extern "C" uint64_t nvc0_context_bar3_size(nvc0_state_t* state) {
+    return nvc0::context::extract(state)->bar3_size();
+}
+
+extern "C" int nvc0_context_checkpoint_start(nvc0_state_t* state) {
+    nvc0::context* ctx = nvc0::context::extract(state);
+    const a3::command res = ctx->checkpoint(a3::command::CHECKPOINT_START, ctx->checkpoint_block());
+    return (res.offset == a3::command::kCHECKPOINT_FAILED) ? -1 : 0;
+}
+
+extern "C" int nvc0_context_checkpoint(nvc0_state_t* state, int finish, const uint8_t** data, uint32_t* size, uint32_t* left) {
+    nvc0::context* ctx = nvc0::context::extract(state);
+    const uint32_t op = finish ? a3::command::CHECKPOINT_FINISH : a3::command::CHECKPOINT_ROUND;
+    const a3::command res = ctx->checkpoint(op, ctx->checkpoint_block());
+    if (res.offset == a3::command::kCHECKPOINT_FAILED) {
+        return -1;
+    }
+    *data = ctx->checkpoint_block()->data();
+    *size = ctx->checkpoint_block()->size();
+    *left = res.offset;
+    return 0;
+}
+
+extern "C" int nvc0_context_load_checkpoint(nvc0_state_t* state, const uint8_t* data, uint32_t size) {
+    return nvc0::context::extract(state)->load_checkpoint(data, size) ? 0 : -1;
 }
 /* vim: set sw=4 ts=4 et tw=80 : */
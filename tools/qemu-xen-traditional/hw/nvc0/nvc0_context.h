@@ -1,5 +1,6 @@
 #ifndef HW_NVC0_NVC0_CONTEXT_H_
 #define HW_NVC0_NVC0_CONTEXT_H_
+#include <vector>
 #include <boost/bind.hpp>
 #include <boost/asio.hpp>
 #include <boost/thread.hpp>
@@ -10,21 +11,31 @@ namespace nvc0 {
 
 class context {
  public:
-    explicit context(nvc0_state_t* state, uint64_t memory_size);
+    explicit context(nvc0_state_t* state);
     nvc0_state_t* state() const { return state_; }
     uint64_t pramin() const { return pramin_; }
     void set_pramin(uint64_t pramin) { pramin_ = pramin; }
     uint32_t id() const { return id_; }
+    uint64_t bar3_size() const { return bar3_size_; }
     // socket based
     a3::command send(const a3::command& cmd);
     // message passing
     a3::command message(const a3::command& cmd, bool read);
     void notify_bar3_change();
+    // checkpoint stream, see a3/a3.h. returns the reply and the block
+    // following it
+    a3::command checkpoint(uint32_t op, std::vector<uint8_t>* block);
+    bool load_checkpoint(const uint8_t* data, uint32_t size);
+    std::vector<uint8_t>* checkpoint_block() { return &checkpoint_block_; }
 
     static context* extract(nvc0_state_t* state);
 
  private:
+    void write_socket(const void* data, std::size_t size);
+    void read_socket(void* data, std::size_t size);
+
     uint32_t id_;
+    uint64_t bar3_size_;  // BAR3 arena size assigned by a3
     nvc0_state_t* state_;
     uint64_t pramin_;  // 16bit shifted
 
@@ -34,6 +45,7 @@ class context {
     boost::mutex socket_mutex_;
     boost::scoped_ptr<a3::interprocess::message_queue> req_queue_;
     boost::scoped_ptr<a3::interprocess::message_queue> res_queue_;
+    std::vector<uint8_t> checkpoint_block_;
 };
 
 }  // namespace nvc0
@@ -30,6 +30,7 @@
 #include "pci/header.h"
 #include "pci/pci.h"
 #include "pass-through.h"
+#include "qemu-timer.h"
 #include "nvc0.h"
 #include "nvc0_ioport.h"
 #include "nvc0_mmio.h"
@@ -132,6 +133,176 @@ static void nvc0_init_real_device(nvc0_state_t* state, uint8_t r_bus, uint8_t r_
     NVC0_PRINTF("PCI device enabled\n");
 }
 
+// Pre-copy stops when this number of dirty VRAM chunks (128KB) is left, or
+// after NVC0_CHECKPOINT_MAX_ROUNDS rounds when the guest keeps the GPU busy
+// (any submission dirties the whole partition).
+#define NVC0_CHECKPOINT_CONVERGED 64
+#define NVC0_CHECKPOINT_MAX_ROUNDS 30
+#define NVC0_CHECKPOINT_ROUND_BLOCKS 16
+#define NVC0_CHECKPOINT_ROUND_MS 10
+
+// The traditional device model receives the save command after the domain is
+// paused. Pre-copy therefore runs from the log-dirty enable command, which
+// libxc sends while the guest still runs, and buffers the blocks until the
+// savevm handler writes them out.
+typedef struct nvc0_precopy {
+    nvc0_state_t* state;
+    QEMUTimer* timer;
+    uint8_t* data;
+    size_t size;
+    size_t capacity;
+    int started;
+    int rounds;
+} nvc0_precopy_t;
+
+static nvc0_precopy_t nvc0_precopy;
+
+static void nvc0_precopy_put(nvc0_precopy_t* pc, const uint8_t* data, uint32_t size) {
+    if (pc->size + size + 4 > pc->capacity) {
+        pc->capacity = (pc->size + size + 4) * 2;
+        pc->data = qemu_realloc(pc->data, pc->capacity);
+    }
+    cpu_to_be32wu((uint32_t*)(pc->data + pc->size), size);
+    memcpy(pc->data + pc->size + 4, data, size);
+    pc->size += size + 4;
+}
+
+static void nvc0_precopy_reset(nvc0_precopy_t* pc) {
+    if (pc->timer) {
+        qemu_del_timer(pc->timer);
+    }
+    qemu_free(pc->data);
+    pc->data = NULL;
+    pc->size = pc->capacity = 0;
+    pc->started = 0;
+    pc->rounds = 0;
+}
+
+static void nvc0_precopy_round(void* opaque) {
+    nvc0_precopy_t* pc = opaque;
+    const uint8_t* data;
+    uint32_t size;
+    uint32_t left = 0;
+    int i;
+
+    for (i = 0; i < NVC0_CHECKPOINT_ROUND_BLOCKS; ++i) {
+        if (nvc0_context_checkpoint(pc->state, 0, &data, &size, &left) < 0) {
+            // the savevm handler restarts the stream
+            NVC0_PRINTF("pre-copy failed\n");
+            nvc0_precopy_reset(pc);
+            return;
+        }
+        if (size) {
+            nvc0_precopy_put(pc, data, size);
+        }
+        if (left <= NVC0_CHECKPOINT_CONVERGED) {
+            return;
+        }
+    }
+    if (++pc->rounds < NVC0_CHECKPOINT_MAX_ROUNDS) {
+        qemu_mod_timer(pc->timer, qemu_get_clock(rt_clock) + NVC0_CHECKPOINT_ROUND_MS);
+    }
+}
+
+void nvc0_logdirty(int enable) {
+    nvc0_precopy_t* pc = &nvc0_precopy;
+    if (!pc->state) {
+        return;
+    }
+    if (!enable) {
+        // keep the buffered blocks for the savevm handler
+        if (pc->timer) {
+            qemu_del_timer(pc->timer);
+        }
+        return;
+    }
+    nvc0_precopy_reset(pc);
+    if (nvc0_context_checkpoint_start(pc->state) < 0) {
+        NVC0_PRINTF("cannot start checkpoint\n");
+        return;
+    }
+    pc->started = 1;
+    if (!pc->timer) {
+        pc->timer = qemu_new_timer(rt_clock, nvc0_precopy_round, pc);
+    }
+    qemu_mod_timer(pc->timer, qemu_get_clock(rt_clock));
+}
+
+// GPU context is streamed as blocks of the A3 checkpoint stream. Each section
+// is a sequence of be32 length prefixed blocks terminated by an empty one.
+static int nvc0_put_checkpoint(QEMUFile* f, nvc0_state_t* state, int finish, uint32_t* left) {
+    const uint8_t* data;
+    uint32_t size;
+    if (nvc0_context_checkpoint(state, finish, &data, &size, left) < 0) {
+        return -1;
+    }
+    if (size) {
+        qemu_put_be32(f, size);
+        qemu_put_buffer(f, data, size);
+    }
+    return 0;
+}
+
+// The domain is paused once this handler runs, so there is nothing to gain
+// from iterating: stage 1 flushes the blocks buffered by pre-copy (or starts
+// the stream when the save is not live) and stage 3 sends the last dirty set
+// followed by the device state.
+static int nvc0_save_live(QEMUFile* f, int stage, void* opaque) {
+    nvc0_state_t* state = opaque;
+    nvc0_precopy_t* pc = &nvc0_precopy;
+    uint32_t left = 0;
+
+    if (stage == 1) {
+        if (pc->timer) {
+            qemu_del_timer(pc->timer);
+        }
+        if (pc->state == state && pc->started) {
+            qemu_put_buffer(f, pc->data, pc->size);
+        } else if (nvc0_context_checkpoint_start(state) < 0) {
+            NVC0_PRINTF("cannot start checkpoint\n");
+            qemu_file_set_error(f);
+            return -1;
+        }
+        nvc0_precopy_reset(pc);
+    }
+
+    if (stage == 3) {
+        do {
+            if (nvc0_put_checkpoint(f, state, 1, &left) < 0) {
+                qemu_file_set_error(f);
+                return -1;
+            }
+        } while (left);
+    }
+
+    qemu_put_be32(f, 0);
+    return 1;
+}
+
+static int nvc0_load(QEMUFile* f, void* opaque, int version_id) {
+    nvc0_state_t* state = opaque;
+    uint8_t* data;
+    uint32_t size;
+    int ret = 0;
+
+    if (version_id != 1) {
+        return -EINVAL;
+    }
+
+    while ((size = qemu_get_be32(f)) != 0) {
+        data = qemu_malloc(size);
+        if (qemu_get_buffer(f, data, size) != (int)size || nvc0_context_load_checkpoint(state, data, size) < 0) {
+            ret = -EINVAL;
+        }
+        qemu_free(data);
+        if (ret) {
+            NVC0_PRINTF("cannot load checkpoint\n");
+            return ret;
+        }
+    }
+    return 0;
+}
+
 // Real device information
 // 0a:00.0 VGA compatible controller: NVIDIA Corporation GF100 [Quadro 6000] (rev a3) (prog-if 00 [VGA controller])
 //         Subsystem: NVIDIA Corporation Device 076f
@@ -216,17 +387,22 @@ struct pt_dev * pci_nvc0_init(PCIBus *bus, const char *e_dev_name) {
     if (nvc0_guest_id == 42) {
         nvc0_api_paravirt_mmio_init(state);
     } else {
+        // init C++ nvc0 context
+        // MMIO init queries BAR3 arena size to the context
+        nvc0_context_init(state);
+
         // init MMIO
         nvc0_mmio_init(state);
 
         // init I/O ports
         nvc0_ioport_init(state);
-
-        // init C++ nvc0 context
-        nvc0_context_init(state);
     }
 
     instance = pci_bus_num(bus) << 8 | state->device->dev.devfn;
+    if (nvc0_guest_id != 42) {
+        register_savevm_live("nvc0", instance, 1, nvc0_save_live, NULL, nvc0_load, state);
+        nvc0_precopy.state = state;
+    }
     NVC0_PRINTF("register device model: %x with guest id %u\n", instance, state->guest);
     return state->device;
 }
@@ -12,6 +12,9 @@ extern "C" {
 
 struct pt_dev * pci_nvc0_init(PCIBus *bus, const char *e_dev_name);
 
+// log-dirty command from the toolstack, starts and stops GPU pre-copy
+void nvc0_logdirty(int enable);
+
 #ifdef __cplusplus
 }
 #endif
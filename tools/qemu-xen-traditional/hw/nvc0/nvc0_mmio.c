@@ -236,9 +236,8 @@ void nvc0_mmio_init(nvc0_state_t* state) {
     // BAR3 effective area is limited to 16MB (24bits)
     // So we should split this area. hard coded 8MB
     // pci_register_io_region(&state->device->dev, 3, 0x4000000 / 4, PCI_ADDRESS_SPACE_MEM_PREFETCH, nvc0_mmio_map);
-    // TODO(Yusuke Suzuki)
-    // This is hard coded value
-    pci_register_io_region(&state->device->dev, 3, A3_BAR3_ARENA_SIZE, PCI_ADDRESS_SPACE_MEM_PREFETCH, nvc0_mmio_map);
+    // arena size is decided by a3 partitioning
+    pci_register_io_region(&state->device->dev, 3, nvc0_context_bar3_size(state), PCI_ADDRESS_SPACE_MEM_PREFETCH, nvc0_mmio_map);
     nvc0_init_bar3(state);
 
     // Region ROM : Meomory
@@ -22,6 +22,7 @@
 #include "pci.h"
 #include "qemu-timer.h"
 #include "qemu-xen.h"
+#include "hw/nvc0/nvc0_main.h"
 
 struct xs_handle *xsh = NULL;
 static char *media_filename[MAX_DRIVES+1];
@@ -828,8 +829,10 @@ static void xenstore_process_logdirty_event(void)
 
     if (!strcmp(act, "enable")) {
         xen_logdirty_enable = 1;
+        nvc0_logdirty(1);
     } else if (!strcmp(act, "disable")) {
         xen_logdirty_enable = 0;
+        nvc0_logdirty(0);
     } else {
         fprintf(logfile, "Log-dirty: bad log-dirty command: %s\n", act);
         exit(1);
@@ -0,0 +1,390 @@
+/*
+ * xc-compression-bench.c
+ *
+ * Times Remus checkpoint compression on dirty page mixes like those of a
+ * running guest, against a word at a time reference encoder, and checks
+ * that the stream decodes and is the same as the reference one.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <xenctrl.h>
+
+#define PAGE_SIZE XC_PAGE_SIZE
+#define WORDS     (PAGE_SIZE / sizeof(uint32_t))
+
+/* Largest checkpoint handed to the compressor at once, below its buffer */
+#define CHUNK_PAGES 4096
+/* Worst case compressed page, see xc_compression.c */
+#define WORST_PAGE  (PAGE_SIZE + 9)
+#define FULL_PAGE   ((char)128)
+#define EMPTY_PAGE  0
+
+enum mix { SPARSE, CLUSTER, HALF, FULL, SAME, MIXED, NR_MIXES };
+
+static const char *mix_names[NR_MIXES] = {
+    "sparse", "cluster", "half", "full", "same", "mixed",
+};
+
+static uint64_t rng = 88172645463325252ULL;
+
+static uint64_t rand64(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return rng;
+}
+
+static void fill_random(char *p, size_t len)
+{
+    uint64_t v;
+    size_t i;
+
+    for ( i = 0; i < len; i += sizeof(v) )
+    {
+        v = rand64();
+        memcpy(p + i, &v, sizeof(v));
+    }
+}
+
+static void dirty_page(char *page, enum mix mix)
+{
+    uint32_t *w = (uint32_t *)page;
+    unsigned int i, off, len;
+
+    if ( mix == MIXED )
+    {
+        /* mostly small updates, some rewritten buffers */
+        i = rand64() % 100;
+        mix = i < 40 ? SPARSE : i < 65 ? CLUSTER : i < 80 ? HALF :
+              i < 90 ? FULL : SAME;
+    }
+
+    switch ( mix )
+    {
+    case SPARSE:    /* counters, list pointers */
+        for ( i = 0; i < 4; i++ )
+            w[rand64() % WORDS] += 1 + (rand64() & 0xff);
+        break;
+    case CLUSTER:   /* a structure or a small message */
+        len = 64 + (rand64() % 449 & ~3u);
+        off = rand64() % (PAGE_SIZE - len) & ~3u;
+        fill_random(page + off, len);
+        break;
+    case HALF:      /* about half the cache lines */
+        for ( off = 0; off < PAGE_SIZE; off += 64 )
+            if ( rand64() & 1 )
+                fill_random(page + off, 64);
+        break;
+    case FULL:      /* page cache or I/O buffers */
+        fill_random(page, PAGE_SIZE);
+        break;
+    default:        /* written with what was there */
+        break;
+    }
+}
+
+/* The encoder as it was, one word at a time. */
+static int ref_compress_page(const char *oldpage, const char *newpage,
+                             char *dest)
+{
+    const uint32_t *new = (const uint32_t *)newpage;
+    const uint32_t *old = (const uint32_t *)oldpage;
+    int off, runptr = 0;
+    int wascopying = 0, copying = 0, bytes_skipped = 0;
+    int complen = 0, runbytes = 0;
+    char runlen = 0;
+
+    for ( off = 0; off <= WORDS; off++ )
+    {
+        copying = (off < WORDS) ? (old[off] != new[off]) : !wascopying;
+        if ( runlen && ((wascopying != copying) || (runlen == 127)) )
+        {
+            runbytes = runlen * sizeof(uint32_t);
+            dest[complen++] = runlen | (wascopying ? 0 : FULL_PAGE);
+            if ( wascopying )
+            {
+                memcpy(dest + complen, newpage + runptr * sizeof(uint32_t),
+                       runbytes);
+                complen += runbytes;
+            }
+            else
+                bytes_skipped += runbytes;
+            runlen = 0;
+            runptr = off;
+        }
+        runlen++;
+        wascopying = copying;
+    }
+
+    if ( bytes_skipped == PAGE_SIZE )
+    {
+        complen = 1;
+        dest[0] = EMPTY_PAGE;
+    }
+    return complen;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+struct result {
+    unsigned long pages, hits;
+    unsigned long long out_bytes;
+    double lib_time, ref_time;
+    int mismatches;
+};
+
+/*
+ * Sends one checkpoint of the given pfns, in chunks the compressor takes,
+ * and decodes it into recv[].
+ */
+static int checkpoint(xc_interface *xch, comp_ctx *ctx, char *mem,
+                      char *sent, char *recv, xen_pfn_t *pfns,
+                      unsigned int nr, char *compbuf, char *refbuf,
+                      struct result *res)
+{
+    unsigned long len, pos, start;
+    unsigned int i, j, n;
+    double t;
+    int rc, reflen;
+
+    for ( i = 0; i < nr; i += n )
+    {
+        n = (nr - i < CHUNK_PAGES) ? nr - i : CHUNK_PAGES;
+
+        for ( j = 0; j < n; j++ )
+            if ( xc_compression_add_page(xch, ctx,
+                                         mem + pfns[i + j] * PAGE_SIZE,
+                                         pfns[i + j], 0) < 0 )
+                return -1;
+
+        t = now();
+        rc = xc_compression_compress_pages(xch, ctx, compbuf,
+                                           CHUNK_PAGES * WORST_PAGE, &len);
+        if ( res )
+            res->lib_time += now() - t;
+        xc_compression_reset_pagebuf(xch, ctx);
+        if ( rc != 1 )
+        {
+            fprintf(stderr, "compress_pages failed (%d)\n", rc);
+            return -1;
+        }
+
+        if ( res )
+        {
+            t = now();
+            for ( j = 0; j < n; j++ )
+                ref_compress_page(sent + pfns[i + j] * PAGE_SIZE,
+                                  mem + pfns[i + j] * PAGE_SIZE, refbuf);
+            res->ref_time += now() - t;
+            res->pages += n;
+            res->out_bytes += len;
+        }
+
+        for ( j = pos = 0; j < n; j++ )
+        {
+            char *page = mem + pfns[i + j] * PAGE_SIZE;
+
+            start = pos;
+            if ( xc_compression_uncompress_page(xch, compbuf, len, &pos,
+                                                recv + pfns[i + j] * PAGE_SIZE) )
+                return -1;
+            if ( memcmp(recv + pfns[i + j] * PAGE_SIZE, page, PAGE_SIZE) )
+            {
+                fprintf(stderr, "pfn %lu differs after decoding\n",
+                        (unsigned long)pfns[i + j]);
+                return -1;
+            }
+
+            if ( res && !(compbuf[start] == FULL_PAGE &&
+                          pos - start == PAGE_SIZE + 1) )
+            {
+                /* a cache hit, which must encode as the reference does */
+                res->hits++;
+                reflen = ref_compress_page(sent + pfns[i + j] * PAGE_SIZE,
+                                           page, refbuf);
+                if ( reflen != pos - start ||
+                     memcmp(refbuf, compbuf + start, reflen) )
+                    res->mismatches++;
+            }
+            memcpy(sent + pfns[i + j] * PAGE_SIZE, page, PAGE_SIZE);
+        }
+        if ( pos != len )
+        {
+            fprintf(stderr, "%lu trailing bytes in checkpoint\n", len - pos);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int run_mix(xc_interface *xch, enum mix mix, unsigned int nr_pages,
+                   unsigned int dirty, unsigned int rounds)
+{
+    char *mem, *sent, *recv, *compbuf, *refbuf;
+    xen_pfn_t *pfns, tmp;
+    comp_ctx *ctx = NULL;
+    struct result res;
+    unsigned int i, j, r;
+    int rc = -1;
+
+    memset(&res, 0, sizeof(res));
+    mem = malloc((size_t)nr_pages * PAGE_SIZE);
+    sent = malloc((size_t)nr_pages * PAGE_SIZE);
+    recv = malloc((size_t)nr_pages * PAGE_SIZE);
+    compbuf = malloc(CHUNK_PAGES * WORST_PAGE);
+    refbuf = malloc(WORST_PAGE);
+    pfns = malloc(nr_pages * sizeof(*pfns));
+    if ( !mem || !sent || !recv || !compbuf || !refbuf || !pfns ||
+         !(ctx = xc_compression_create_context(xch, nr_pages)) )
+    {
+        fprintf(stderr, "Out of memory\n");
+        goto out;
+    }
+
+    /* the first checkpoint sends everything and fills the cache */
+    fill_random(mem, (size_t)nr_pages * PAGE_SIZE);
+    for ( i = 0; i < nr_pages; i++ )
+        pfns[i] = i;
+    if ( checkpoint(xch, ctx, mem, sent, recv, pfns, nr_pages,
+                    compbuf, refbuf, NULL) )
+        goto out;
+
+    for ( r = 0; r < rounds; r++ )
+    {
+        /* a random set of distinct pages */
+        for ( i = 0; i < dirty; i++ )
+        {
+            j = i + rand64() % (nr_pages - i);
+            tmp = pfns[i];
+            pfns[i] = pfns[j];
+            pfns[j] = tmp;
+            dirty_page(mem + pfns[i] * PAGE_SIZE, mix);
+        }
+        if ( checkpoint(xch, ctx, mem, sent, recv, pfns, dirty,
+                        compbuf, refbuf, &res) )
+            goto out;
+    }
+
+    printf("%-8s %8lu %6.1f%% %7.1f%% %9.0f %9.0f %6.2fx%s\n",
+           mix_names[mix], res.pages, 100.0 * res.hits / res.pages,
+           100.0 * res.out_bytes / ((double)res.pages * PAGE_SIZE),
+           res.pages * (double)PAGE_SIZE / res.lib_time / 1e6,
+           res.pages * (double)PAGE_SIZE / res.ref_time / 1e6,
+           res.ref_time / res.lib_time,
+           res.mismatches ? "  MISMATCH" : "");
+    rc = res.mismatches ? -1 : 0;
+
+ out:
+    if ( ctx )
+        xc_compression_free_context(xch, ctx);
+    free(pfns);
+    free(refbuf);
+    free(compbuf);
+    free(recv);
+    free(sent);
+    free(mem);
+    return rc;
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+            "usage: xc-compression-bench [-p pages] [-d dirty] [-r rounds]"
+            " [-m mix]\n"
+            "  -p  pages in the guest (4096)\n"
+            "  -d  pages dirtied per checkpoint (1024)\n"
+            "  -r  checkpoints (100)\n"
+            "  -m  sparse, cluster, half, full, same or mixed (all)\n"
+            "The delta cache holds 8192 pages; larger guests exercise"
+            " replacement.\n");
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int nr_pages = 4096, dirty = 1024, rounds = 100;
+    int mix = -1, m, opt, rc = 0;
+    xc_interface *xch;
+
+    while ( (opt = getopt(argc, argv, "p:d:r:m:h")) != -1 )
+    {
+        switch ( opt )
+        {
+        case 'p':
+            nr_pages = strtoul(optarg, NULL, 0);
+            break;
+        case 'd':
+            dirty = strtoul(optarg, NULL, 0);
+            break;
+        case 'r':
+            rounds = strtoul(optarg, NULL, 0);
+            break;
+        case 'm':
+            for ( mix = 0; mix < NR_MIXES; mix++ )
+                if ( !strcmp(optarg, mix_names[mix]) )
+                    break;
+            if ( mix == NR_MIXES )
+                usage();
+            break;
+        default:
+            usage();
+        }
+    }
+    if ( !nr_pages || !dirty || !rounds || dirty > nr_pages )
+        usage();
+
+    xch = xc_interface_open(NULL, NULL, XC_OPENFLAG_DUMMY);
+    if ( !xch )
+    {
+        perror("xc_interface_open");
+        return 1;
+    }
+
+    printf("%u pages, %u dirtied per checkpoint, %u checkpoints\n",
+           nr_pages, dirty, rounds);
+    printf("%-8s %8s %7s %8s %9s %9s %7s\n", "mix", "pages", "hits",
+           "size", "MB/s", "ref MB/s", "speedup");
+    for ( m = 0; m < NR_MIXES; m++ )
+        if ( (mix < 0 || mix == m) && run_mix(xch, m, nr_pages, dirty, rounds) )
+            rc = 1;
+
+    xc_interface_close(xch);
+    return rc;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-set-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
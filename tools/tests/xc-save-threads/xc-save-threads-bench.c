@@ -0,0 +1,184 @@
+/*
+ * xc-save-threads-bench.c
+ *
+ * Saves an HVM guest to /dev/null once per number of save threads and
+ * reports the throughput reached, see XCFLAGS_SAVE_THREADS.  The guest is
+ * suspended for each save and resumed after it, so use a throwaway guest
+ * without PV drivers: those can be resumed without their cooperation.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <xenctrl.h>
+#include <xenguest.h>
+
+struct bench {
+    xc_interface *xch;
+    uint32_t domid;
+};
+
+static int suspend(void *data)
+{
+    struct bench *b = data;
+
+    return !xc_domain_shutdown(b->xch, b->domid, SHUTDOWN_suspend);
+}
+
+/* The save is not live, so qemu has no pages to track. */
+static int switch_qemu_logdirty(int domid, unsigned enable, void *data)
+{
+    return 0;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+            "usage: xc-save-threads-bench [-r rounds] domid [threads...]\n"
+            "  -r  saves per thread count, the best is reported (3)\n"
+            "Thread counts default to 1 2 4 8.\n");
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    static const unsigned int default_threads[] = { 1, 2, 4, 8 };
+    struct save_callbacks callbacks;
+    struct bench b;
+    xc_dominfo_t info;
+    unsigned int rounds = 3, nr_threads, threads, i, r;
+    double t, best, mb;
+    int opt, fd, failed, rc = 0;
+
+    while ( (opt = getopt(argc, argv, "r:h")) != -1 )
+    {
+        switch ( opt )
+        {
+        case 'r':
+            rounds = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage();
+        }
+    }
+    if ( optind >= argc || !rounds )
+        usage();
+    b.domid = strtoul(argv[optind++], NULL, 0);
+    nr_threads = argc - optind;
+
+    b.xch = xc_interface_open(NULL, NULL, 0);
+    if ( !b.xch )
+    {
+        perror("xc_interface_open");
+        return 1;
+    }
+    if ( xc_domain_getinfo(b.xch, b.domid, 1, &info) != 1 ||
+         info.domid != b.domid || !info.hvm )
+    {
+        fprintf(stderr, "domain %u is not an HVM guest\n", b.domid);
+        xc_interface_close(b.xch);
+        return 1;
+    }
+    mb = info.nr_pages * (double)XC_PAGE_SIZE / (1024 * 1024);
+
+    fd = open("/dev/null", O_WRONLY);
+    if ( fd < 0 )
+    {
+        perror("/dev/null");
+        xc_interface_close(b.xch);
+        return 1;
+    }
+
+    memset(&callbacks, 0, sizeof(callbacks));
+    callbacks.suspend = suspend;
+    callbacks.switch_qemu_logdirty = switch_qemu_logdirty;
+    callbacks.data = &b;
+
+    printf("domain %u, %.0f MB\n", b.domid, mb);
+    printf("%8s %10s %10s\n", "threads", "time(s)", "MB/s");
+    for ( i = 0; i < (nr_threads ? nr_threads : 4); i++ )
+    {
+        threads = nr_threads ? strtoul(argv[optind + i], NULL, 0)
+                             : default_threads[i];
+        best = 0;
+        failed = 0;
+        for ( r = 0; r < rounds; r++ )
+        {
+            t = now();
+            if ( xc_domain_save(b.xch, fd, b.domid, 0, 0,
+                                XCFLAGS_HVM | XCFLAGS_SAVE_THREADS(threads),
+                                &callbacks, 1, 0) )
+            {
+                failed = 1;
+                break;
+            }
+            t = now() - t;
+            if ( xc_domain_resume(b.xch, b.domid, 1) )
+            {
+                fprintf(stderr, "cannot resume domain %u\n", b.domid);
+                close(fd);
+                xc_interface_close(b.xch);
+                return 1;
+            }
+            if ( !best || t < best )
+                best = t;
+        }
+        if ( failed )
+        {
+            /* Resume only a guest the save got as far as suspending. */
+            if ( xc_domain_getinfo(b.xch, b.domid, 1, &info) == 1 &&
+                 info.domid == b.domid && info.shutdown &&
+                 info.shutdown_reason == SHUTDOWN_suspend &&
+                 xc_domain_resume(b.xch, b.domid, 1) )
+            {
+                fprintf(stderr, "cannot resume domain %u\n", b.domid);
+                close(fd);
+                xc_interface_close(b.xch);
+                return 1;
+            }
+            printf("%8u %10s %10s\n", threads, "-", "failed");
+            rc = 1;
+            continue;
+        }
+        printf("%8u %10.3f %10.1f\n", threads, best, mb / best);
+    }
+
+    close(fd);
+    xc_interface_close(b.xch);
+    return rc;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-set-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
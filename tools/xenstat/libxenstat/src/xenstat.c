@@ -60,7 +60,9 @@ static void xenstat_free_xen_version(xenstat_node * node);
 static void xenstat_free_vbds(xenstat_node * node);
 static void xenstat_uninit_vcpus(xenstat_handle * handle);
 static void xenstat_uninit_xen_version(xenstat_handle * handle);
-static char *xenstat_get_domain_name(xenstat_handle * handle, unsigned int domain_id);
+static uint32_t xenstat_request_domain_name(xenstat_handle * handle,
+					    unsigned int domain_id);
+static char *xenstat_get_domain_name(xenstat_handle * handle, uint32_t req_id);
 static void xenstat_prune_domain(xenstat_node *node, unsigned int entry);
 
 static xenstat_collector collectors[] = {
@@ -164,6 +166,7 @@ xenstat_node *xenstat_get_node(xenstat_handle * handle, unsigned int flags)
 	xenstat_node *node;
 	xc_physinfo_t physinfo = { 0 };
 	xc_domaininfo_t domaininfo[DOMAIN_CHUNK_SIZE];
+	uint32_t name_reqs[DOMAIN_CHUNK_SIZE];
 	unsigned int new_domains;
 	unsigned int i;
 
@@ -224,14 +227,22 @@ xenstat_node *xenstat_get_node(xenstat_handle * handle, unsigned int flags)
 		/* zero out newly allocated memory in case error occurs below */
 		memset(domain, 0, new_domains * sizeof(xenstat_domain));
 
+		/* Ask for all the names before waiting for the first */
+		for (i = 0; i < new_domains; i++)
+			name_reqs[i] = xenstat_request_domain_name(handle,
+						domaininfo[i].domain);
+
 		for (i = 0; i < new_domains; i++) {
 			/* Fill in domain using domaininfo[i] */
 			domain->id = domaininfo[i].domain;
-			domain->name = xenstat_get_domain_name(handle, 
-							       domain->id);
+			domain->name = xenstat_get_domain_name(handle,
+							       name_reqs[i]);
 			if (domain->name == NULL) {
 				if (errno == ENOMEM) {
 					/* fatal error */
+					while (++i < new_domains)
+						free(xenstat_get_domain_name(
+							handle, name_reqs[i]));
 					xenstat_free_node(node);
 					return NULL;
 				}
@@ -737,13 +748,19 @@ unsigned long long xenstat_tmem_succ_pers_gets(xenstat_tmem *tmem)
 }
 
 
-static char *xenstat_get_domain_name(xenstat_handle *handle, unsigned int domain_id)
+static uint32_t xenstat_request_domain_name(xenstat_handle *handle,
+					    unsigned int domain_id)
 {
 	char path[80];
 
 	snprintf(path, sizeof(path),"/local/domain/%i/name", domain_id);
 
-	return xs_read(handle->xshandle, XBT_NULL, path, NULL);
+	return xs_read_submit(handle->xshandle, XBT_NULL, path);
+}
+
+static char *xenstat_get_domain_name(xenstat_handle *handle, uint32_t req_id)
+{
+	return xs_read_reply(handle->xshandle, req_id, NULL);
 }
 
 /* Remove specified entry from list of domains */
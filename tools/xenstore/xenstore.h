@@ -102,6 +102,39 @@ bool xs_mkdir(struct xs_handle *h, xs_transaction_t t,
 bool xs_rm(struct xs_handle *h, xs_transaction_t t,
 	   const char *path);
 
+/* Pipelined requests.
+ * The _submit calls send a request without waiting for its reply and return
+ * its request id, or 0 on failure.  Any number of requests may be in flight:
+ * the matching _reply call, in any order, waits for the reply to a request
+ * and returns like the synchronous call.  Every request submitted must have
+ * its reply collected.
+ */
+uint32_t xs_read_submit(struct xs_handle *h, xs_transaction_t t,
+			const char *path);
+void *xs_read_reply(struct xs_handle *h, uint32_t req_id, unsigned int *len);
+uint32_t xs_directory_submit(struct xs_handle *h, xs_transaction_t t,
+			     const char *path);
+char **xs_directory_reply(struct xs_handle *h, uint32_t req_id,
+			  unsigned int *num);
+uint32_t xs_write_submit(struct xs_handle *h, xs_transaction_t t,
+			 const char *path, const void *data, unsigned int len);
+bool xs_write_reply(struct xs_handle *h, uint32_t req_id);
+
+struct xs_subtree_node {
+	char *path;
+	char *value;		/* nul terminated */
+	unsigned int len;	/* not including terminator */
+};
+
+/* Read a node and all the nodes below it, in one round trip per level of
+ * the tree rather than per node.  Nodes removed while it is read are left
+ * out.  Returns a malloced array, parents before children: call free() on
+ * it after use.  Num indicates size.
+ */
+struct xs_subtree_node *xs_read_subtree(struct xs_handle *h,
+					xs_transaction_t t,
+					const char *path, unsigned int *num);
+
 /* Restrict a xenstore handle so that it acts as if it had the
  * permissions of domain @domid.  The handle must currently be
  * using domain 0's credentials.
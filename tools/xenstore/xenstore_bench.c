@@ -0,0 +1,1095 @@
+/*
+ * This file is subject to the terms and conditions of the GNU General
+ * Public License.  See the file "COPYING" in the main directory of
+ * this archive for more details.
+ *
+ * Benchmarks of a running xenstored.
+ *
+ *   xenstore-bench transaction [-s] [-n nodes[,nodes...]] [-c count]
+ *                              [-r reads] [-w writes]
+ *   xenstore-bench watch [-s] [-d domains] [-c count]
+ *   xenstore-bench churn [-s] [-t socket|ring] [-d domains[,domains...]]
+ *                        [-c cycles]
+ *
+ * transaction: populates /bench with the given number of nodes and reports
+ * the throughput of transactions reading and writing random nodes, once per
+ * store size.
+ *
+ * watch: lays out a /local/domain tree for the given number of domains, with
+ * one connection per domain watching its frontend nodes and one for dom0
+ * watching the backends, and reports how many watches xenstored evaluates per
+ * write of random device states.  The writes run once with the watch index
+ * and once with the linear scan of every watch, for comparison.
+ *
+ * churn: boots the given number of domains, then destroys a random one and
+ * creates another per cycle, until all are shut down.  A toolstack, the dom0
+ * backends and each guest's drivers send what they would for the domain
+ * build, device hotplug and shutdown: transactions, watches and permission
+ * changes.  Reports ops/s and the p50/p99 latency per message type, once per
+ * number of domains.  The guests connect to the socket, or with -t ring to a
+ * xenstored started with --ring-standin, which serves them over a shared
+ * page as it does a guest's ring.
+ */
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <err.h>
+#include <errno.h>
+#include <getopt.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <xenstore.h>
+
+#define BENCH_ROOT "/bench"
+#define BENCH_DIR_NODES 1000
+#define MAX_SIZES 16
+#define MSG_TYPES (XS_RESET_WATCHES + 1)
+#define CHURN_MAX_DOMID 32000
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+node_path(char *buf, size_t len, unsigned int i)
+{
+    /* keep directories small, xenstored rewrites the parent per child */
+    snprintf(buf, len, BENCH_ROOT "/%u/%u", i / BENCH_DIR_NODES, i);
+}
+
+static void
+populate(struct xs_handle *xsh, unsigned int from, unsigned int to)
+{
+    char path[64], value[32];
+    unsigned int i;
+
+    for (i = from; i < to; i++) {
+        node_path(path, sizeof(path), i);
+        snprintf(value, sizeof(value), "%u", i);
+        if (!xs_write(xsh, XBT_NULL, path, value, strlen(value)))
+            err(1, "xs_write (%s)", path);
+    }
+}
+
+/* returns false if the transaction has to be retried */
+static bool
+transaction(struct xs_handle *xsh, unsigned int nodes,
+            unsigned int reads, unsigned int writes)
+{
+    char path[64], value[32];
+    xs_transaction_t xth;
+    unsigned int i, len;
+    void *data;
+
+    xth = xs_transaction_start(xsh);
+    if (xth == XBT_NULL)
+        err(1, "xs_transaction_start");
+
+    for (i = 0; i < reads; i++) {
+        node_path(path, sizeof(path), random() % nodes);
+        data = xs_read(xsh, xth, path, &len);
+        if (data == NULL)
+            err(1, "xs_read (%s)", path);
+        free(data);
+    }
+
+    for (i = 0; i < writes; i++) {
+        node_path(path, sizeof(path), random() % nodes);
+        snprintf(value, sizeof(value), "%ld", random());
+        if (!xs_write(xsh, xth, path, value, strlen(value)))
+            err(1, "xs_write (%s)", path);
+    }
+
+    if (!xs_transaction_end(xsh, xth, false)) {
+        if (errno == EAGAIN)
+            return false;
+        err(1, "xs_transaction_end");
+    }
+    return true;
+}
+
+static void
+bench_transaction(struct xs_handle *xsh, unsigned int *sizes,
+                  unsigned int nr_sizes, unsigned int count,
+                  unsigned int reads, unsigned int writes)
+{
+    unsigned int populated = 0, s, i, retries;
+    double start, elapsed;
+
+    printf("%10s %10s %10s %12s %12s\n",
+           "nodes", "count", "retries", "elapsed(s)", "txn/s");
+    for (s = 0; s < nr_sizes; s++) {
+        if (sizes[s] > populated) {
+            populate(xsh, populated, sizes[s]);
+            populated = sizes[s];
+        }
+
+        retries = 0;
+        start = now();
+        for (i = 0; i < count; i++)
+            while (!transaction(xsh, sizes[s], reads, writes))
+                retries++;
+        elapsed = now() - start;
+
+        printf("%10u %10u %10u %12.3f %12.1f\n",
+               sizes[s], count, retries, elapsed, count / elapsed);
+        fflush(stdout);
+    }
+
+    xs_rm(xsh, XBT_NULL, BENCH_ROOT);
+}
+
+static void
+write_node(struct xs_handle *xsh, const char *path, const char *value)
+{
+    if (!xs_write(xsh, XBT_NULL, path, value, strlen(value)))
+        err(1, "xs_write (%s)", path);
+}
+
+static void
+watch_node(struct xs_handle *xsh, const char *path, const char *token)
+{
+    if (!xs_watch(xsh, path, token))
+        err(1, "xs_watch (%s)", path);
+}
+
+/* evaluated watches and fires so far, from xenstored */
+static void
+watch_stats(struct xs_handle *xsh, unsigned int *watches,
+            unsigned long *fires, unsigned long *evaluated)
+{
+    unsigned int paths;
+    char *stats;
+
+    stats = xs_debug_command(xsh, "watches", NULL, 0);
+    if (stats == NULL)
+        err(1, "xs_debug_command (watches)");
+    if (sscanf(stats, "watches %u paths %u fires %lu evaluated %lu",
+               watches, &paths, fires, evaluated) != 4)
+        errx(1, "unexpected watch statistics '%s'", stats);
+    free(stats);
+}
+
+static const char *watch_devices[] = { "vif/0", "vbd/51712" };
+
+/* random device state writes with the given watch scan of xenstored */
+static void
+watch_writes(struct xs_handle *xsh, const char *scan, unsigned int domains,
+             unsigned int count)
+{
+    unsigned int d, i, watches, nr_devices = 2;
+    unsigned long fires[2], evaluated[2];
+    char path[128], *stats;
+    double start, elapsed;
+
+    stats = xs_debug_command(xsh, "watches", (void *)scan, strlen(scan) + 1);
+    if (stats == NULL)
+        err(1, "xs_debug_command (watches %s)", scan);
+    free(stats);
+
+    watch_stats(xsh, &watches, &fires[0], &evaluated[0]);
+    start = now();
+    for (i = 0; i < count; i++) {
+        const char *device = watch_devices[random() % nr_devices];
+
+        d = random() % domains + 1;
+        if (random() % 2)
+            snprintf(path, sizeof(path),
+                     "/local/domain/%u/device/%s/state", d, device);
+        else
+            snprintf(path, sizeof(path),
+                     "/local/domain/0/backend/%s/%u/state", device, d);
+        write_node(xsh, path, random() % 2 ? "4" : "3");
+    }
+    elapsed = now() - start;
+    watch_stats(xsh, &watches, &fires[1], &evaluated[1]);
+
+    printf("%10s %10u %10u %10u %14.1f %12.3f %12.1f\n", scan, domains,
+           watches, count,
+           (double)(evaluated[1] - evaluated[0]) / (fires[1] - fires[0]),
+           elapsed, count / elapsed);
+}
+
+static void
+bench_watch(struct xs_handle *xsh, unsigned int domains, unsigned int count)
+{
+    struct xs_handle **conns;
+    unsigned int d, i, nr_devices = 2;
+    char path[128];
+
+    conns = calloc(domains + 1, sizeof(*conns));
+    if (conns == NULL)
+        err(1, "calloc");
+
+    for (d = 1; d <= domains; d++) {
+        snprintf(path, sizeof(path), "/local/domain/%u/name", d);
+        write_node(xsh, path, "bench");
+        snprintf(path, sizeof(path), "/local/domain/%u/memory/target", d);
+        write_node(xsh, path, "524288");
+        for (i = 0; i < nr_devices; i++) {
+            snprintf(path, sizeof(path),
+                     "/local/domain/%u/device/%s/state", d, watch_devices[i]);
+            write_node(xsh, path, "1");
+            snprintf(path, sizeof(path),
+                     "/local/domain/0/backend/%s/%u/state",
+                     watch_devices[i], d);
+            write_node(xsh, path, "1");
+        }
+    }
+
+    /* dom0: toolstack and backend drivers */
+    conns[0] = xs_open(XS_OPEN_SOCKETONLY);
+    if (conns[0] == NULL)
+        err(1, "xs_open");
+    watch_node(conns[0], "@introduceDomain", "introduce");
+    watch_node(conns[0], "@releaseDomain", "release");
+    for (i = 0; i < nr_devices; i++) {
+        snprintf(path, sizeof(path), "/local/domain/0/backend/%.3s",
+                 watch_devices[i]);
+        watch_node(conns[0], path, "backend");
+    }
+
+    /* guests: balloon and frontend drivers */
+    for (d = 1; d <= domains; d++) {
+        conns[d] = xs_open(XS_OPEN_SOCKETONLY);
+        if (conns[d] == NULL)
+            err(1, "xs_open");
+        snprintf(path, sizeof(path), "/local/domain/%u/memory/target", d);
+        watch_node(conns[d], path, "balloon");
+        for (i = 0; i < nr_devices; i++) {
+            snprintf(path, sizeof(path),
+                     "/local/domain/%u/device/%s", d, watch_devices[i]);
+            watch_node(conns[d], path, "frontend");
+            snprintf(path, sizeof(path),
+                     "/local/domain/0/backend/%s/%u/state",
+                     watch_devices[i], d);
+            watch_node(conns[d], path, "backend-state");
+        }
+    }
+
+    printf("%10s %10s %10s %10s %14s %12s %12s\n", "scan", "domains",
+           "watches", "writes", "evaluated/wr", "elapsed(s)", "writes/s");
+    watch_writes(xsh, "index", domains, count);
+    watch_writes(xsh, "linear", domains, count);
+    free(xs_debug_command(xsh, "watches", "index", sizeof("index")));
+
+    for (d = 0; d <= domains; d++)
+        xs_close(conns[d]);
+    free(conns);
+
+    for (d = 1; d <= domains; d++) {
+        snprintf(path, sizeof(path), "/local/domain/%u", d);
+        xs_rm(xsh, XBT_NULL, path);
+    }
+    xs_rm(xsh, XBT_NULL, "/local/domain/0/backend");
+}
+
+/*
+ * churn: the clients below talk the wire protocol themselves, so that each
+ * message can be timed and a guest can use a ring like a real one.
+ */
+struct conn {
+    int fd;
+    struct xenstore_domain_interface *ring;  /* NULL over the socket */
+    uint32_t req_id;
+};
+
+struct latency {
+    double *us;
+    unsigned int nr, size;
+};
+
+struct domain {
+    uint32_t domid;
+    struct conn guest;
+};
+
+struct churn {
+    struct conn toolstack;
+    struct conn backend;
+    struct domain *domains;
+    unsigned int nr_domains;
+    bool ring;
+    uint32_t next_domid;
+    unsigned char live[CHURN_MAX_DOMID + 1];
+};
+
+static const struct device {
+    const char *type;
+    unsigned int id;
+} devices[] = {
+    { "vif", 0 },
+    { "vbd", 51712 },
+};
+
+#define NR_DEVICES (sizeof(devices) / sizeof(devices[0]))
+
+static struct latency latencies[MSG_TYPES];
+static unsigned long watch_events;
+
+static void
+record_latency(enum xsd_sockmsg_type type, double us)
+{
+    struct latency *l = &latencies[type];
+
+    if (l->nr == l->size) {
+        l->size = l->size ? l->size * 2 : 1024;
+        l->us = realloc(l->us, l->size * sizeof(*l->us));
+        if (l->us == NULL)
+            err(1, "realloc");
+    }
+    l->us[l->nr++] = us;
+}
+
+static int
+compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static int
+connect_to(const char *path)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    fd = socket(PF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        err(1, "socket");
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+        err(1, "connect (%s)", path);
+    return fd;
+}
+
+static void
+conn_socket(struct conn *c)
+{
+    memset(c, 0, sizeof(*c));
+    c->fd = connect_to(xs_daemon_socket());
+}
+
+/* hands xenstored a page as the ring of domid, see --ring-standin */
+static void
+conn_ring(struct conn *c, uint32_t domid)
+{
+    char control[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr *cmsg;
+    struct msghdr msg;
+    struct iovec iov;
+    FILE *page;
+    int fd;
+    char ready;
+
+    memset(c, 0, sizeof(*c));
+    page = tmpfile();
+    if (page == NULL || ftruncate(fileno(page), getpagesize()) != 0)
+        err(1, "tmpfile");
+    c->ring = mmap(NULL, getpagesize(), PROT_READ | PROT_WRITE, MAP_SHARED,
+                   fileno(page), 0);
+    if (c->ring == MAP_FAILED)
+        err(1, "mmap");
+    c->fd = connect_to(xs_daemon_socket_ring());
+
+    fd = fileno(page);
+    iov.iov_base = &domid;
+    iov.iov_len = sizeof(domid);
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fd));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(fd));
+    if (sendmsg(c->fd, &msg, 0) != sizeof(domid))
+        err(1, "sendmsg");
+    fclose(page);
+
+    /* the first notification says the ring is ready */
+    if (read(c->fd, &ready, 1) != 1)
+        errx(1, "xenstored refused a ring for domain %u", domid);
+}
+
+static void
+conn_close(struct conn *c)
+{
+    if (c->ring)
+        munmap(c->ring, getpagesize());
+    close(c->fd);
+}
+
+/* waits for xenstored to notify a change of the ring */
+static void
+ring_wait(struct conn *c)
+{
+    char buf[4096];
+    ssize_t len;
+
+    len = read(c->fd, buf, sizeof(buf));
+    if (len == 0)
+        errx(1, "xenstored closed the ring");
+    if (len < 0 && errno != EINTR)
+        err(1, "read");
+}
+
+static void
+ring_notify(struct conn *c)
+{
+    char byte = 0;
+
+    if (write(c->fd, &byte, 1) != 1)
+        err(1, "write");
+}
+
+static void
+ring_write(struct conn *c, const char *data, unsigned int len)
+{
+    struct xenstore_domain_interface *intf = c->ring;
+    XENSTORE_RING_IDX cons, prod;
+    unsigned int chunk;
+
+    while (len) {
+        cons = intf->req_cons;
+        prod = intf->req_prod;
+        __sync_synchronize();
+        if (prod - cons == XENSTORE_RING_SIZE) {
+            ring_wait(c);
+            continue;
+        }
+
+        chunk = XENSTORE_RING_SIZE - MASK_XENSTORE_IDX(prod);
+        if (chunk > XENSTORE_RING_SIZE - (prod - cons))
+            chunk = XENSTORE_RING_SIZE - (prod - cons);
+        if (chunk > len)
+            chunk = len;
+        memcpy(intf->req + MASK_XENSTORE_IDX(prod), data, chunk);
+        __sync_synchronize();
+        intf->req_prod = prod + chunk;
+        ring_notify(c);
+
+        data += chunk;
+        len -= chunk;
+    }
+}
+
+static void
+ring_read(struct conn *c, char *data, unsigned int len)
+{
+    struct xenstore_domain_interface *intf = c->ring;
+    XENSTORE_RING_IDX cons, prod;
+    unsigned int chunk;
+
+    while (len) {
+        cons = intf->rsp_cons;
+        prod = intf->rsp_prod;
+        __sync_synchronize();
+        if (prod == cons) {
+            ring_wait(c);
+            continue;
+        }
+
+        chunk = XENSTORE_RING_SIZE - MASK_XENSTORE_IDX(cons);
+        if (chunk > prod - cons)
+            chunk = prod - cons;
+        if (chunk > len)
+            chunk = len;
+        memcpy(data, intf->rsp + MASK_XENSTORE_IDX(cons), chunk);
+        __sync_synchronize();
+        intf->rsp_cons = cons + chunk;
+        ring_notify(c);
+
+        data += chunk;
+        len -= chunk;
+    }
+}
+
+static void
+conn_write(struct conn *c, const void *data, unsigned int len)
+{
+    if (c->ring)
+        ring_write(c, data, len);
+    else if (!xs_write_all(c->fd, data, len))
+        err(1, "write");
+}
+
+static void
+conn_read(struct conn *c, void *data, unsigned int len)
+{
+    ssize_t done;
+
+    if (c->ring) {
+        ring_read(c, data, len);
+        return;
+    }
+    while (len) {
+        done = read(c->fd, data, len);
+        if (done < 0 && errno == EINTR)
+            continue;
+        if (done <= 0)
+            errx(1, "xenstored closed the connection");
+        data = (char *)data + done;
+        len -= done;
+    }
+}
+
+/*
+ * Sends a request and times it until its reply, counting the watch events
+ * read before it.  Returns the reply, or NULL with errno set on XS_ERROR.
+ */
+static char *
+request(struct conn *c, uint32_t tx_id, enum xsd_sockmsg_type type,
+        const char *payload, unsigned int len)
+{
+    struct xsd_sockmsg msg;
+    unsigned int i, nr_errors = sizeof(xsd_errors) / sizeof(xsd_errors[0]);
+    double start;
+    char *body;
+
+    msg.type = type;
+    msg.req_id = ++c->req_id;
+    msg.tx_id = tx_id;
+    msg.len = len;
+
+    start = now();
+    conn_write(c, &msg, sizeof(msg));
+    conn_write(c, payload, len);
+    for (;;) {
+        conn_read(c, &msg, sizeof(msg));
+        body = malloc(msg.len + 1);
+        if (body == NULL)
+            err(1, "malloc");
+        conn_read(c, body, msg.len);
+        body[msg.len] = '\0';
+        if (msg.type != XS_WATCH_EVENT)
+            break;
+        watch_events++;
+        free(body);
+    }
+    record_latency(type, (now() - start) * 1e6);
+
+    if (msg.req_id != c->req_id)
+        errx(1, "reply to request %u, expected %u", msg.req_id, c->req_id);
+    if (msg.type == XS_ERROR) {
+        for (i = 0; i < nr_errors; i++)
+            if (strcmp(body, xsd_errors[i].errstring) == 0)
+                break;
+        errno = i < nr_errors ? xsd_errors[i].errnum : EINVAL;
+        free(body);
+        return NULL;
+    }
+    return body;
+}
+
+/* the arguments are strings up to a NULL; the value of XS_WRITE is last */
+static char *
+vcall(struct conn *c, uint32_t tx_id, enum xsd_sockmsg_type type, va_list ap)
+{
+    char payload[XENSTORE_PAYLOAD_MAX];
+    unsigned int len = 0, n;
+    const char *arg;
+
+    while ((arg = va_arg(ap, const char *)) != NULL) {
+        n = strlen(arg) + 1;
+        if (len + n > sizeof(payload))
+            errx(1, "%s request too long", xs_sockmsg_string(type));
+        memcpy(payload + len, arg, n);
+        len += n;
+    }
+    if (type == XS_WRITE && len)
+        len--;
+    return request(c, tx_id, type, payload, len);
+}
+
+static char *
+call(struct conn *c, uint32_t tx_id, enum xsd_sockmsg_type type, ...)
+{
+    va_list ap;
+    char *reply;
+
+    va_start(ap, type);
+    reply = vcall(c, tx_id, type, ap);
+    va_end(ap);
+    return reply;
+}
+
+/* as call, for requests which must succeed and whose reply is not needed */
+static void
+check(struct conn *c, uint32_t tx_id, enum xsd_sockmsg_type type, ...)
+{
+    const char *path;
+    va_list ap;
+    char *reply;
+
+    va_start(ap, type);
+    path = va_arg(ap, const char *);
+    va_end(ap);
+
+    va_start(ap, type);
+    reply = vcall(c, tx_id, type, ap);
+    va_end(ap);
+    if (reply == NULL)
+        err(1, "%s (%s)", xs_sockmsg_string(type), path);
+    free(reply);
+}
+
+static uint32_t
+tx_start(struct conn *c)
+{
+    uint32_t tx_id;
+    char *reply;
+
+    reply = call(c, 0, XS_TRANSACTION_START, "", NULL);
+    if (reply == NULL)
+        err(1, "TRANSACTION_START");
+    tx_id = strtoul(reply, NULL, 0);
+    free(reply);
+    return tx_id;
+}
+
+/* returns false if the transaction has to be retried */
+static bool
+tx_end(struct conn *c, uint32_t tx_id)
+{
+    char *reply;
+
+    reply = call(c, tx_id, XS_TRANSACTION_END, "T", NULL);
+    if (reply == NULL) {
+        if (errno == EAGAIN)
+            return false;
+        err(1, "TRANSACTION_END");
+    }
+    free(reply);
+    return true;
+}
+
+/* formats a path or value, valid until eight more are formatted */
+static const char *
+fmt(const char *format, ...)
+{
+    static char bufs[8][128];
+    static unsigned int next;
+    char *buf = bufs[next++ % 8];
+    va_list ap;
+
+    va_start(ap, format);
+    vsnprintf(buf, sizeof(bufs[0]), format, ap);
+    va_end(ap);
+    return buf;
+}
+
+/* the toolstack, backends and frontend connect a device, as for hotplug */
+static void
+device_add(struct churn *ch, struct domain *d, const struct device *dev)
+{
+    struct conn *ts = &ch->toolstack, *be = &ch->backend, *g = &d->guest;
+    char fe_path[128], be_path[128], owner[16], reader[16];
+    uint32_t tx;
+
+    snprintf(fe_path, sizeof(fe_path), "/local/domain/%u/device/%s/%u",
+             d->domid, dev->type, dev->id);
+    snprintf(be_path, sizeof(be_path), "/local/domain/0/backend/%s/%u/%u",
+             dev->type, d->domid, dev->id);
+    snprintf(owner, sizeof(owner), "n%u", d->domid);
+    snprintf(reader, sizeof(reader), "r%u", d->domid);
+
+    do {
+        tx = tx_start(ts);
+        check(ts, tx, XS_MKDIR, be_path, NULL);
+        check(ts, tx, XS_SET_PERMS, be_path, "n0", reader, NULL);
+        check(ts, tx, XS_WRITE, fmt("%s/frontend", be_path), fe_path, NULL);
+        check(ts, tx, XS_WRITE, fmt("%s/frontend-id", be_path),
+              fmt("%u", d->domid), NULL);
+        check(ts, tx, XS_WRITE, fmt("%s/online", be_path), "1", NULL);
+        check(ts, tx, XS_WRITE, fmt("%s/state", be_path), "1", NULL);
+        check(ts, tx, XS_MKDIR, fe_path, NULL);
+        check(ts, tx, XS_SET_PERMS, fe_path, owner, "r0", NULL);
+        check(ts, tx, XS_WRITE, fmt("%s/backend", fe_path), be_path, NULL);
+        check(ts, tx, XS_WRITE, fmt("%s/backend-id", fe_path), "0", NULL);
+        check(ts, tx, XS_WRITE, fmt("%s/state", fe_path), "1", NULL);
+    } while (!tx_end(ts, tx));
+
+    /* backend driver: InitWait */
+    free(call(be, 0, XS_READ, fmt("%s/frontend", be_path), NULL));
+    check(be, 0, XS_WRITE, fmt("%s/hotplug-status", be_path), "connected",
+          NULL);
+    check(be, 0, XS_WRITE, fmt("%s/state", be_path), "2", NULL);
+
+    /* frontend driver: publishes its ring, Initialised */
+    free(call(g, 0, XS_DIRECTORY, fmt("/local/domain/%u/device/%s",
+                                       d->domid, dev->type), NULL));
+    free(call(g, 0, XS_READ, fmt("%s/backend", fe_path), NULL));
+    check(g, 0, XS_WATCH, fmt("%s/state", be_path), fe_path, NULL);
+    do {
+        tx = tx_start(g);
+        check(g, tx, XS_WRITE, fmt("%s/ring-ref", fe_path), "8", NULL);
+        check(g, tx, XS_WRITE, fmt("%s/event-channel", fe_path), "12", NULL);
+    } while (!tx_end(g, tx));
+    check(g, 0, XS_WRITE, fmt("%s/state", fe_path), "3", NULL);
+
+    /* backend driver: maps the ring, Connected */
+    free(call(be, 0, XS_READ, fmt("%s/ring-ref", fe_path), NULL));
+    free(call(be, 0, XS_READ, fmt("%s/event-channel", fe_path), NULL));
+    check(be, 0, XS_WRITE, fmt("%s/state", be_path), "4", NULL);
+
+    free(call(g, 0, XS_READ, fmt("%s/state", be_path), NULL));
+    check(g, 0, XS_WRITE, fmt("%s/state", fe_path), "4", NULL);
+}
+
+static void
+device_remove(struct churn *ch, struct domain *d, const struct device *dev)
+{
+    struct conn *be = &ch->backend, *g = &d->guest;
+    char fe_path[128], be_path[128];
+
+    snprintf(fe_path, sizeof(fe_path), "/local/domain/%u/device/%s/%u",
+             d->domid, dev->type, dev->id);
+    snprintf(be_path, sizeof(be_path), "/local/domain/0/backend/%s/%u/%u",
+             dev->type, d->domid, dev->id);
+
+    check(g, 0, XS_WRITE, fmt("%s/state", fe_path), "5", NULL);
+    check(be, 0, XS_WRITE, fmt("%s/state", be_path), "5", NULL);
+    check(g, 0, XS_WRITE, fmt("%s/state", fe_path), "6", NULL);
+    check(be, 0, XS_WRITE, fmt("%s/state", be_path), "6", NULL);
+    check(g, 0, XS_UNWATCH, fmt("%s/state", be_path), fe_path, NULL);
+}
+
+static uint32_t
+alloc_domid(struct churn *ch)
+{
+    unsigned int i;
+
+    for (i = 0; i < CHURN_MAX_DOMID; i++) {
+        ch->next_domid = ch->next_domid % CHURN_MAX_DOMID + 1;
+        if (!ch->live[ch->next_domid]) {
+            ch->live[ch->next_domid] = 1;
+            return ch->next_domid;
+        }
+    }
+    errx(1, "out of domain ids");
+}
+
+/* the toolstack builds the domain, which boots and gets its devices */
+static void
+domain_create(struct churn *ch, struct domain *d)
+{
+    static const char *guest_dirs[] = { "device", "control", "data" };
+    static const char *dom0_dirs[] = { "cpu", "memory" };
+    struct conn *ts = &ch->toolstack, *g = &d->guest;
+    char dom[64], owner[16], reader[16];
+    unsigned int i;
+    uint32_t tx;
+
+    d->domid = alloc_domid(ch);
+    snprintf(dom, sizeof(dom), "/local/domain/%u", d->domid);
+    snprintf(owner, sizeof(owner), "n%u", d->domid);
+    snprintf(reader, sizeof(reader), "r%u", d->domid);
+
+    do {
+        tx = tx_start(ts);
+        free(call(ts, tx, XS_RM, dom, NULL));
+        check(ts, tx, XS_MKDIR, dom, NULL);
+        check(ts, tx, XS_SET_PERMS, dom, "n0", reader, NULL);
+        check(ts, tx, XS_WRITE, fmt("%s/name", dom),
+              fmt("bench-%u", d->domid), NULL);
+        check(ts, tx, XS_WRITE, fmt("%s/domid", dom),
+              fmt("%u", d->domid), NULL);
+        for (i = 0; i < 2; i++) {
+            check(ts, tx, XS_MKDIR, fmt("%s/%s", dom, dom0_dirs[i]), NULL);
+            check(ts, tx, XS_SET_PERMS, fmt("%s/%s", dom, dom0_dirs[i]),
+                  "n0", reader, NULL);
+        }
+        for (i = 0; i < 3; i++) {
+            check(ts, tx, XS_MKDIR, fmt("%s/%s", dom, guest_dirs[i]), NULL);
+            check(ts, tx, XS_SET_PERMS, fmt("%s/%s", dom, guest_dirs[i]),
+                  owner, NULL);
+        }
+    } while (!tx_end(ts, tx));
+    check(ts, 0, XS_WRITE, fmt("%s/memory/static-max", dom), "524288", NULL);
+    check(ts, 0, XS_WRITE, fmt("%s/memory/target", dom), "524288", NULL);
+
+    /* the stand-in takes the place of XS_INTRODUCE */
+    if (ch->ring)
+        conn_ring(g, d->domid);
+    else
+        conn_socket(g);
+
+    /* xenbus, balloon and shutdown watches of the guest kernel */
+    check(g, 0, XS_WATCH, fmt("%s/device", dom), "device", NULL);
+    check(g, 0, XS_WATCH, fmt("%s/memory/target", dom), "balloon", NULL);
+    check(g, 0, XS_WATCH, fmt("%s/control/shutdown", dom), "shutdown", NULL);
+    free(call(g, 0, XS_READ, fmt("%s/memory/target", dom), NULL));
+
+    for (i = 0; i < NR_DEVICES; i++)
+        device_add(ch, d, &devices[i]);
+}
+
+/* a clean shutdown requested by the toolstack, which then cleans up */
+static void
+domain_destroy(struct churn *ch, struct domain *d)
+{
+    struct conn *ts = &ch->toolstack, *g = &d->guest;
+    char dom[64];
+    unsigned int i;
+
+    snprintf(dom, sizeof(dom), "/local/domain/%u", d->domid);
+
+    check(ts, 0, XS_WRITE, fmt("%s/control/shutdown", dom), "poweroff", NULL);
+    free(call(g, 0, XS_READ, fmt("%s/control/shutdown", dom), NULL));
+    check(g, 0, XS_WRITE, fmt("%s/control/shutdown", dom), "", NULL);
+    for (i = 0; i < NR_DEVICES; i++)
+        device_remove(ch, d, &devices[i]);
+    check(g, 0, XS_UNWATCH, fmt("%s/device", dom), "device", NULL);
+    check(g, 0, XS_UNWATCH, fmt("%s/memory/target", dom), "balloon", NULL);
+    check(g, 0, XS_UNWATCH, fmt("%s/control/shutdown", dom), "shutdown",
+          NULL);
+
+    if (ch->ring)
+        check(ts, 0, XS_RELEASE, fmt("%u", d->domid), NULL);
+    conn_close(g);
+
+    check(ts, 0, XS_RM, dom, NULL);
+    for (i = 0; i < NR_DEVICES; i++)
+        free(call(ts, 0, XS_RM, fmt("/local/domain/0/backend/%s/%u",
+                                    devices[i].type, d->domid), NULL));
+    ch->live[d->domid] = 0;
+}
+
+static unsigned int
+count_nodes(struct xs_handle *xsh)
+{
+    struct xs_subtree_node *nodes;
+    unsigned int num;
+
+    nodes = xs_read_subtree(xsh, XBT_NULL, "/", &num);
+    if (nodes == NULL)
+        err(1, "xs_read_subtree");
+    free(nodes);
+    return num;
+}
+
+static void
+print_latencies(void)
+{
+    struct latency *l;
+    unsigned int type;
+
+    printf("%20s %10s %10s %10s\n", "type", "count", "p50(us)", "p99(us)");
+    for (type = 0; type < MSG_TYPES; type++) {
+        l = &latencies[type];
+        if (l->nr == 0)
+            continue;
+        qsort(l->us, l->nr, sizeof(*l->us), compare_double);
+        printf("%20s %10u %10.1f %10.1f\n", xs_sockmsg_string(type), l->nr,
+               l->us[l->nr / 2], l->us[l->nr * 99 / 100]);
+        l->nr = 0;
+    }
+}
+
+static void
+bench_churn(struct xs_handle *xsh, unsigned int *sizes,
+            unsigned int nr_sizes, unsigned int cycles, bool ring)
+{
+    struct churn *ch;
+    unsigned int s, i, d, nodes, watches, ops, type;
+    unsigned long fires, evaluated;
+    double start, elapsed;
+
+    ch = calloc(1, sizeof(*ch));
+    if (ch == NULL)
+        err(1, "calloc");
+    ch->ring = ring;
+
+    for (s = 0; s < nr_sizes; s++) {
+        ch->nr_domains = sizes[s];
+        ch->domains = calloc(ch->nr_domains, sizeof(*ch->domains));
+        if (ch->domains == NULL)
+            err(1, "calloc");
+        watch_events = 0;
+
+        /* dom0: toolstack and backend drivers */
+        conn_socket(&ch->toolstack);
+        check(&ch->toolstack, 0, XS_WATCH, "@introduceDomain", "introduce",
+              NULL);
+        check(&ch->toolstack, 0, XS_WATCH, "@releaseDomain", "release", NULL);
+        conn_socket(&ch->backend);
+        for (i = 0; i < NR_DEVICES; i++)
+            check(&ch->backend, 0, XS_WATCH,
+                  fmt("/local/domain/0/backend/%s", devices[i].type),
+                  "backend", NULL);
+
+        start = now();
+        for (d = 0; d < ch->nr_domains; d++)
+            domain_create(ch, &ch->domains[d]);
+        nodes = count_nodes(xsh);
+        watch_stats(xsh, &watches, &fires, &evaluated);
+        for (i = 0; i < cycles; i++) {
+            d = random() % ch->nr_domains;
+            domain_destroy(ch, &ch->domains[d]);
+            domain_create(ch, &ch->domains[d]);
+        }
+        for (d = 0; d < ch->nr_domains; d++)
+            domain_destroy(ch, &ch->domains[d]);
+        elapsed = now() - start;
+
+        ops = 0;
+        for (type = 0; type < MSG_TYPES; type++)
+            ops += latencies[type].nr;
+
+        printf("%10s %10s %10s %10s %10s %10s %12s %12s\n", "domains",
+               "nodes", "watches", "cycles", "ops", "events", "elapsed(s)",
+               "ops/s");
+        printf("%10u %10u %10u %10u %10u %10lu %12.3f %12.1f\n",
+               ch->nr_domains, nodes, watches, cycles, ops, watch_events,
+               elapsed, ops / elapsed);
+        print_latencies();
+        printf("\n");
+        fflush(stdout);
+
+        conn_close(&ch->toolstack);
+        conn_close(&ch->backend);
+        free(ch->domains);
+    }
+
+    free(ch);
+}
+
+static unsigned int
+parse_sizes(char *arg, unsigned int *sizes)
+{
+    unsigned int n = 0;
+    char *tok;
+
+    for (tok = strtok(arg, ","); tok; tok = strtok(NULL, ",")) {
+        if (n == MAX_SIZES)
+            errx(1, "at most %d sizes", MAX_SIZES);
+        sizes[n] = strtoul(tok, NULL, 0);
+        if (sizes[n] == 0)
+            errx(1, "invalid size '%s'", tok);
+        n++;
+    }
+    return n;
+}
+
+static void
+usage(const char *progname)
+{
+    errx(1, "Usage: %s transaction [-h] [-s] [-n nodes[,nodes...]] "
+         "[-c count] [-r reads] [-w writes]\n"
+         "       %s watch [-h] [-s] [-d domains] [-c count]\n"
+         "       %s churn [-h] [-s] [-t socket|ring] "
+         "[-d domains[,domains...]] [-c cycles]",
+         progname, progname, progname);
+}
+
+int
+main(int argc, char **argv)
+{
+    struct xs_handle *xsh;
+    unsigned int sizes[MAX_SIZES] = { 1000, 10000, 100000 };
+    unsigned int nr_sizes = 3, count = 1000, reads = 4, writes = 2;
+    unsigned int domains[MAX_SIZES] = { 10, 100, 500 }, nr_domains = 0;
+    int socket = 0, ring = 0;
+    enum { TRANSACTION, WATCH, CHURN } mode;
+
+    if (argc < 2)
+        usage(argv[0]);
+    if (strcmp(argv[1], "transaction") == 0)
+        mode = TRANSACTION;
+    else if (strcmp(argv[1], "watch") == 0)
+        mode = WATCH;
+    else if (strcmp(argv[1], "churn") == 0)
+        mode = CHURN;
+    else
+        usage(argv[0]);
+
+    while (1) {
+        int c, index = 0;
+        static struct option long_options[] = {
+            {"help",    0, 0, 'h'},
+            {"socket",  0, 0, 's'},
+            {"nodes",   1, 0, 'n'},
+            {"count",   1, 0, 'c'},
+            {"reads",   1, 0, 'r'},
+            {"writes",  1, 0, 'w'},
+            {"domains", 1, 0, 'd'},
+            {"transport", 1, 0, 't'},
+            {0, 0, 0, 0}
+        };
+
+        c = getopt_long(argc - 1, argv + 1, "hsn:c:r:w:d:t:",
+                        long_options, &index);
+        if (c == -1)
+            break;
+
+        switch (c) {
+        case 'h':
+            usage(argv[0]);
+            /* NOTREACHED */
+        case 's':
+            socket = 1;
+            break;
+        case 'n':
+            nr_sizes = parse_sizes(optarg, sizes);
+            break;
+        case 'c':
+            count = strtoul(optarg, NULL, 0);
+            break;
+        case 'r':
+            reads = strtoul(optarg, NULL, 0);
+            break;
+        case 'w':
+            writes = strtoul(optarg, NULL, 0);
+            break;
+        case 'd':
+            nr_domains = parse_sizes(optarg, domains);
+            break;
+        case 't':
+            if (strcmp(optarg, "ring") == 0)
+                ring = 1;
+            else if (strcmp(optarg, "socket") != 0)
+                errx(1, "invalid transport '%s'", optarg);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    xsh = xs_open(socket ? XS_OPEN_SOCKETONLY : 0);
+    if (xsh == NULL)
+        err(1, "xs_open");
+
+    srandom(1);
+    switch (mode) {
+    case TRANSACTION:
+        bench_transaction(xsh, sizes, nr_sizes, count, reads, writes);
+        break;
+    case WATCH:
+        bench_watch(xsh, nr_domains ? domains[0] : 500, count);
+        break;
+    case CHURN:
+        bench_churn(xsh, domains, nr_domains ? nr_domains : 3,
+                    count, ring);
+        break;
+    }
+
+    xs_close(xsh);
+    return 0;
+}
@@ -50,8 +50,13 @@ const char *xs_daemon_rootdir(void);
 const char *xs_daemon_rundir(void);
 const char *xs_daemon_socket(void);
 const char *xs_daemon_socket_ro(void);
+const char *xs_daemon_socket_ring(void);
 const char *xs_domain_dev(void);
 const char *xs_daemon_tdb(void);
+const char *xs_daemon_store_log(void);
+
+/* Name of a message type, for traces. */
+const char *xs_sockmsg_string(enum xsd_sockmsg_type type);
 
 /* Simple write function: loops for you. */
 bool xs_write_all(int fd, const void *data, unsigned int len);
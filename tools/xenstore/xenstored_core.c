@@ -19,7 +19,6 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
-#include <sys/select.h>
 #ifndef NO_SOCKETS
 #include <sys/socket.h>
 #include <sys/un.h>
@@ -50,7 +49,6 @@
 #include "xenstored_transaction.h"
 #include "xenstored_domain.h"
 #include "xenctrl.h"
-#include "tdb.h"
 
 #include "hashtable.h"
 
@@ -63,7 +61,6 @@ static bool recovery = true;
 static bool remove_local = true;
 static int reopen_log_pipe[2];
 static char *tracefile = NULL;
-static TDB_CONTEXT *tdb_ctx = NULL;
 
 static void corrupt(struct connection *conn, const char *fmt, ...);
 static void check_store(void);
@@ -82,51 +79,10 @@ int quota_nb_watch_per_domain = 128;
 int quota_max_entry_size = 2048; /* 2K */
 int quota_max_transaction = 10;
 
-TDB_CONTEXT *tdb_context(struct connection *conn)
+static struct transaction *conn_transaction(struct connection *conn)
 {
 	/* conn = NULL used in manual_node at setup. */
-	if (!conn || !conn->transaction)
-		return tdb_ctx;
-	return tdb_transaction_context(conn->transaction);
-}
-
-bool replace_tdb(const char *newname, TDB_CONTEXT *newtdb)
-{
-	if (!(tdb_ctx->flags & TDB_INTERNAL))
-		if (rename(newname, xs_daemon_tdb()) != 0)
-			return false;
-	tdb_close(tdb_ctx);
-	tdb_ctx = talloc_steal(talloc_autofree_context(), newtdb);
-	return true;
-}
-
-static char *sockmsg_string(enum xsd_sockmsg_type type)
-{
-	switch (type) {
-	case XS_DEBUG: return "DEBUG";
-	case XS_DIRECTORY: return "DIRECTORY";
-	case XS_READ: return "READ";
-	case XS_GET_PERMS: return "GET_PERMS";
-	case XS_WATCH: return "WATCH";
-	case XS_UNWATCH: return "UNWATCH";
-	case XS_TRANSACTION_START: return "TRANSACTION_START";
-	case XS_TRANSACTION_END: return "TRANSACTION_END";
-	case XS_INTRODUCE: return "INTRODUCE";
-	case XS_RELEASE: return "RELEASE";
-	case XS_GET_DOMAIN_PATH: return "GET_DOMAIN_PATH";
-	case XS_WRITE: return "WRITE";
-	case XS_MKDIR: return "MKDIR";
-	case XS_RM: return "RM";
-	case XS_SET_PERMS: return "SET_PERMS";
-	case XS_WATCH_EVENT: return "WATCH_EVENT";
-	case XS_ERROR: return "ERROR";
-	case XS_IS_DOMAIN_INTRODUCED: return "XS_IS_DOMAIN_INTRODUCED";
-	case XS_RESUME: return "RESUME";
-	case XS_SET_TARGET: return "SET_TARGET";
-	case XS_RESET_WATCHES: return "RESET_WATCHES";
-	default:
-		return "**UNKNOWN**";
-	}
+	return conn ? conn->transaction : NULL;
 }
 
 void trace(const char *fmt, ...)
@@ -179,7 +135,7 @@ static void trace_io(const struct connection *conn,
 	      out ? "OUT" : "IN", conn,
 	      tm->tm_year + 1900, tm->tm_mon + 1,
 	      tm->tm_mday, tm->tm_hour, tm->tm_min, tm->tm_sec,
-	      sockmsg_string(data->hdr.msg.type));
+	      xs_sockmsg_string(data->hdr.msg.type));
 	
 	for (i = 0; i < data->hdr.msg.len; i++)
 		trace("%c", (data->buffer[i] != '\0') ? data->buffer[i] : ' ');
@@ -224,51 +180,70 @@ static void reopen_log(void)
 	}
 }
 
+/* Segments handed to one conn->write: header and body per message. */
+#define OUT_IOV_MAX 64
+
+/* Write as much of the queued output as the connection takes at once. */
 static bool write_messages(struct connection *conn)
 {
-	int ret;
-	struct buffered_data *out;
-
-	out = list_top(&conn->out_list, struct buffered_data, list);
-	if (out == NULL)
-		return true;
+	struct iovec iov[OUT_IOV_MAX];
+	struct buffered_data *out, *tmp;
+	unsigned int len;
+	int ret, n = 0;
 
-	if (out->inhdr) {
-		if (verbose)
-			xprintf("Writing msg %s (%.*s) out to %p\n",
-				sockmsg_string(out->hdr.msg.type),
-				out->hdr.msg.len,
-				out->buffer, conn);
-		ret = conn->write(conn, out->hdr.raw + out->used,
-				  sizeof(out->hdr) - out->used);
-		if (ret < 0)
-			return false;
-
-		out->used += ret;
-		if (out->used < sizeof(out->hdr))
-			return true;
-
-		out->inhdr = false;
-		out->used = 0;
-
-		/* Second write might block if non-zero. */
-		if (out->hdr.msg.len && !conn->domain)
-			return true;
+	list_for_each_entry(out, &conn->out_list, list) {
+		if (n + 2 > OUT_IOV_MAX)
+			break;
+		if (out->inhdr) {
+			if (verbose && out->used == 0)
+				xprintf("Writing msg %s (%.*s) out to %p\n",
+					xs_sockmsg_string(out->hdr.msg.type),
+					out->hdr.msg.len,
+					out->buffer, conn);
+			iov[n].iov_base = out->hdr.raw + out->used;
+			iov[n].iov_len = sizeof(out->hdr) - out->used;
+			n++;
+			iov[n].iov_base = out->buffer;
+			iov[n].iov_len = out->hdr.msg.len;
+		} else {
+			iov[n].iov_base = out->buffer + out->used;
+			iov[n].iov_len = out->hdr.msg.len - out->used;
+		}
+		if (iov[n].iov_len)
+			n++;
 	}
+	if (n == 0)
+		return true;
 
-	ret = conn->write(conn, out->buffer + out->used,
-			  out->hdr.msg.len - out->used);
+	ret = conn->write(conn, iov, n);
 	if (ret < 0)
 		return false;
 
-	out->used += ret;
-	if (out->used != out->hdr.msg.len)
-		return true;
+	/* Retire the messages that went out. */
+	list_for_each_entry_safe(out, tmp, &conn->out_list, list) {
+		if (out->inhdr) {
+			len = sizeof(out->hdr) - out->used;
+			if (ret < len) {
+				out->used += ret;
+				break;
+			}
+			ret -= len;
+			out->inhdr = false;
+			out->used = 0;
+		}
 
-	trace_io(conn, out, 1);
+		len = out->hdr.msg.len - out->used;
+		if (ret < len) {
+			out->used += ret;
+			break;
+		}
+		ret -= len;
+
+		trace_io(conn, out, 1);
 
-	list_del(&out->list);
-	talloc_free(out);
+		list_del(&out->list);
+		talloc_free(out);
+	}
 
 	return true;
 }
@@ -279,73 +254,37 @@ static int destroy_conn(void *_conn)
 
 	/* Flush outgoing if possible, but don't block. */
 	if (!conn->domain) {
-		fd_set set;
-		struct timeval none;
-
-		FD_ZERO(&set);
-		FD_SET(conn->fd, &set);
-		none.tv_sec = none.tv_usec = 0;
-
-		while (!list_empty(&conn->out_list)
-		       && select(conn->fd+1, NULL, &set, NULL, &none) == 1)
+		while (!list_empty(&conn->out_list) && conn->writable)
 			if (!write_messages(conn))
 				break;
+		poll_del(conn->fd);
 		close(conn->fd);
 	}
         if (conn->target)
                 talloc_unlink(conn, conn->target);
 	list_del(&conn->list);
+	list_del(&conn->pending);
 	trace_destroy(conn, "connection");
 	return 0;
 }
 
+/* Connections with input or output to handle in the main loop. */
+static LIST_HEAD(pending_conns);
 
-static void set_fd(int fd, fd_set *set, int *max)
+void conn_wakeup(struct connection *conn)
 {
-	if (fd < 0)
-		return;
-	FD_SET(fd, set);
-	if (fd > *max)
-		*max = fd;
+	if (list_empty(&conn->pending))
+		list_add_tail(&conn->pending, &pending_conns);
 }
 
-
-static int initialize_set(fd_set *inset, fd_set *outset, int sock, int ro_sock,
-			  struct timeval **ptimeout)
+static bool conn_can_read(struct connection *conn)
 {
-	static struct timeval zero_timeout = { 0 };
-	struct connection *conn;
-	int max = -1;
-
-	*ptimeout = NULL;
-
-	FD_ZERO(inset);
-	FD_ZERO(outset);
-
-	if (sock != -1)
-		set_fd(sock, inset, &max);
-	if (ro_sock != -1)
-		set_fd(ro_sock, inset, &max);
-	if (reopen_log_pipe[0] != -1)
-		set_fd(reopen_log_pipe[0], inset, &max);
-
-	if (xce_handle != NULL)
-		set_fd(xc_evtchn_fd(xce_handle), inset, &max);
-
-	list_for_each_entry(conn, &connections, list) {
-		if (conn->domain) {
-			if (domain_can_read(conn) ||
-			    (domain_can_write(conn) &&
-			     !list_empty(&conn->out_list)))
-				*ptimeout = &zero_timeout;
-		} else {
-			set_fd(conn->fd, inset, &max);
-			if (!list_empty(&conn->out_list))
-				FD_SET(conn->fd, outset);
-		}
-	}
+	return conn->domain ? domain_can_read(conn) : conn->readable;
+}
 
-	return max;
+static bool conn_can_write(struct connection *conn)
+{
+	return conn->domain ? domain_can_write(conn) : conn->writable;
 }
 
 /* Is child a subnode of parent, or equal? */
@@ -367,29 +306,18 @@ bool is_child(const char *child, const char *parent)
 /* If it fails, returns NULL and sets errno. */
 static struct node *read_node(struct connection *conn, const char *name)
 {
-	TDB_DATA key, data;
+	struct store_data data;
 	uint32_t *p;
 	struct node *node;
-	TDB_CONTEXT * context = tdb_context(conn);
-
-	key.dptr = (void *)name;
-	key.dsize = strlen(name);
-	data = tdb_fetch(context, key);
 
-	if (data.dptr == NULL) {
-		if (tdb_error(context) == TDB_ERR_NOEXIST)
-			errno = ENOENT;
-		else {
-			log("TDB error on read: %s", tdb_errorstr(context));
-			errno = EIO;
-		}
+	data = transaction_fetch(conn_transaction(conn), name);
+	if (data.dptr == NULL)
 		return NULL;
-	}
 
 	node = talloc(name, struct node);
 	node->name = talloc_strdup(node, name);
 	node->parent = NULL;
-	node->tdb = tdb_context(conn);
+	node->trans = conn_transaction(conn);
 	talloc_steal(node, data.dptr);
 
 	/* Datalen, childlen, number of permissions */
@@ -412,15 +340,12 @@ static bool write_node(struct connection *conn, const struct node *node)
 {
 	/*
 	 * conn will be null when this is called from manual_node.
-	 * tdb_context copes with this.
+	 * conn_transaction copes with this.
 	 */
 
-	TDB_DATA key, data;
+	struct store_data data;
 	void *p;
 
-	key.dptr = (void *)node->name;
-	key.dsize = strlen(node->name);
-
 	data.dsize = 3*sizeof(uint32_t)
 		+ node->num_perms*sizeof(node->perms[0])
 		+ node->datalen + node->childlen;
@@ -440,9 +365,8 @@ static bool write_node(struct connection *conn, const struct node *node)
 	p += node->datalen;
 	memcpy(p, node->children, node->childlen);
 
-	/* TDB should set errno, but doesn't even set ecode AFAICT. */
-	if (tdb_store(tdb_context(conn), key, data, TDB_REPLACE) != 0) {
-		corrupt(conn, "Write of %s failed", key.dptr);
+	if (!transaction_store(conn_transaction(conn), node->name, data)) {
+		corrupt(conn, "Write of %s failed", node->name);
 		goto error;
 	}
 	return true;
@@ -618,6 +542,7 @@ void send_reply(struct connection *conn, enum xsd_sockmsg_type type,
 
 	/* Queue for later transmission. */
 	list_add_tail(&bdata->list, &conn->out_list);
+	conn_wakeup(conn);
 }
 
 /* Some routines (write, mkdir, etc) just need a non-error return */
@@ -751,12 +676,7 @@ static void do_read(struct connection *conn, const char *name)
 
 static void delete_node_single(struct connection *conn, struct node *node)
 {
-	TDB_DATA key;
-
-	key.dptr = (void *)node->name;
-	key.dsize = strlen(node->name);
-
-	if (tdb_delete(tdb_context(conn), key) != 0) {
+	if (!transaction_delete(conn_transaction(conn), node->name)) {
 		corrupt(conn, "Could not delete '%s'", node->name);
 		return;
 	}
@@ -797,7 +717,7 @@ static struct node *construct_node(struct connection *conn, const char *name)
 
 	/* Allocate node */
 	node = talloc(name, struct node);
-	node->tdb = tdb_context(conn);
+	node->trans = conn_transaction(conn);
 	node->name = talloc_strdup(node, name);
 
 	/* Inherit permissions, except unprivileged domains own what they create */
@@ -818,15 +738,11 @@ static struct node *construct_node(struct connection *conn, const char *name)
 static int destroy_node(void *_node)
 {
 	struct node *node = _node;
-	TDB_DATA key;
 
 	if (streq(node->name, "/"))
 		corrupt(NULL, "Destroying root node!");
 
-	key.dptr = (void *)node->name;
-	key.dsize = strlen(node->name);
-
-	tdb_delete(node->tdb, key);
+	transaction_delete(node->trans, node->name);
 	return 0;
 }
 
@@ -1149,6 +1065,23 @@ static void do_debug(struct connection *conn, struct buffered_data *in)
 	if (streq(in->buffer, "check"))
 		check_store();
 
+	if (streq(in->buffer, "watches")) {
+		char *stats;
+
+		if (num > 1) {
+			int err = set_watch_scan(in->buffer + get_string(in, 0));
+
+			if (err) {
+				send_error(conn, err);
+				return;
+			}
+		}
+		stats = watch_stats(in);
+
+		send_reply(conn, XS_DEBUG, stats, strlen(stats) + 1);
+		return;
+	}
+
 	send_ack(conn, XS_DEBUG);
 }
 
@@ -1258,7 +1191,7 @@ static void consider_message(struct connection *conn)
 {
 	if (verbose)
 		xprintf("Got message %s len %i from %p\n",
-			sockmsg_string(conn->in->hdr.msg.type),
+			xs_sockmsg_string(conn->in->hdr.msg.type),
 			conn->in->hdr.msg.len, conn);
 
 	process_message(conn, conn->in);
@@ -1317,8 +1250,39 @@ bad_client:
 
 static void handle_output(struct connection *conn)
 {
-	if (!write_messages(conn))
-		talloc_free(conn);
+	while (!list_empty(&conn->out_list) && conn_can_write(conn)) {
+		if (!write_messages(conn)) {
+			talloc_free(conn);
+			return;
+		}
+	}
+}
+
+/* Messages read from one connection before the others get their turn. */
+#define CONN_INPUT_BATCH 32
+
+static void handle_conn(struct connection *conn)
+{
+	unsigned int i;
+
+	/* Hold a reference: handling may free conn. */
+	for (i = 0; i < CONN_INPUT_BATCH && conn_can_read(conn); i++) {
+		talloc_increase_ref_count(conn);
+		handle_input(conn);
+		if (talloc_free(conn) == 0)
+			return;
+	}
+
+	/* Replies of the whole batch go out together. */
+	talloc_increase_ref_count(conn);
+	handle_output(conn);
+	if (talloc_free(conn) == 0)
+		return;
+
+	/* Back on the list if there is more than a batch of input. */
+	list_del_init(&conn->pending);
+	if (conn_can_read(conn))
+		conn_wakeup(conn);
 }
 
 struct connection *new_connection(connwritefn_t *write, connreadfn_t *read)
@@ -1334,6 +1298,7 @@ struct connection *new_connection(connwritefn_t *write, connreadfn_t *read)
 	new->read = read;
 	new->can_write = true;
 	new->transaction_started = 0;
+	INIT_LIST_HEAD(&new->pending);
 	INIT_LIST_HEAD(&new->out_list);
 	INIT_LIST_HEAD(&new->watches);
 	INIT_LIST_HEAD(&new->transaction_list);
@@ -1355,12 +1320,15 @@ static void accept_connection(int sock, bool canwrite)
 {
 }
 #else
-static int writefd(struct connection *conn, const void *data, unsigned int len)
+static int writefd(struct connection *conn, const struct iovec *iov,
+		   int iovcnt)
 {
 	int rc;
 
-	while ((rc = write(conn->fd, data, len)) < 0) {
+	while ((rc = writev(conn->fd, iov, iovcnt)) < 0) {
 		if (errno == EAGAIN) {
+			conn->writable = false;
+			poll_rearm(conn->fd, false, true);
 			rc = 0;
 			break;
 		}
@@ -1377,8 +1345,9 @@ static int readfd(struct connection *conn, void *data, unsigned int len)
 
 	while ((rc = read(conn->fd, data, len)) < 0) {
 		if (errno == EAGAIN) {
-			rc = 0;
-			break;
+			conn->readable = false;
+			poll_rearm(conn->fd, true, false);
+			return 0;
 		}
 		if (errno != EINTR)
 			break;
@@ -1402,16 +1371,24 @@ static void accept_connection(int sock, bool canwrite)
 	if (fd < 0)
 		return;
 
+	/* Edge triggered: read and write until EAGAIN. */
+	if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0) {
+		close(fd);
+		return;
+	}
+
 	conn = new_connection(writefd, readfd);
 	if (conn) {
 		conn->fd = fd;
 		conn->can_write = canwrite;
+		if (!poll_add(fd, conn, true))
+			talloc_free(conn);
 	} else
 		close(fd);
 }
 #endif
 
-static int tdb_flags;
+static bool internal_db;
 
 /* We create initial nodes manually. */
 static void manual_node(const char *name, const char *child)
@@ -1434,13 +1411,7 @@ static void manual_node(const char *name, const char *child)
 
 static void setup_structure(void)
 {
-	char *tdbname;
-	tdbname = talloc_strdup(talloc_autofree_context(), xs_daemon_tdb());
-
-	if (!(tdb_flags & TDB_INTERNAL))
-		tdb_ctx = tdb_open(tdbname, 0, tdb_flags, O_RDWR, 0);
-
-	if (tdb_ctx) {
+	if (store_open(internal_db ? NULL : xs_daemon_store_log())) {
 		/* XXX When we make xenstored able to restart, this will have
 		   to become cleverer, checking for existing domains and not
 		   removing the corresponding entries, but for now xenstored
@@ -1469,11 +1440,6 @@ static void setup_structure(void)
 		talloc_free(tlocal);
 	}
 	else {
-		tdb_ctx = tdb_open(tdbname, 7919, tdb_flags, O_RDWR|O_CREAT,
-				   0640);
-		if (!tdb_ctx)
-			barf_perror("Could not create tdb file %s", tdbname);
-
 		manual_node("/", "tool");
 		manual_node("/tool", "xenstored");
 		manual_node("/tool/xenstored", NULL);
@@ -1600,22 +1566,20 @@ static void check_store_(const char *name, struct hashtable *reachable)
 /**
  * Helper to clean_store below.
  */
-static int clean_store_(TDB_CONTEXT *tdb, TDB_DATA key, TDB_DATA val,
-			void *private)
+static void clean_store_(const char *key, struct store_data val,
+			 void *private)
 {
 	struct hashtable *reachable = private;
-	char * name = talloc_strndup(NULL, key.dptr, key.dsize);
+	char * name = talloc_strdup(NULL, key);
 
 	if (!hashtable_search(reachable, name)) {
 		log("clean_store: '%s' is orphaned!", name);
 		if (recovery) {
-			tdb_delete(tdb, key);
+			transaction_delete(NULL, name);
 		}
 	}
 
 	talloc_free(name);
-
-	return 0;
 }
 
 
@@ -1625,7 +1589,7 @@ static int clean_store_(TDB_CONTEXT *tdb, TDB_DATA key, TDB_DATA val,
  */
 static void clean_store(struct hashtable *reachable)
 {
-	tdb_traverse(tdb_ctx, &clean_store_, reachable);
+	store_traverse(&clean_store_, reachable);
 }
 
 
@@ -1741,6 +1705,8 @@ static void usage(void)
 "                      the store is corrupted (debug only),\n"
 "  --internal-db       store database in memory, not on disk\n"
 "  --preserve-local    to request that /local is preserved on start-up,\n"
+"  --ring-standin      to let local processes play domains over a ring\n"
+"                      (testing only),\n"
 "  --verbose           to request verbose execution.\n");
 }
 
@@ -1760,6 +1726,7 @@ static struct option options[] = {
 	{ "no-recovery", 0, NULL, 'R' },
 	{ "preserve-local", 0, NULL, 'L' },
 	{ "internal-db", 0, NULL, 'I' },
+	{ "ring-standin", 0, NULL, 'r' },
 	{ "verbose", 0, NULL, 'V' },
 	{ "watch-nb", 1, NULL, 'W' },
 	{ NULL, 0, NULL, 0 } };
@@ -1768,18 +1735,60 @@ extern void dump_conn(struct connection *conn);
 int dom0_event = 0;
 int priv_domid = 0;
 
+static int *sock, *ro_sock;
+static int evtchn_fd = -1;
+static int standin_fd = -1;
+
+/* Called by the event loop, data identifies the descriptor. */
+static void handle_ready(void *data, bool in, bool out)
+{
+	struct connection *conn;
+
+	if (data == &reopen_log_pipe[0]) {
+		char c;
+		if (read(reopen_log_pipe[0], &c, 1) != 1)
+			barf_perror("read failed");
+		reopen_log();
+	} else if (data == sock)
+		accept_connection(*sock, true);
+	else if (data == ro_sock)
+		accept_connection(*ro_sock, false);
+	else if (data == &evtchn_fd)
+		handle_event();
+	else if (data == &standin_fd)
+		accept_standin(standin_fd);
+	else if (handle_standin_handshake(data))
+		return;
+	else {
+		conn = data;
+		if (conn->domain) {
+			handle_standin_event(conn);
+			return;
+		}
+		if (in)
+			conn->readable = true;
+		if (out)
+			conn->writable = true;
+		conn_wakeup(conn);
+	}
+}
+
+static void add_fd(int fd, void *data)
+{
+	if (fd != -1 && !poll_add(fd, data, false))
+		barf_perror("Could not watch descriptor %d", fd);
+}
+
 int main(int argc, char *argv[])
 {
-	int opt, *sock, *ro_sock, max;
-	fd_set inset, outset;
+	int opt;
 	bool dofork = true;
 	bool outputpid = false;
 	bool no_domain_init = false;
+	bool ring_standin = false;
 	const char *pidfile = NULL;
-	int evtchn_fd = -1;
-	struct timeval *timeout;
 
-	while ((opt = getopt_long(argc, argv, "DE:F:HNPS:t:T:RLVW:", options,
+	while ((opt = getopt_long(argc, argv, "DE:F:HNPS:t:T:RLrVW:", options,
 				  NULL)) != -1) {
 		switch (opt) {
 		case 'D':
@@ -1806,6 +1815,9 @@ int main(int argc, char *argv[])
 		case 'L':
 			remove_local = false;
 			break;
+		case 'r':
+			ring_standin = true;
+			break;
 		case 'S':
 			quota_max_entry_size = strtol(optarg, NULL, 10);
 			break;
@@ -1816,7 +1828,7 @@ int main(int argc, char *argv[])
 			tracefile = optarg;
 			break;
 		case 'I':
-			tdb_flags = TDB_INTERNAL|TDB_NOLOCK;
+			internal_db = true;
 			break;
 		case 'V':
 			verbose = true;
@@ -1856,6 +1868,7 @@ int main(int argc, char *argv[])
 	/* Don't kill us with SIGPIPE. */
 	signal(SIGPIPE, SIG_IGN);
 
+	poll_init();
 	init_sockets(&sock, &ro_sock);
 	init_pipe(reopen_log_pipe);
 
@@ -1866,6 +1879,9 @@ int main(int argc, char *argv[])
 	if (!no_domain_init)
 		domain_init();
 
+	if (ring_standin)
+		standin_fd = standin_init();
+
 	/* Restore existing connections. */
 	restore_existing_connections();
 
@@ -1884,76 +1900,31 @@ int main(int argc, char *argv[])
 		evtchn_fd = xc_evtchn_fd(xce_handle);
 
 	/* Get ready to listen to the tools. */
-	max = initialize_set(&inset, &outset, *sock, *ro_sock, &timeout);
+	add_fd(*sock, sock);
+	add_fd(*ro_sock, ro_sock);
+	add_fd(reopen_log_pipe[0], &reopen_log_pipe[0]);
+	add_fd(evtchn_fd, &evtchn_fd);
+	add_fd(standin_fd, &standin_fd);
 
 	/* Tell the kernel we're up and running. */
 	xenbus_notify_running();
 
 	/* Main loop. */
 	for (;;) {
-		struct connection *conn, *next;
+		LIST_HEAD(ready);
+		struct connection *conn;
 
-		if (select(max+1, &inset, &outset, NULL, timeout) < 0) {
-			if (errno == EINTR)
-				continue;
-			barf_perror("Select failed");
-		}
+		/* Don't sleep while connections still have work. */
+		store_flush();
 
-		if (reopen_log_pipe[0] != -1 && FD_ISSET(reopen_log_pipe[0], &inset)) {
-			char c;
-			if (read(reopen_log_pipe[0], &c, 1) != 1)
-				barf_perror("read failed");
-			reopen_log();
-		}
+		poll_wait(list_empty(&pending_conns) ? -1 : 0, handle_ready);
 
-		if (*sock != -1 && FD_ISSET(*sock, &inset))
-			accept_connection(*sock, true);
-
-		if (*ro_sock != -1 && FD_ISSET(*ro_sock, &inset))
-			accept_connection(*ro_sock, false);
-
-		if (evtchn_fd != -1 && FD_ISSET(evtchn_fd, &inset))
-			handle_event();
-
-		next = list_entry(connections.next, typeof(*conn), list);
-		if (&next->list != &connections)
-			talloc_increase_ref_count(next);
-		while (&next->list != &connections) {
-			conn = next;
-
-			next = list_entry(conn->list.next,
-					  typeof(*conn), list);
-			if (&next->list != &connections)
-				talloc_increase_ref_count(next);
-
-			if (conn->domain) {
-				if (domain_can_read(conn))
-					handle_input(conn);
-				if (talloc_free(conn) == 0)
-					continue;
-
-				talloc_increase_ref_count(conn);
-				if (domain_can_write(conn) &&
-				    !list_empty(&conn->out_list))
-					handle_output(conn);
-				if (talloc_free(conn) == 0)
-					continue;
-			} else {
-				if (FD_ISSET(conn->fd, &inset))
-					handle_input(conn);
-				if (talloc_free(conn) == 0)
-					continue;
-
-				talloc_increase_ref_count(conn);
-				if (FD_ISSET(conn->fd, &outset))
-					handle_output(conn);
-				if (talloc_free(conn) == 0)
-					continue;
-			}
+		/* Connections woken up from here on wait for the next round. */
+		list_splice_init(&pending_conns, &ready);
+		while ((conn = list_top(&ready, struct connection, pending))) {
+			list_del_init(&conn->pending);
+			handle_conn(conn);
 		}
-
-		max = initialize_set(&inset, &outset, *sock, *ro_sock,
-				     &timeout);
 	}
 }
 
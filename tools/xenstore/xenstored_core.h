@@ -23,13 +23,14 @@
 #include <xenctrl.h>
 
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <dirent.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <errno.h>
 #include "xenstore_lib.h"
 #include "list.h"
-#include "tdb.h"
+#include "xenstored_store.h"
 
 struct buffered_data
 {
@@ -51,7 +52,7 @@ struct buffered_data
 };
 
 struct connection;
-typedef int connwritefn_t(struct connection *, const void *, unsigned int);
+typedef int connwritefn_t(struct connection *, const struct iovec *, int);
 typedef int connreadfn_t(struct connection *, void *, unsigned int);
 
 struct connection
@@ -61,6 +62,13 @@ struct connection
 	/* The file descriptor we came in on. */
 	int fd;
 
+	/* Socket readiness: set on the edges reported by the event loop,
+	 * cleared when a read or write would block. */
+	bool readable, writable;
+
+	/* On the list of connections the main loop has to service. */
+	struct list_head pending;
+
 	/* Who am I? 0 for socket connections. */
 	unsigned int id;
 
@@ -99,8 +107,8 @@ extern struct list_head connections;
 struct node {
 	const char *name;
 
-	/* Database I came from */
-	TDB_CONTEXT *tdb;
+	/* Transaction I came from, NULL for the committed store */
+	struct transaction *trans;
 
 	/* Parent (optional) */
 	struct node *parent;
@@ -145,17 +153,11 @@ struct node *get_node(struct connection *conn,
 		      const char *name,
 		      enum xs_perm_type perm);
 
-/* Get TDB context for this connection */
-TDB_CONTEXT *tdb_context(struct connection *conn);
-
-/* Destructor for tdbs: required for transaction code */
-int destroy_tdb(void *_tdb);
-
-/* Replace the tdb: required for transaction code */
-bool replace_tdb(const char *newname, TDB_CONTEXT *newtdb);
-
 struct connection *new_connection(connwritefn_t *write, connreadfn_t *read);
 
+/* Have the main loop service this connection: input or room for output. */
+void conn_wakeup(struct connection *conn);
+
 
 /* Is this a valid node name? */
 bool is_valid_nodename(const char *node);
@@ -192,6 +194,17 @@ void finish_daemonize(void);
 /* Open a pipe for signal handling */
 void init_pipe(int reopen_log_pipe[2]);
 
+/* Event loop: xenstored_epoll.c or xenstored_select.c.  Connection sockets
+ * are edge triggered, once reported ready they are reported again only after
+ * a read or write returned EAGAIN and poll_rearm() was called for it. */
+typedef void poll_fn_t(void *data, bool in, bool out);
+void poll_init(void);
+bool poll_add(int fd, void *data, bool edge);
+void poll_del(int fd);
+void poll_rearm(int fd, bool in, bool out);
+/* Wait up to timeout ms (-1 forever), calls fn for each ready descriptor. */
+void poll_wait(int timeout, poll_fn_t *fn);
+
 xc_gnttab **xcg_handle;
 
 #endif /* _XENSTORED_CORE_H */
@@ -19,9 +19,15 @@
 
 #include <stdio.h>
 #include <sys/mman.h>
+#ifndef NO_SOCKETS
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#endif
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <fcntl.h>
 #include <xenctrl.h>
 
 #include "utils.h"
@@ -64,6 +70,9 @@ struct domain
 	/* Shared page. */
 	struct xenstore_domain_interface *interface;
 
+	/* Socket of a ring stand-in playing this domain, or -1. */
+	int standin;
+
 	/* The connection associated with this. */
 	struct connection *conn;
 
@@ -79,6 +88,10 @@ struct domain
 
 static LIST_HEAD(domains);
 
+/* Domains by local event channel port, for handle_event. */
+static struct domain **port_domains;
+static unsigned int nr_port_domains;
+
 static bool check_indexes(XENSTORE_RING_IDX cons, XENSTORE_RING_IDX prod)
 {
 	return ((prod - cons) <= XENSTORE_RING_SIZE);
@@ -104,13 +117,31 @@ static const void *get_input_chunk(XENSTORE_RING_IDX cons,
 	return buf + MASK_XENSTORE_IDX(cons);
 }
 
+static void notify_domain(struct domain *domain)
+{
+	char c = 0;
+
+	if (domain->standin == -1) {
+		xc_evtchn_notify(xce_handle, domain->port);
+		return;
+	}
+
+	/* If the socket is full, a notification is pending anyway. */
+	while (write(domain->standin, &c, 1) < 0 && errno == EINTR)
+		continue;
+}
+
+/* Copies as much as fits in the ring, with one notification. */
 static int writechn(struct connection *conn,
-		    const void *data, unsigned int len)
+		    const struct iovec *iov, int iovcnt)
 {
 	uint32_t avail;
 	void *dest;
 	struct xenstore_domain_interface *intf = conn->domain->interface;
 	XENSTORE_RING_IDX cons, prod;
+	const char *data;
+	unsigned int len;
+	int i, total = 0;
 
 	/* Must read indexes once, and before anything else, and verified. */
 	cons = intf->rsp_cons;
@@ -122,17 +153,33 @@ static int writechn(struct connection *conn,
 		return -1;
 	}
 
-	dest = get_output_chunk(cons, prod, intf->rsp, &avail);
-	if (avail < len)
-		len = avail;
+	for (i = 0; i < iovcnt; i++) {
+		data = iov[i].iov_base;
+		len = iov[i].iov_len;
+		while (len) {
+			dest = get_output_chunk(cons, prod, intf->rsp, &avail);
+			if (avail == 0)
+				goto full;
+			if (avail > len)
+				avail = len;
+			memcpy(dest, data, avail);
+			prod += avail;
+			data += avail;
+			len -= avail;
+			total += avail;
+		}
+	}
+
+ full:
+	if (total == 0)
+		return 0;
 
-	memcpy(dest, data, len);
 	xen_mb();
-	intf->rsp_prod += len;
+	intf->rsp_prod = prod;
 
-	xc_evtchn_notify(xce_handle, conn->domain->port);
+	notify_domain(conn->domain);
 
-	return len;
+	return total;
 }
 
 static int readchn(struct connection *conn, void *data, unsigned int len)
@@ -160,7 +207,7 @@ static int readchn(struct connection *conn, void *data, unsigned int len)
 	xen_mb();
 	intf->req_cons += len;
 
-	xc_evtchn_notify(xce_handle, conn->domain->port);
+	notify_domain(conn->domain);
 
 	return len;
 }
@@ -185,6 +232,33 @@ static void unmap_interface(void *interface)
 		munmap(interface, getpagesize());
 }
 
+static void set_domain_port(struct domain *domain, evtchn_port_t port)
+{
+	struct domain **ports;
+	unsigned int nr;
+
+	if (domain->port && domain->port < nr_port_domains)
+		port_domains[domain->port] = NULL;
+
+	domain->port = port;
+	if (!port)
+		return;
+
+	if (port >= nr_port_domains) {
+		nr = port < 64 ? 64 : 2 * port;
+		ports = talloc_realloc(talloc_autofree_context(), port_domains,
+				       struct domain *, nr);
+		if (!ports)
+			barf_perror("Failed to index event channel port %u",
+				    port);
+		memset(ports + nr_port_domains, 0,
+		       (nr - nr_port_domains) * sizeof(*ports));
+		port_domains = ports;
+		nr_port_domains = nr;
+	}
+	port_domains[port] = domain;
+}
+
 static int destroy_domain(void *_domain)
 {
 	struct domain *domain = _domain;
@@ -194,6 +268,7 @@ static int destroy_domain(void *_domain)
 	if (domain->port) {
 		if (xc_evtchn_unbind(xce_handle, domain->port) == -1)
 			eprintf("> Unbinding port %i failed!\n", domain->port);
+		set_domain_port(domain, 0);
 	}
 
 	if (domain->interface) {
@@ -201,10 +276,17 @@ static int destroy_domain(void *_domain)
 		   using munmap() and not the grant unmap call. */
 		if (domain->domid == 0)
 			unmap_xenbus(domain->interface);
+		else if (domain->standin != -1)
+			munmap(domain->interface, getpagesize());
 		else
 			unmap_interface(domain->interface);
 	}
 
+	if (domain->standin != -1) {
+		poll_del(domain->standin);
+		close(domain->standin);
+	}
+
 	fire_watches(NULL, "@releaseDomain", false);
 
 	return 0;
@@ -217,6 +299,9 @@ static void domain_cleanup(void)
 	int notify = 0;
 
 	list_for_each_entry_safe(domain, tmp, &domains, list) {
+		/* Not known to the hypervisor. */
+		if (domain->standin != -1)
+			continue;
 		if (xc_domain_getinfo(*xc_handle, domain->domid, 1,
 				      &dominfo) == 1 &&
 		    dominfo.domid == domain->domid) {
@@ -236,7 +321,6 @@ static void domain_cleanup(void)
 		fire_watches(NULL, "@releaseDomain", false);
 }
 
-/* We scan all domains rather than use the information given here. */
 void handle_event(void)
 {
 	evtchn_port_t port;
@@ -246,6 +330,8 @@ void handle_event(void)
 
 	if (port == virq_port)
 		domain_cleanup();
+	else if (port < nr_port_domains && port_domains[port])
+		conn_wakeup(port_domains[port]->conn);
 
 	if (xc_evtchn_unmask(xce_handle, port) == -1)
 		barf_perror("Failed to write to event fd");
@@ -281,6 +367,8 @@ static struct domain *new_domain(void *context, unsigned int domid,
 
 	domain = talloc(context, struct domain);
 	domain->port = 0;
+	domain->interface = NULL;
+	domain->standin = -1;
 	domain->shutdown = 0;
 	domain->domid = domid;
 	domain->path = talloc_domain_path(domain, domid);
@@ -288,11 +376,14 @@ static struct domain *new_domain(void *context, unsigned int domid,
 	list_add(&domain->list, &domains);
 	talloc_set_destructor(domain, destroy_domain);
 
-	/* Tell kernel we're interested in this event. */
-	rc = xc_evtchn_bind_interdomain(xce_handle, domid, port);
-	if (rc == -1)
-	    return NULL;
-	domain->port = rc;
+	/* Tell kernel we're interested in this event: ring stand-ins have
+	   none. */
+	if (port) {
+		rc = xc_evtchn_bind_interdomain(xce_handle, domid, port);
+		if (rc == -1)
+			return NULL;
+		set_domain_port(domain, rc);
+	}
 
 	domain->conn = new_connection(writechn, readchn);
 	domain->conn->domain = domain;
@@ -391,12 +482,14 @@ void do_introduce(struct connection *conn, struct buffered_data *in)
 		talloc_steal(domain->conn, domain);
 
 		fire_watches(NULL, "@introduceDomain", false);
-	} else if ((domain->mfn == mfn) && (domain->conn != conn)) {
+	} else if ((domain->mfn == mfn) && (domain->conn != conn) &&
+		   (domain->standin == -1)) {
 		/* Use XS_INTRODUCE for recreating the xenbus event-channel. */
 		if (domain->port)
 			xc_evtchn_unbind(xce_handle, domain->port);
+		set_domain_port(domain, 0);
 		rc = xc_evtchn_bind_interdomain(xce_handle, domid, port);
-		domain->port = (rc == -1) ? 0 : rc;
+		set_domain_port(domain, (rc == -1) ? 0 : rc);
 		domain->remote_port = port;
 	} else {
 		send_error(conn, EINVAL);
@@ -404,6 +497,7 @@ void do_introduce(struct connection *conn, struct buffered_data *in)
 	}
 
 	domain_conn_reset(domain);
+	conn_wakeup(domain->conn);
 
 	send_ack(conn, XS_INTRODUCE);
 }
@@ -617,6 +711,7 @@ static int dom0_init(void)
 	talloc_steal(dom0->conn, dom0); 
 
 	xc_evtchn_notify(xce_handle, dom0->port); 
+	conn_wakeup(dom0->conn);
 
 	return 0; 
 }
@@ -658,6 +753,218 @@ void domain_init(void)
 	virq_port = rc;
 }
 
+#ifdef NO_SOCKETS
+int standin_init(void)
+{
+	barf("Ring stand-ins need sockets");
+}
+
+void accept_standin(int sock)
+{
+}
+
+bool handle_standin_handshake(void *data)
+{
+	return false;
+}
+
+void handle_standin_event(struct connection *conn)
+{
+}
+#else
+/*
+ * Ring stand-in, to test and benchmark the ring without a hypervisor.  A
+ * local process connects to xs_daemon_socket_ring() and plays a domain: it
+ * sends its domid with the descriptor of the page holding the rings.  The
+ * socket stands in for the event channel, a byte per notification, and
+ * closing it for the domain going away.  Once set up, xenstored notifies.
+ */
+int standin_init(void)
+{
+	struct sockaddr_un addr;
+	int sock;
+
+	sock = socket(PF_UNIX, SOCK_STREAM, 0);
+	if (sock < 0)
+		barf_perror("Could not create socket");
+
+	unlink(xs_daemon_socket_ring());
+
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, xs_daemon_socket_ring());
+	if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+		barf_perror("Could not bind socket to %s",
+			    xs_daemon_socket_ring());
+	if (chmod(xs_daemon_socket_ring(), 0600) != 0)
+		barf_perror("Could not chmod sockets");
+	if (listen(sock, 1) != 0)
+		barf_perror("Could not listen on sockets");
+
+	return sock;
+}
+
+/*
+ * Stand-ins which connected but have not sent their domid and page yet.
+ * The handshake is completed from the event loop, so a slow or silent
+ * client does not hold up the other connections.
+ */
+struct standin_handshake
+{
+	struct list_head list;
+	int fd;
+};
+
+static LIST_HEAD(standin_handshakes);
+static unsigned int nr_standin_handshakes;
+
+#define STANDIN_HANDSHAKES_MAX 16
+
+static int destroy_standin_handshake(void *_hs)
+{
+	struct standin_handshake *hs = _hs;
+
+	if (hs->fd != -1) {
+		poll_del(hs->fd);
+		close(hs->fd);
+	}
+	list_del(&hs->list);
+	nr_standin_handshakes--;
+	return 0;
+}
+
+void accept_standin(int sock)
+{
+	struct standin_handshake *hs;
+	int fd;
+
+	fd = accept(sock, NULL, NULL);
+	if (fd < 0)
+		return;
+
+	/* Refuse rather than grow without bound. */
+	if (nr_standin_handshakes >= STANDIN_HANDSHAKES_MAX ||
+	    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0) {
+		close(fd);
+		return;
+	}
+
+	hs = talloc(NULL, struct standin_handshake);
+	if (!hs) {
+		close(fd);
+		return;
+	}
+	hs->fd = fd;
+	list_add_tail(&hs->list, &standin_handshakes);
+	nr_standin_handshakes++;
+	talloc_set_destructor(hs, destroy_standin_handshake);
+
+	if (!poll_add(fd, hs, false))
+		talloc_free(hs);
+}
+
+/* The stand-in sends its domid with the page once it is connected. */
+static void finish_standin(struct standin_handshake *hs)
+{
+	char control[CMSG_SPACE(sizeof(int))];
+	struct xenstore_domain_interface *interface;
+	struct domain *domain;
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	struct iovec iov;
+	uint32_t domid;
+	ssize_t len;
+	int fd = hs->fd, page = -1;
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = &domid;
+	iov.iov_len = sizeof(domid);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	len = recvmsg(fd, &msg, 0);
+	if (len < 0 && (errno == EAGAIN || errno == EINTR))
+		return;
+
+	/* From here on the descriptor belongs to the domain, or is closed. */
+	poll_del(fd);
+	hs->fd = -1;
+	talloc_free(hs);
+
+	if (len != sizeof(domid))
+		goto fail;
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if (!cmsg || cmsg->cmsg_level != SOL_SOCKET ||
+	    cmsg->cmsg_type != SCM_RIGHTS)
+		goto fail;
+	memcpy(&page, CMSG_DATA(cmsg), sizeof(page));
+
+	/* Never stand in for dom0 or the privileged domain. */
+	if (domid == 0 || domid == priv_domid ||
+	    domid >= DOMID_FIRST_RESERVED || find_domain_by_domid(domid))
+		goto fail;
+
+	interface = mmap(NULL, getpagesize(), PROT_READ|PROT_WRITE,
+			 MAP_SHARED, page, 0);
+	if (interface == MAP_FAILED)
+		goto fail;
+	close(page);
+
+	domain = new_domain(NULL, domid, 0);
+	domain->interface = interface;
+	domain->standin = fd;
+	talloc_steal(domain->conn, domain);
+
+	if (!poll_add(fd, domain->conn, false)) {
+		talloc_free(domain->conn);
+		return;
+	}
+
+	fire_watches(NULL, "@introduceDomain", false);
+
+	domain_conn_reset(domain);
+	notify_domain(domain);
+	conn_wakeup(domain->conn);
+	return;
+
+ fail:
+	if (page != -1)
+		close(page);
+	close(fd);
+}
+
+bool handle_standin_handshake(void *data)
+{
+	struct standin_handshake *hs;
+
+	list_for_each_entry(hs, &standin_handshakes, list) {
+		if (hs == data) {
+			finish_standin(hs);
+			return true;
+		}
+	}
+	return false;
+}
+
+/* The stand-in notified, or went away. */
+void handle_standin_event(struct connection *conn)
+{
+	char buf[64];
+	ssize_t len;
+
+	while ((len = read(conn->domain->standin, buf, sizeof(buf))) > 0)
+		continue;
+
+	if (len == 0 || (errno != EAGAIN && errno != EINTR)) {
+		talloc_free(conn);
+		return;
+	}
+
+	conn_wakeup(conn);
+}
+#endif
+
 void domain_entry_inc(struct connection *conn, struct node *node)
 {
 	struct domain *d;
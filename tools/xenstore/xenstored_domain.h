@@ -45,6 +45,13 @@ void do_reset_watches(struct connection *conn);
 
 void domain_init(void);
 
+/* Ring stand-ins: returns the socket to listen to. */
+int standin_init(void);
+void accept_standin(int sock);
+/* Completes the handshake of a stand-in, false if data is not one. */
+bool handle_standin_handshake(void *data);
+void handle_standin_event(struct connection *conn);
+
 /* Returns the implicit path of a connection (only domains have this) */
 const char *get_implicit_path(const struct connection *conn);
 
@@ -0,0 +1,94 @@
+/* 
+    Event loop backend of the Xen Store Daemon on epoll.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <sys/epoll.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "utils.h"
+#include "xenstored_core.h"
+
+/* Events taken per epoll_wait. */
+#define POLL_EVENTS 64
+
+static int epoll_fd = -1;
+
+void poll_init(void)
+{
+	epoll_fd = epoll_create(POLL_EVENTS);
+	if (epoll_fd < 0)
+		barf_perror("Could not create epoll instance");
+	fcntl(epoll_fd, F_SETFD, FD_CLOEXEC);
+}
+
+bool poll_add(int fd, void *data, bool edge)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	if (edge)
+		ev.events |= EPOLLOUT | EPOLLET;
+	ev.data.ptr = data;
+
+	return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0;
+}
+
+void poll_del(int fd)
+{
+	struct epoll_event ev;
+
+	/* Pre 2.6.9 kernels want an event even though it is ignored. */
+	memset(&ev, 0, sizeof(ev));
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, &ev);
+}
+
+void poll_rearm(int fd, bool in, bool out)
+{
+	/* Edge triggered: the next edge is reported without asking. */
+}
+
+void poll_wait(int timeout, poll_fn_t *fn)
+{
+	struct epoll_event events[POLL_EVENTS];
+	int i, n;
+
+	n = epoll_wait(epoll_fd, events, POLL_EVENTS, timeout);
+	if (n < 0) {
+		if (errno == EINTR)
+			return;
+		barf_perror("epoll_wait failed");
+	}
+
+	for (i = 0; i < n; i++)
+		fn(events[i].data.ptr,
+		   events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR),
+		   events[i].events & EPOLLOUT);
+}
+
+/*
+ * Local variables:
+ *  c-file-style: "linux"
+ *  indent-tabs-mode: t
+ *  c-indent-level: 8
+ *  c-basic-offset: 8
+ *  tab-width: 8
+ * End:
+ */
@@ -0,0 +1,132 @@
+/* 
+    Event loop backend of the Xen Store Daemon on select, for the platforms
+    without epoll.  Edge triggered descriptors are watched one shot, until
+    poll_rearm() asks for them again.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <sys/types.h>
+#include <sys/select.h>
+#include <sys/time.h>
+#include <errno.h>
+#include <string.h>
+
+#include "utils.h"
+#include "xenstored_core.h"
+
+static struct poll_fd {
+	void *data;
+	bool edge;
+
+	/* Directions to watch. */
+	bool in, out;
+} poll_fds[FD_SETSIZE];
+
+static int max_fd = -1;
+
+void poll_init(void)
+{
+	memset(poll_fds, 0, sizeof(poll_fds));
+}
+
+bool poll_add(int fd, void *data, bool edge)
+{
+	if (fd < 0 || fd >= FD_SETSIZE) {
+		errno = EMFILE;
+		return false;
+	}
+
+	poll_fds[fd].data = data;
+	poll_fds[fd].edge = edge;
+	poll_fds[fd].in = true;
+	poll_fds[fd].out = edge;
+	if (fd > max_fd)
+		max_fd = fd;
+	return true;
+}
+
+void poll_del(int fd)
+{
+	if (fd < 0 || fd >= FD_SETSIZE)
+		return;
+
+	memset(&poll_fds[fd], 0, sizeof(poll_fds[fd]));
+	while (max_fd >= 0 && !poll_fds[max_fd].data)
+		max_fd--;
+}
+
+void poll_rearm(int fd, bool in, bool out)
+{
+	if (fd < 0 || fd >= FD_SETSIZE)
+		return;
+
+	poll_fds[fd].in |= in;
+	poll_fds[fd].out |= out;
+}
+
+void poll_wait(int timeout, poll_fn_t *fn)
+{
+	fd_set inset, outset;
+	struct timeval tv, *ptv = NULL;
+	bool in, out;
+	int fd, max;
+
+	FD_ZERO(&inset);
+	FD_ZERO(&outset);
+	for (fd = 0; fd <= max_fd; fd++) {
+		if (!poll_fds[fd].data)
+			continue;
+		if (poll_fds[fd].in)
+			FD_SET(fd, &inset);
+		if (poll_fds[fd].out)
+			FD_SET(fd, &outset);
+	}
+
+	if (timeout >= 0) {
+		tv.tv_sec = timeout / 1000;
+		tv.tv_usec = (timeout % 1000) * 1000;
+		ptv = &tv;
+	}
+
+	if (select(max_fd + 1, &inset, &outset, NULL, ptv) < 0) {
+		if (errno == EINTR)
+			return;
+		barf_perror("Select failed");
+	}
+
+	/* Callbacks may add descriptors: only look at the ones selected. */
+	for (fd = 0, max = max_fd; fd <= max; fd++) {
+		in = FD_ISSET(fd, &inset);
+		out = FD_ISSET(fd, &outset);
+		if (!poll_fds[fd].data || (!in && !out))
+			continue;
+		if (poll_fds[fd].edge) {
+			poll_fds[fd].in &= !in;
+			poll_fds[fd].out &= !out;
+		}
+		fn(poll_fds[fd].data, in, out);
+	}
+}
+
+/*
+ * Local variables:
+ *  c-file-style: "linux"
+ *  indent-tabs-mode: t
+ *  c-indent-level: 8
+ *  c-basic-offset: 8
+ *  tab-width: 8
+ * End:
+ */
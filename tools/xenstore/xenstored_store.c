@@ -0,0 +1,599 @@
+/*
+    Node store of the Xen Store Daemon.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/*
+ * Records live in memory, in a hash table of records allocated from size
+ * class pools.  Reads never touch the file system.
+ *
+ * Changes are appended to a log, buffered until the main loop is about to
+ * sleep.  The log starts with a snapshot of the store, written when the
+ * store is opened and whenever stale records outweigh live ones:
+ *
+ *   "xenstored log 1\n"
+ *   struct log_record, name, data      (store)
+ *   struct log_record, name            (delete)
+ *   ...
+ *
+ * A record that is cut short or fails its checksum ends the log, as after
+ * a crash in the middle of a write.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "talloc.h"
+#include "utils.h"
+#include "xenstored_store.h"
+
+#define LOG_MAGIC "xenstored log 1\n"
+#define LOG_MAGIC_LEN (sizeof(LOG_MAGIC) - 1)
+
+#define LOG_STORE  1
+#define LOG_DELETE 2
+
+struct log_record {
+	uint32_t op;
+	uint32_t namelen;
+	uint32_t dsize;
+	uint32_t csum;
+};
+
+/* Don't compact logs smaller than this. */
+#define LOG_COMPACT_MIN (1024 * 1024)
+/* Seconds between attempts to rewrite a log that failed. */
+#define LOG_RETRY 10
+
+/* Size classes from 64 bytes to 4K, larger records are malloc'ed. */
+#define POOL_MIN_SHIFT 6
+#define POOL_CLASSES 7
+#define POOL_SLAB (64 * 1024)
+
+struct record {
+	/* Next record in the hash bucket. */
+	struct record *next;
+	unsigned int hash;
+
+	/* Size class it was allocated from. */
+	unsigned int class;
+
+	unsigned int namelen;
+	unsigned int dsize;
+
+	/* Name, nul, data. */
+	char buf[];
+};
+
+static void *pool_free[POOL_CLASSES];
+
+static struct record **buckets;
+static unsigned int nr_buckets, nr_records;
+
+/* The log, with changes not written yet. */
+static char *log_path;
+static int log_fd = -1;
+static char *log_buf;
+static size_t log_used, log_size;
+
+/* Bytes in the log file, and how many a snapshot would take. */
+static uint64_t log_bytes, live_bytes;
+
+/* Writing the log failed: rewrite it whole. */
+static bool log_failed;
+static time_t log_failed_time;
+
+static void *pool_alloc(size_t size, unsigned int *class)
+{
+	size_t csize = 1 << POOL_MIN_SHIFT;
+	unsigned int c;
+	char *slab, *p;
+	size_t off;
+
+	for (c = 0; c < POOL_CLASSES && csize < size; c++)
+		csize <<= 1;
+	*class = c;
+	if (c == POOL_CLASSES)
+		return malloc(size);
+
+	if (!pool_free[c]) {
+		slab = malloc(POOL_SLAB);
+		if (!slab)
+			return NULL;
+		for (off = 0; off + csize <= POOL_SLAB; off += csize) {
+			*(void **)(slab + off) = pool_free[c];
+			pool_free[c] = slab + off;
+		}
+	}
+
+	p = pool_free[c];
+	pool_free[c] = *(void **)p;
+	return p;
+}
+
+static void pool_release(void *p, unsigned int class)
+{
+	if (class == POOL_CLASSES) {
+		free(p);
+		return;
+	}
+	*(void **)p = pool_free[class];
+	pool_free[class] = p;
+}
+
+static unsigned int hash_name(const char *name, unsigned int len)
+{
+	unsigned int hash = 5381;
+	unsigned int i;
+
+	for (i = 0; i < len; i++)
+		hash = ((hash << 5) + hash) + (unsigned int)name[i];
+
+	return hash;
+}
+
+/* FNV-1a */
+static uint32_t checksum(uint32_t csum, const void *data, size_t len)
+{
+	const unsigned char *p = data;
+
+	while (len--)
+		csum = (csum ^ *p++) * 16777619;
+	return csum;
+}
+
+static uint32_t record_checksum(const struct log_record *rec,
+				const char *name, const void *data)
+{
+	uint32_t csum = 2166136261U;
+
+	csum = checksum(csum, rec, offsetof(struct log_record, csum));
+	csum = checksum(csum, name, rec->namelen);
+	return checksum(csum, data, rec->dsize);
+}
+
+static uint64_t record_bytes(const struct record *rec)
+{
+	return sizeof(struct log_record) + rec->namelen + rec->dsize;
+}
+
+static struct record **find_record(const char *name, unsigned int namelen,
+				   unsigned int hash)
+{
+	struct record **pp;
+
+	if (!nr_buckets)
+		return NULL;
+
+	for (pp = &buckets[hash & (nr_buckets - 1)]; *pp; pp = &(*pp)->next)
+		if ((*pp)->hash == hash && (*pp)->namelen == namelen &&
+		    memcmp((*pp)->buf, name, namelen) == 0)
+			return pp;
+	return NULL;
+}
+
+static bool grow_buckets(void)
+{
+	unsigned int nr = nr_buckets ? nr_buckets * 2 : 1024;
+	struct record **new, *rec, *next;
+	unsigned int i;
+
+	new = calloc(nr, sizeof(*new));
+	if (!new)
+		return false;
+
+	for (i = 0; i < nr_buckets; i++) {
+		for (rec = buckets[i]; rec; rec = next) {
+			next = rec->next;
+			rec->next = new[rec->hash & (nr - 1)];
+			new[rec->hash & (nr - 1)] = rec;
+		}
+	}
+
+	free(buckets);
+	buckets = new;
+	nr_buckets = nr;
+	return true;
+}
+
+static bool insert_record(const char *name, unsigned int namelen,
+			  const void *data, unsigned int dsize)
+{
+	unsigned int hash = hash_name(name, namelen);
+	struct record **pp, *rec;
+	unsigned int class;
+
+	if (nr_records >= nr_buckets && !grow_buckets() && !nr_buckets)
+		goto nomem;
+
+	rec = pool_alloc(sizeof(*rec) + namelen + 1 + dsize, &class);
+	if (!rec)
+		goto nomem;
+	rec->hash = hash;
+	rec->class = class;
+	rec->namelen = namelen;
+	rec->dsize = dsize;
+	memcpy(rec->buf, name, namelen);
+	rec->buf[namelen] = '\0';
+	if (dsize)
+		memcpy(rec->buf + namelen + 1, data, dsize);
+
+	/* Replace in place, or add to the bucket. */
+	pp = find_record(name, namelen, hash);
+	if (pp) {
+		rec->next = (*pp)->next;
+		live_bytes -= record_bytes(*pp);
+		pool_release(*pp, (*pp)->class);
+		*pp = rec;
+	} else {
+		rec->next = buckets[hash & (nr_buckets - 1)];
+		buckets[hash & (nr_buckets - 1)] = rec;
+		nr_records++;
+	}
+	live_bytes += record_bytes(rec);
+	return true;
+
+ nomem:
+	errno = ENOMEM;
+	return false;
+}
+
+static bool remove_record(const char *name, unsigned int namelen)
+{
+	struct record **pp, *rec;
+
+	pp = find_record(name, namelen, hash_name(name, namelen));
+	if (!pp) {
+		errno = ENOENT;
+		return false;
+	}
+
+	rec = *pp;
+	*pp = rec->next;
+	live_bytes -= record_bytes(rec);
+	pool_release(rec, rec->class);
+	nr_records--;
+	return true;
+}
+
+static void log_change(uint32_t op, const char *name, const void *data,
+		       unsigned int dsize)
+{
+	struct log_record rec;
+	size_t len, size;
+	char *buf;
+
+	if (log_fd == -1 || log_failed)
+		return;
+
+	rec.op = op;
+	rec.namelen = strlen(name);
+	rec.dsize = dsize;
+	rec.csum = record_checksum(&rec, name, data);
+
+	len = sizeof(rec) + rec.namelen + dsize;
+	if (log_used + len > log_size) {
+		size = log_size ? log_size : 64 * 1024;
+		while (log_used + len > size)
+			size *= 2;
+		buf = realloc(log_buf, size);
+		if (!buf) {
+			/* The next flush rewrites the log from memory. */
+			log_failed = true;
+			return;
+		}
+		log_buf = buf;
+		log_size = size;
+	}
+
+	memcpy(log_buf + log_used, &rec, sizeof(rec));
+	memcpy(log_buf + log_used + sizeof(rec), name, rec.namelen);
+	if (dsize)
+		memcpy(log_buf + log_used + sizeof(rec) + rec.namelen,
+		       data, dsize);
+	log_used += len;
+}
+
+struct store_data store_fetch(const char *name)
+{
+	unsigned int namelen = strlen(name);
+	struct store_data data = { NULL, 0 };
+	struct record **pp;
+
+	pp = find_record(name, namelen, hash_name(name, namelen));
+	if (!pp) {
+		errno = ENOENT;
+		return data;
+	}
+
+	data.dptr = talloc_memdup(NULL, (*pp)->buf + namelen + 1,
+				  (*pp)->dsize);
+	if (!data.dptr) {
+		errno = ENOMEM;
+		return data;
+	}
+	data.dsize = (*pp)->dsize;
+	return data;
+}
+
+bool store_store(const char *name, struct store_data data)
+{
+	if (!insert_record(name, strlen(name), data.dptr, data.dsize))
+		return false;
+	log_change(LOG_STORE, name, data.dptr, data.dsize);
+	return true;
+}
+
+bool store_delete(const char *name)
+{
+	if (!remove_record(name, strlen(name)))
+		return false;
+	log_change(LOG_DELETE, name, NULL, 0);
+	return true;
+}
+
+void store_traverse(store_traverse_fn *fn, void *private)
+{
+	struct record *rec, *next;
+	struct store_data data;
+	unsigned int i;
+
+	for (i = 0; i < nr_buckets; i++) {
+		for (rec = buckets[i]; rec; rec = next) {
+			next = rec->next;
+			data.dptr = rec->buf + rec->namelen + 1;
+			data.dsize = rec->dsize;
+			fn(rec->buf, data, private);
+		}
+	}
+}
+
+static bool write_all(int fd, const void *data, size_t len)
+{
+	const char *p = data;
+	ssize_t ret;
+
+	while (len) {
+		ret = write(fd, p, len);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		p += ret;
+		len -= ret;
+	}
+	return true;
+}
+
+/* Replace the log with a snapshot of the store. */
+static bool compact_log(void)
+{
+	char *tmp, *buf = NULL;
+	size_t used = 0, size = 256 * 1024, len;
+	struct log_record hdr;
+	struct record *rec;
+	unsigned int i;
+	int fd;
+
+	tmp = talloc_asprintf(NULL, "%s.new", log_path);
+	if (!tmp)
+		return false;
+	fd = open(tmp, O_WRONLY|O_CREAT|O_TRUNC, 0640);
+	if (fd < 0)
+		goto fail;
+	buf = malloc(size);
+	if (!buf || !write_all(fd, LOG_MAGIC, LOG_MAGIC_LEN))
+		goto fail;
+
+	for (i = 0; i < nr_buckets; i++) {
+		for (rec = buckets[i]; rec; rec = rec->next) {
+			hdr.op = LOG_STORE;
+			hdr.namelen = rec->namelen;
+			hdr.dsize = rec->dsize;
+			hdr.csum = record_checksum(&hdr, rec->buf,
+						   rec->buf + rec->namelen + 1);
+			len = record_bytes(rec);
+			if (used + len > size) {
+				if (!write_all(fd, buf, used))
+					goto fail;
+				used = 0;
+			}
+			if (len > size) {
+				if (!write_all(fd, &hdr, sizeof(hdr)) ||
+				    !write_all(fd, rec->buf, rec->namelen) ||
+				    !write_all(fd, rec->buf + rec->namelen + 1,
+					       rec->dsize))
+					goto fail;
+				continue;
+			}
+			memcpy(buf + used, &hdr, sizeof(hdr));
+			memcpy(buf + used + sizeof(hdr), rec->buf,
+			       rec->namelen);
+			memcpy(buf + used + sizeof(hdr) + rec->namelen,
+			       rec->buf + rec->namelen + 1, rec->dsize);
+			used += len;
+		}
+	}
+	if (!write_all(fd, buf, used) || fsync(fd) != 0)
+		goto fail;
+	if (rename(tmp, log_path) != 0)
+		goto fail;
+
+	if (log_fd != -1)
+		close(log_fd);
+	log_fd = fd;
+	log_bytes = LOG_MAGIC_LEN + live_bytes;
+	log_used = 0;
+	log_failed = false;
+	free(buf);
+	talloc_free(tmp);
+	return true;
+
+ fail:
+	eprintf("Could not write store log %s: %s", tmp, strerror(errno));
+	if (fd >= 0) {
+		close(fd);
+		unlink(tmp);
+	}
+	free(buf);
+	talloc_free(tmp);
+	return false;
+}
+
+void store_flush(void)
+{
+	if (!log_path)
+		return;
+
+	if (log_failed) {
+		/* Don't retry a full disk on every request. */
+		if (time(NULL) - log_failed_time < LOG_RETRY)
+			return;
+		log_failed_time = time(NULL);
+		compact_log();
+		return;
+	}
+
+	if (!log_used)
+		return;
+
+	if (log_bytes + log_used > LOG_COMPACT_MIN &&
+	    log_bytes + log_used > 2 * (LOG_MAGIC_LEN + live_bytes)) {
+		if (compact_log())
+			return;
+	} else if (write_all(log_fd, log_buf, log_used)) {
+		log_bytes += log_used;
+		log_used = 0;
+		return;
+	} else
+		eprintf("Could not write store log %s: %s", log_path,
+			strerror(errno));
+
+	log_failed = true;
+	log_failed_time = time(NULL);
+	log_used = 0;
+}
+
+/* Replay the log into the store, stopping at the first bad record. */
+static bool replay_log(const char *path)
+{
+	struct log_record rec;
+	const char *name, *data;
+	char *buf, *p, *end;
+	struct stat st;
+	size_t len = 0;
+	ssize_t ret;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+	if (fstat(fd, &st) != 0 || st.st_size < LOG_MAGIC_LEN) {
+		close(fd);
+		return false;
+	}
+
+	buf = malloc(st.st_size);
+	if (!buf)
+		barf_perror("Could not load store log %s", path);
+	while (len < st.st_size) {
+		ret = read(fd, buf + len, st.st_size - len);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			break;
+		len += ret;
+	}
+	close(fd);
+
+	/* Not a log, an old tdb for instance: start afresh. */
+	if (len < LOG_MAGIC_LEN || memcmp(buf, LOG_MAGIC, LOG_MAGIC_LEN)) {
+		free(buf);
+		return false;
+	}
+
+	for (p = buf + LOG_MAGIC_LEN, end = buf + len; p < end; ) {
+		if (end - p < sizeof(rec))
+			break;
+		memcpy(&rec, p, sizeof(rec));
+		if (end - p - sizeof(rec) < (uint64_t)rec.namelen + rec.dsize)
+			break;
+		name = p + sizeof(rec);
+		data = name + rec.namelen;
+		if (rec.csum != record_checksum(&rec, name, data))
+			break;
+
+		if (rec.op == LOG_STORE) {
+			if (!insert_record(name, rec.namelen, data, rec.dsize))
+				barf_perror("Could not load store log %s",
+					    path);
+		} else if (rec.op == LOG_DELETE)
+			remove_record(name, rec.namelen);
+		else
+			break;
+		p = (char *)data + rec.dsize;
+	}
+
+	if (p != end)
+		eprintf("Store log %s ends with a bad record at %lu, "
+			"dropping %lu bytes", path, (unsigned long)(p - buf),
+			(unsigned long)(end - p));
+
+	free(buf);
+	return true;
+}
+
+bool store_load(const char *path)
+{
+	return replay_log(path);
+}
+
+bool store_open(const char *path)
+{
+	bool loaded;
+
+	if (!path)
+		return false;
+
+	loaded = replay_log(path);
+
+	/* Start from a snapshot: drops stale and torn records. */
+	log_path = strdup(path);
+	if (!log_path || !compact_log())
+		barf_perror("Could not create store log %s", path);
+
+	return loaded;
+}
+
+/*
+ * Local variables:
+ *  c-file-style: "linux"
+ *  indent-tabs-mode: t
+ *  c-indent-level: 8
+ *  c-basic-offset: 8
+ *  tab-width: 8
+ * End:
+ */
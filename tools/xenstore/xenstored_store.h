@@ -0,0 +1,54 @@
+/* 
+    Node store of the Xen Store Daemon.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef _XENSTORED_STORE_H
+#define _XENSTORED_STORE_H
+
+#include <stdbool.h>
+
+/* The record of a node, see read_node for its layout. */
+struct store_data {
+	void *dptr;
+	unsigned int dsize;
+};
+
+/* Load the store logged at path and keep logging changes to it.  Returns
+ * false if there was no store to load.  NULL keeps the store in memory. */
+bool store_open(const char *path);
+
+/* Load the store logged at path, without logging changes. */
+bool store_load(const char *path);
+
+/* Copy of a record, talloc'ed without a parent.  If it fails, dptr is NULL
+ * and errno is set. */
+struct store_data store_fetch(const char *name);
+
+/* If they fail, return false and set errno. */
+bool store_store(const char *name, struct store_data data);
+bool store_delete(const char *name);
+
+/* Calls fn for each record, which may delete the record it is given. */
+typedef void store_traverse_fn(const char *name, struct store_data data,
+			       void *private);
+void store_traverse(store_traverse_fn *fn, void *private);
+
+/* Write out the changes logged so far, compacting the log when it is mostly
+ * stale records.  The main loop calls this before it sleeps. */
+void store_flush(void);
+
+#endif /* _XENSTORED_STORE_H */
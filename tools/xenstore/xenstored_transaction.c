@@ -26,16 +26,42 @@
 #include <assert.h>
 #include <stdarg.h>
 #include <stdlib.h>
+#include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include "talloc.h"
 #include "list.h"
+#include "hashtable.h"
 #include "xenstored_transaction.h"
 #include "xenstored_watch.h"
 #include "xenstored_domain.h"
 #include "xenstore_lib.h"
 #include "utils.h"
 
+/*
+ * Transactions work on the committed store directly instead of on a copy of
+ * it.  Nodes written or deleted by a transaction are kept in its write set
+ * until commit, and every node it looked at is remembered.  The store
+ * remembers the generation at which each node last changed, so a commit
+ * fails with EAGAIN only if a node the transaction accessed has changed
+ * since the transaction started.
+ */
+
+struct accessed_node
+{
+	/* List of all accessed nodes in the context of this transaction. */
+	struct list_head list;
+
+	/* The name of the node. */
+	char *name;
+
+	/* Written or deleted by this transaction? */
+	bool modified;
+
+	/* New record of a modified node, dptr is NULL if deleted. */
+	struct store_data data;
+};
+
 struct changed_node
 {
 	/* List of all changed nodes in the context of this transaction. */
@@ -69,11 +95,11 @@ struct transaction
 	uint32_t id;
 
 	/* Generation when transaction started. */
-	unsigned int generation;
+	uint64_t generation;
 
-	/* TDB to work on, and filename */
-	TDB_CONTEXT *tdb;
-	char *tdb_name;
+	/* Nodes read or modified, and their index by name. */
+	struct list_head accessed;
+	struct hashtable *accessed_index;
 
 	/* List of changed nodes. */
 	struct list_head changes;
@@ -83,12 +109,222 @@ struct transaction
 };
 
 extern int quota_max_transaction;
-static unsigned int generation;
 
-/* Return tdb context to use for this connection. */
-TDB_CONTEXT *tdb_transaction_context(struct transaction *trans)
+/* Bumped by every change of the committed store. */
+static uint64_t generation;
+
+/*
+ * Generation of the last change of each node, only needed while there are
+ * transactions to check against: cleared when the last one is gone.
+ */
+static struct hashtable *node_generations;
+static unsigned int nr_transactions;
+
+static unsigned int hash_from_key_fn(void *k)
+{
+	char *str = k;
+	unsigned int hash = 5381;
+	char c;
+
+	while ((c = *str++))
+		hash = ((hash << 5) + hash) + (unsigned int)c;
+
+	return hash;
+}
+
+static int keys_equal_fn(void *key1, void *key2)
+{
+	return 0 == strcmp((char *)key1, (char *)key2);
+}
+
+/* The committed store changed this node. */
+static void node_changed(const char *name)
+{
+	uint64_t *gen;
+	char *key;
+
+	generation++;
+	if (!nr_transactions)
+		return;
+
+	if (!node_generations) {
+		node_generations = create_hashtable(16, hash_from_key_fn,
+						    keys_equal_fn);
+		if (!node_generations)
+			barf_perror("Could not allocate node generations");
+	}
+
+	gen = hashtable_search(node_generations, (void *)name);
+	if (gen) {
+		*gen = generation;
+		return;
+	}
+
+	key = strdup(name);
+	gen = malloc(sizeof(*gen));
+	if (!key || !gen || !hashtable_insert(node_generations, key, gen))
+		barf_perror("Could not record node generation");
+	*gen = generation;
+}
+
+static uint64_t node_generation(const char *name)
+{
+	uint64_t *gen = NULL;
+
+	if (node_generations)
+		gen = hashtable_search(node_generations, (void *)name);
+	return gen ? *gen : 0;
+}
+
+static struct accessed_node *find_accessed(struct transaction *trans,
+					   const char *name)
 {
-	return trans->tdb;
+	return hashtable_search(trans->accessed_index, (void *)name);
+}
+
+/* If it fails, returns NULL and sets errno. */
+static struct accessed_node *add_accessed(struct transaction *trans,
+					  const char *name)
+{
+	struct accessed_node *a;
+	char *key;
+
+	a = find_accessed(trans, name);
+	if (a)
+		return a;
+
+	a = talloc_zero(trans, struct accessed_node);
+	key = strdup(name);
+	if (!a || !key)
+		goto nomem;
+	a->name = talloc_strdup(a, name);
+	if (!a->name || !hashtable_insert(trans->accessed_index, key, a))
+		goto nomem;
+	list_add_tail(&a->list, &trans->accessed);
+	return a;
+ nomem:
+	free(key);
+	talloc_free(a);
+	errno = ENOMEM;
+	return NULL;
+}
+
+/* The record of a node as the transaction sees it, without a talloc parent.
+ * If it fails, dptr is NULL and errno is set. */
+struct store_data transaction_fetch(struct transaction *trans,
+				    const char *name)
+{
+	struct accessed_node *a = NULL;
+	struct store_data data;
+
+	if (trans) {
+		a = find_accessed(trans, name);
+		if (a && a->modified) {
+			if (!a->data.dptr) {
+				errno = ENOENT;
+				return a->data;
+			}
+			data.dsize = a->data.dsize;
+			data.dptr = talloc_memdup(NULL, a->data.dptr,
+						  data.dsize);
+			if (!data.dptr)
+				errno = ENOMEM;
+			return data;
+		}
+	}
+
+	data = store_fetch(name);
+	if (!data.dptr && errno != ENOENT)
+		return data;
+
+	/* Missing nodes are accessed too: creating them conflicts. */
+	if (trans && !a && !add_accessed(trans, name)) {
+		talloc_free(data.dptr);
+		data.dptr = NULL;
+	}
+	return data;
+}
+
+static bool store_modified(struct transaction *trans, const char *name,
+			   struct store_data data)
+{
+	struct accessed_node *a;
+
+	a = add_accessed(trans, name);
+	if (!a)
+		return false;
+
+	talloc_free(a->data.dptr);
+	a->data.dptr = NULL;
+	a->data.dsize = 0;
+	if (data.dptr) {
+		a->data.dptr = talloc_memdup(a, data.dptr, data.dsize);
+		if (!a->data.dptr) {
+			errno = ENOMEM;
+			return false;
+		}
+		a->data.dsize = data.dsize;
+	}
+	a->modified = true;
+	return true;
+}
+
+/* Store the record of a node, in the write set of the transaction if any. */
+bool transaction_store(struct transaction *trans, const char *name,
+		       struct store_data data)
+{
+	if (trans)
+		return store_modified(trans, name, data);
+
+	if (!store_store(name, data))
+		return false;
+	node_changed(name);
+	return true;
+}
+
+/* Delete the record of a node, in the write set of the transaction if any. */
+bool transaction_delete(struct transaction *trans, const char *name)
+{
+	struct store_data none = { NULL, 0 };
+
+	if (trans)
+		return store_modified(trans, name, none);
+
+	if (!store_delete(name) && errno != ENOENT)
+		return false;
+	node_changed(name);
+	return true;
+}
+
+/* Has anything the transaction accessed changed since it started? */
+static bool transaction_conflicts(struct transaction *trans)
+{
+	struct accessed_node *a;
+
+	if (trans->generation == generation)
+		return false;
+
+	list_for_each_entry(a, &trans->accessed, list)
+		if (node_generation(a->name) > trans->generation)
+			return true;
+	return false;
+}
+
+/* Apply the write set to the committed store. */
+static bool transaction_commit(struct transaction *trans)
+{
+	struct accessed_node *a;
+
+	list_for_each_entry(a, &trans->accessed, list) {
+		if (!a->modified)
+			continue;
+		if (a->data.dptr) {
+			if (!transaction_store(NULL, a->name, a->data))
+				return false;
+		} else if (!transaction_delete(NULL, a->name))
+			return false;
+	}
+	return true;
 }
 
 /* Callers get a change node (which can fail) and only commit after they've
@@ -97,11 +333,9 @@ void add_change_node(struct transaction *trans, const char *node, bool recurse)
 {
 	struct changed_node *i;
 
-	if (!trans) {
-		/* They're changing the global database. */
-		generation++;
+	/* Changes of the global database count when stored. */
+	if (!trans)
 		return;
-	}
 
 	list_for_each_entry(i, &trans->changes, list)
 		if (streq(i->node, node))
@@ -118,9 +352,11 @@ static int destroy_transaction(void *_transaction)
 	struct transaction *trans = _transaction;
 
 	trace_destroy(trans, "transaction");
-	if (trans->tdb)
-		tdb_close(trans->tdb);
-	unlink(trans->tdb_name);
+	hashtable_destroy(trans->accessed_index, 0);
+	if (--nr_transactions == 0 && node_generations) {
+		hashtable_destroy(node_generations, 1);
+		node_generations = NULL;
+	}
 	return 0;
 }
 
@@ -156,18 +392,16 @@ void do_transaction_start(struct connection *conn, struct buffered_data *in)
 
 	/* Attach transaction to input for autofree until it's complete */
 	trans = talloc(in, struct transaction);
+	INIT_LIST_HEAD(&trans->accessed);
 	INIT_LIST_HEAD(&trans->changes);
 	INIT_LIST_HEAD(&trans->changed_domains);
 	trans->generation = generation;
-	trans->tdb_name = talloc_asprintf(trans, "%s.%p",
-					  xs_daemon_tdb(), trans);
-	trans->tdb = tdb_copy(tdb_context(conn), trans->tdb_name);
-	if (!trans->tdb) {
-		send_error(conn, errno);
+	trans->accessed_index = create_hashtable(16, hash_from_key_fn,
+						 keys_equal_fn);
+	if (!trans->accessed_index) {
+		send_error(conn, ENOMEM);
 		return;
 	}
-	/* Make it close if we go away. */
-	talloc_steal(trans, trans->tdb);
 
 	/* Pick an unused transaction identifier. */
 	do {
@@ -180,6 +414,7 @@ void do_transaction_start(struct connection *conn, struct buffered_data *in)
 	talloc_steal(conn, trans);
 	talloc_set_destructor(trans, destroy_transaction);
 	conn->transaction_started++;
+	nr_transactions++;
 
 	snprintf(id_str, sizeof(id_str), "%u", trans->id);
 	send_reply(conn, XS_TRANSACTION_START, id_str, strlen(id_str)+1);
@@ -209,17 +444,14 @@ void do_transaction_end(struct connection *conn, const char *arg)
 	talloc_steal(arg, trans);
 
 	if (streq(arg, "T")) {
-		/* FIXME: Merge, rather failing on any change. */
-		if (trans->generation != generation) {
+		if (transaction_conflicts(trans)) {
 			send_error(conn, EAGAIN);
 			return;
 		}
-		if (!replace_tdb(trans->tdb_name, trans->tdb)) {
-			send_error(conn, errno);
+		if (!transaction_commit(trans)) {
+			send_error(conn, EIO);
 			return;
 		}
-		/* Don't close this: we won! */
-		trans->tdb = NULL;
 
 		/* fix domain entry for each changed domain */
 		list_for_each_entry(d, &trans->changed_domains, list)
@@ -228,7 +460,6 @@ void do_transaction_end(struct connection *conn, const char *arg)
 		/* Fire off the watches for everything that changed. */
 		list_for_each_entry(i, &trans->changes, list)
 			fire_watches(conn, i->node, i->recurse);
-		generation++;
 	}
 	send_ack(conn, XS_TRANSACTION_END);
 }
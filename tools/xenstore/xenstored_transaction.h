@@ -35,8 +35,13 @@ void transaction_entry_dec(struct transaction *trans, unsigned int domid);
 void add_change_node(struct transaction *trans, const char *node,
                      bool recurse);
 
-/* Return tdb context to use for this connection. */
-TDB_CONTEXT *tdb_transaction_context(struct transaction *trans);
+/* Node records as seen by trans, NULL for the committed store.  Fetched
+ * data has no talloc parent; on failure dptr is NULL and errno is set. */
+struct store_data transaction_fetch(struct transaction *trans,
+				    const char *name);
+bool transaction_store(struct transaction *trans, const char *name,
+		       struct store_data data);
+bool transaction_delete(struct transaction *trans, const char *name);
 
 void conn_delete_all_transactions(struct connection *conn);
 
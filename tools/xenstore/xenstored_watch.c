@@ -24,8 +24,10 @@
 #include <sys/time.h>
 #include <time.h>
 #include <assert.h>
+#include <string.h>
 #include "talloc.h"
 #include "list.h"
+#include "hashtable.h"
 #include "xenstored_watch.h"
 #include "xenstore_lib.h"
 #include "utils.h"
@@ -33,11 +35,27 @@
 
 extern int quota_nb_watch_per_domain;
 
+struct watch_path
+{
+	/* List of all watched paths. */
+	struct list_head list;
+
+	/* Watches on this path, from all connections. */
+	struct list_head watches;
+
+	char *node;
+};
+
 struct watch
 {
 	/* Watches on this connection */
 	struct list_head list;
 
+	/* Watches on the same path, and the connection owning this one. */
+	struct list_head path_list;
+	struct watch_path *path;
+	struct connection *conn;
+
 	/* Current outstanding events applying to this watch. */
 	struct list_head events;
 
@@ -48,6 +66,84 @@ struct watch
 	char *node;
 };
 
+/*
+ * Watched paths are indexed by name, so a change only looks up the node and
+ * each of its ancestors instead of testing every watch of every connection.
+ */
+static struct hashtable *watch_index;
+static LIST_HEAD(watch_paths);
+
+static unsigned int nr_watches;
+static unsigned long nr_fires, nr_evaluated;
+
+/* Test every watch of every connection instead, for comparison. */
+static bool watch_linear;
+
+static unsigned int hash_from_key_fn(void *k)
+{
+	char *str = k;
+	unsigned int hash = 5381;
+	char c;
+
+	while ((c = *str++))
+		hash = ((hash << 5) + hash) + (unsigned int)c;
+
+	return hash;
+}
+
+static int keys_equal_fn(void *key1, void *key2)
+{
+	return 0 == strcmp((char *)key1, (char *)key2);
+}
+
+static struct watch_path *find_watch_path(const char *node)
+{
+	if (!watch_index)
+		return NULL;
+	return hashtable_search(watch_index, (void *)node);
+}
+
+static struct watch_path *get_watch_path(const char *node)
+{
+	struct watch_path *path;
+	char *key;
+
+	path = find_watch_path(node);
+	if (path)
+		return path;
+
+	if (!watch_index) {
+		watch_index = create_hashtable(64, hash_from_key_fn,
+					       keys_equal_fn);
+		if (!watch_index)
+			return NULL;
+	}
+
+	path = talloc(NULL, struct watch_path);
+	key = strdup(node);
+	if (!path || !key)
+		goto nomem;
+	path->node = talloc_strdup(path, node);
+	if (!path->node || !hashtable_insert(watch_index, key, path))
+		goto nomem;
+	INIT_LIST_HEAD(&path->watches);
+	list_add_tail(&path->list, &watch_paths);
+	return path;
+ nomem:
+	free(key);
+	talloc_free(path);
+	return NULL;
+}
+
+static void put_watch_path(struct watch_path *path)
+{
+	if (!list_empty(&path->watches))
+		return;
+	hashtable_remove(watch_index, path->node);
+	list_del(&path->list);
+	talloc_free(path);
+}
+
 static void add_event(struct connection *conn,
 		      struct watch *watch,
 		      const char *name)
@@ -86,29 +182,105 @@ static void add_event(struct connection *conn,
 	talloc_free(data);
 }
 
-void fire_watches(struct connection *conn, const char *name, bool recurse)
+/* Event on every watch of the path, for a change of name. */
+static void fire_watch_path(const char *node, const char *name)
 {
-	struct connection *i;
+	struct watch_path *path = find_watch_path(node);
 	struct watch *watch;
 
+	if (!path)
+		return;
+
+	list_for_each_entry(watch, &path->watches, path_list) {
+		nr_evaluated++;
+		add_event(watch->conn, watch, name ? name : watch->node);
+	}
+}
+
+void fire_watches(struct connection *conn, const char *name, bool recurse)
+{
+	struct watch_path *path;
+	char *prefix;
+	unsigned int len;
+
 	/* During transactions, don't fire watches. */
 	if (conn && conn->transaction)
 		return;
 
-	/* Create an event for each watch. */
-	list_for_each_entry(i, &connections, list) {
-		list_for_each_entry(watch, &i->watches, list) {
-			if (is_child(name, watch->node))
-				add_event(i, watch, name);
-			else if (recurse && is_child(watch->node, name))
-				add_event(i, watch, watch->node);
+	nr_fires++;
+
+	if (watch_linear) {
+		struct connection *i;
+		struct watch *watch;
+
+		list_for_each_entry(i, &connections, list) {
+			list_for_each_entry(watch, &i->watches, list) {
+				nr_evaluated++;
+				if (is_child(name, watch->node))
+					add_event(i, watch, name);
+				else if (recurse && is_child(watch->node, name))
+					add_event(i, watch, watch->node);
+			}
 		}
+		return;
+	}
+
+	/* Watches on the node and its ancestors, as is_child() has it. */
+	fire_watch_path("/", name);
+	if (streq(name, "/"))
+		goto children;
+
+	prefix = talloc_strdup(NULL, name);
+	for (len = 1; prefix[len]; len++) {
+		if (prefix[len] != '/')
+			continue;
+		prefix[len] = '\0';
+		fire_watch_path(prefix, name);
+		prefix[len] = '/';
 	}
+	fire_watch_path(prefix, name);
+	talloc_free(prefix);
+
+ children:
+	/* Removed subtree: watches below it see their own node go. */
+	if (!recurse)
+		return;
+	list_for_each_entry(path, &watch_paths, list) {
+		nr_evaluated++;
+		if (!streq(path->node, name) && !streq(path->node, "/") &&
+		    is_child(path->node, name))
+			fire_watch_path(path->node, NULL);
+	}
+}
+
+char *watch_stats(const void *ctx)
+{
+	return talloc_asprintf(ctx, "watches %u paths %u fires %lu "
+			       "evaluated %lu scan %s", nr_watches,
+			       watch_index ? hashtable_count(watch_index) : 0,
+			       nr_fires, nr_evaluated,
+			       watch_linear ? "linear" : "index");
+}
+
+int set_watch_scan(const char *scan)
+{
+	if (streq(scan, "linear"))
+		watch_linear = true;
+	else if (streq(scan, "index"))
+		watch_linear = false;
+	else
+		return EINVAL;
+	return 0;
 }
 
 static int destroy_watch(void *_watch)
 {
-	trace_destroy(_watch, "watch");
+	struct watch *watch = _watch;
+
+	trace_destroy(watch, "watch");
+	list_del(&watch->path_list);
+	put_watch_path(watch->path);
+	nr_watches--;
 	return 0;
 }
 
@@ -161,6 +333,16 @@ void do_watch(struct connection *conn, struct buffered_data *in)
 	else
 		watch->relative_path = NULL;
 
+	watch->path = get_watch_path(watch->node);
+	if (!watch->path) {
+		talloc_free(watch);
+		send_error(conn, ENOMEM);
+		return;
+	}
+	watch->conn = conn;
+	list_add_tail(&watch->path_list, &watch->path->watches);
+	nr_watches++;
+
 	INIT_LIST_HEAD(&watch->events);
 
 	domain_watch_inc(conn);
@@ -30,6 +30,12 @@ void fire_watches(struct connection *conn, const char *name, bool recurse);
 
 void dump_watches(struct connection *conn);
 
+/* Number of watches and how many were evaluated by fire_watches. */
+char *watch_stats(const void *ctx);
+
+/* "index" (default) or "linear" scan of the watches, EINVAL otherwise. */
+int set_watch_scan(const char *scan);
+
 void conn_delete_all_watches(struct connection *conn);
 
 #endif /* _XENSTORED_WATCH_H */
@@ -69,19 +69,21 @@ struct xs_handle {
 	int watch_pipe[2];
 
 	/*
-         * A list of replies. Currently only one will ever be outstanding
-         * because we serialise requests. The requester can wait on the
-         * conditional variable for its response.
+         * A list of replies to requests in flight. Requesters wait on the
+         * conditional variable until theirs, matched by request id, is in.
          */
 	struct list_head reply_list;
 	pthread_mutex_t reply_mutex;
 	pthread_cond_t reply_condvar;
 
-	/* One request at a time. */
+	/* One request written at a time. */
 	pthread_mutex_t request_mutex;
 
+	/* Id of the last request sent. */
+	uint32_t req_id;
+
 	/* Lock discipline:
-	 *  Only holder of the request lock may write to h->fd.
+	 *  Only holder of the request lock may write to h->fd or req_id.
 	 *  Only holder of the request lock may access read_thr_exists.
 	 *  If read_thr_exists==0, only holder of request lock may read h->fd;
 	 *  If read_thr_exists==1, only the read thread may read h->fd.
@@ -98,6 +100,7 @@ struct xs_handle {
 #define mutex_lock(m)		pthread_mutex_lock(m)
 #define mutex_unlock(m)		pthread_mutex_unlock(m)
 #define condvar_signal(c)	pthread_cond_signal(c)
+#define condvar_broadcast(c)	pthread_cond_broadcast(c)
 #define condvar_wait(c,m)	pthread_cond_wait(c,m)
 #define cleanup_push(f, a)	\
     pthread_cleanup_push((void (*)(void *))(f), (void *)(a))
@@ -120,11 +123,13 @@ struct xs_handle {
 	struct list_head watch_list;
 	/* Clients can select() on this pipe to wait for a watch to fire. */
 	int watch_pipe[2];
+	uint32_t req_id;
 };
 
 #define mutex_lock(m)		((void)0)
 #define mutex_unlock(m)		((void)0)
 #define condvar_signal(c)	((void)0)
+#define condvar_broadcast(c)	((void)0)
 #define condvar_wait(c,m)	((void)0)
 #define cleanup_push(f, a)	((void)0)
 #define cleanup_pop(run)	((void)0)
@@ -397,34 +402,60 @@ static int get_error(const char *errorstring)
 	return xsd_errors[i].errnum;
 }
 
-/* Adds extra nul terminator, because we generally (always?) hold strings. */
-static void *read_reply(
-	struct xs_handle *h, enum xsd_sockmsg_type *type, unsigned int *len)
+static struct xs_stored_msg *find_reply(struct xs_handle *h, uint32_t req_id)
+{
+	struct xs_stored_msg *msg;
+
+	/* Replies come in order, so this is usually the first. */
+	list_for_each_entry(msg, &h->reply_list, list)
+		if (msg->hdr.req_id == req_id)
+			return msg;
+	return NULL;
+}
+
+/* Wait for the reply to a request.
+ * Adds extra nul terminator, because we generally (always?) hold strings. */
+static void *read_reply(struct xs_handle *h, uint32_t req_id,
+			enum xsd_sockmsg_type *type, unsigned int *len)
 {
 	struct xs_stored_msg *msg;
 	char *body;
 	int read_from_thread;
 
+	/* Without a reader thread, read the comms channel ourselves and keep
+	 * the request lock so the thread isn't started underneath us. */
+	mutex_lock(&h->request_mutex);
 	read_from_thread = read_thread_exists(h);
-
-	/* Read from comms channel ourselves if there is no reader thread. */
-	if (!read_from_thread && (read_message(h, 0) == -1))
-		return NULL;
+	if (read_from_thread)
+		mutex_unlock(&h->request_mutex);
 
 	mutex_lock(&h->reply_mutex);
+	while ((msg = find_reply(h, req_id)) == NULL) {
+		if (!read_from_thread) {
+			mutex_unlock(&h->reply_mutex);
+			if (read_message(h, 0) == -1) {
+				mutex_unlock(&h->request_mutex);
+				return NULL;
+			}
+			mutex_lock(&h->reply_mutex);
+			continue;
+		}
 #ifdef USE_PTHREAD
-	while (list_empty(&h->reply_list) && read_from_thread && h->fd != -1)
+		if (h->fd == -1)
+			break;
 		condvar_wait(&h->reply_condvar, &h->reply_mutex);
 #endif
-	if (list_empty(&h->reply_list)) {
-		mutex_unlock(&h->reply_mutex);
+	}
+	if (msg)
+		list_del(&msg->list);
+	mutex_unlock(&h->reply_mutex);
+	if (!read_from_thread)
+		mutex_unlock(&h->request_mutex);
+
+	if (!msg) {
 		errno = EINVAL;
 		return NULL;
 	}
-	msg = list_top(&h->reply_list, struct xs_stored_msg, list);
-	list_del(&msg->list);
-	assert(list_empty(&h->reply_list));
-	mutex_unlock(&h->reply_mutex);
 
 	*type = msg->hdr.type;
 	if (len)
@@ -436,21 +467,19 @@ static void *read_reply(
 	return body;
 }
 
-/* Send message to xs, get malloc'ed reply.  NULL and set errno on error. */
-static void *xs_talkv(struct xs_handle *h, xs_transaction_t t,
-		      enum xsd_sockmsg_type type,
-		      const struct iovec *iovec,
-		      unsigned int num_vecs,
-		      unsigned int *len)
+/* Send message to xs without waiting for the reply.
+ * Returns the request id, or 0 and set errno on error. */
+static uint32_t xs_submitv(struct xs_handle *h, xs_transaction_t t,
+			   enum xsd_sockmsg_type type,
+			   const struct iovec *iovec,
+			   unsigned int num_vecs)
 {
 	struct xsd_sockmsg msg;
-	void *ret = NULL;
 	int saved_errno;
 	unsigned int i;
 	struct sigaction ignorepipe, oldact;
 
 	msg.tx_id = t;
-	msg.req_id = 0;
 	msg.type = type;
 	msg.len = 0;
 	for (i = 0; i < num_vecs; i++)
@@ -468,6 +497,11 @@ static void *xs_talkv(struct xs_handle *h, xs_transaction_t t,
 
 	mutex_lock(&h->request_mutex);
 
+	/* 0 reports failure. */
+	if (++h->req_id == 0)
+		h->req_id++;
+	msg.req_id = h->req_id;
+
 	if (!xs_write_all(h->fd, &msg, sizeof(msg)))
 		goto fail;
 
@@ -475,39 +509,80 @@ static void *xs_talkv(struct xs_handle *h, xs_transaction_t t,
 		if (!xs_write_all(h->fd, iovec[i].iov_base, iovec[i].iov_len))
 			goto fail;
 
-	ret = read_reply(h, &msg.type, len);
-	if (!ret)
-		goto fail;
-
 	mutex_unlock(&h->request_mutex);
 
 	sigaction(SIGPIPE, &oldact, NULL);
-	if (msg.type == XS_ERROR) {
+	return msg.req_id;
+
+fail:
+	/* We're in a bad state, so close fd. */
+	saved_errno = errno;
+	mutex_unlock(&h->request_mutex);
+	sigaction(SIGPIPE, &oldact, NULL);
+	close(h->fd);
+	h->fd = -1;
+	errno = saved_errno;
+	return 0;
+}
+
+/* Get malloc'ed reply to a request of this type.
+ * NULL and set errno on error. */
+static void *xs_reply(struct xs_handle *h, uint32_t req_id,
+		      enum xsd_sockmsg_type type, unsigned int *len)
+{
+	enum xsd_sockmsg_type reply_type;
+	void *ret;
+	int saved_errno;
+
+	/* The request failed and closed the connection. */
+	if (!req_id) {
+		errno = EBADF;
+		return NULL;
+	}
+
+	ret = read_reply(h, req_id, &reply_type, len);
+	if (!ret) {
+		saved_errno = errno;
+		goto close_fd;
+	}
+
+	if (reply_type == XS_ERROR) {
 		saved_errno = get_error(ret);
 		free(ret);
 		errno = saved_errno;
 		return NULL;
 	}
 
-	if (msg.type != type) {
+	if (reply_type != type) {
 		free(ret);
 		saved_errno = EBADF;
 		goto close_fd;
 	}
 	return ret;
 
-fail:
-	/* We're in a bad state, so close fd. */
-	saved_errno = errno;
-	mutex_unlock(&h->request_mutex);
-	sigaction(SIGPIPE, &oldact, NULL);
 close_fd:
+	/* We're in a bad state, so close fd. */
 	close(h->fd);
 	h->fd = -1;
 	errno = saved_errno;
 	return NULL;
 }
 
+/* Send message to xs, get malloc'ed reply.  NULL and set errno on error. */
+static void *xs_talkv(struct xs_handle *h, xs_transaction_t t,
+		      enum xsd_sockmsg_type type,
+		      const struct iovec *iovec,
+		      unsigned int num_vecs,
+		      unsigned int *len)
+{
+	uint32_t req_id;
+
+	req_id = xs_submitv(h, t, type, iovec, num_vecs);
+	if (!req_id)
+		return NULL;
+	return xs_reply(h, req_id, type, len);
+}
+
 /* free(), but don't change errno. */
 static void free_no_errno(void *p)
 {
@@ -537,13 +612,24 @@ static bool xs_bool(char *reply)
 	return true;
 }
 
-char **xs_directory(struct xs_handle *h, xs_transaction_t t,
-		    const char *path, unsigned int *num)
+/* Simplified version of xs_submitv: single message. */
+static uint32_t xs_submit_single(struct xs_handle *h, xs_transaction_t t,
+				 enum xsd_sockmsg_type type,
+				 const char *string)
 {
-	char *strings, *p, **ret;
-	unsigned int len;
+	struct iovec iovec;
+
+	iovec.iov_base = (void *)string;
+	iovec.iov_len = strlen(string) + 1;
+	return xs_submitv(h, t, type, &iovec, 1);
+}
+
+/* Turn the reply to XS_DIRECTORY into an array of names. */
+static char **directory_reply(char *strings, unsigned int len,
+			      unsigned int *num)
+{
+	char *p, **ret;
 
-	strings = xs_single(h, t, XS_DIRECTORY, path, &len);
 	if (!strings)
 		return NULL;
 
@@ -565,6 +651,16 @@ char **xs_directory(struct xs_handle *h, xs_transaction_t t,
 	return ret;
 }
 
+char **xs_directory(struct xs_handle *h, xs_transaction_t t,
+		    const char *path, unsigned int *num)
+{
+	char *strings;
+	unsigned int len;
+
+	strings = xs_single(h, t, XS_DIRECTORY, path, &len);
+	return directory_reply(strings, len, num);
+}
+
 /* Get the value of a single file, nul terminated.
  * Returns a malloced value: call free() on it after use.
  * len indicates length in bytes, not including the nul.
@@ -610,6 +706,189 @@ bool xs_rm(struct xs_handle *h, xs_transaction_t t,
 	return xs_bool(xs_single(h, t, XS_RM, path, NULL));
 }
 
+uint32_t xs_read_submit(struct xs_handle *h, xs_transaction_t t,
+			const char *path)
+{
+	return xs_submit_single(h, t, XS_READ, path);
+}
+
+void *xs_read_reply(struct xs_handle *h, uint32_t req_id, unsigned int *len)
+{
+	return xs_reply(h, req_id, XS_READ, len);
+}
+
+uint32_t xs_directory_submit(struct xs_handle *h, xs_transaction_t t,
+			     const char *path)
+{
+	return xs_submit_single(h, t, XS_DIRECTORY, path);
+}
+
+char **xs_directory_reply(struct xs_handle *h, uint32_t req_id,
+			  unsigned int *num)
+{
+	char *strings;
+	unsigned int len;
+
+	strings = xs_reply(h, req_id, XS_DIRECTORY, &len);
+	return directory_reply(strings, len, num);
+}
+
+uint32_t xs_write_submit(struct xs_handle *h, xs_transaction_t t,
+			 const char *path, const void *data, unsigned int len)
+{
+	struct iovec iovec[2];
+
+	iovec[0].iov_base = (void *)path;
+	iovec[0].iov_len = strlen(path) + 1;
+	iovec[1].iov_base = (void *)data;
+	iovec[1].iov_len = len;
+
+	return xs_submitv(h, t, XS_WRITE, iovec, ARRAY_SIZE(iovec));
+}
+
+bool xs_write_reply(struct xs_handle *h, uint32_t req_id)
+{
+	return xs_bool(xs_reply(h, req_id, XS_WRITE, NULL));
+}
+
+/* Node of xs_read_subtree while it is read: path and value malloc'ed. */
+struct subtree_node {
+	char *path;
+	char *value;
+	unsigned int len;
+	uint32_t read_id, dir_id;
+};
+
+static char *subtree_child(const char *parent, const char *name)
+{
+	size_t plen = strlen(parent), nlen = strlen(name);
+	char *path;
+
+	/* No double slash below the root. */
+	if (plen && parent[plen - 1] == '/')
+		plen--;
+	path = malloc(plen + 1 + nlen + 1);
+	if (!path)
+		return NULL;
+	memcpy(path, parent, plen);
+	path[plen] = '/';
+	memcpy(path + plen + 1, name, nlen + 1);
+	return path;
+}
+
+/* A node below the top one that is gone or hidden since its parent was read
+ * is skipped, with what is below it.  Other errors fail the whole read. */
+static void subtree_error(unsigned int i, int *saved_errno)
+{
+	if (i != 0 && (errno == ENOENT || errno == EACCES))
+		return;
+	if (!*saved_errno)
+		*saved_errno = errno;
+}
+
+struct xs_subtree_node *xs_read_subtree(struct xs_handle *h,
+					xs_transaction_t t,
+					const char *path, unsigned int *num)
+{
+	struct subtree_node *nodes, *tmp;
+	struct xs_subtree_node *ret = NULL;
+	unsigned int n = 1, size = 16, level, end, i, j, children;
+	size_t bytes = 0, plen;
+	int saved_errno = 0;
+	char **dir, *p;
+
+	nodes = calloc(size, sizeof(*nodes));
+	if (!nodes)
+		return NULL;
+	nodes[0].path = strdup(path);
+	if (!nodes[0].path)
+		goto out;
+
+	/* One round trip per level: all its reads and directories are
+	 * submitted before the first reply is collected. */
+	for (level = 0; level < n; level = end) {
+		end = n;
+		for (i = level; i < end; i++) {
+			nodes[i].read_id = xs_read_submit(h, t, nodes[i].path);
+			nodes[i].dir_id = xs_directory_submit(h, t,
+							      nodes[i].path);
+		}
+
+		for (i = level; i < end; i++) {
+			nodes[i].value = xs_read_reply(h, nodes[i].read_id,
+						       &nodes[i].len);
+			if (!nodes[i].value)
+				subtree_error(i, &saved_errno);
+			dir = xs_directory_reply(h, nodes[i].dir_id,
+						 &children);
+			if (!dir)
+				subtree_error(i, &saved_errno);
+			if (!dir || !nodes[i].value || saved_errno) {
+				free(dir);
+				continue;
+			}
+
+			if (n + children > size) {
+				while (n + children > size)
+					size *= 2;
+				tmp = realloc(nodes, size * sizeof(*nodes));
+				if (!tmp)
+					saved_errno = ENOMEM;
+				else
+					nodes = tmp;
+			}
+			for (j = 0; j < children && !saved_errno; j++) {
+				memset(&nodes[n], 0, sizeof(nodes[n]));
+				nodes[n].path = subtree_child(nodes[i].path,
+							      dir[j]);
+				if (!nodes[n].path)
+					saved_errno = ENOMEM;
+				else
+					n++;
+			}
+			free(dir);
+		}
+		if (saved_errno)
+			goto out;
+	}
+
+	/* Transfer to one big alloc for easy freeing. */
+	for (i = 0, *num = 0; i < n; i++) {
+		if (!nodes[i].value)
+			continue;
+		bytes += strlen(nodes[i].path) + 1 + nodes[i].len + 1;
+		(*num)++;
+	}
+	ret = malloc(*num * sizeof(*ret) + bytes);
+	if (!ret) {
+		saved_errno = ENOMEM;
+		goto out;
+	}
+	p = (char *)&ret[*num];
+	for (i = 0, j = 0; i < n; i++) {
+		if (!nodes[i].value)
+			continue;
+		plen = strlen(nodes[i].path) + 1;
+		ret[j].path = memcpy(p, nodes[i].path, plen);
+		p += plen;
+		ret[j].value = p;
+		ret[j].len = nodes[i].len;
+		memcpy(p, nodes[i].value, nodes[i].len + 1);
+		p += nodes[i].len + 1;
+		j++;
+	}
+
+out:
+	for (i = 0; i < n; i++) {
+		free(nodes[i].path);
+		free(nodes[i].value);
+	}
+	free(nodes);
+	if (!ret)
+		errno = saved_errno ? saved_errno : ENOMEM;
+	return ret;
+}
+
 /* Get permissions of node (first element is owner).
  * Returns malloced array, or NULL: call free() after use.
  */
@@ -1095,14 +1374,9 @@ static int read_message(struct xs_handle *h, int nonblocking)
 	} else {
 		mutex_lock(&h->reply_mutex);
 
-		/* There should only ever be one response pending! */
-		if (!list_empty(&h->reply_list)) {
-			mutex_unlock(&h->reply_mutex);
-			goto error_freebody;
-		}
-
+		/* Any number of requesters may be waiting for their reply. */
 		list_add_tail(&msg->list, &h->reply_list);
-		condvar_signal(&h->reply_condvar);
+		condvar_broadcast(&h->reply_condvar);
 
 		mutex_unlock(&h->reply_mutex);
 	}
@@ -58,6 +58,13 @@ const char *xs_daemon_tdb(void)
 	return buf;
 }
 
+const char *xs_daemon_store_log(void)
+{
+	static char buf[PATH_MAX];
+	snprintf(buf, sizeof(buf), "%s/store.log", xs_daemon_rootdir());
+	return buf;
+}
+
 const char *xs_daemon_socket(void)
 {
 	return xs_daemon_path();
@@ -74,6 +81,17 @@ const char *xs_daemon_socket_ro(void)
 	return buf;
 }
 
+const char *xs_daemon_socket_ring(void)
+{
+	static char buf[PATH_MAX];
+	const char *s = xs_daemon_path();
+	if (s == NULL)
+		return NULL;
+	if (snprintf(buf, sizeof(buf), "%s_ring", s) >= PATH_MAX)
+		return NULL;
+	return buf;
+}
+
 const char *xs_domain_dev(void)
 {
 	char *s = getenv("XENSTORED_PATH");
@@ -89,6 +107,36 @@ const char *xs_domain_dev(void)
 #endif
 }
 
+const char *xs_sockmsg_string(enum xsd_sockmsg_type type)
+{
+	switch (type) {
+	case XS_DEBUG: return "DEBUG";
+	case XS_DIRECTORY: return "DIRECTORY";
+	case XS_READ: return "READ";
+	case XS_GET_PERMS: return "GET_PERMS";
+	case XS_WATCH: return "WATCH";
+	case XS_UNWATCH: return "UNWATCH";
+	case XS_TRANSACTION_START: return "TRANSACTION_START";
+	case XS_TRANSACTION_END: return "TRANSACTION_END";
+	case XS_INTRODUCE: return "INTRODUCE";
+	case XS_RELEASE: return "RELEASE";
+	case XS_GET_DOMAIN_PATH: return "GET_DOMAIN_PATH";
+	case XS_WRITE: return "WRITE";
+	case XS_MKDIR: return "MKDIR";
+	case XS_RM: return "RM";
+	case XS_SET_PERMS: return "SET_PERMS";
+	case XS_WATCH_EVENT: return "WATCH_EVENT";
+	case XS_ERROR: return "ERROR";
+	case XS_IS_DOMAIN_INTRODUCED: return "XS_IS_DOMAIN_INTRODUCED";
+	case XS_RESUME: return "RESUME";
+	case XS_SET_TARGET: return "SET_TARGET";
+	case XS_RESTRICT: return "RESTRICT";
+	case XS_RESET_WATCHES: return "RESET_WATCHES";
+	default:
+		return "**UNKNOWN**";
+	}
+}
+
 /* Simple routines for writing to sockets, etc. */
 bool xs_write_all(int fd, const void *data, unsigned int len)
 {